@@ -171,7 +171,7 @@ static int NBT_ParseFile(NBTFile nbt, ZStream in, int flags)
 {
 	NBTHdr  hdr;
 	uint8_t type;
-	int     len, off;
+	int     len, off, ret;
 	DATA8   mem;
 
 	/* first byte: node type */
@@ -247,7 +247,23 @@ static int NBT_ParseFile(NBTFile nbt, ZStream in, int flags)
 		swap(mem[2], mem[5]); swap(mem[3], mem[4]);
 		break;
 	case TAG_Byte_Array:
-		len = hdr->count = UINT32(in);
+		/* count is only 16bit: do not truncate the array though */
+		len = UINT32(in);
+		hdr->count = len;
+		if (in->arrayCb && in->depth == 1)
+		{
+			/* terminate the tree at this node, so that callback can query what has been read so far */
+			SET_NULL(NBT_AddBytes(nbt, 4));
+			nbt->usage -= 4;
+			ret = in->arrayCb(nbt, off, len, in, in->arrayData);
+			if (ret >= 0)
+			{
+				/* payload consumed by callback: only keep the header */
+				uint8_t skip[256];
+				for (HDR(nbt, off)->count = 0, len -= ret; len > 0 && gzRead(in, skip, MIN(len, sizeof skip)) > 0; len -= sizeof skip);
+				break;
+			}
+		}
 		mem = NBT_AddBytes(nbt, len);
 		gzRead(in, mem, len);
 		HDR(nbt, off)->size += nbt->alloc;
@@ -311,10 +327,12 @@ static int NBT_ParseFile(NBTFile nbt, ZStream in, int flags)
 					flags |= nbt->usage << 3;
 					NBT_AddBytes(nbt, MIN_SECTION_MEM);
 				}
+				in->depth ++;
 				while ((sz = NBT_ParseFile(nbt, in, flags)) > 0)
 				{
 					HDR(nbt, off)->size += sz;
 				}
+				in->depth --;
 				HDR(nbt, off)->size += 4;
 				mem = NBT_AddBytes(nbt, 1);
 				SET_NULL(mem);
@@ -324,10 +342,12 @@ static int NBT_ParseFile(NBTFile nbt, ZStream in, int flags)
 		break;
 	case TAG_Compound:
 	{	int sz;
+		in->depth ++;
 		while ((sz = NBT_ParseFile(nbt, in, flags)) > 0)
 		{
 			HDR(nbt, off)->size += sz;
 		}
+		in->depth --;
 		HDR(nbt, off)->size += 4;
 		mem = NBT_AddBytes(nbt, 1);
 		SET_NULL(mem);
@@ -1222,6 +1242,8 @@ struct NBTWriteParam_t
 	write_t       puts;
 	NBT_WriteCb_t cb;
 	APTR          cbdata;
+	ZStream       stream;   /* NBT_SaveStream() only */
+	int           depth;    /* nesting level of node being written (same as ZStream_t.depth) */
 };
 
 static void NBT_WriteArray(APTR out, write_t cb, DATA8 mem, int items, int size)
@@ -1285,7 +1307,17 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 		puts(out, mem, off = sizeof_type[type], 1);
 		break;
 	case TAG_Byte_Array:
-		dword = off = hdr->count;
+		off = hdr->count;
+		/* only nodes directly under root, like NBT_ParseStream() */
+		if (param->stream && param->depth == 1 && (i = param->stream->arrayCb(nbt, offset, 0, NULL, param->stream->arrayData)) >= 0)
+		{
+			/* size first, then content is provided by callback */
+			dword = i;
+			puts(out, &dword, 4, 1);
+			param->stream->arrayCb(nbt, offset, i, param->stream, param->stream->arrayData);
+			break;
+		}
+		dword = off;
 		puts(out, &dword, 4, 1);
 		puts(out, mem, dword, 0);
 	    break;
@@ -1306,6 +1338,7 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 			dword = param->cb(hdr->count & 0xff, param->cbdata, NULL);
 			putc(out, type);
 			puts(out, &dword, 4, 1);
+			param->depth ++;
 			while (dword > 0 && param->cb(hdr->count & 0xff, param->cbdata, &sub))
 			{
 				sub.alloc = 0;
@@ -1321,6 +1354,7 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 				puts(out, &type, 1, 0);
 				dword --;
 			}
+			param->depth --;
 			/* skip entire content of NBT */
 			off = p - mem;
 			break;
@@ -1344,12 +1378,14 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 			}
 			break;
 		case TAG_Compound:
+			param->depth ++;
 			for (i = hdr->count, p = mem; i > 0; i --)
 			{
 				while ((off = NBT_WriteFile(nbt, out, p - nbt->mem, param)) > 0)
 					p += off;
 				p += 4; /* byte terminator */
 			}
+			param->depth --;
 			off = p - mem;
 		}
 		break;
@@ -1357,6 +1393,7 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 		off = 0;
 		offset += mem - (DATA8) hdr;
 		p = mem;
+		param->depth ++;
 		while ((i = NBT_WriteFile(nbt, out, offset, param)) > 0)
 		{
 			offset += i; off += i; p += i;
@@ -1387,6 +1424,7 @@ static int NBT_WriteFile(NBTFile nbt, APTR out, int offset, NBTWriteParam param)
 			type = 0;
 			puts(out, &type, 1, 0);
 		}
+		param->depth --;
 		break;
 	case TAG_Int_Array:
 		dword = hdr->count;
@@ -1459,6 +1497,29 @@ int NBT_Save(NBTFile nbt, STRPTR path, NBT_WriteCb_t cb, APTR cbparam)
 	return 0;
 }
 
+/* same as NBT_Save(), but content of TAG_Byte_Array directly under root node can be written by <cb> */
+int NBT_SaveStream(NBTFile nbt, STRPTR path, NBT_ArrayCb_t cb, APTR cbparam)
+{
+	struct ZStream_t out = {.arrayCb = cb, .arrayData = cbparam};
+	struct NBTWriteParam_t params = {
+		NBT_WriteToGZ, NULL, NULL, &out
+	};
+	out.gzin = gzopen(path, "wb");
+
+	if (out.gzin)
+	{
+		int ret = NBT_WriteFile(nbt, out.gzin, 0, &params);
+		gzclose(out.gzin);
+		return ret;
+	}
+	return 0;
+}
+
+int NBT_StreamWrite(NBTStream out, APTR buffer, int len)
+{
+	return gzwrite(out->gzin, buffer, len);
+}
+
 #ifdef DEBUG
 int NBT_Dump(NBTFile root, int offset, int level, FILE * out)
 {
@@ -1657,6 +1718,32 @@ int NBT_ParseZlib(NBTFile file, DATA8 stream, int bytes)
 	return 0;
 }
 
+/*
+ * parse a gzip-compressed file, but let <cb> process TAG_Byte_Array directly under root node: the callback
+ * must return how many bytes of the array it has read (with NBT_StreamRead()) or -1 to store them in <file>.
+ */
+int NBT_ParseStream(NBTFile file, STRPTR path, NBT_ArrayCb_t cb, APTR cbparam)
+{
+	ZStream in = gzOpen(path, 0, 0);
+
+	memset(file, 0, sizeof *file);
+	if (in)
+	{
+		in->arrayCb = cb;
+		in->arrayData = cbparam;
+		file->page = 1023;
+		NBT_ParseFile(file, in, 0);
+		gzClose(in);
+		return file->usage > 0;
+	}
+	return 0;
+}
+
+int NBT_StreamRead(NBTStream in, APTR buffer, int len)
+{
+	return gzRead(in, buffer, len);
+}
+
 #ifdef DEBUG
 /* check that hdr->size is consistent */
 static int NBT_CheckHdrsize(NBTFile nbt, int offset)
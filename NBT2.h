@@ -15,15 +15,21 @@ typedef struct NBTFile_t        NBTFile_t;
 typedef struct NBTIter_t *      NBTIter;
 typedef struct NBTIter_t        NBTIter_t;
 typedef struct NBTHdr_t *       NBTHdr;
+typedef struct ZStream_t *      NBTStream;
 
 typedef int (*NBT_WriteCb_t)(int tag, APTR ud, NBTFile);
+typedef int (*NBT_ArrayCb_t)(NBTFile, int offset, int bytes, NBTStream, APTR ud);
 
 int   NBT_Parse(NBTFile, STRPTR path);
 int   NBT_ParseIO(NBTFile, FILE * in, int offset);
 int   NBT_ParseZlib(NBTFile, DATA8 stream, int bytes);
+int   NBT_ParseStream(NBTFile, STRPTR path, NBT_ArrayCb_t cb, APTR cbparam);
+int   NBT_StreamRead(NBTStream, APTR buffer, int len);
+int   NBT_StreamWrite(NBTStream, APTR buffer, int len);
 int   NBT_FindNode(NBTFile, int offset, STRPTR name);
 int   NBT_FindNodeFromStream(DATA8 nbt, int offset, STRPTR name);
 int   NBT_Save(NBTFile, STRPTR path, NBT_WriteCb_t cb, APTR cbparam);
+int   NBT_SaveStream(NBTFile, STRPTR path, NBT_ArrayCb_t cb, APTR cbparam);
 int   NBT_Iter(NBTIter iter);
 int   NBT_FormatSection(DATA8 mem, int y);
 int   NBT_SetHdrSize(NBTFile, int offset);
@@ -162,6 +168,9 @@ struct ZStream_t
 	DATA8    bout, bin;
 	int      read;
 	z_stream strm;
+	int      depth;            /* nesting level of node being parsed */
+	NBT_ArrayCb_t arrayCb;     /* NBT_ParseStream() / NBT_SaveStream() */
+	APTR     arrayData;
 };
 
 #define	UINT32(in)     (((((gzGetC(in) << 8) | gzGetC(in)) << 8) | gzGetC(in)) << 8) | gzGetC(in)
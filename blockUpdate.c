@@ -1247,17 +1247,16 @@ int blockRotateZ90(int blockId)
 }
 
 /* set lower 4bits to reflect a flip/mirror along Y axis */
-int blockMirrorY(BlockIter iter)
+static int blockMirrorStateY(int blockId)
 {
 	static uint8_t mirrorYFull[] = {1, 0, 2, 3, 4, 5, 6, 7};
 	static uint8_t mirrorYLever[] = {5, 1, 2, 3, 4, 0, 6, 7, 13, 9, 10, 11, 12, 8, 14, 15};
-	int blockId = getBlockId(iter);
 	Block b = &blockIds[blockId>>4];
 	switch (b->orientHint) {
 	case ORIENT_FULL:   return (blockId & ~7) | mirrorYFull[blockId & 7];
 	case ORIENT_SLAB:   return blockId ^ 8;
 	case ORIENT_STAIRS: return blockId ^ 4;
-	case ORIENT_LEVER:  return (blockId & !15) | mirrorYLever[blockId & 15];
+	case ORIENT_LEVER:  return (blockId & ~15) | mirrorYLever[blockId & 15];
 	default:
 		if (b->special == BLOCK_TRAPDOOR)
 			return blockId ^ 8;
@@ -1265,6 +1264,11 @@ int blockMirrorY(BlockIter iter)
 	return blockId;
 }
 
+int blockMirrorY(BlockIter iter)
+{
+	return blockMirrorStateY(getBlockId(iter));
+}
+
 static int mirrorDoor(BlockIter iter, int offset, int blockId)
 {
 	/* top part of door: orient is in bottom part */
@@ -1284,7 +1288,7 @@ static int mirrorDoor(BlockIter iter, int offset, int blockId)
 	else return blockId;
 }
 
-int blockMirrorX(BlockIter iter)
+static int blockMirrorStateX(int blockId)
 {
 	static uint8_t mirrorXFull[]  = {0, 1, 2, 3, 5, 4, 6, 7};
 	static uint8_t mirrorXRail[]  = {0, 1, 3, 2, 4, 5, 7, 6, 9, 8, 10, 11, 12, 13, 14, 15};
@@ -1296,7 +1300,6 @@ int blockMirrorX(BlockIter iter)
 	static uint8_t mirrorXSign[]  = {0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
 	static uint8_t mirrorXLever[] = {0, 2, 1, 3, 4, 5, 6, 7};
 
-	int blockId = getBlockId(iter);
 	Block b = &blockIds[blockId>>4];
 	switch (b->orientHint) {
 	case ORIENT_FULL:   return (blockId & ~7) | mirrorXFull[blockId & 7];
@@ -1308,7 +1311,6 @@ int blockMirrorX(BlockIter iter)
 	case ORIENT_SWNE:   return (blockId & ~3) | mirrorXSWNE[blockId & 3];
 	case ORIENT_LEVER:  return (blockId & ~7) | mirrorXLever[blockId & 7];
 	case ORIENT_VINES:  return blockId ^ 10;
-	case ORIENT_DOOR:   return mirrorDoor(iter, 0, blockId);
 	case ORIENT_RAILS:
 		if (blockStateIndex[(blockId & ~15) | 7])
 			/* this type of rail type can curve */
@@ -1331,7 +1333,15 @@ int blockMirrorX(BlockIter iter)
 	return blockId;
 }
 
-int blockMirrorZ(BlockIter iter)
+int blockMirrorX(BlockIter iter)
+{
+	int blockId = getBlockId(iter);
+	if (blockIds[blockId>>4].orientHint == ORIENT_DOOR)
+		return mirrorDoor(iter, 0, blockId);
+	return blockMirrorStateX(blockId);
+}
+
+static int blockMirrorStateZ(int blockId)
 {
 	static uint8_t mirrorZFull[]  = {0, 1, 3, 2, 4, 5, 6, 7};
 	static uint8_t mirrorZRail[]  = {0, 1, 2, 3, 5, 4, 9, 8, 7, 6, 10, 11, 12, 13, 14, 15};
@@ -1343,7 +1353,6 @@ int blockMirrorZ(BlockIter iter)
 	static uint8_t mirrorZLever[] = {0, 1, 2, 4, 3, 5, 6, 7};
 	static uint8_t mirrorZTrapD[] = {1, 0, 2, 3};
 
-	int blockId = getBlockId(iter);
 	Block b = &blockIds[blockId>>4];
 	switch (b->orientHint) {
 	case ORIENT_FULL:   return (blockId & ~7) | mirrorZFull[blockId & 7];
@@ -1355,7 +1364,6 @@ int blockMirrorZ(BlockIter iter)
 	case ORIENT_SWNE:   return (blockId & ~3) | mirrorZSWNE[blockId & 3];
 	case ORIENT_LEVER:  return (blockId & ~7) | mirrorZLever[blockId & 7];
 	case ORIENT_VINES:  return blockId ^ 5;
-	case ORIENT_DOOR:   return mirrorDoor(iter, 8, blockId);
 	case ORIENT_RAILS:
 		if (blockStateIndex[(blockId & ~15) | 7])
 			/* this type of rail type can curve */
@@ -1377,3 +1385,37 @@ int blockMirrorZ(BlockIter iter)
 	}
 	return blockId;
 }
+
+int blockMirrorZ(BlockIter iter)
+{
+	int blockId = getBlockId(iter);
+	if (blockIds[blockId>>4].orientHint == ORIENT_DOOR)
+		return mirrorDoor(iter, 8, blockId);
+	return blockMirrorStateZ(blockId);
+}
+
+/* transformed state of every block id:meta for <transform> (TRANSFORM_*): doors still need blockMirrorX/Z() */
+DATA16 blockTransformTable(int transform)
+{
+	static uint16_t tables[6][4096];
+	static uint8_t  init[6];
+	DATA16 table = tables[transform];
+	int    id;
+
+	if (init[transform] == 0)
+	{
+		for (id = 0; id < 4096; id ++)
+		{
+			switch (transform) {
+			case TRANSFORM_ROTATE + VX: table[id] = blockRotateX90(id); break;
+			case TRANSFORM_ROTATE + VY: table[id] = blockRotateY90(id); break;
+			case TRANSFORM_ROTATE + VZ: table[id] = blockRotateZ90(id); break;
+			case TRANSFORM_MIRROR + VX: table[id] = blockMirrorStateX(id); break;
+			case TRANSFORM_MIRROR + VY: table[id] = blockMirrorStateY(id); break;
+			case TRANSFORM_MIRROR + VZ: table[id] = blockMirrorStateZ(id);
+			}
+		}
+		init[transform] = 1;
+	}
+	return table;
+}
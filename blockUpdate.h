@@ -15,5 +15,6 @@ int blockRotateZ90(int blockId);
 int blockMirrorX(BlockIter);
 int blockMirrorY(BlockIter);
 int blockMirrorZ(BlockIter);
+DATA16 blockTransformTable(int transform);
 
 #endif
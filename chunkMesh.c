@@ -150,9 +150,12 @@ uint8_t sampleOffset[48] = { /* S, E, N, W, T, B */
 /* yep, more look-up table init */
 void chunkInitStatic(void)
 {
+	extern Mutex chunkTileLock;
 	int8_t i, x, z;
 	int    pos;
 
+	chunkTileLock = MutexCreate();
+
 	for (i = 0; i < 64; i ++)
 	{
 		int8_t layer = 0;
@@ -958,7 +961,8 @@ static void chunkGenCube(BlockIter iterator, MeshWriter buffer, BlockState b)
 /*
  * pre-generate lighting used for sky/block light and ambient occlusion
  * note: if sky and block light are all zeros, nothing will be generated:
- * this will cut the lighting tex needed by 20% on a typical minecraft landscape
+ * this will cut the lighting tex needed by 20% on a typical minecraft landscape.
+ * same if light is constant over the 18x18x18 volume: value is then stored in glLightId.
  */
 #define AO_HARSHNESS         0x55  /* max: 255 */
 
@@ -974,7 +978,7 @@ static void chunkGenLight(Map map, BlockIter iterator, MeshWriter writer)
 	{
 	    /* all zeros: no need to allocate a texture for this */
 		x = iterator->cd->glLightId;
-		if (x < 0xfffe)
+		if (LIGHT_HASSLOT(x))
 			mapFreeLightingSlot(map, x);
 		iterator->cd->glLightId = LIGHT_SKY0_BLOCK0;
 		return;
@@ -1042,8 +1046,21 @@ static void chunkGenLight(Map map, BlockIter iterator, MeshWriter writer)
 	}
 	#endif
 
+	/* constant light over the entire volume (deep underground, open sky, ...): encode value in glLightId */
+	skyBlock = (DATA8) (writer->cur + 1);
+	for (x = 2; x < TEX_LIGHT_SIZE*2 && skyBlock[x] == skyBlock[0] && skyBlock[x+1] == skyBlock[1]; x += 2);
+	if (x == TEX_LIGHT_SIZE*2)
+	{
+		x = iterator->cd->glLightId;
+		if (LIGHT_HASSLOT(x))
+			mapFreeLightingSlot(map, x);
+		/* values are multiple of 17 (except 1: dark air marker) */
+		iterator->cd->glLightId = LIGHT_UNIFORM(skyBlock[0] / 17, skyBlock[1] / 17);
+		return;
+	}
+
 	x = iterator->cd->glLightId;
-	if (x >= 0xfffe)
+	if (! LIGHT_HASSLOT(x))
 		x = iterator->cd->glLightId = mapAllocLightingTex(map);
 	/* will mark this block as a lighting tex, not as vertex buffer */
 	writer->cur[0] = QUAD_LIGHT_ID | x;
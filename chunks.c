@@ -17,8 +17,11 @@
 #include "render.h"
 #include "entities.h"
 #include "tileticks.h"
+#include "redstone.h"
 #include "NBT2.h"
 
+/* tile entities are expanded on first access, possibly from meshing threads (created by chunkInitStatic()) */
+Mutex chunkTileLock;
 
 /*
  * reading chunk from disk
@@ -159,7 +162,7 @@ static TileEntityHash chunkCreateTileEntityHash(Chunk c, int count)
 }
 
 /* add a tile entity at given iterator "coordinates", will free()'ed the one that is already there, if any */
-Bool chunkAddTileEntity(ChunkData cd, int offset, DATA8 mem)
+static Bool chunkStoreTileEntity(ChunkData cd, int offset, DATA8 mem)
 {
 	struct TileEntityEntry_t entry = {.data = mem};
 
@@ -208,6 +211,12 @@ Bool chunkAddTileEntity(ChunkData cd, int offset, DATA8 mem)
 	return True;
 }
 
+Bool chunkAddTileEntity(ChunkData cd, int offset, DATA8 mem)
+{
+	chunkExpandTileEntities(cd->chunk);
+	return chunkStoreTileEntity(cd, offset, mem);
+}
+
 /* update X, Y, Z field of tile NBT record */
 void chunkUpdateTilePosition(ChunkData cd, int offset, DATA8 tile)
 {
@@ -227,19 +236,28 @@ void chunkUpdateTilePosition(ChunkData cd, int offset, DATA8 tile)
 	}
 }
 
+/* only check if there are tile entities when loading chunk: hash table will be built on first access */
+static void chunkIndexTileEntities(Chunk c)
+{
+	int    off = NBT_FindNode(&c->nbt, 0, "TileEntities");
+	NBTHdr hdr = (NBTHdr) (c->nbt.mem + off);
+
+	if (off < 0) return;
+	/* sometimes this node is saved as a TAG_List_End or TAG_List_Byte :-/ */
+	c->cflags |= CFLAG_HAS_TE;
+	hdr->type = TAG_List_Compound;
+	c->lazyTE = hdr->count > 0;
+}
+
 /* transfer NBT tile entites into a hash table for (way) faster access */
-void chunkExpandTileEntities(Chunk c)
+static void chunkBuildTileEntities(Chunk c)
 {
 	NBTFile_t nbt = c->nbt;
 	int       off = NBT_FindNode(&c->nbt, 0, "TileEntities");
 	NBTHdr    hdr = (NBTHdr) (nbt.mem + off);
 	NBTIter_t iter;
 
-	if (off < 0) return;
-	/* sometimes this node is saved as a TAG_List_End or TAG_List_Byte :-/ */
-	c->cflags |= CFLAG_HAS_TE;
-	hdr->type = TAG_List_Compound;
-	if (hdr->count == 0) return;
+	if (off < 0 || hdr->count == 0) return;
 
 	NBT_InitIter(&nbt, off, &iter);
 
@@ -265,11 +283,53 @@ void chunkExpandTileEntities(Chunk c)
 		}
 		if (flag == 7 && XYZ[1] < (c->maxy << 4) && (unsigned) XYZ[0] < 16 && (unsigned) XYZ[2] < 16)
 		{
-			chunkAddTileEntity(c->layer[XYZ[1] >> 4], XYZ[0] | (XYZ[2] << 4) | ((XYZ[1] & 15) << 8), nbt.mem + off);
+			chunkStoreTileEntity(c->layer[XYZ[1] >> 4], XYZ[0] | (XYZ[2] << 4) | ((XYZ[1] & 15) << 8), nbt.mem + off);
 		}
 	}
 }
 
+/* called before any access to <tileEntities> */
+void chunkExpandTileEntities(Chunk c)
+{
+	/* acquire/release pair: hash table must be visible to other threads before the flag is cleared */
+	if (__atomic_load_n(&c->lazyTE, __ATOMIC_ACQUIRE) == 0) return;
+	MutexEnter(chunkTileLock);
+	/* another thread might have done the job in the meantime */
+	if (c->lazyTE)
+	{
+		chunkBuildTileEntities(c);
+		__atomic_store_n(&c->lazyTE, 0, __ATOMIC_RELEASE);
+	}
+	MutexLeave(chunkTileLock);
+}
+
+void chunkFreeHash(TileEntityHash hash, DATA8 min, DATA8 max);
+
+/* chunk is outside entity distance: free hash table if it can be rebuilt as is from NBT (not MT safe: no selection job must be running) */
+Bool chunkDropTileEntities(Chunk c)
+{
+	TileEntityHash  hash = c->tileEntities;
+	TileEntityEntry ent;
+	int i;
+
+	if (hash == NULL || (c->cflags & (CFLAG_REBUILDTE | CFLAG_NEEDSAVE)))
+		return False;
+
+	for (i = hash->max, ent = (TileEntityEntry) (hash + 1); i > 0; i --, ent ++)
+	{
+		DATA8 mem = ent->data;
+		if (mem == NULL) continue;
+		/* observed locations are only set when meshing: can't get them back from NBT */
+		if (mem == TILE_OBSERVED_DATA || (ent->xzy & ~TILE_COORD) || ! (c->nbt.mem <= mem && mem < c->nbt.mem + c->nbt.max))
+			return False;
+	}
+	chunkFreeHash(hash, c->nbt.mem, c->nbt.mem + c->nbt.max);
+	c->tileEntities = NULL;
+	c->lazyTE = 1;
+	return True;
+}
+
+/* chunk has been meshed: entities will be parsed by chunkDecodeEntities() once within entity distance */
 void chunkExpandEntities(Chunk c)
 {
 	int off = NBT_FindNode(&c->nbt, 0, "/Level.Entities");
@@ -278,9 +338,23 @@ void chunkExpandEntities(Chunk c)
 	{
 		c->cflags |= CFLAG_HAS_ENT;
 		NBTHdr hdr = (NBTHdr) (c->nbt.mem + off);
-		if (hdr->count == 0) return; /* empty list */
+		if (hdr->count > 0)
+			c->cflags |= CFLAG_LAZYENT;
+	}
+}
+
+/* parse entities and create their models (main thread only) */
+void chunkDecodeEntities(Chunk c)
+{
+	if ((c->cflags & CFLAG_LAZYENT) == 0) return;
+	c->cflags &= ~CFLAG_LAZYENT;
+
+	int off = NBT_FindNode(&c->nbt, 0, "/Level.Entities");
+	if (off > 0)
+	{
 		NBTIter_t list;
-		Entity    prev = NULL;
+		/* entities might have been created in this chunk before it was decoded */
+		Entity    prev = entityLastFromChunk(c);
 		NBT_InitIter(&c->nbt, off, &list);
 		while ((off = NBT_Iter(&list)) >= 0)
 			prev = entityParse(c, &c->nbt, off, prev);
@@ -289,6 +363,7 @@ void chunkExpandEntities(Chunk c)
 
 static TileEntityEntry chunkGetTileEntry(ChunkData cd, int offset)
 {
+	chunkExpandTileEntities(cd->chunk);
 	TileEntityHash  hash = cd->chunk->tileEntities; if (! hash) return NULL;
 	TileEntityEntry base = (TileEntityEntry) (hash + 1);
 	uint32_t        xzy  = offset + (cd->Y << 8);
@@ -310,6 +385,14 @@ DATA8 chunkGetTileEntity(ChunkData cd, int offset)
 	return entry && entry->data != TILE_OBSERVED_DATA ? entry->data : NULL;
 }
 
+/* tile entity or location monitored by an observer */
+Bool chunkHasTileEntry(ChunkData cd, int offset)
+{
+	chunkExpandTileEntities(cd->chunk);
+	TileEntityHash hash = cd->chunk->tileEntities;
+	return hash && hash->count > 0 && chunkGetTileEntry(cd, offset) != NULL;
+}
+
 /* tile data will be potentially realloc()'ed */
 DATA8 chunkUpdateTileEntity(ChunkData cd, int offset)
 {
@@ -327,6 +410,7 @@ DATA8 chunkUpdateTileEntity(ChunkData cd, int offset)
 /* tile entity has been deleted: remove ref from hash */
 DATA8 chunkDeleteTileEntity(ChunkData cd, int offset, Bool extract, DATA8 observed)
 {
+	chunkExpandTileEntities(cd->chunk);
 	TileEntityHash  hash = cd->chunk->tileEntities; if (! hash) return NULL;
 	TileEntityEntry base = (TileEntityEntry) (hash + 1);
 	uint32_t        xzy  = offset + (cd->Y << 8);
@@ -405,6 +489,7 @@ void chunkDeleteTile(Chunk c, DATA8 tile)
 /* iterate over all tile entities defined in this chunk (*offset needs to be initially set to 0) */
 DATA8 chunkIterTileEntity(Chunk c, int XYZ[3], int * offset)
 {
+	chunkExpandTileEntities(c);
 	if (! c->tileEntities) return NULL;
 	TileEntityHash  hash = c->tileEntities;
 	TileEntityEntry base = (TileEntityEntry) (hash + 1);
@@ -519,7 +604,7 @@ Bool chunkLoad(Chunk chunk, const char * path, int x, int z)
 				}
 			}
 
-			chunkExpandTileEntities(chunk);
+			chunkIndexTileEntities(chunk);
 
 			return True;
 		}
@@ -700,6 +785,7 @@ static int chunkSaveExtra(int tag, APTR cbparam, NBTFile nbt)
 	switch (tag) {
 	case CHUNK_NBT_TILEENTITIES:
 		/* list of tile entities modified */
+		chunkExpandTileEntities(chunk);
 		hash = chunk->tileEntities;
 		if (nbt == NULL)
 		{
@@ -743,7 +829,8 @@ static int chunkSaveExtra(int tag, APTR cbparam, NBTFile nbt)
 		/* list of entities modified */
 		if (nbt == NULL)
 		{
-			/* total count of entities for this chunk */
+			/* total count of entities for this chunk: those not decoded yet must be kept */
+			chunkDecodeEntities(chunk);
 			return entityCount(chunk->entityList);
 		}
 		if ((save->flags & CHUNK_NBT_ENTITIES) == 0)
@@ -763,13 +850,14 @@ static int chunkSaveExtra(int tag, APTR cbparam, NBTFile nbt)
 		break;
 
 	case CHUNK_NBT_TILETICKS:
+		#define curTick      nbt.alloc
 		if (nbt == NULL)
 		{
 			return updateCount(chunk);
 		}
 		if ((save->flags & CHUNK_NBT_TILETICKS) == 0)
 		{
-			chunk->cdIndex = 0;
+			chunk->curTick = 0;
 			save->flags |= CHUNK_NBT_TILETICKS;
 			if ((chunk->cflags & CFLAG_HAS_TT) == 0)
 			{
@@ -780,8 +868,9 @@ static int chunkSaveExtra(int tag, APTR cbparam, NBTFile nbt)
 				return -1;
 			}
 		}
-		if (updateGetNBT(chunk, nbt, &chunk->cdIndex))
+		if (updateGetNBT(chunk, nbt, &chunk->curTick))
 			return 1;
+		#undef curTick
 		break;
 
 	case CHUNK_NBT_SECTION:
@@ -965,6 +1054,9 @@ int chunkFree(Map map, Chunk c, Bool clear)
 {
 	int i, max, ret;
 
+	/* compiled wire runs keep pointers to ChunkData */
+	if (map) redstoneNetClearChunk(c->X, c->Z);
+
 	for (i = ret = 0, max = c->maxy; max > 0; max --, i ++)
 	{
 		ChunkData cd = c->layer[i];
@@ -973,7 +1065,7 @@ int chunkFree(Map map, Chunk c, Bool clear)
 			if (clear)
 			{
 				if (cd->glBank) meshFreeGPU(cd), ret ++;
-				if (cd->glLightId < 0xfffe) mapFreeLightingSlot(map, cd->glLightId);
+				if (LIGHT_HASSLOT(cd->glLightId)) mapFreeLightingSlot(map, cd->glLightId);
 			}
 			if (cd->emitters) free(cd->emitters);
 			free(cd);
@@ -984,6 +1076,7 @@ int chunkFree(Map map, Chunk c, Bool clear)
 		chunkFreeHash((TileEntityHash) c->tileEntities, c->nbt.mem, c->nbt.mem + c->nbt.max);
 		c->tileEntities = NULL;
 	}
+	c->lazyTE = 0;
 	if (clear)
 	{
 		if (c->cflags & CFLAG_HASENTITY)
@@ -37,6 +37,7 @@ void      chunkUpdate(Map map, Chunk update, ChunkData air, int layer, MeshIniti
 int       chunkFree(Map, Chunk, Bool clear);
 ChunkData chunkCreateEmpty(Chunk, int layer);
 DATA8     chunkGetTileEntity(ChunkData cd, int offset);
+Bool      chunkHasTileEntry(ChunkData cd, int offset);
 DATA8     chunkUpdateTileEntity(ChunkData, int offset);
 DATA8     chunkDeleteTileEntity(ChunkData, int offset, Bool extract, DATA8 observed);
 Bool      chunkAddTileEntity(ChunkData, int offset, DATA8 mem);
@@ -48,6 +49,8 @@ void      chunkMarkForUpdate(Chunk, int type);
 void      chunkExpandEntities(Chunk);
 void      chunkDeleteTile(Chunk, DATA8 tile);
 void      chunkExpandTileEntities(Chunk);
+Bool      chunkDropTileEntities(Chunk);
+void      chunkDecodeEntities(Chunk);
 
 struct ChunkData_t                     /* one sub-chunk of 16x16x16 blocks */
 {
@@ -67,7 +70,7 @@ struct ChunkData_t                     /* one sub-chunk of 16x16x16 blocks */
 	/* VERTEX_ARRAY_BUFFER location */
 	void *    glBank;                  /* GPUBank (filled by meshAllocGPU()) */
 	uint16_t  glSlot;                  /* slot in glBank where GPUMem info can be retrieved */
-	uint16_t  glLightId;               /* texId used for lighting (low 7bit: tex num in Map->lightingTex, hi 9bit: slot) */
+	uint16_t  glLightId;               /* texId used for lighting (low 7bit: tex num in Map->lightingTex, hi 9bit: slot), or LIGHT_UNIFORM() */
 	int       glSize;                  /* size in bytes */
 	int       glAlpha;                 /* alpha quads in bytes, need separate pass */
 	int       glDiscard;               /* discardable quads if too far away (bytes) */
@@ -83,8 +86,9 @@ struct Chunk_t                         /* an entire column of 16x16 blocks */
 	uint8_t   neighbor;                /* offset for chunkNeighbor[] table */
 	uint8_t   maxy;                    /* number of sub-chunks in layer[], starting at 0 */
 	uint8_t   noChunks;                /* S,E,N,W bitfield: no chunks in this direction */
+	uint8_t   lazyTE;                  /* TileEntities in NBT not expanded in <tileEntities> yet */
 
-	uint16_t  cflags;                  /* CLFAG_* */
+	uint32_t  cflags;                  /* CLFAG_* */
 	uint16_t  entityList;              /* linked list of all entities in this chunk */
 
 	uint16_t  cdIndex;                 /* iterate over ChunkData/Entities/TileEnt when saving */
@@ -114,17 +118,21 @@ enum /* flags for Chunk.cflags */
 	CFLAG_REBUILDENT = 0x0100,         /* mark Entity list for rebuilt when saved */
 	CFLAG_REBUILDTT  = 0x0200,         /* TileTicks */
 	CFLAG_PROCESSING = 0x0400,
+	CFLAG_RELIGHT    = 0x0800,         /* light tables need to be recomputed (see lighting.c) */
 
 	CFLAG_HAS_SEC    = 0x1000,         /* flag set if corresponding NBT record is present */
 	CFLAG_HAS_TE     = 0x2000,
 	CFLAG_HAS_ENT    = 0x4000,         /* note: not exactly the same than CFLAG_HASENTITY (see below) */
 	CFLAG_HAS_TT     = 0x8000,
+
+	CFLAG_LAZYENT    = 0x10000,        /* entities in NBT not decoded yet (outside entity distance) */
 };
 
 /*
  * note: difference between HASENTITY and HAS_ENT:
  * CFLAG_HAS_ENT: has an "Entities" TAG_List_Compound in the NBT stream.
  * CFLAG_HAS_ENTITY: entites are loaded and rendered (lazy chunks must not load any though).
+ * CFLAG_LAZYENT: HASENTITY is set, but entities will only be parsed once the chunk is within entity distance.
  */
 
 enum /* flags for ChunkData.cdFlags */
@@ -173,6 +181,9 @@ enum /* NBT update tag (type parameter of chunkMarkForUpdate) */
 #define TEX_MESH_INT_SIZE              (((TEX_LIGHT_SIZE*2 + 4 + VERTEX_DATA_SIZE - 1) / VERTEX_DATA_SIZE) * VERTEX_INT_SIZE)
 #define LIGHT_SKY15_BLOCK0             0xfffe
 #define LIGHT_SKY0_BLOCK0              0xffff
+#define LIGHT_UNIFORM_BANK             125     /* glLightId: sub-chunk has constant light, no tex slot needed */
+#define LIGHT_UNIFORM(sky, block)      (LIGHT_UNIFORM_BANK | ((((sky) << 4) | (block)) << 7))
+#define LIGHT_HASSLOT(lightId)         (((lightId) & 127) < LIGHT_UNIFORM_BANK)
 
 #ifdef CHUNK_IMPL                      /* private stuff below */
 
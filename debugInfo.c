@@ -16,6 +16,11 @@
 #include "nanovg.h"
 #include "globals.h"
 #include "meshBanks.h"
+#include "mapUpdate.h"
+#include "tileticks.h"
+#include "undoredo.h"
+#include "entities.h"
+#include "physics.h"
 #include "SIT.h"
 
 extern struct RenderWorld_t render;
@@ -51,6 +56,12 @@ void debugLight(vec4 pos, int normal)
 	LightingTex tex;
 	int lightId = iter.cd->glLightId;
 
+	if (! LIGHT_HASSLOT(lightId))
+	{
+		fprintf(stderr, "no light tex: lightId = %d:%d\n", lightId & 127, lightId >> 7);
+		return;
+	}
+
 	for (tex = HEAD(globals.level->lightingTex); lightId & 127; lightId --, NEXT(tex));
 
 	int  slot = lightId >> 7;
@@ -188,7 +199,7 @@ void debugSaveVertex(void)
 				header[3] = 0;
 
 				fwrite(header, 1, 4, out);
-				if (cd->glLightId < 0xfffe)
+				if (LIGHT_HASSLOT(cd->glLightId))
 				{
 					skyLight += 4096;
 					fwrite(cd->blockIds + SKYLIGHT_OFFSET, 1, 2048, out);
@@ -568,9 +579,30 @@ void debugRenderCaveGraph(void)
 	}
 }
 
+/* memory used by lighting: 3d tex slots vs sub-chunks whose light has been collapsed into glLightId */
+static void debugLightingMem(Map map, int stats[3])
+{
+	Chunk chunk, eof;
+	int   i;
+
+	memset(stats, 0, 3 * sizeof *stats);
+	for (chunk = map->chunks, eof = chunk + map->mapArea * map->mapArea; chunk < eof; chunk ++)
+	{
+		if ((chunk->cflags & CFLAG_HASMESH) == 0) continue;
+		for (i = 0; i < chunk->maxy; i ++)
+		{
+			ChunkData cd = chunk->layer[i];
+			if (cd == NULL || cd->slot > 0) continue;
+			if (LIGHT_HASSLOT(cd->glLightId)) stats[0] ++; else
+			if ((cd->glLightId & 127) == LIGHT_UNIFORM_BANK) stats[1] ++;
+			else stats[2] ++;
+		}
+	}
+}
+
 void debugCoord(APTR vg, vec4 camera, int total)
 {
-	TEXT message[256];
+	TEXT message[512];
 	int  len = sprintf(message, "XYZ: %.2f, %.2f (eye), %.2f (feet: %.2f)\n", PRINT_COORD(camera), (double) (camera[VY] - PLAYER_HEIGHT));
 	int  vis, lightTex;
 
@@ -586,8 +618,22 @@ void debugCoord(APTR vg, vec4 camera, int total)
 	for (bank = HEAD(globals.level->gpuBanks), vis = 0; bank; vis += bank->vtxSize, NEXT(bank));
 	len += sprintf(message + len, "Chunks: %d/%d (culled: %d, fakeAlloc: %d)\n", vis, globals.level->GPUchunk, globals.level->chunkCulled,
 		globals.level->fakeMax);
-	len += sprintf(message + len, "FPS: %.1f (%.1f ms)", FrameGetFPS(), render.frustumTime);
-	len += sprintf(message + len, "\nLighting: %d slots", lightTex);
+	extern struct Frustum_t frustum;
+	len += sprintf(message + len, "FPS: %.1f (frustum: %.2f ms, reused: %d)", FrameGetFPS(), render.frustumTime, frustum.reused);
+	int lightStats[3];
+	debugLightingMem(globals.level, lightStats);
+	/* each slot is 18x18x18 RG8 texels, without compaction all sub-chunks would need one */
+	len += sprintf(message + len, "\nLighting: %d slots (%d KB), uniform: %d, dark/sky: %d (saved: %d KB)",
+		lightTex, lightTex * (TEX_LIGHT_SIZE * 2) >> 10, lightStats[1], lightStats[2],
+		(lightStats[1] + lightStats[2]) * (TEX_LIGHT_SIZE * 2) >> 10);
+	int undoStats[3];
+	undoMemUsage(undoStats);
+	len += sprintf(message + len, "\nUndo: %d KB in memory, %d KB on disk (journal: %d KB)",
+		undoStats[0] >> 10, undoStats[1] >> 10, undoStats[2] >> 10);
+	int updateStats[3];
+	mapUpdateStats(updateStats);
+	len += sprintf(message + len, "\nUpdates: %d queued, %d duplicates, %d applied",
+		updateStats[0], updateStats[1], updateStats[2]);
 
 	#if 0
 	/* show chunks as they are being loaded */
@@ -784,6 +830,176 @@ void debugCaveGraph(Map map)
 }
 
 
+/*
+ * simulation profiler: time spent in tile ticks, block updates, entities and particles attributed to chunks
+ */
+#define PROF_TOPN       10             /* chunks dumped in CSV every second */
+#define PROF_DEPTH      8
+
+typedef struct ProfChunk_t *      ProfChunk;
+
+struct ProfChunk_t
+{
+	int      X, Z;                     /* chunk coord (in blocks) */
+	double   time[PROF_MAX];           /* ms spent during current second */
+	int      events[PROF_MAX];
+	double   total;                    /* ms spent during last second */
+	int      totalEvents;
+	uint8_t  used;
+};
+
+static struct
+{
+	ProfChunk table;                   /* hash table on X, Z (linear probing) */
+	int       mask, count;
+	double    start;                   /* start of current second */
+	double    child[PROF_DEPTH];       /* time spent in nested calls: cost is exclusive */
+	int       depth;
+	double    max;                     /* max ProfChunk.total */
+	int       seconds;
+	FILE *    csv;
+}	prof;
+
+#define PROF_HASH(X, Z)     ((((uint32_t) (X) >> 4) * 4099 + ((uint32_t) (Z) >> 4)) * 0x9E3779B1u >> 12)
+
+static void debugProfRehash(int max, Bool dropIdle)
+{
+	ProfChunk old = prof.table, eof = old + prof.mask + 1, pc;
+	prof.table = calloc(max, sizeof *prof.table);
+	prof.mask  = max - 1;
+	prof.count = 0;
+	for (pc = old; old && pc < eof; pc ++)
+	{
+		int i;
+		if (! pc->used || (dropIdle && pc->total == 0)) continue;
+		for (i = PROF_HASH(pc->X, pc->Z) & prof.mask; prof.table[i].used; i = (i + 1) & prof.mask);
+		prof.table[i] = *pc;
+		prof.count ++;
+	}
+	free(old);
+}
+
+static ProfChunk debugProfGet(int X, int Z, Bool create)
+{
+	ProfChunk pc;
+	int i;
+	if (prof.table == NULL)
+	{
+		if (! create) return NULL;
+		debugProfRehash(256, False);
+	}
+	for (i = PROF_HASH(X, Z) & prof.mask; (pc = prof.table + i)->used; i = (i + 1) & prof.mask)
+		if (pc->X == X && pc->Z == Z) return pc;
+
+	if (! create) return NULL;
+	if (prof.count * 2 >= prof.mask)
+	{
+		debugProfRehash((prof.mask + 1) * 2, False);
+		for (i = PROF_HASH(X, Z) & prof.mask; prof.table[i].used; i = (i + 1) & prof.mask);
+		pc = prof.table + i;
+	}
+	pc->X = X;
+	pc->Z = Z;
+	pc->used = 1;
+	prof.count ++;
+	return pc;
+}
+
+/* one second elapsed: keep total of each chunk, dump the most expensive ones */
+static void debugProfRoll(double now)
+{
+	ProfChunk top[PROF_TOPN], pc, eof;
+	int count, i;
+
+	prof.max = 0;
+	prof.start = now;
+	prof.seconds ++;
+	if (prof.table == NULL) return;
+	for (pc = prof.table, eof = pc + prof.mask + 1, count = 0; pc < eof; pc ++)
+	{
+		if (! pc->used) continue;
+		for (i = 0, pc->total = 0, pc->totalEvents = 0; i < PROF_MAX; i ++)
+			pc->total += pc->time[i], pc->totalEvents += pc->events[i];
+		if (prof.max < pc->total)
+			prof.max = pc->total;
+		if (pc->total > 0 && (count < PROF_TOPN || top[count-1]->total < pc->total))
+		{
+			/* keep top list sorted */
+			for (i = count < PROF_TOPN ? count ++ : count - 1; i > 0 && top[i-1]->total < pc->total; top[i] = top[i-1], i --);
+			top[i] = pc;
+		}
+	}
+
+	if (prof.csv == NULL && count > 0)
+	{
+		prof.csv = fopen("debug/profile.csv", "w");
+		if (prof.csv)
+			fprintf(prof.csv, "second,X,Z,total_ms,events,tileticks_ms,blockupdates_ms,entities_ms,particles_ms,physics_ms\n");
+	}
+	if (prof.csv)
+	{
+		for (i = 0; i < count; i ++)
+		{
+			int j;
+			pc = top[i];
+			fprintf(prof.csv, "%d,%d,%d,%.3f,%d", prof.seconds - 1, pc->X, pc->Z, pc->total, pc->totalEvents);
+			for (j = 0; j < PROF_MAX; j ++)
+				fprintf(prof.csv, ",%.3f", pc->time[j]);
+			fputc('\n', prof.csv);
+		}
+		fflush(prof.csv);
+	}
+
+	for (pc = prof.table; pc < eof; pc ++)
+	{
+		memset(pc->time, 0, sizeof pc->time);
+		memset(pc->events, 0, sizeof pc->events);
+	}
+	/* forget about chunks that have been idle */
+	if (prof.count > 64)
+		debugProfRehash(prof.mask + 1, True);
+}
+
+static void debugProfReset(void)
+{
+	if (prof.csv) fclose(prof.csv);
+	free(prof.table);
+	memset(&prof, 0, sizeof prof);
+}
+
+double debugProfStart(void)
+{
+	if (prof.depth < PROF_DEPTH)
+		prof.child[prof.depth] = 0;
+	prof.depth ++;
+	return FrameGetTime();
+}
+
+void debugProfEnd(int type, Chunk chunk, double start)
+{
+	double now = FrameGetTime();
+	double elapsed = now - start;
+	double self = elapsed;
+
+	prof.depth --;
+	if (prof.depth < PROF_DEPTH)
+		self -= prof.child[prof.depth];
+	if (0 < prof.depth && prof.depth <= PROF_DEPTH)
+		prof.child[prof.depth-1] += elapsed;
+
+	if (now - prof.start >= 1000)
+	{
+		if (prof.start > 0) debugProfRoll(now);
+		else prof.start = now;
+	}
+	if (chunk)
+	{
+		ProfChunk pc = debugProfGet(chunk->X, chunk->Z, True);
+		pc->time[type] += self;
+		pc->events[type] ++;
+	}
+}
+
 /*
  * side-view functions: mostly used to debug SkyLight, BlockLight and HeightMap values
  */
@@ -800,6 +1016,7 @@ static struct
 	int        showLightValue;
 	int        showHeightMap;
 	int        showChunks;
+	int        showProfile;
 	int        showGraph;
 	int        zoom;
 	int        cellH, cellV;
@@ -820,6 +1037,16 @@ static char debugVector[] = {
 	 0, 0, -1, 1,
 };
 
+/* OnActivate on checkbox "simulation cost" */
+static int debugToggleProfile(SIT_Widget w, APTR cd, APTR ud)
+{
+	int checked;
+	SIT_GetValues(w, SIT_CheckState, &checked, NULL);
+	globals.profiling = checked;
+	debugProfReset();
+	return 1;
+}
+
 static int debugExit(SIT_Widget w, APTR cd, APTR ud)
 {
 	* (int *) ud = 2;
@@ -858,6 +1085,8 @@ void debugSetPos(int * exitCode)
 		"  curValue=", &debug.showChunks, "left=WIDGET,none,1em top=MIDDLE,skylight>"
 		" <button name=heightmap title='Show heightmap' buttonType=", SITV_CheckBox,
 		"  curValue=", &debug.showHeightMap, "left=WIDGET,chunk,1em top=MIDDLE,skylight>"
+		" <button name=profile title='Show simulation cost' buttonType=", SITV_CheckBox,
+		"  curValue=", &debug.showProfile, "left=WIDGET,heightmap,1em top=MIDDLE,skylight>"
 		" <button name=back title='3D view' right=FORM>"
 		" <label name=slice right=WIDGET,back,1em top=MIDDLE,back>"
 		"</canvas>"
@@ -881,10 +1110,46 @@ void debugSetPos(int * exitCode)
 	}
 
 	SIT_AddCallback(SIT_GetById(globals.app, "back"), SITE_OnActivate, debugExit, exitCode);
+	SIT_AddCallback(SIT_GetById(globals.app, "profile"), SITE_OnActivate, debugToggleProfile, NULL);
 
 	SIT_InsertDialog(render.blockInfo);
 }
 
+/* heatmap of simulation cost (last second profiled) of chunks crossed by the slice */
+static void debugRenderProfile(NVGcontext * vg, vec4 top, char dir[4])
+{
+	int coord[] = {top[0], top[2]};
+	int i, x, start;
+
+	if (prof.max <= 0) return;
+	nvgFontSize(vg, 16);
+	for (i = debug.cellH, x = start = debug.xoff; i > 0; i --)
+	{
+		int X = coord[0] & ~15;
+		int Z = coord[1] & ~15;
+		coord[0] += dir[0];
+		coord[1] += dir[2];
+		x += debug.sliceSz;
+		/* one rect per chunk */
+		if (i > 1 && (coord[0] & ~15) == X && (coord[1] & ~15) == Z) continue;
+
+		ProfChunk pc = debugProfGet(X, Z, False);
+		if (pc && pc->total > 0)
+		{
+			uint8_t color[] = {0xff, 0x20, 0x00, 0x30 + pc->total / prof.max * 0x90};
+			TEXT    cost[64];
+			nvgBeginPath(vg);
+			nvgRect(vg, start, 0, x - start, globals.height);
+			nvgFillColorRGBA8(vg, color);
+			nvgFill(vg);
+			sprintf(cost, "%.2f ms (%d)", pc->total, pc->totalEvents);
+			nvgFillColorRGBA8(vg, "\xff\xff\xff\xff");
+			nvgText(vg, start + 4, globals.height - 40, cost, NULL);
+		}
+		start = x;
+	}
+}
+
 /* render side view of world */
 void debugWorld(void)
 {
@@ -1067,6 +1332,9 @@ void debugWorld(void)
 		}
 	}
 
+	if (debug.showProfile)
+		debugRenderProfile(vg, top, dir);
+
 	/* show current player position */
 	x = (debug.top[debug.sliceAxis] - debug.orig[debug.sliceAxis]) * debug.sliceSz + debug.xoff;
 	y = (debug.top[1] - debug.orig[1]) * debug.sliceSz + debug.yoff;
@@ -1303,6 +1571,7 @@ void debugLoadSaveState(STRPTR path, Bool load)
 		debug.showChunks = GetINIValueInt(ini, "Debug/ShowChunks", 0);
 		debug.showLightValue = GetINIValueInt(ini, "Debug/LightValue", 0);
 		debug.showHeightMap = GetINIValueInt(ini, "Debug/ShowHeightMap", 0);
+		debug.showProfile = globals.profiling = GetINIValueInt(ini, "Debug/Profile", 0);
 		// debug.zoom = GetINIValueInt(ini, "Debug/Zoom", 32);
 		debug.zoom = 32;
 	}
@@ -1312,6 +1581,87 @@ void debugLoadSaveState(STRPTR path, Bool load)
 		SetINIValueInt(path, "Debug/ShowChunks", debug.showChunks);
 		SetINIValueInt(path, "Debug/LightValue", debug.showLightValue);
 		SetINIValueInt(path, "Debug/ShowHeightMap", debug.showHeightMap);
+		SetINIValueInt(path, "Debug/Profile", debug.showProfile);
 		// SetINIValueInt(path, "Debug/Zoom", debug.zoom);
 	}
 }
+
+/*
+ * in-game benchmarks (debug build only): results are dumped on stderr
+ */
+#ifdef DEBUG
+#define BENCH_SIZE      32
+
+/* place/remove lots of light emitters and opaque layers in an empty area above player */
+static void debugBenchLight(Map map, vec4 start)
+{
+	static STRPTR steps[] = {"place emitters", "place opaque slab", "remove opaque slab", "remove emitters"};
+	struct BlockIter_t iter;
+	ItemID_t glowstone = itemGetByName("glowstone", False);
+	ItemID_t stone = itemGetByName("stone", False);
+	vec4 pos;
+	int  i, x, z;
+
+	pos[VX] = floorf(start[VX]) - BENCH_SIZE/2;
+	pos[VY] = floorf(start[VY]) + 4;
+	pos[VZ] = floorf(start[VZ]) - BENCH_SIZE/2;
+
+	if (pos[VY] + 8 >= BUILD_HEIGHT)
+	{
+		fprintf(stderr, "bench light: too close to build limit\n");
+		return;
+	}
+
+	/* area must be empty, we don't want to destroy anything */
+	for (i = 0; i < 8; i ++)
+	{
+		for (z = 0; z < BENCH_SIZE; z ++)
+		{
+			for (x = 0; x < BENCH_SIZE; x ++)
+			{
+				mapInitIter(map, &iter, (vec4) {pos[VX] + x, pos[VY] + i, pos[VZ] + z}, False);
+				if (iter.ref == NULL || (iter.cd != chunkAir && iter.blockIds[iter.offset] != 0))
+				{
+					fprintf(stderr, "bench light: area %d,%d,%d is not empty\n", (int) pos[VX], (int) pos[VY], (int) pos[VZ]);
+					return;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < DIM(steps); i ++)
+	{
+		double time = FrameGetTime();
+		int    count = 0;
+		for (z = 0; z < BENCH_SIZE; z ++)
+		{
+			for (x = 0; x < BENCH_SIZE; x ++)
+			{
+				vec4 block = {pos[VX] + x, pos[VY], pos[VZ] + z};
+				int  id;
+				switch (i) {
+				case 0: if ((x & 3) || (z & 3)) continue; id = glowstone; break;
+				case 1: block[VY] += 6; id = stone; break;
+				case 2: block[VY] += 6; id = 0; break;
+				default: if ((x & 3) || (z & 3)) continue; id = 0;
+				}
+				mapUpdate(map, block, id, NULL, UPDATE_SILENT | UPDATE_DONTLOG);
+				count ++;
+			}
+		}
+		time = FrameGetTime() - time;
+		fprintf(stderr, "bench light: %s: %d blocks in %.1f ms (%.3f ms/block)\n", steps[i], count, time, time / count);
+	}
+	mapUpdateMesh(map);
+}
+
+void debugBenchmark(int type, vec4 pos)
+{
+	switch (type) {
+	case DEBUG_BENCH_LIGHT:    debugBenchLight(globals.level, pos); break;
+	case DEBUG_BENCH_TILETICK: updateBenchmark(); break;
+	case DEBUG_BENCH_ENTITYGRID: entityGridBenchmark(); break;
+	case DEBUG_BENCH_COLLISION: physicsBenchmark(globals.level, pos); break;
+	}
+}
+#endif
@@ -33,6 +33,7 @@ struct Paintings_t       paintings;
 
 static void hashAlloc(int);
 static void hashInsert(ItemID_t id, int VBObank);
+static void entityAnimRemove(int index);
 
 /* map is about to be closed */
 void entityNukeAll(void)
@@ -58,10 +59,12 @@ void entityNukeAll(void)
 		}
 	}
 
-	quadTreeClear();
+	entityGridClear();
 	while ((node = ListRemHead(&entities.physBatch))) free(node);
 	while ((node = ListRemHead(&entities.list)))      free(node);
-	free(entities.animate);
+	free(entities.animate.entity);
+	free(entities.animate.stopTime);
+	free(entities.animate.prevTime);
 	free(entities.hash.list);
 	memset(&entities.hash, 0, sizeof entities.hash);
 	/* the following banks can be deleted entirely */
@@ -91,8 +94,7 @@ void entityNukeAll(void)
 	for (i = 0; i < entities.initModelCount; i ++)
 		hashInsert(models[i], i << 6);
 
-	entities.animate = NULL;
-	entities.animCount = entities.animMax = 0;
+	memset(&entities.animate, 0, sizeof entities.animate);
 	entities.selected = NULL;
 	entities.selectedId = 0;
 }
@@ -891,7 +893,7 @@ Entity entityParse(Chunk chunk, NBTFile nbt, int offset, Entity prev)
 			entity->enflags |= ENFLAG_FULLLIGHT;
 		entityGetLight(chunk, pos+3, entity->light, entity->enflags & ENFLAG_FULLLIGHT);
 		entityAddToCommandList(entity);
-		quadTreeInsertItem(entity);
+		entityGridInsert(entity);
 
 		/* entity that have multiple parts (item frame, armor stand) */
 		while (prev->next != ENTITY_END)
@@ -1265,7 +1267,7 @@ uint16_t entityClear(EntityBuffer buf, int index)
 	EntityBank bank;
 
 	Entity entity = buf->entities + index;
-	quadTreeDeleteItem(entity);
+	entityGridDelete(entity);
 	buf->usage[index>>5] ^= 1 << (index & 31);
 	buf->count --;
 	entity->tile = NULL;
@@ -1296,6 +1298,26 @@ void entityUnload(Chunk c)
 	c->entityList = ENTITY_END;
 }
 
+/* chunk <c> went out of entity distance: discard entities if they can be parsed again from NBT */
+Bool entityUnloadIdle(Chunk c)
+{
+	Entity entity;
+	int    slot;
+
+	if (c->cflags & CFLAG_REBUILDENT)
+		return False;
+
+	for (slot = c->entityList; slot != ENTITY_END; slot = entity->next)
+	{
+		entity = entityGetById(slot);
+		/* still referenced by animation or physics */
+		if (entity->enflags & ENFLAG_INANIM)
+			return False;
+	}
+	entityUnload(c);
+	return True;
+}
+
 /* remove one entity from given chunk */
 void entityDelete(Chunk c, DATA8 tile)
 {
@@ -1378,13 +1400,9 @@ Bool entityDeleteById(Map map, int entityId)
 				/* block pushed by piston: cannot be removed until anim is done */
 				return False;
 			/* animated entities: need to be removed from anim list */
-			EntityAnim anim;
-			for (anim = entities.animate, i = entities.animCount; i > 0 && anim->entity != entity; i --, anim ++);
-			if (i > 0)
-			{
-				if (i > 1) memmove(anim, anim + 1, sizeof *anim * (i - 1));
-				entities.animCount --;
-			}
+			for (i = 0; i < entities.animate.count && entities.animate.entity[i] != entity; i ++);
+			if (i < entities.animate.count)
+				entityAnimRemove(i);
 		}
 
 		/* unlink from chunk active entities */
@@ -1508,22 +1526,85 @@ void entityGetPos(int entityId, float ret[3])
 		memset(ret, 0, 12);
 }
 
-#define ANIM_REMAIN(ptr)     ((DATA8) (entities.animate + entities.animCount) - (DATA8) ptr)
+/* push <entity> at the end of the animated list */
+static void entityAnimAdd(Entity entity, int stopTime)
+{
+	EntityAnim anim = &entities.animate;
+	int i;
+
+	if (anim->count == anim->max)
+	{
+		anim->max += ENTITY_BATCH;
+		anim->entity   = realloc(anim->entity,   anim->max * sizeof *anim->entity);
+		anim->stopTime = realloc(anim->stopTime, anim->max * sizeof *anim->stopTime);
+		anim->prevTime = realloc(anim->prevTime, anim->max * sizeof *anim->prevTime);
+	}
+	i = anim->count ++;
+	anim->entity[i]   = entity;
+	anim->prevTime[i] = (int) globals.curTime;
+	anim->stopTime[i] = stopTime;
+}
+
+/* order of animated entities does not matter: replace with last */
+static void entityAnimRemove(int index)
+{
+	EntityAnim anim = &entities.animate;
+	int last = -- anim->count;
+
+	anim->entity[index]   = anim->entity[last];
+	anim->stopTime[index] = anim->stopTime[last];
+	anim->prevTime[index] = anim->prevTime[last];
+}
+
+/* move all entities driven by physics: integration is done in batch, only collision will access the map */
+static void entityAnimPhysics(int time)
+{
+	struct PhysicsBatch_t batch;
+	EntityAnim anim = &entities.animate;
+	Chunk chunks[PHYSICS_BATCH];
+	int i, j;
+
+	for (i = 0; i < anim->count; )
+	{
+		for (batch.count = 0; i < anim->count && batch.count < PHYSICS_BATCH; i ++)
+		{
+			if (anim->stopTime[i] != UPDATE_BY_PHYSICS) continue;
+			chunks[batch.count] = anim->entity[i]->chunkRef;
+			physicsBatchAdd(&batch, anim->entity[i]->private, (time - anim->prevTime[i]) / 50.f);
+		}
+		if (batch.count == 0) continue;
+		double start = globals.profiling ? debugProfStart() : 0;
+		physicsBatchIntegrate(&batch);
+		if (start > 0) debugProfEnd(PROF_PHYSICS, NULL, start);
+
+		for (j = 0; j < batch.count; j ++)
+		{
+			start = globals.profiling ? debugProfStart() : 0;
+			physicsBatchCollide(globals.level, &batch, j);
+			if (start > 0) debugProfEnd(PROF_PHYSICS, chunks[j], start);
+		}
+	}
+}
 
 void entityAnimate(void)
 {
-	EntityAnim anim;
+	EntityAnim anim = &entities.animate;
 	int i, time = globals.curTime, finalize = 0;
-	for (i = entities.animCount, anim = entities.animate; i > 0; i --)
+
+	entityAnimPhysics(time);
+
+	for (i = 0; i < anim->count; )
 	{
-		Entity entity = anim->entity;
-		int remain = anim->stopTime - time;
-		if (anim->stopTime == UPDATE_BY_PHYSICS)
+		Entity entity = anim->entity[i];
+		Chunk  chunk  = entity->chunkRef;
+		double start  = globals.profiling ? debugProfStart() : 0;
+		int    remain = anim->stopTime[i] - time;
+		if (anim->stopTime[i] == UPDATE_BY_PHYSICS)
 		{
+			/* already moved by entityAnimPhysics() */
 			float oldPos[3];
 			PhysicsEntity physics = entity->private;
 			memcpy(oldPos, entity->pos, 12);
-			physicsMoveEntity(globals.level, physics, (time - anim->prevTime) / 50.f);
 
 			if ((physics->physFlags & PHYSFLAG_OVERHOPPER) /*&& (entity->blockId & ENTITY_ITEM)*/)
 			{
@@ -1536,50 +1617,45 @@ void entityAnimate(void)
 				{
 					entityFreePhysics(entity);
 					entityDelete(entity->chunkRef, entity->tile);
-					memmove(anim, anim + 1, ANIM_REMAIN(anim));
-					entities.animCount --;
+					entityAnimRemove(i);
+					if (start > 0) debugProfEnd(PROF_ENTITY, chunk, start);
 					continue;
 				}
 			}
 
 			memcpy(entity->pos, physics->loc, 12);
 			entityUpdateInfo(entity, oldPos);
-			anim->prevTime = time;
+			anim->prevTime[i] = time;
 			if (physics->dir[VX] < EPSILON &&
 			    physics->dir[VY] < EPSILON && fabsf(physics->friction[VY] < EPSILON) &&
 			    physics->dir[VZ] < EPSILON)
 			{
 				entityFreePhysics(entity);
+				entityAnimRemove(i);
 				if (entity->enflags & ENFLAG_ITEM)
 				{
 					/* just remove the anim, but keep the entity */
-					entities.animCount --;
 					entity->enflags &= ~ENFLAG_INANIM;
-					memmove(anim, anim + 1, ANIM_REMAIN(anim));
 				}
 				else /* remove anim and convert entity to block or item */
 				{
 					/* convert back to block or item if we can't */
 					worldItemPlaceOrCreate(entity);
 					entityDelete(entity->chunkRef, entity->tile);
-					/* remove from list */
-					entities.animCount --;
-					memmove(anim, anim + 1, ANIM_REMAIN(anim));
 				}
 			}
-			else anim ++;
+			else i ++;
 		}
-		else if (anim->stopTime == UPDATE_BY_RAILS)
+		else if (anim->stopTime[i] == UPDATE_BY_RAILS)
 		{
-			if (! minecartUpdate(entity, (time - anim->prevTime) / 50.f))
+			if (! minecartUpdate(entity, (time - anim->prevTime[i]) / 50.f))
 			{
 				/* minecart stopped remove from list */
-				entities.animCount --;
-				memmove(anim, anim + 1, ANIM_REMAIN(anim));
+				entityAnimRemove(i);
 				entity->enflags &= ~ENFLAG_INANIM;
 				entityFreePhysics(entity);
 			}
-			else anim->prevTime = time;
+			else anim->prevTime[i ++] = time;
 		}
 		else if (remain > 0)
 		{
@@ -1589,17 +1665,16 @@ void entityAnimate(void)
 			for (j = 0; j < 3; j ++)
 			{
 				/* entity->pos will drift due to infinitesimal error accumulation on iterative sum */
-				float pos = entity->pos[j] += (entity->motion[j] - entity->pos[j]) * (time - anim->prevTime) / remain;
+				float pos = entity->pos[j] += (entity->motion[j] - entity->pos[j]) * (time - anim->prevTime[i]) / remain;
 				/* physics collision are very picky about not exceeding bounding box :-/ */
 				if ((pos - oldPos[j]) * (entity->motion[j] - pos) < 0)
 					entity->pos[j] = entity->motion[j];
 			}
-			anim->prevTime = time;
+			anim->prevTime[i ++] = time;
 
 			/* update VBO */
 			entityUpdateInfo(entity, oldPos);
 			physicsEntityMoved(globals.level, entity, oldPos, entity->pos);
-			anim ++;
 		}
 		else /* anim done: remove entity */
 		{
@@ -1609,12 +1684,12 @@ void entityAnimate(void)
 			/* due to lag, entity animation can skip entirely the branch before this "else" */
 			physicsEntityMoved(globals.level, entity, entity->pos, entity->motion);
 			/* remove from list */
-			entities.animCount --;
-			memmove(anim, anim + 1, ANIM_REMAIN(anim));
+			entityAnimRemove(i);
 			entityDelete(entity->chunkRef, tile);
 			updateFinished(tile, dest);
 			finalize = 1;
 		}
+		if (start > 0) debugProfEnd(PROF_ENTITY, chunk, start);
 	}
 	if (finalize)
 		updateFinished(NULL, NULL);
@@ -1623,16 +1698,15 @@ void entityAnimate(void)
 /* block entity */
 Entity entityCreateOrUpdate(Chunk chunk, vec4 pos, ItemID_t blockId, vec4 dest, int ticks, DATA8 tile)
 {
-	EntityAnim anim;
 	Entity     entity;
 	uint16_t   slot;
 	uint8_t    item = (blockId & ENTITY_ITEM) > 0;
 
 	blockId &= ~ENTITY_ITEM;
 	/* check if it is already in the list */
-	for (slot = entities.animCount, anim = entities.animate, entity = NULL; slot > 0; slot --, anim ++)
+	for (slot = entities.animate.count, entity = NULL; slot > 0; slot --)
 	{
-		entity = anim->entity;
+		entity = entities.animate.entity[slot-1];
 		if (entity->tile == tile) break;
 	}
 
@@ -1663,32 +1737,23 @@ Entity entityCreateOrUpdate(Chunk chunk, vec4 pos, ItemID_t blockId, vec4 dest,
 	entityGetLight(chunk, pos, entity->light, entity->enflags & ENFLAG_FULLLIGHT);
 	entityAddToCommandList(entity);
 
-	if ((entity->enflags & ENFLAG_INQUADTREE) == 0)
-		quadTreeInsertItem(entity);
+	if ((entity->enflags & ENFLAG_INGRID) == 0)
+		entityGridInsert(entity);
 
 	/* push it into the animate list */
-	if (entities.animCount == entities.animMax)
-	{
-		entities.animMax += ENTITY_BATCH;
-		entities.animate = realloc(entities.animate, entities.animMax * sizeof *entities.animate);
-	}
-	anim = entities.animate + entities.animCount;
-	entities.animCount ++;
-	anim->prevTime = (int) globals.curTime;
 	if (ticks < 0)
 	{
 		/* XXX 2nd param should be a param of this function */
 		worldItemCreateBlock(entity, ! item);
-		anim->stopTime = ticks;
+		entityAnimAdd(entity, ticks);
 	}
 	else
 	{
 		entity->enflags |= ENFLAG_FIXED;
-		anim->stopTime = anim->prevTime + ticks * globals.redstoneTick;
+		entityAnimAdd(entity, (int) globals.curTime + ticks * globals.redstoneTick);
 	}
-	anim->entity = entity;
 
-//	fprintf(stderr, "adding entity %d at %p / %d\n", entities.animCount, tile, slot);
+//	fprintf(stderr, "adding entity %d at %p / %d\n", entities.animate.count, tile, slot);
 	return entity;
 }
 
@@ -1725,7 +1790,7 @@ void entityUpdateInfo(Entity entity, vec4 oldPos)
 	EntityBank bank;
 	int j;
 	for (j = BANK_NUM(entity->VBObank), bank = HEAD(entities.banks); j > 0; j --, NEXT(bank));
-	quadTreeChangePos(entity);
+	entityGridMove(entity);
 	Chunk cur = entity->chunkRef;
 
 	if (cur)
@@ -1790,20 +1855,11 @@ void entityInitMove(Entity entity, int side, float factor)
 	else mode = side;
 
 	/* push it into the animate list */
-	if (entities.animCount == entities.animMax)
-	{
-		entities.animMax += ENTITY_BATCH;
-		entities.animate = realloc(entities.animate, entities.animMax * sizeof *entities.animate);
-	}
 	if ((entity->enflags & ENFLAG_INANIM) == 0)
 	{
 		undoLog(LOG_ENTITY_CHANGED, entity->pos, entity->tile, entityGetId(entity));
-		EntityAnim anim = entities.animate + entities.animCount;
-		entities.animCount ++;
 		entity->enflags |= ENFLAG_INANIM;
-		anim->prevTime = (int) globals.curTime;
-		anim->stopTime = mode;
-		anim->entity = entity;
+		entityAnimAdd(entity, mode);
 	}
 }
 
@@ -1826,7 +1882,7 @@ void entityUpdateNearby(BlockIter iterator, int blockId)
 		playerCheckNearby(p, bbox);
 
 	/* get entities that are not fixed */
-	Entity * list = quadTreeIntersect(bbox, &count, ENFLAG_FIXED | ENFLAG_EQUALZERO);
+	Entity * list = entityGridIntersect(bbox, &count, ENFLAG_FIXED | ENFLAG_EQUALZERO);
 
 	bbox[VY+3] -= 0.125f;
 	for (i = 0; i < count; i ++)
@@ -14,12 +14,14 @@
 
 typedef struct Entity_t *   Entity;
 typedef struct QuadTree_t * QuadTree;
+typedef struct GridCell_t * GridCell;
 
 void   entityNukeAll(void);
 Entity entityParse(Chunk, NBTFile nbt, int offset, Entity prev);
 Entity entityLastFromChunk(Chunk);
 Bool   entityInitStatic(void);
 void   entityUnload(Chunk);
+Bool   entityUnloadIdle(Chunk);
 void   entityAnimate(void);
 void   entityRender(void);
 void   entityDebug(int id);
@@ -60,9 +62,12 @@ void worldItemAdd(Map);
 void worldItemDup(Map map, vec info, int entityId);
 void worldItemCreateFromBlock(BlockIter, int side);
 
-void quadTreeInit(int x, int z, int size);
-void quadTreeDebug(APTR vg);
-Entity * quadTreeIntersect(float bbox[6], int * count, int filter);
+void entityGridInit(int maxDist);
+void entityGridDebug(APTR vg);
+void entityGridBenchmark(void);
+int  entityGridQuery(float bbox[6], int filter, Entity * list, int max);
+int  entityGridQueryBatch(float * bboxes, int count, int filter, Entity * list, int max, int * offsets);
+Entity * entityGridIntersect(float bbox[6], int * count, int filter);
 
 #define UPDATE_BY_PHYSICS          -1 /* special param for <ticks> of entityCreateOrUpdate() */
 #define UPDATE_BY_RAILS            -2
@@ -73,16 +78,16 @@ enum                               /* possible flags for Entity_t.enflags */
 	ENFLAG_POPIFPUSHED = 0x0001,   /* if pushed by piston: convert to item */
 	ENFLAG_FIXED       = 0x0002,   /* can't be pushed by piston */
 	ENFLAG_FULLLIGHT   = 0x0004,   /* lighting similar to SOLID voxel */
-	ENFLAG_OVERLAP     = 0x0008,   /* overlap partition of a quad tree (set by quad tree, do not set manually) */
+	ENFLAG_OVERLAP     = 0x0008,   /* overlap partition of a quad tree (only used by quad tree benchmark) */
 	ENFLAG_BBOXROTATED = 0x0010,   /* don't apply rotation/scale on bbox */
-	ENFLAG_INQUADTREE  = 0x0020,   /* entity is in quad tree (will need removal) */
+	ENFLAG_INGRID      = 0x0020,   /* entity is in spatial grid (will need removal) */
 	ENFLAG_TEXENTITES  = 0x0040,   /* use texture sampler for entities */
 	ENFLAG_HASBBOX     = 0x0080,   /* other entities can collide with these */
 	ENFLAG_USEMOTION   = 0x0100,   /* use entity->motion as position */
 	ENFLAG_INANIM      = 0x0200,   /* used in a animated sequence (need to remove ref when deleted) */
 	ENFLAG_ITEM        = 0x0400,   /* differentiate world item from block entity (Entity_t.blockId) */
 
-	ENFLAG_EQUALZERO   = 0x8000,   /* extra <filter> parameter for quadTreeIntersect() */
+	ENFLAG_EQUALZERO   = 0x8000,   /* extra <filter> parameter for entityGridQuery() */
 	ENFLAG_ANYENTITY   = 0x7fff
 };
 
@@ -205,12 +210,23 @@ struct Entity_t
 	STRPTR   name;                 /* from NBT ("id" key) */
 	APTR     private;              /* private stuff allocated by entity */
 
-	/* quadtree fields */
+	/* spatial grid fields */
+	Entity   gnext, gprev;         /* doubly linked list of entities within a grid cell */
+	int      gcell;                /* index of cell in grid hash table */
+#ifdef DEBUG
 	Entity   qnext;                /* linked list of entities in a quad tree leaf node */
 	QuadTree qnode;                /* quadtree node where entity is */
+#endif
 };
 
-struct QuadTree_t                  /* quadtree for entity collision check (36b) */
+struct GridCell_t                  /* entities whose center is within a chunk column */
+{
+	int      X, Z;                 /* chunk coord (block coord >> 4) */
+	int      count;                /* entities in <items> (<0: free slot) */
+	Entity   items;
+};
+
+struct QuadTree_t                  /* quadtree for entity collision check (36b): only kept for benchmark */
 {
 	float    x, z;
 	uint16_t size;                 /* always a power of 2 */
@@ -298,13 +314,20 @@ struct EntityPhysBatch_t           /* provide buffers to process physics fo a mo
 	PHYSBOX  mem[128];
 };
 
+struct EntityAnim_t                /* entities being moved (SoA): removed by swapping with last one */
+{
+	Entity * entity;
+	int *    stopTime;             /* UPDATE_BY_PHYSICS, UPDATE_BY_RAILS or time when anim is done */
+	int *    prevTime;             /* time of last update */
+	int      count, max;
+};
+
 struct EntitiesPrivate_t           /* static vars for entity.c */
 {
 	EntityHash_t hash;             /* item id => vbobank */
 	ListHead     list;             /* EntityBuffer */
 	ListHead     banks;            /* EntityBank */
 	ListHead     physBatch;        /* EntityPhysBatch */
-	EntityAnim   animate;
 	EntityType   type;
 	int          typeCount;
 	int          typeMax;
@@ -312,21 +335,13 @@ struct EntitiesPrivate_t           /* static vars for entity.c */
 	int          texEntity;
 	int          texTerrain;
 	/* clear fields below on map exit */
-	int          animCount;
-	int          animMax;
+	struct EntityAnim_t animate;
 	Entity       selected;
 	int          selectedId;       /* entity id */
 	int          initModelCount;   /* clear extra models on exit */
 	int          initVtxCount;
 };
 
-struct EntityAnim_t
-{
-	int      stopTime;
-	int      prevTime;
-	Entity   entity;
-};
-
 struct CustModel_t                 /* custom entity model (instead of being derived from block models) */
 {
 	float *  model;                /* vertex data from TileFinder (converted to num) */
@@ -363,10 +378,20 @@ enum                  /* possible values for swapAxis of entityAddModel() */
 };
 
 
+void entityGridClear(void);
+void entityGridDelete(Entity item);
+void entityGridInsert(Entity item);
+void entityGridMove(Entity item);
+
+#ifdef DEBUG
+void quadTreeInit(int x, int z, int size);
 void quadTreeClear(void);
 void quadTreeDeleteItem(Entity item);
 void quadTreeInsertItem(Entity item);
 void quadTreeChangePos(Entity item);
+void quadTreeDebug(APTR vg);
+Entity * quadTreeIntersect(float bbox[6], int * count, int filter);
+#endif
 
 void worldItemInit(void);
 void worldItemDelete(Entity);
@@ -0,0 +1,456 @@
+/*
+ * entityGrid.c : space partitioning of entities with a loose grid aligned on chunk columns.
+ *
+ * the purpose of this module is to be able to quickly enumerate entities that intersect a 3d AABB. Each entity
+ * is linked into the cell that contains its center: moving an entity only requires to relink it when it crosses
+ * a chunk boundary. Cells are stored in a hash table, so the grid has no bounds. Since entities can extend
+ * beyond their cell, queries are enlarged by the biggest half-size of entities seen so far.
+ */
+
+#define ENTITY_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "entities.h"
+
+#define GRID_MIN      64
+#define GRID_FREE     -1           /* slot never used: ends a probe sequence */
+#define GRID_DELETED  -2           /* cell became empty: can be reused, but probing must continue past it */
+#define CELL(coord)   ((int) floorf(coord) >> 4)
+
+static struct EntityGrid_t
+{
+	GridCell cells;                /* hash table (open addressing, linear probing) */
+	int      count, max;           /* cells with entities / capacity (power of 2) */
+	int      used;                 /* slots not free (count + deleted ones) */
+	float    extent[2];            /* biggest half-size of entities along X and Z */
+	Entity * selected;             /* result of entityGridIntersect() */
+	int      selMax;
+}	grid;
+
+static int entityGridHash(int X, int Z)
+{
+	return ((uint32_t) X * 73856093u ^ (uint32_t) Z * 19349663u) & (grid.max - 1);
+}
+
+/* rehash cells into a table of <max> slots: entities will need their cell index updated */
+static Bool entityGridResize(int max)
+{
+	GridCell cells = malloc(max * sizeof *cells);
+	GridCell old   = grid.cells;
+	int      i, oldMax = grid.max;
+
+	if (cells == NULL) return False;
+	for (i = 0; i < max; i ++)
+		cells[i].count = GRID_FREE;
+
+	grid.cells = cells;
+	grid.max = max;
+	grid.used = 0;
+	for (i = 0; i < oldMax; i ++)
+	{
+		GridCell cell = old + i;
+		Entity   item;
+		int      slot;
+		/* empty and deleted cells are dropped here */
+		if (cell->count <= 0) continue;
+		for (slot = entityGridHash(cell->X, cell->Z); cells[slot].count >= 0; slot = (slot + 1) & (max - 1));
+		cells[slot] = *cell;
+		grid.used ++;
+		for (item = cell->items; item; item = item->gnext)
+			item->gcell = slot;
+	}
+	free(old);
+	return True;
+}
+
+/* get index of cell at chunk coord <X>, <Z> (-1 if not found and <create> is False) */
+static int entityGridCell(int X, int Z, Bool create)
+{
+	GridCell cell;
+	int      i, reuse = -1;
+
+	if (grid.max == 0)
+	{
+		if (! create || ! entityGridResize(GRID_MIN)) return -1;
+	}
+	for (i = entityGridHash(X, Z); (cell = grid.cells + i)->count != GRID_FREE; i = (i + 1) & (grid.max - 1))
+	{
+		if (cell->count == GRID_DELETED)
+		{
+			if (reuse < 0) reuse = i;
+		}
+		else if (cell->X == X && cell->Z == Z) return i;
+	}
+
+	if (! create) return -1;
+	if (reuse >= 0)
+	{
+		cell = grid.cells + (i = reuse);
+	}
+	else if (grid.used * 2 >= grid.max)
+	{
+		/* keep load factor below 50%: purge deleted cells first, only grow if that is not enough */
+		if (! entityGridResize(grid.count * 4 >= grid.max ? grid.max * 2 : grid.max)) return -1;
+		return entityGridCell(X, Z, True);
+	}
+	else grid.used ++;
+	cell->X = X;
+	cell->Z = Z;
+	cell->count = 0;
+	cell->items = NULL;
+	grid.count ++;
+	return i;
+}
+
+/* pre-allocate cells for a map with a render distance of <maxDist> chunks */
+void entityGridInit(int maxDist)
+{
+	int size = (maxDist * 2 + 1) * (maxDist * 2 + 1) * 2;
+	int max;
+
+	for (max = GRID_MIN; max < size; max <<= 1);
+	if (max > grid.max)
+		entityGridResize(max);
+}
+
+/* start from scratch */
+void entityGridClear(void)
+{
+	free(grid.cells);
+	free(grid.selected);
+	memset(&grid, 0, sizeof grid);
+}
+
+/* link <item> into the cell containing its center */
+void entityGridInsert(Entity item)
+{
+	float scale = ENTITY_SCALE(item);
+	int   slot  = entityGridCell(CELL(item->pos[VX]), CELL(item->pos[VZ]), True);
+
+	if (slot < 0) return;
+
+	GridCell cell = grid.cells + slot;
+	item->gcell = slot;
+	item->gprev = NULL;
+	item->gnext = cell->items;
+	if (cell->items) cell->items->gprev = item;
+	cell->items = item;
+	cell->count ++;
+	item->enflags |= ENFLAG_INGRID;
+
+	/* queries will have to check neighbor cells up to that distance */
+	if (grid.extent[0] < item->szx * scale) grid.extent[0] = item->szx * scale;
+	if (grid.extent[1] < item->szz * scale) grid.extent[1] = item->szz * scale;
+}
+
+static void entityGridUnlink(Entity item)
+{
+	GridCell cell = grid.cells + item->gcell;
+	if (item->gprev) item->gprev->gnext = item->gnext;
+	else             cell->items = item->gnext;
+	if (item->gnext) item->gnext->gprev = item->gprev;
+	if (-- cell->count == 0)
+	{
+		/* release cell: chunks that are out of range would otherwise fill the table */
+		cell->count = GRID_DELETED;
+		grid.count --;
+	}
+}
+
+void entityGridDelete(Entity item)
+{
+	/* not every entity are in the grid (temporary ones aren't) */
+	if ((item->enflags & ENFLAG_INGRID) == 0)
+		return;
+
+	entityGridUnlink(item);
+	item->enflags &= ~ENFLAG_INGRID;
+}
+
+/* entity has moved: only need to relink it if it changed chunk */
+void entityGridMove(Entity item)
+{
+	if ((item->enflags & ENFLAG_INGRID) == 0)
+		return;
+
+	GridCell cell = grid.cells + item->gcell;
+	if (cell->X == CELL(item->pos[VX]) && cell->Z == CELL(item->pos[VZ]))
+		return;
+
+	entityGridUnlink(item);
+	entityGridInsert(item);
+}
+
+/* check entities of one cell: returns number of entities intersecting <bbox> (only <max> are stored in <list>) */
+static int entityGridCheckCell(GridCell cell, float bbox[6], int filter, Entity * list, int count, int max)
+{
+	Entity item;
+	for (item = cell->items; item; item = item->gnext)
+	{
+		if (filter & ENFLAG_EQUALZERO ? (item->enflags & filter) != 0 : (item->enflags & filter) == 0)
+			continue;
+
+		float scale = ENTITY_SCALE(item);
+		float SX = item->szx * scale;
+		float SZ = item->szz * scale;
+		float SY = item->szy * scale;
+		float X  = item->pos[VX];
+		float Y  = item->pos[VY];
+		float Z  = item->pos[VZ];
+		if (bbox[VX] < X+SX && bbox[VX+3] > X-SX &&
+		    bbox[VY] < Y+SY && bbox[VY+3] > Y-SY &&
+		    bbox[VZ] < Z+SZ && bbox[VZ+3] > Z-SZ)
+		{
+			/* intersecting bounding box */
+			if (count < max) list[count] = item;
+			count ++;
+		}
+	}
+	return count;
+}
+
+/*
+ * get entities that intersect <bbox>: returns number of entities found, only <max> will be stored in <list>
+ * (can be NULL if only the count is needed). Grid is not modified: can be called from any thread, as long as
+ * the grid is not modified at the same time.
+ */
+int entityGridQuery(float bbox[6], int filter, Entity * list, int max)
+{
+	int X1 = CELL(bbox[VX]   - grid.extent[0]);
+	int Z1 = CELL(bbox[VZ]   - grid.extent[1]);
+	int X2 = CELL(bbox[VX+3] + grid.extent[0]);
+	int Z2 = CELL(bbox[VZ+3] + grid.extent[1]);
+	int count = 0, X, Z, i;
+
+	if (grid.count == 0)
+		return 0;
+
+	if ((X2 - X1 + 1) * (Z2 - Z1 + 1) > grid.count)
+	{
+		/* very large box: cheaper to scan all cells */
+		for (i = 0; i < grid.max; i ++)
+		{
+			GridCell cell = grid.cells + i;
+			if (cell->count > 0 && X1 <= cell->X && cell->X <= X2 && Z1 <= cell->Z && cell->Z <= Z2)
+				count = entityGridCheckCell(cell, bbox, filter, list, count, max);
+		}
+		return count;
+	}
+
+	for (Z = Z1; Z <= Z2; Z ++)
+	{
+		for (X = X1; X <= X2; X ++)
+		{
+			i = entityGridCell(X, Z, False);
+			if (i >= 0 && grid.cells[i].count > 0)
+				count = entityGridCheckCell(grid.cells + i, bbox, filter, list, count, max);
+		}
+	}
+	return count;
+}
+
+/*
+ * query <count> boxes (6 floats each) at once: entities intersecting box <i> will be stored in <list> from
+ * <offsets[i]> to <offsets[i+1]> (excluded). Returns total number of entities found (can be more than <max>).
+ */
+int entityGridQueryBatch(float * bboxes, int count, int filter, Entity * list, int max, int * offsets)
+{
+	int i, total, stored;
+
+	for (i = total = stored = 0; i < count; i ++, bboxes += 6)
+	{
+		int found = entityGridQuery(bboxes, filter, list + stored, max - stored);
+		offsets[i] = stored;
+		total  += found;
+		stored += found < max - stored ? found : max - stored;
+	}
+	offsets[i] = stored;
+	return total;
+}
+
+/* same as entityGridQuery(), but results are stored in a buffer owned by this module (main thread only) */
+Entity * entityGridIntersect(float bbox[6], int * count, int filter)
+{
+	int found = entityGridQuery(bbox, filter, grid.selected, grid.selMax);
+
+	if (found > grid.selMax)
+	{
+		int max = (found + 31) & ~31;
+		Entity * list = realloc(grid.selected, max * sizeof *list);
+		if (list)
+		{
+			grid.selected = list;
+			grid.selMax = max;
+		}
+		found = entityGridQuery(bbox, filter, grid.selected, grid.selMax);
+		if (found > grid.selMax) found = grid.selMax;
+	}
+	*count = found;
+	return grid.selected;
+}
+
+#ifdef DEBUG
+/* render on screen grid cells with entity location */
+#define MARGIN    20
+#include "nanovg.h"
+#include "globals.h"
+void entityGridDebug(APTR vg)
+{
+	float bbox[4] = {1e6, 1e6, -1e6, -1e6};
+	float scale;
+	int   i;
+
+	if (grid.count == 0) return;
+	for (i = 0; i < grid.max; i ++)
+	{
+		GridCell cell = grid.cells + i;
+		if (cell->count < 0) continue;
+		if (bbox[0] > cell->X) bbox[0] = cell->X;
+		if (bbox[1] > cell->Z) bbox[1] = cell->Z;
+		if (bbox[2] < cell->X) bbox[2] = cell->X;
+		if (bbox[3] < cell->Z) bbox[3] = cell->Z;
+	}
+	scale = fminf((globals.width - 2*MARGIN) / (bbox[2] - bbox[0] + 1), (globals.height - 2*MARGIN) / (bbox[3] - bbox[1] + 1)) / 16;
+	bbox[0] *= 16;
+	bbox[1] *= 16;
+
+	nvgBeginPath(vg);
+	nvgFillColorRGBA8(vg, "\0\0\0\x7f");
+	nvgRect(vg, 0, 0, globals.width, globals.height);
+	nvgFill(vg);
+	for (i = 0; i < grid.max; i ++)
+	{
+		GridCell cell = grid.cells + i;
+		Entity   item;
+		if (cell->count < 0) continue;
+		nvgStrokeColorRGBA8(vg, cell->count > 0 ? "\x20\x88\x20\xff" : "\xff\x20\x20\xff");
+		nvgBeginPath(vg);
+		nvgRect(vg, (cell->X * 16 - bbox[0]) * scale + MARGIN, (cell->Z * 16 - bbox[1]) * scale + MARGIN, 16 * scale, 16 * scale);
+		nvgStroke(vg);
+
+		nvgStrokeColorRGBA8(vg, "\xff\xff\xff\xff");
+		for (item = cell->items; item; item = item->gnext)
+		{
+			float SX = item->szx * ENTITY_SCALE(item);
+			float SZ = item->szz * ENTITY_SCALE(item);
+			nvgBeginPath(vg);
+			nvgRect(vg, (item->pos[VX] - SX - bbox[0]) * scale + MARGIN, (item->pos[VZ] - SZ - bbox[1]) * scale + MARGIN,
+				SX * 2 * scale, SZ * 2 * scale);
+			nvgStroke(vg);
+		}
+	}
+}
+
+/*
+ * benchmark: insert, move, query and delete lots of entities, with this grid and with the quad tree it
+ * replaced (quadtree.c). Results are dumped on stderr.
+ */
+#define BENCH_ENTITIES     10000
+#define BENCH_FRAMES       100
+#define BENCH_AREA         512
+
+static uint32_t benchSeed;
+
+static float entityGridBenchRand(float min, float max)
+{
+	/* xorshift: same sequence for both runs */
+	benchSeed ^= benchSeed << 13;
+	benchSeed ^= benchSeed >> 17;
+	benchSeed ^= benchSeed << 5;
+	return min + (benchSeed & 0xffffff) * (max - min) / 0x1000000;
+}
+
+static void entityGridBenchRun(Entity list, Bool quadTree)
+{
+	static STRPTR names[] = {"grid", "quad tree"};
+	float  bbox[6];
+	double time[4];
+	int    i, frame, found;
+
+	/* same entities for both */
+	benchSeed = 1;
+	memset(list, 0, BENCH_ENTITIES * sizeof *list);
+	for (i = 0; i < BENCH_ENTITIES; i ++)
+	{
+		Entity item = list + i;
+		item->pos[VX] = entityGridBenchRand(0, BENCH_AREA);
+		item->pos[VY] = entityGridBenchRand(60, 80);
+		item->pos[VZ] = entityGridBenchRand(0, BENCH_AREA);
+		item->szx = item->szz = entityGridBenchRand(0.25f, 1) * BASEVTX;
+		item->szy = entityGridBenchRand(0.25f, 2) * BASEVTX;
+		item->rotation[3] = 1;
+		item->enflags = ENFLAG_HASBBOX;
+	}
+
+	if (quadTree) quadTreeInit(0, 0, BENCH_AREA);
+	time[0] = FrameGetTime();
+	for (i = 0; i < BENCH_ENTITIES; i ++)
+	{
+		if (quadTree) quadTreeInsertItem(list + i);
+		else          entityGridInsert(list + i);
+	}
+	time[0] = FrameGetTime() - time[0];
+
+	for (frame = found = 0, time[1] = time[2] = 0; frame < BENCH_FRAMES; frame ++)
+	{
+		double start = FrameGetTime();
+		for (i = 0; i < BENCH_ENTITIES; i ++)
+		{
+			Entity item = list + i;
+			item->pos[VX] += entityGridBenchRand(-0.5f, 0.5f);
+			item->pos[VZ] += entityGridBenchRand(-0.5f, 0.5f);
+			if (quadTree) quadTreeChangePos(item);
+			else          entityGridMove(item);
+		}
+		time[1] += FrameGetTime() - start;
+
+		/* collision check of every entity against its surroundings */
+		start = FrameGetTime();
+		for (i = 0; i < BENCH_ENTITIES; i ++)
+		{
+			Entity item = list + i;
+			int    count;
+			bbox[VX] = item->pos[VX] - 1; bbox[VX+3] = item->pos[VX] + 1;
+			bbox[VY] = item->pos[VY] - 1; bbox[VY+3] = item->pos[VY] + 1;
+			bbox[VZ] = item->pos[VZ] - 1; bbox[VZ+3] = item->pos[VZ] + 1;
+			if (quadTree) quadTreeIntersect(bbox, &count, ENFLAG_HASBBOX);
+			else          entityGridIntersect(bbox, &count, ENFLAG_HASBBOX);
+			found += count;
+		}
+		time[2] += FrameGetTime() - start;
+	}
+
+	time[3] = FrameGetTime();
+	for (i = 0; i < BENCH_ENTITIES; i ++)
+	{
+		if (quadTree) quadTreeDeleteItem(list + i);
+		else          entityGridDelete(list + i);
+	}
+	time[3] = FrameGetTime() - time[3];
+	if (quadTree) quadTreeClear();
+
+	fprintf(stderr, "bench %s: %d inserts in %.1f ms, %d moves in %.1f ms, %d queries in %.1f ms (%d found), %d deletes in %.1f ms\n",
+		names[quadTree], BENCH_ENTITIES, time[0], BENCH_ENTITIES * BENCH_FRAMES, time[1], BENCH_ENTITIES * BENCH_FRAMES, time[2],
+		found, BENCH_ENTITIES, time[3]);
+}
+
+void entityGridBenchmark(void)
+{
+	Entity list = malloc(BENCH_ENTITIES * sizeof *list);
+
+	if (list)
+	{
+		/* grid is used by current map: work on an empty one */
+		struct EntityGrid_t saved = grid;
+		memset(&grid, 0, sizeof grid);
+		entityGridBenchRun(list, False);
+		entityGridClear();
+		grid = saved;
+
+		entityGridBenchRun(list, True);
+		free(list);
+	}
+}
+#endif
@@ -66,16 +66,22 @@ typedef struct MCGlobals_t
 	uint8_t guiScale;         /* [50-200] % */
 	uint8_t brightness;       /* [0-101] => map [0-100] to ambient values [0.2 - 0.4], 101 means full brightness */
 	uint8_t renderDist;       /* in chunks */
+	uint8_t entityDist;       /* in chunks: entities are only decoded up to that distance (0 = render distance) */
 	uint8_t distanceFOG;      /* 1 = use fog, 0 = don't */
 	uint8_t showPreview;      /* 1 = show preview block, 0 = outline only */
 	uint8_t lockMouse;        /* 1 = mouse lock within window, 0 = free mouse */
 	uint8_t fullScreen;       /* 0 = window, 1 = full screen, 2 = auto full-screen */
 	int     fullScrWidth;     /* full screen resolution */
 	int     fullScrHeight;
+	int     undoMaxMem;       /* in MB: older undo buffers are moved to a temp file above that (0 = no limit) */
+	int     autoSelectMax;    /* max blocks auto-select will flood through */
 
 	/* if world is being edited */
 	int modifCount;
 
+	/* collect simulation cost per chunk (see debugProfStart()) */
+	uint8_t profiling;
+
 	/* Uniform Buffer Object used by all shaders */
 	int uboShader;
 
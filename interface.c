@@ -34,6 +34,7 @@
 #include "undoredo.h"
 #include "mcedit.h"
 #include "globals.h"
+#include "lighting.h"
 
 static struct MCInterface_t mcui;
 static struct MCInventory_t selfinv = {.invRow = 3, .invCol = MAXCOLINV, .groupId = 1, .itemsNb = MAXCOLINV * 3};
@@ -1012,15 +1013,13 @@ void mcuiAnalyze(void)
 	SIT_AddCallback(SIT_GetById(diag, "save"), SITE_OnActivate, mcuiCopyAnalyze, &tiles);
 	SIT_AddCallback(diag, SITE_OnFinalize, mcuiClearAnalyze, &tiles);
 
-	int  dx, dy, dz, i, j;
+	int  dx, dz, i, j;
 	vec  points = selectionGetPoints();
 	vec4 pos = {
 		fminf(points[VX], points[VX+4]),
 		fminf(points[VY], points[VY+4]),
 		fminf(points[VZ], points[VZ+4])
 	};
-	dx = fabsf(points[VX] - points[VX+4]) + 1;
-	dy = fabsf(points[VY] - points[VY+4]) + 1;
 	dz = fabsf(points[VZ] - points[VZ+4]) + 1;
 
 	Block block;
@@ -1035,53 +1034,71 @@ void mcuiAnalyze(void)
 		block->invType = i;
 
 	int * statistics = calloc(blockLast - blockStates, sizeof (int));
+	DATA32 histo = selectionHistogram();
+	for (i = 0; histo && i < 4096; i ++)
+	{
+		if (histo[i] == 0) continue;
+		BlockState b = blockGetById(i);
+		if (b->id == 0) continue;
+		uint16_t id = b->id;
+		uint8_t data = id & 15;
+		/* check if we can use alternative block state */
+		block = &blockIds[id >> 4];
+		switch (block->orientHint) {
+		case ORIENT_LOG:
+			if (4 <= data && data < 12) id -= data & ~3;
+			break;
+		case ORIENT_SLAB:
+			id -= data & ~7;
+			break;
+		case ORIENT_BED:
+		case ORIENT_LEVER:
+		case ORIENT_SNOW:
+		case ORIENT_TORCH:
+		case ORIENT_FULL:
+		case ORIENT_RAILS:
+		case ORIENT_STAIRS:
+		case ORIENT_NSWE:
+			id -= data;
+			if (id == ID(RSTORCH_OFF, 0))
+				id = ID(RSTORCH_ON, 0);
+			break;
+		case ORIENT_SWNE:
+			id -= data & 3;
+			break;
+		case ORIENT_DOOR:
+			if (data >= 8) continue;
+			id -= data;
+			break;
+		default:
+			if (block->special == BLOCK_RSWIRE)
+				id -= data;
+		}
+		b = blockGetById(id);
+		statistics[b - blockStates] += histo[i];
+	}
+	free(histo);
+
+	/* check if there are items we might want to inspect in containers */
 	struct BlockIter_t iter;
-	for (mapInitIter(globals.level, &iter, pos, False); dy > 0; dy --)
+	int range[6];
+	selectionGetRange(range, False);
+	for (pos[VZ] = range[VZ] & ~15; pos[VZ] < range[VZ+3]; pos[VZ] += 16)
 	{
-		for (j = 0; j < dz; j ++, mapIter(&iter, -dx, 0, 1))
+		for (pos[VX] = range[VX] & ~15; pos[VX] < range[VX+3]; pos[VX] += 16)
 		{
-			for (i = 0; i < dx; i ++, mapIter(&iter, 1, 0, 0))
+			Chunk c = mapGetChunk(globals.level, pos);
+			int   offset = 0, XYZ[3];
+			DATA8 tile;
+			if (c == NULL) continue;
+			while ((tile = chunkIterTileEntity(c, XYZ, &offset)))
 			{
-				BlockState b = blockGetById(getBlockId(&iter));
-				if (b->id == 0) continue;
-				uint16_t id = b->id;
-				uint8_t data = id & 15;
-				/* check if we can use alternative block state */
-				block = &blockIds[id >> 4];
-				switch (block->orientHint) {
-				case ORIENT_LOG:
-					if (4 <= data && data < 12) id -= data & ~3;
-					break;
-				case ORIENT_SLAB:
-					id -= data & ~7;
-					break;
-				case ORIENT_BED:
-				case ORIENT_LEVER:
-				case ORIENT_SNOW:
-				case ORIENT_TORCH:
-				case ORIENT_FULL:
-				case ORIENT_RAILS:
-				case ORIENT_STAIRS:
-				case ORIENT_NSWE:
-					id -= data;
-					if (id == ID(RSTORCH_OFF, 0))
-						id = ID(RSTORCH_ON, 0);
-					break;
-				case ORIENT_SWNE:
-					id -= data & 3;
-					break;
-				case ORIENT_DOOR:
-					if (data >= 8) continue;
-					id -= data;
-					break;
-				default:
-					if (block->special == BLOCK_RSWIRE)
-						id -= data;
-				}
-				b = blockGetById(id);
-				DATA8 tile;
-				/* check if there are items we might want to inspect in this block */
-				if (block->invType > 0 && (tile = chunkGetTileEntity(iter.cd, iter.offset)))
+				if (XYZ[VX] < range[VX] || XYZ[VX] >= range[VX+3] ||
+				    XYZ[VY] < range[VY] || XYZ[VY] >= range[VY+3] ||
+				    XYZ[VZ] < range[VZ] || XYZ[VZ] >= range[VZ+3]) continue;
+				mapInitIter(globals.level, &iter, (vec4) {XYZ[VX], XYZ[VY], XYZ[VZ]}, False);
+				block = &blockIds[iter.blockIds[iter.offset]];
+				if (block->invType > 0)
 				{
 					NBTFile_t nbt = {.mem = tile};
 					int items = NBT_FindNode(&nbt, 0, "Items");
@@ -1092,10 +1109,8 @@ void mcuiAnalyze(void)
 							storeTileEntity(&tiles, block->invType, tile);
 					}
 				}
-				statistics[b - blockStates] ++;
 			}
 		}
-		mapIter(&iter, 0, 1, -dz);
 	}
 
 	/* build list of items */
@@ -1827,7 +1842,6 @@ static Bool mcuiPaintingsFindLocation(vec4 ret)
 
 				/* also check that there are no entities in the area */
 				float bbox[6], tmp;
-				int   count;
 				memcpy(bbox, ret, 12);
 				bbox[VX] += normal[VX];
 				bbox[VY] += normal[VY];
@@ -1837,8 +1851,7 @@ static Bool mcuiPaintingsFindLocation(vec4 ret)
 				bbox[VY+3] = bbox[VY] + tileH;
 				if (bbox[VX] > bbox[VX+3]) swap_tmp(bbox[VX], bbox[VX+3], tmp);
 				if (bbox[VZ] > bbox[VZ+3]) swap_tmp(bbox[VZ], bbox[VZ+3], tmp);
-				quadTreeIntersect(bbox, &count, ENFLAG_ANYENTITY);
-				if (count == 0)
+				if (entityGridQuery(bbox, ENFLAG_ANYENTITY, NULL, 0) == 0)
 					return True;
 			}
 		}
@@ -2267,8 +2280,100 @@ void mcuiWorldInfo(void)
 }
 
 /*
- * Filter interface: TODO
+ * Filter interface: recompute light of selection or entire world
  */
+static struct
+{
+	SIT_Widget  prog, result, ok, ko;
+	SIT_Action  asyncCheck;
+	int         allRegions;
+	struct LightingWorld_t world;
+}	mcuiRelight;
+
+static void mcuiRelightResult(int chunks, double timeMS)
+{
+	TEXT msg[128];
+	sprintf(msg, LANG("%d chunks in %.1f ms (%.0f chunks/s)"), chunks, timeMS, timeMS > 0 ? chunks * 1000 / timeMS : 0);
+	SIT_SetValues(mcuiRelight.result, SIT_Title, msg, NULL);
+}
+
+/* timer: monitor thread started by lightingRelightWorld() */
+static int mcuiRelightProgress(SIT_Widget w, APTR cd, APTR ud)
+{
+	LightingWorld world = &mcuiRelight.world;
+	if (world->done)
+	{
+		/* chunks loaded in the editor have been skipped: relight them in memory (will be saved with the rest) */
+		double start = FrameGetTime();
+		if (mapUpdateRelightArea(globals.level, NULL) > 0)
+			renderAddModif();
+		free(world->skip);
+		world->skip = NULL;
+		mcuiRelight.asyncCheck = NULL;
+		mcuiRelightResult(world->chunks, world->elapsed + FrameGetTime() - start);
+		SIT_SetValues(mcuiRelight.prog, SIT_Visible, False, NULL);
+		SIT_SetValues(mcuiRelight.ok, SIT_Enabled, True, NULL);
+		SIT_SetValues(mcuiRelight.ko, SIT_Title, LANG("Close"), NULL);
+		return -1;
+	}
+	if (world->regions > 0)
+		SIT_SetValues(mcuiRelight.prog, SIT_Visible, True, SIT_ProgressPos, world->regionDone * 100 / world->regions, NULL);
+	return 0;
+}
+
+/* OnActivate on "relight" button */
+static int mcuiRelightStart(SIT_Widget w, APTR cd, APTR ud)
+{
+	Map map = globals.level;
+	if (mcuiRelight.allRegions)
+	{
+		/* chunks in memory might have been modified: don't overwrite them on disk */
+		LightingWorld world = &mcuiRelight.world;
+		int max = map->mapArea * map->mapArea;
+		world->skip = malloc(max * 2 * sizeof (int));
+		world->skipCount = 0;
+		world->path = map->path;
+		world->cancel = 0;
+		if (world->skip)
+		{
+			Chunk c;
+			for (c = map->chunks; max > 0; max --, c ++)
+			{
+				/* must be the same columns mapUpdateRelightArea() will relight in memory */
+				if ((c->cflags & CFLAG_GOTDATA) == 0) continue;
+				world->skip[world->skipCount*2]   = c->X;
+				world->skip[world->skipCount*2+1] = c->Z;
+				world->skipCount ++;
+			}
+		}
+		lightingRelightWorld(world);
+		SIT_SetValues(w, SIT_Enabled, False, NULL);
+		SIT_SetValues(mcuiRelight.ko, SIT_Title, LANG("Cancel"), NULL);
+		SIT_SetValues(mcuiRelight.result, SIT_Title, "", NULL);
+		mcuiRelight.asyncCheck = SIT_ActionAdd(w, globals.curTimeUI, globals.curTimeUI + 1e9, mcuiRelightProgress, NULL);
+	}
+	else
+	{
+		int    range[6];
+		double start = FrameGetTime();
+		selectionGetRange(range, False);
+		int    count = mapUpdateRelightArea(map, range);
+		if (count > 0) renderAddModif();
+		mcuiRelightResult(count, FrameGetTime() - start);
+	}
+	return 1;
+}
+
+/* OnActivate on cancel/close button */
+static int mcuiRelightStop(SIT_Widget w, APTR cd, APTR ud)
+{
+	if (mcuiRelight.asyncCheck)
+		/* stop after current region */
+		mcuiRelight.world.cancel = 1;
+	else
+		SIT_Exit(EXIT_LOOP);
+	return 1;
+}
 
 void mcuiFilter(void)
 {
@@ -2277,14 +2382,27 @@ void mcuiFilter(void)
 		NULL
 	);
 
+	Bool hasSel = selectionHasPoints() > 0;
+	mcuiRelight.allRegions = ! hasSel;
+
 	SIT_CreateWidgets(diag,
-		"<label name=dlgtitle#title title='Filter blocks:' left=FORM right=FORM>"
-		"<label name=todo title='TODO...' top=WIDGET,#LAST,1em>"
-		"<button name=ko.act title=Cancel top=WIDGET,#LAST,1em right=FORM buttonType=", SITV_CancelButton, ">"
-		"<button name=ok.act title=Filter top=OPPOSITE,ko right=WIDGET,ko,1em buttonType=", SITV_DefaultButton, ">"
+		"<label name=dlgtitle#title title=", LANG("Recompute sky and block light of:"), "left=FORM right=FORM>"
+		"<button name=sel title=", LANG("Selection"), "enabled=", hasSel, "curValue=", &mcuiRelight.allRegions,
+		" buttonType=", SITV_RadioButton, "radioID=0 top=WIDGET,#LAST,0.5em>"
+		"<button name=all title=", LANG("All region files (modified on disk)"), "curValue=", &mcuiRelight.allRegions,
+		" buttonType=", SITV_RadioButton, "radioID=1 top=WIDGET,#LAST,0.3em>"
+		"<label name=result title='' left=FORM right=FORM top=WIDGET,#LAST,0.5em>"
+		"<button name=ko.act title=", LANG("Close"), "top=WIDGET,#LAST,1em right=FORM buttonType=", SITV_CancelButton, ">"
+		"<button name=ok.act title=", LANG("Relight"), "top=OPPOSITE,ko right=WIDGET,ko,1em buttonType=", SITV_DefaultButton, ">"
+		"<progress name=prog visible=0 title='%d%%' left=FORM right=WIDGET,ok,1em top=MIDDLE,ok>"
 	);
 
-	SIT_AddCallback(SIT_GetById(diag, "ko"), SITE_OnActivate, mcuiExitWnd, NULL);
+	mcuiRelight.prog   = SIT_GetById(diag, "prog");
+	mcuiRelight.result = SIT_GetById(diag, "result");
+	mcuiRelight.ok     = SIT_GetById(diag, "ok");
+	mcuiRelight.ko     = SIT_GetById(diag, "ko");
+	SIT_AddCallback(mcuiRelight.ko, SITE_OnActivate, mcuiRelightStop, NULL);
+	SIT_AddCallback(mcuiRelight.ok, SITE_OnActivate, mcuiRelightStart, NULL);
 
 	SIT_ManageWidget(diag);
 }
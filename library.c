@@ -26,7 +26,7 @@
 
 static struct MCLibrary_t library;
 
-static Bool librarySaveAsStream(Map brush);
+static Bool librarySaveAsStream(Map brush, Bool withTables);
 static Map libraryNBTToBrush(NBTFile);
 
 /* SITE_OnActivate on "Save" button */
@@ -252,7 +252,7 @@ static int libraryExport(SIT_Widget w, APTR cd, APTR ud)
 		return 0;
 	}
 
-	if (librarySaveAsStream(map = brush->data))
+	if (librarySaveAsStream(map = brush->data, True))
 	{
 		/* compress the stream with zlib (using deflate method, not gzip) */
 		int   bytes;
@@ -414,31 +414,139 @@ static Bool GetTilePosition(int * XYZ, DATA8 tile)
 	return flags == 7;
 }
 
+/*
+ * Blocks and Data tables of schematics are stored XZY, like chunks: copy one row along X to or from
+ * the brush (there is a 1 block border of air around brush).
+ */
+static void libraryCopyRow(Map brush, DATA8 row, int y, int z, int flags)
+{
+	int chunkX = (brush->size[VX] + 15) >> 4;
+	int x, i, n, max;
+
+	for (x = 1, max = brush->size[VX] - 1; x < max; x += n, row += n)
+	{
+		ChunkData cd  = brush->chunks[(x >> 4) + (z >> 4) * chunkX].layer[y >> 4];
+		int       pos = CHUNK_BLOCK_POS(x & 15, z & 15, y & 15);
+		DATA8     blocks = cd->blockIds;
+		n = MIN(16 - (x & 15), max - x);
+		switch (flags) {
+		case LIB_TOBRUSH:
+			memcpy(blocks + pos, row, n);
+			break;
+		case LIB_TOBRUSH | LIB_DATA:
+			for (i = 0; i < n; i ++, pos ++)
+				blocks[DATA_OFFSET + (pos >> 1)] |= pos & 1 ? row[i] << 4 : row[i] & 15;
+			break;
+		case 0:
+			memcpy(row, blocks + pos, n);
+			break;
+		case LIB_DATA:
+			for (i = 0; i < n; i ++, pos ++)
+			{
+				uint8_t state = blocks[DATA_OFFSET + (pos >> 1)];
+				row[i] = pos & 1 ? state >> 4 : state & 15;
+			}
+		}
+	}
+}
+
+/* callback for NBT_ParseStream(): read Blocks and Data in slabs straight into brush */
+static int libraryReadArray(NBTFile nbt, int offset, int bytes, NBTStream in, APTR ud)
+{
+	LibBrush lib  = ud;
+	STRPTR   name = NBT_Hdr(nbt, offset)->name;
+	int      flags, size[3], rows, slab, read, y, z;
+	DATA8    buffer, row;
+	Map      brush;
+
+	if (strcasecmp(name, "Blocks") == 0) flags = LIB_TOBRUSH; else
+	if (strcasecmp(name, "Data") == 0)   flags = LIB_TOBRUSH | LIB_DATA;
+	else return -1;
+
+	if (lib->data == NULL)
+	{
+		/* dimensions are usually stored before tables (if not, schematic will be read the old way) */
+		size[VX] = NBT_GetInt(nbt, NBT_FindNode(nbt, 0, "/Width"),  0);
+		size[VY] = NBT_GetInt(nbt, NBT_FindNode(nbt, 0, "/Height"), 0);
+		size[VZ] = NBT_GetInt(nbt, NBT_FindNode(nbt, 0, "/Length"), 0);
+		if (size[VX] <= 0 || size[VY] <= 0 || size[VZ] <= 0 || bytes < size[VX] * size[VY] * size[VZ])
+			return -1;
+		lib->data = selectionAllocBrush((uint16_t[3]){size[VX]+2, size[VY]+2, size[VZ]+2});
+		if (lib->data == NULL) return -1;
+	}
+	brush = lib->data;
+	size[VX] = brush->size[VX] - 2;
+	size[VY] = brush->size[VY] - 2;
+	size[VZ] = brush->size[VZ] - 2;
+	if (bytes < size[VX] * size[VY] * size[VZ])
+	{
+		/* table smaller than other one: schematic is truncated */
+		lib->readError = 1;
+		return 0;
+	}
+
+	/* never hold the entire table in memory */
+	rows = MAX(LIB_SLAB / size[VX], 1);
+	buffer = malloc(rows * size[VX]);
+	if (buffer == NULL)
+	{
+		/* payload will be skipped: load must be aborted */
+		lib->readError = 1;
+		return 0;
+	}
+
+	for (y = 1, slab = read = 0, row = buffer; y <= size[VY]; y ++)
+	{
+		for (z = 1; z <= size[VZ]; z ++, slab --, row += size[VX])
+		{
+			if (slab == 0)
+			{
+				int left = (size[VY] - y) * size[VZ] + size[VZ] - z + 1;
+				slab = MIN(rows, left);
+				if (NBT_StreamRead(in, row = buffer, slab * size[VX]) != slab * size[VX])
+					goto error;
+				read += slab * size[VX];
+			}
+			libraryCopyRow(brush, row, y, z, flags);
+		}
+	}
+	error:
+	/* short read: load must be aborted */
+	if (read < size[VX] * size[VY] * size[VZ])
+		lib->readError = 1;
+	free(buffer);
+	return read;
+}
+
 /* parse an MCEdit v1 schematics: it is a simple dump of BlockIds and Data table */
 static Bool libraryParseSchematics(LibBrush lib, DATA16 size)
 {
-	int x, y, z;
+	struct BlockIter_t iter;
+	int x, y = 0, z = 0;
+	Map brush = lib->data;
+
+	/* tables that have not been streamed into brush (clipboard or dimensions stored after tables) */
 	DATA8 block = NBT_ArrayStart(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Blocks"), &z);
 	DATA8 data  = NBT_ArrayStart(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Data"),   &y);
+	x = size[VX] * size[VY] * size[VZ];
+	if (z < x) block = NULL;
+	if (y < x) data  = NULL;
 
-	if (! block || ! data || y < z || z < size[VX] * size[VY] * size[VZ]) return False;
-	Map brush = selectionAllocBrush((uint16_t[3]){size[VX]+2, size[VY]+2, size[VZ]+2});
-	if (! brush) return False;
+	if (brush == NULL)
+	{
+		if (! block || ! data) return False;
+		brush = selectionAllocBrush((uint16_t[3]){size[VX]+2, size[VY]+2, size[VZ]+2});
+		if (! brush) return False;
+	}
 
 	/* pretty straitforward forward */
-	struct BlockIter_t iter;
-	mapInitIterOffset(&iter, brush->firstVisible, 256+16+1);
-	iter.nbor = brush->chunkOffsets;
-	for (y = size[VY]; y > 0; y --, mapIter(&iter, 0, 1, -size[VZ]))
+	if (block || data)
+	for (y = 1; y <= size[VY]; y ++)
 	{
-		for (z = size[VZ]; z > 0; z --, mapIter(&iter, -size[VX], 0, 1))
+		for (z = 1; z <= size[VZ]; z ++)
 		{
-			for (x = size[VX]; x > 0; x --, block ++, data ++, mapIter(&iter, 1, 0, 0))
-			{
-				uint8_t state = data[0];
-				iter.blockIds[iter.offset] = block[0];
-				iter.blockIds[DATA_OFFSET + (iter.offset>>1)] |= iter.offset & 1 ? state << 4 : state;
-			}
+			if (block) libraryCopyRow(brush, block, y, z, LIB_TOBRUSH), block += size[VX];
+			if (data)  libraryCopyRow(brush, data,  y, z, LIB_TOBRUSH | LIB_DATA), data += size[VX];
 		}
 	}
 
@@ -479,8 +587,8 @@ static Map libraryNBTToBrush(NBTFile nbt)
 }
 
 
-/* save brush as a MCEdit v1 schematic file */
-static Bool librarySaveAsStream(Map brush)
+/* save brush as a MCEdit v1 schematic file (<withTables> == False: Blocks and Data will be written by libraryWriteArray()) */
+static Bool librarySaveAsStream(Map brush, Bool withTables)
 {
 	NBTFile_t nbt = {.page = 511};
 	int size[] = {brush->size[VX] - 2,
@@ -495,39 +603,45 @@ static Bool librarySaveAsStream(Map brush)
 			TAG_Short, "Length", size[VZ],
 			TAG_Short, "Height", size[VY],
 			TAG_String, "Materials", "Alpha",
-			TAG_Byte_Array, "Blocks", bytes, 0,
-			TAG_Byte_Array, "Data", bytes, 0,
+			TAG_Byte_Array, "Blocks", withTables ? bytes : 0, 0,
+			TAG_Byte_Array, "Data", withTables ? bytes : 0, 0,
 			TAG_List_Compound, "TileEntities", 0, /* count will be filled later */
 			TAG_End
 	);
 	int TE = NBT_FindNode(&nbt, 0, "TileEntities");
+	int x, y, z;
 
-	/* Blocks and Data table are empty: need to copy them from brush to NBT */
-	struct BlockIter_t iter;
-	int x, y, z, blocks, data;
-	mapInitIterOffset(&iter, brush->firstVisible, 256+16+1);
-	blocks = (DATA8) NBT_Payload(&nbt, NBT_FindNode(&nbt, 0, "Blocks")) - nbt.mem;
-	data   = (DATA8) NBT_Payload(&nbt, NBT_FindNode(&nbt, 0, "Data")) - nbt.mem;
+	if (withTables)
+	{
+		/* Blocks and Data table are empty: need to copy them from brush to NBT */
+		DATA8 blocks = NBT_Payload(&nbt, NBT_FindNode(&nbt, 0, "Blocks"));
+		DATA8 data   = NBT_Payload(&nbt, NBT_FindNode(&nbt, 0, "Data"));
+
+		for (y = 1; y <= size[VY]; y ++)
+		{
+			for (z = 1; z <= size[VZ]; z ++, blocks += size[VX], data += size[VX])
+			{
+				libraryCopyRow(brush, blocks, y, z, 0);
+				libraryCopyRow(brush, data,   y, z, LIB_DATA);
+			}
+		}
+	}
 
-	/* stored XZY, like chunks */
-	for (y = size[VY]; y > 0; y --, mapIter(&iter, 0, 1, -size[VZ]))
+	/* tile entities: only need to scan the hash table of each chunk */
+	Chunk chunk = brush->chunks;
+	for (z = (brush->size[VZ] + 15) >> 4; z > 0; z --)
 	{
-		for (z = size[VZ]; z > 0; z --, mapIter(&iter, -size[VX], 0, 1))
+		for (x = (brush->size[VX] + 15) >> 4; x > 0; x --, chunk ++)
 		{
-			for (x = size[VX]; x > 0; x --, mapIter(&iter, 1, 0, 0), blocks ++, data ++)
+			DATA8 tile;
+			int   XYZ[3];
+			for (y = 0; (tile = chunkIterTileEntity(chunk, XYZ, &y)); )
 			{
-				uint8_t state = iter.blockIds[DATA_OFFSET + (iter.offset >> 1)];
-				nbt.mem[blocks] = iter.blockIds[iter.offset];
-				nbt.mem[data]   = iter.offset & 1 ? state >> 4 : state & 15;
-				DATA8 tile = chunkGetTileEntity(iter.cd, iter.offset);
-				if (tile)
-				{
-					NBTIter_t iterTE;
-					NBT_IterCompound(&iterTE, tile);
-					for (tileNb ++; (bytes = NBT_Iter(&iterTE)) >= 0; )
-						NBT_Add(&nbt, TAG_Raw_Data, NBT_HdrSize(tile+bytes), tile+bytes, TAG_End);
-					NBT_Add(&nbt, TAG_Compound_End);
-				}
+				NBTIter_t iterTE;
+				NBT_IterCompound(&iterTE, tile);
+				for (tileNb ++; (bytes = NBT_Iter(&iterTE)) >= 0; )
+					NBT_Add(&nbt, TAG_Raw_Data, NBT_HdrSize(tile+bytes), tile+bytes, TAG_End);
+				NBT_Add(&nbt, TAG_Compound_End);
 			}
 		}
 	}
@@ -546,11 +660,51 @@ static Bool librarySaveAsStream(Map brush)
  * user's library interface
  */
 
+/* callback for NBT_SaveStream(): write Blocks and Data in slabs straight from brush */
+static int libraryWriteArray(NBTFile nbt, int offset, int bytes, NBTStream out, APTR ud)
+{
+	Map    brush = ud;
+	STRPTR name  = NBT_Hdr(nbt, offset)->name;
+	int    flags, rows, slab, y, z;
+	int    size[] = {brush->size[VX] - 2, brush->size[VY] - 2, brush->size[VZ] - 2};
+	DATA8  buffer, row;
+
+	if (strcasecmp(name, "Blocks") == 0) flags = 0; else
+	if (strcasecmp(name, "Data") == 0)   flags = LIB_DATA;
+	else return -1;
+
+	/* first call: only want the size */
+	if (out == NULL)
+		return size[VX] * size[VY] * size[VZ];
+
+	rows = MAX(LIB_SLAB / size[VX], 1);
+	buffer = malloc(rows * size[VX]);
+	if (buffer == NULL) return 0;
+
+	for (y = 1, slab = 0, row = buffer; y <= size[VY]; y ++)
+	{
+		for (z = 1; z <= size[VZ]; z ++)
+		{
+			libraryCopyRow(brush, row, y, z, flags);
+			row += size[VX];
+			slab ++;
+			if (slab == rows || (y == size[VY] && z == size[VZ]))
+			{
+				NBT_StreamWrite(out, buffer, slab * size[VX]);
+				row = buffer;
+				slab = 0;
+			}
+		}
+	}
+	free(buffer);
+	return bytes;
+}
+
 static Bool librarySaveSchematics(Map brush, STRPTR path)
 {
-	if (librarySaveAsStream(brush))
+	if (librarySaveAsStream(brush, False))
 	{
-		int bytes = NBT_Save(&brush->levelDat, path, NULL, NULL);
+		int bytes = NBT_SaveStream(&brush->levelDat, path, libraryWriteArray, brush);
 		NBT_Free(&brush->levelDat);
 		memset(&brush->levelDat, 0, sizeof brush->levelDat);
 		return bytes > 0;
@@ -560,20 +714,31 @@ static Bool librarySaveSchematics(Map brush, STRPTR path)
 
 static Bool libraryExtractThumb(LibBrush lib, STRPTR path, DATA16 size)
 {
-	if (NBT_Parse(&lib->nbt, path))
+	/* Blocks and Data will be read directly into lib->data */
+	lib->readError = 0;
+	if (NBT_ParseStream(&lib->nbt, path, libraryReadArray, lib))
 	{
-		/* seems to be a valid NBT, check if it is a schematics */
-		size[VY] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Height"), 0);
-		size[VZ] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Length"), 0);
-		size[VX] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Width"), 0);
-		if (size[VY] > 0 && size[VZ] > 0 && size[VX] > 0)
+		if (lib->readError)
 		{
-			lib->nvgFBO = nvgluCreateFramebuffer(globals.nvgCtx, lib->thumbSz, lib->thumbSz, NVG_IMAGE_DEPTH);
-
-			if (libraryParseSchematics(lib, size))
+			/* truncated Blocks/Data table: don't show a partial brush */
+			selectionFreeBrush(lib->data);
+			lib->data = NULL;
+		}
+		else
+		{
+			/* seems to be a valid NBT, check if it is a schematics */
+			size[VY] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Height"), 0);
+			size[VZ] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Length"), 0);
+			size[VX] = NBT_GetInt(&lib->nbt, NBT_FindNode(&lib->nbt, 0, "Width"), 0);
+			if (size[VY] > 0 && size[VZ] > 0 && size[VX] > 0)
 			{
-				libraryGenMesh(lib);
-				libraryGenThumb(lib);
+				lib->nvgFBO = nvgluCreateFramebuffer(globals.nvgCtx, lib->thumbSz, lib->thumbSz, NVG_IMAGE_DEPTH);
+
+				if (libraryParseSchematics(lib, size))
+				{
+					libraryGenMesh(lib);
+					libraryGenThumb(lib);
+				}
 			}
 		}
 		/* not needed anymore */
@@ -22,6 +22,14 @@ typedef struct NVGLUframebuffer *  NVGFBO;
 
 void libraryFreeBrush(LibBrush);
 
+#define LIB_SLAB            (256 * 1024)   /* max bytes of Blocks/Data tables in memory while streaming */
+
+enum /* <flags> for libraryCopyRow() */
+{
+	LIB_TOBRUSH = 1,                /* row -> brush (otherwise brush -> row) */
+	LIB_DATA    = 2                 /* Data table, instead of Blocks */
+};
+
 struct MCLibrary_t
 {
 	ListHead   brushes;         /* LibBrush */
@@ -44,6 +52,7 @@ struct LibBrush_t
 	int        size;            /* in bytes */
 	uint16_t   thumbSz;         /* in px */
 	uint8_t    staticStruct;    /* LibBrush cannot be free()'ed */
+	uint8_t    readError;       /* Blocks/Data could not be streamed entirely: schematic is truncated */
 	NVGFBO     nvgFBO;          /* preview of brush */
 	NBTFile_t  nbt;             /* if brush has been read from a schematic file */
 };
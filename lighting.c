@@ -0,0 +1,562 @@
+/*
+ * lighting.c: recompute SkyLight, BlockLight and HeightMap tables of entire columns from scratch.
+ *
+ * mapUpdate.c does this incrementally, which is fine for a single block, but a bulk edit (fill,
+ * replace, ...) would relight the same area thousands of times. Here, columns are first processed
+ * independently (and in parallel): heightmap, direct skylight and flood fill of light within the
+ * column. Then a second pass (single threaded) will spread light across column boundaries.
+ */
+
+#define LIGHTING_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lighting.h"
+#include "render.h"
+
+static struct LightingPrivate_t lighting;
+
+extern uint8_t  slotsXZ[]; /* from chunkMesh.c */
+extern uint8_t  slotsY[];
+extern uint32_t chunkNearby[];
+
+static inline int lightingGet(Chunk c, int pos, int table)
+{
+	int y = pos >> 8;
+	if (y >= c->maxy * 16)
+		/* above last sub-chunk: implicit air */
+		return table == SKYLIGHT_OFFSET ? MAXSKY : 0;
+
+	uint8_t val = c->layer[y >> 4]->blockIds[table + ((pos & 4095) >> 1)];
+	return pos & 1 ? val >> 4 : val & 15;
+}
+
+static inline void lightingSet(DATA8 table, int off, int val)
+{
+	DATA8 p = table + (off >> 1);
+	if (off & 1) *p = (*p & 0x0f) | (val << 4);
+	else         *p = (*p & 0xf0) | val;
+}
+
+/* same rules than mapUpdate.c: skylight at max value goes down without attenuation through transparent blocks */
+static inline int lightingAttenuate(int level, int opac, Bool skyDown)
+{
+	if (opac >= MAXLIGHT) return 0;
+	if (skyDown && level == MAXSKY && opac == 0) return MAXSKY;
+	return level - (opac > 1 ? opac : 1);
+}
+
+/* neighbor column in direction <side> (S, E, N, W), only if it has been loaded */
+static Chunk lightingNeighbor(Chunk c, int side)
+{
+	Chunk n = c + lighting.nbor[c->neighbor + (1 << side)];
+	if (n->X == c->X + relx[side] * 16 && n->Z == c->Z + relz[side] * 16 && (n->cflags & CFLAG_GOTDATA))
+		return n;
+	return NULL;
+}
+
+static void lightingAdd(LightingQueue queue, Chunk c, int pos)
+{
+	if (queue->count == queue->max)
+	{
+		if (queue->head > 0 && queue->head >= (queue->max >> 1))
+		{
+			/* more than half of queue is already processed: reclaim space */
+			memmove(queue->cells, queue->cells + queue->head, (queue->count - queue->head) * sizeof *queue->cells);
+			queue->count -= queue->head;
+			queue->head = 0;
+		}
+		else
+		{
+			int max = queue->max < 1024 ? 1024 : queue->max * 2;
+			LightingCell cells = realloc(queue->cells, max * sizeof *cells);
+			if (cells == NULL) return;
+			queue->cells = cells;
+			queue->max = max;
+		}
+	}
+	LightingCell cell = queue->cells + queue->count;
+	cell->chunk = c;
+	cell->pos = pos;
+	queue->count ++;
+}
+
+/* propagate light <level> coming from a neighbor into cell <x, y, z> of column <c> */
+static void lightingPush(LightingQueue queue, Chunk c, int x, int y, int z, int level, int table, Bool down)
+{
+	if (y < 0 || y >= BUILD_HEIGHT || (c->cflags & CFLAG_RELIGHT) == 0)
+		return;
+
+	int       pos = CHUNK_BLOCK_POS(x, z, y);
+	ChunkData cd  = y < c->maxy * 16 ? c->layer[y >> 4] : NULL;
+	Block     b   = blockIds + (cd ? cd->blockIds[pos & 4095] : 0);
+
+	if (table == SKYLIGHT_OFFSET)
+		level = lightingAttenuate(level, b->opacSky, down);
+	else
+		level = lightingAttenuate(level, b->opacLight, False);
+
+	if (level <= lightingGet(c, pos, table))
+		return;
+
+	if (cd == NULL)
+	{
+		/* only done by lightingSeams(), which is single threaded */
+		cd = chunkCreateEmpty(c, y >> 4);
+		if (cd == NULL) return;
+		lighting.newLayer = 1;
+	}
+	lightingSet(cd->blockIds + table, pos & 4095, level);
+	if (level > 1)
+		lightingAdd(queue, c, pos);
+}
+
+/* BFS: spread light until all cells in queue have been processed */
+static void lightingSpread(LightingQueue queue, int table, Bool local)
+{
+	while (queue->head < queue->count)
+	{
+		LightingCell cell = queue->cells + queue->head;
+		Chunk c = cell->chunk;
+		int   pos = cell->pos, i;
+		int   level = lightingGet(c, pos, table);
+
+		queue->head ++;
+		if (level <= 1) continue;
+
+		for (i = 0; i < 6; i ++)
+		{
+			int   x = (pos & 15) + relx[i];
+			int   z = ((pos >> 4) & 15) + relz[i];
+			int   y = (pos >> 8) + rely[i];
+			Chunk n = c;
+
+			if (x < 0 || x > 15 || z < 0 || z > 15)
+			{
+				/* seams will be processed later */
+				if (local) continue;
+				n = lightingNeighbor(c, i);
+				if (n == NULL) continue;
+				x &= 15;
+				z &= 15;
+			}
+			/* can't allocate sub-chunk in a worker thread */
+			else if (local && y >= c->maxy * 16) continue;
+
+			lightingPush(queue, n, x, y, z, level, table, i == SIDE_BOTTOM);
+		}
+	}
+	queue->head = queue->count = 0;
+}
+
+/* first pass: only consider what's inside the column */
+static void lightingColumn(LightingCol col, LightingQueue queue)
+{
+	Chunk  c = col->chunk;
+	DATA32 height = c->heightMap;
+	int    top = c->maxy * 16;
+	int    i, y, pos;
+
+	for (i = 0; i < c->maxy; i ++)
+	{
+		DATA8 blocks = c->layer[i]->blockIds;
+		if (col->backup)
+		{
+			memcpy(col->backup + i * 4096,        blocks + SKYLIGHT_OFFSET,   2048);
+			memcpy(col->backup + i * 4096 + 2048, blocks + BLOCKLIGHT_OFFSET, 2048);
+		}
+		memset(blocks + SKYLIGHT_OFFSET,   0, 2048);
+		memset(blocks + BLOCKLIGHT_OFFSET, 0, 2048);
+	}
+
+	/* direct skylight and heightmap */
+	for (i = 0; i < 256; i ++)
+	{
+		int level = MAXSKY, hmap = 0;
+		for (y = top - 1; y >= 0 && level > 0; y --)
+		{
+			DATA8 blocks = c->layer[y >> 4]->blockIds;
+			int   off    = i + ((y & 15) << 8);
+			int   opac   = blockIds[blocks[off]].opacSky;
+
+			if (opac > 0 && hmap == 0) hmap = y + 1;
+			level = lightingAttenuate(level, opac, True);
+			if (level < 0) level = 0;
+			lightingSet(blocks + SKYLIGHT_OFFSET, off, level);
+		}
+		if (height) height[i] = hmap;
+	}
+
+	/* only cells next to a darker area need to spread their skylight */
+	for (pos = 0; pos < top * 256; pos ++)
+	{
+		int level = lightingGet(c, pos, SKYLIGHT_OFFSET);
+		if (level <= 1) continue;
+		for (i = 0; i < 4; i ++)
+		{
+			int x = (pos & 15) + relx[i];
+			int z = ((pos >> 4) & 15) + relz[i];
+			if (x < 0 || x > 15 || z < 0 || z > 15) continue;
+			int nbor = (pos & ~255) | (z << 4) | x;
+			int opac = blockIds[c->layer[pos >> 12]->blockIds[nbor & 4095]].opacSky;
+			if (lightingGet(c, nbor, SKYLIGHT_OFFSET) < lightingAttenuate(level, opac, False))
+			{
+				lightingAdd(queue, c, pos);
+				break;
+			}
+		}
+	}
+	lightingSpread(queue, SKYLIGHT_OFFSET, True);
+
+	/* block light: start from emitters */
+	for (pos = 0; pos < top * 256; pos ++)
+	{
+		DATA8 blocks = c->layer[pos >> 12]->blockIds;
+		int   emit   = blockIds[blocks[pos & 4095]].emitLight;
+		if (emit > 0)
+		{
+			lightingSet(blocks + BLOCKLIGHT_OFFSET, pos & 4095, emit);
+			if (emit > 1) lightingAdd(queue, c, pos);
+		}
+	}
+	lightingSpread(queue, BLOCKLIGHT_OFFSET, True);
+}
+
+/* worker thread: grab columns until there are none left */
+static void lightingWorker(void * arg)
+{
+	struct LightingQueue_t queue = {0};
+
+	for (;;)
+	{
+		int next;
+		MutexEnter(lighting.lock);
+		next = lighting.next ++;
+		MutexLeave(lighting.lock);
+		if (next >= lighting.count) break;
+		lightingColumn(lighting.columns + next, &queue);
+	}
+	free(queue.cells);
+	/* calling thread also process columns, but don't need to signal anything */
+	if (arg) SemAdd(lighting.done, 1);
+}
+
+/* second pass: light coming from neighbor columns (and sub-chunks above the last one) */
+static void lightingSeams(LightingQueue queue, int table)
+{
+	LightingCol col;
+	int i;
+
+	for (col = lighting.columns, i = lighting.count; i > 0; i --, col ++)
+	{
+		Chunk c = col->chunk;
+		int   side, j, y;
+
+		for (side = 0; side < 4; side ++)
+		{
+			Chunk n = lightingNeighbor(c, side);
+			if (n == NULL) continue;
+			int top = MAX(c->maxy, n->maxy) * 16;
+			int back = (side + 2) & 3;
+
+			for (j = 0; j < 16; j ++)
+			{
+				/* cell in <n> facing <c>, on side <back> */
+				int x = relx[side] ? (relx[side] > 0 ? 0 : 15) : j;
+				int z = relz[side] ? (relz[side] > 0 ? 0 : 15) : j;
+				for (y = 0; y < top; y ++)
+				{
+					int level = lightingGet(n, CHUNK_BLOCK_POS(x, z, y), table);
+					if (level > 1)
+						lightingPush(queue, c, (x + relx[back]) & 15, y, (z + relz[back]) & 15, level, table, False);
+				}
+			}
+		}
+		if (table == BLOCKLIGHT_OFFSET && col->maxy > 0 && col->maxy < CHUNK_LIMIT)
+		{
+			/* block light can go above the last sub-chunk */
+			int pos = CHUNK_BLOCK_POS(0, 0, col->maxy * 16 - 1);
+			for (j = 0; j < 256; j ++, pos ++)
+				if (lightingGet(c, pos, table) > 1) lightingAdd(queue, c, pos);
+		}
+	}
+	lightingSpread(queue, table, False);
+}
+
+/* check which sub-chunks had their light changed */
+static void lightingCompare(LightingCol col, LightingCb_t changed)
+{
+	Chunk c = col->chunk;
+	int   i, j;
+
+	for (i = 0; i < c->maxy; i ++)
+	{
+		ChunkData cd = c->layer[i];
+		DATA8     old = i < col->maxy ? col->backup + i * 4096 : NULL;
+		DATA8     sky = cd->blockIds + SKYLIGHT_OFFSET;
+		DATA8     light = cd->blockIds + BLOCKLIGHT_OFFSET;
+		int       nearby = 0;
+		Bool      modif = False;
+
+		for (j = 0; j < 2048; j ++)
+		{
+			if (old ? sky[j] != old[j] || light[j] != old[2048+j] : sky[j] != 255 || light[j] != 0)
+			{
+				int off = j << 1;
+				nearby |= chunkNearby[slotsXZ[off & 255] | slotsY[off >> 8]] |
+				          chunkNearby[slotsXZ[(off+1) & 255] | slotsY[off >> 8]];
+				modif = True;
+			}
+		}
+		if (modif)
+		{
+			/* entity light in this chunk needs to be updated */
+			c->cflags |= CFLAG_ETTLIGHT;
+			changed(cd, nearby);
+		}
+	}
+}
+
+/*
+ * recompute light of <columns> (all sub-chunks), <nbor> is the chunkOffsets table of the map.
+ * <changed> will be called for every sub-chunk whose light has been modified (can be NULL).
+ */
+int lightingRelight(Chunk * columns, int count, DATAS16 nbor, int flags, LightingCb_t changed)
+{
+	struct LightingQueue_t queue = {0};
+	LightingCol col;
+	int i, max, threads;
+
+	#ifdef DEBUG
+	double start = FrameGetTime();
+	#endif
+
+	if (count == 0) return 0;
+
+	/* columns around can be affected by up to 15 blocks */
+	max = flags & LIGHTING_EXPAND ? count * 9 : count;
+	lighting.columns = col = calloc(max, sizeof *col);
+	lighting.nbor = nbor;
+	if (col == NULL)
+	{
+		/* columns queued by mapUpdateLazyLight() must not stay flagged: they would be ignored from now on */
+		for (i = 0; i < count; i ++)
+			columns[i]->cflags &= ~CFLAG_RELIGHT;
+		return 0;
+	}
+
+	for (i = 0; i < count; i ++)
+	{
+		Chunk c = columns[i];
+		if ((c->cflags & CFLAG_GOTDATA) == 0)
+		{
+			c->cflags &= ~CFLAG_RELIGHT;
+			continue;
+		}
+		c->cflags |= CFLAG_RELIGHT;
+		col->chunk = c;
+		col ++;
+	}
+	lighting.newLayer = 0;
+	if (flags & LIGHTING_EXPAND)
+	{
+		LightingCol eof = col;
+		LightingCol dirty;
+		for (dirty = lighting.columns; dirty < eof; dirty ++)
+		{
+			static uint8_t ring[] = {1, 2, 4, 8, 3, 6, 12, 9};
+			Chunk c = dirty->chunk;
+			for (i = 0; i < DIM(ring); i ++)
+			{
+				Chunk n = c + nbor[c->neighbor + ring[i]];
+				int   dx = ring[i] & 2 ? 16 : ring[i] & 8 ? -16 : 0;
+				int   dz = ring[i] & 1 ? 16 : ring[i] & 4 ? -16 : 0;
+				if (n->X != c->X + dx || n->Z != c->Z + dz || (n->cflags & (CFLAG_GOTDATA|CFLAG_RELIGHT)) != CFLAG_GOTDATA)
+					continue;
+				n->cflags |= CFLAG_RELIGHT;
+				col->chunk = n;
+				col ++;
+			}
+		}
+	}
+	lighting.count = count = col - lighting.columns;
+	lighting.next = 0;
+
+	for (col = lighting.columns, i = count; i > 0; i --, col ++)
+	{
+		Chunk c = col->chunk;
+		int   j;
+		/* some worlds have missing sections in the middle of a column: worker threads expect them all */
+		for (j = 0; j < c->maxy; j ++)
+		{
+			if (c->layer[j]) continue;
+			int maxy = c->maxy;
+			c->maxy = j;
+			chunkCreateEmpty(c, j);
+			c->maxy = maxy;
+			lighting.newLayer = 1;
+		}
+		col->maxy = c->maxy;
+		if (changed && col->maxy > 0)
+			col->backup = malloc(col->maxy * 4096);
+	}
+
+	/* first pass: columns are independent from each other */
+	if (lighting.lock == NULL)
+		lighting.lock = MutexCreate(), lighting.done = SemInit(0);
+	threads = MIN(count, LIGHTING_THREADS) - 1;
+	for (i = 0; i < threads; i ++)
+		ThreadCreate(lightingWorker, &lighting);
+	lightingWorker(NULL);
+	for (i = 0; i < threads; i ++)
+		SemWait(lighting.done);
+
+	/* second pass: across column boundaries */
+	lightingSeams(&queue, SKYLIGHT_OFFSET);
+	lightingSeams(&queue, BLOCKLIGHT_OFFSET);
+	free(queue.cells);
+
+	for (col = lighting.columns, i = count; i > 0; i --, col ++)
+	{
+		col->chunk->cflags &= ~CFLAG_RELIGHT;
+		if (changed)
+			lightingCompare(col, changed);
+		free(col->backup);
+	}
+	free(lighting.columns);
+	lighting.columns = NULL;
+
+	/* sub-chunks have been allocated: frustum culling must take them into account */
+	if (lighting.newLayer && (flags & LIGHTING_OFFLINE) == 0)
+		renderResetFrustum();
+
+	#ifdef DEBUG
+	fprintf(stderr, "relight: %d columns in %.1f ms\n", count, FrameGetTime() - start);
+	#endif
+
+	return count;
+}
+
+/*
+ * offline relighting of an entire world: region files are processed one at a time, with a one
+ * chunk wide border of the neighbor regions to get the light coming from across region boundaries
+ * (these chunks are only read, they will be relit when their own region is processed).
+ */
+#define REGION_GRID     34
+
+static int lightingCmpXZ(const void * item1, const void * item2)
+{
+	const int * xz1 = item1;
+	const int * xz2 = item2;
+	return xz1[0] != xz2[0] ? xz1[0] - xz2[0] : xz1[1] - xz2[1];
+}
+
+static void lightingRelightRegion(LightingWorld world, Chunk grid, int rx, int rz)
+{
+	Chunk   relight[32*32];
+	Chunk   c;
+	int16_t nbor[16];
+	int     x, z, count;
+
+	/* similar to brush (selection.c): no wrap around */
+	for (x = 0; x < 16; x ++)
+	{
+		int offset = 0;
+		if (x & 1) offset += REGION_GRID;
+		if (x & 2) offset += 1;
+		if (x & 4) offset -= REGION_GRID;
+		if (x & 8) offset -= 1;
+		nbor[x] = offset;
+	}
+
+	memset(grid, 0, REGION_GRID * REGION_GRID * sizeof *grid);
+	for (z = count = 0, c = grid; z < REGION_GRID; z ++)
+	{
+		for (x = 0; x < REGION_GRID; x ++, c ++)
+		{
+			int XZ[] = {(rx * 32 + x - 1) * 16, (rz * 32 + z - 1) * 16};
+			if (! chunkLoad(c, world->path, XZ[0], XZ[1]))
+				continue;
+			c->cflags |= CFLAG_GOTDATA;
+			if (x == 0 || z == 0 || x == REGION_GRID-1 || z == REGION_GRID-1)
+				continue;
+			/* chunks loaded in the editor will be relit (and saved) from there */
+			if (world->skip && bsearch(XZ, world->skip, world->skipCount, 2 * sizeof (int), lightingCmpXZ))
+				continue;
+			relight[count++] = c;
+		}
+	}
+
+	lightingRelight(relight, count, nbor, LIGHTING_OFFLINE, NULL);
+
+	for (x = 0; x < count; x ++)
+	{
+		if (chunkSave(relight[x], world->path))
+			world->chunks ++;
+		else
+			world->failed ++;
+	}
+
+	for (x = REGION_GRID * REGION_GRID, c = grid; x > 0; x --, c ++)
+		if (c->cflags & CFLAG_GOTDATA) chunkFree(NULL, c, False);
+}
+
+static void lightingWorldThread(void * arg)
+{
+	LightingWorld world = arg;
+	ScanDirData   args;
+	Chunk         grid = malloc(REGION_GRID * REGION_GRID * sizeof *grid);
+	int *         regions = NULL;
+	int           max = 0, i;
+	double        start = FrameGetTime();
+
+	if (grid && ScanDirInit(&args, world->path))
+	{
+		do
+		{
+			int XZ[2];
+			if (args.isDir || sscanf(args.name, "r.%d.%d.mca", XZ, XZ + 1) != 2)
+				continue;
+			if (world->regions == max)
+			{
+				int * list = realloc(regions, (max + 64) * 2 * sizeof *list);
+				if (list == NULL) break;
+				regions = list;
+				max += 64;
+			}
+			memcpy(regions + world->regions * 2, XZ, sizeof XZ);
+			world->regions ++;
+		}
+		while (ScanDirNext(&args));
+	}
+
+	if (world->skip)
+		qsort(world->skip, world->skipCount, 2 * sizeof (int), lightingCmpXZ);
+
+	for (i = 0; i < world->regions && ! world->cancel; i ++)
+	{
+		lightingRelightRegion(world, grid, regions[i*2], regions[i*2+1]);
+		world->regionDone ++;
+		world->elapsed = FrameGetTime() - start;
+	}
+	world->elapsed = FrameGetTime() - start;
+
+	#ifdef DEBUG
+	fprintf(stderr, "relight world: %d chunks in %.1f ms (%.1f chunks/s)\n", world->chunks, world->elapsed,
+		world->elapsed > 0 ? world->chunks * 1000 / world->elapsed : 0);
+	#endif
+
+	free(regions);
+	free(grid);
+	world->done = 1;
+}
+
+/* start a thread to relight all region files of a world: <world> will be updated as regions are processed */
+void lightingRelightWorld(LightingWorld world)
+{
+	world->regions = world->regionDone = 0;
+	world->chunks = world->failed = 0;
+	world->elapsed = 0;
+	world->done = 0;
+	ThreadCreate(lightingWorldThread, world);
+}
@@ -0,0 +1,73 @@
+/*
+ * lighting.h: public function to recompute SkyLight/BlockLight/HeightMap of entire columns.
+ */
+
+#ifndef MC_LIGHTING_H
+#define MC_LIGHTING_H
+
+#include "maps.h"
+
+typedef void (*LightingCb_t)(ChunkData, int nearby);
+typedef struct LightingWorld_t *   LightingWorld;
+
+int  lightingRelight(Chunk * columns, int count, DATAS16 nbor, int flags, LightingCb_t changed);
+void lightingRelightWorld(LightingWorld);
+
+enum /* <flags> for lightingRelight() */
+{
+	LIGHTING_EXPAND  = 1,          /* also relight the ring of columns around <columns> */
+	LIGHTING_OFFLINE = 2           /* columns are not part of the rendered map (see lightingRelightWorld()) */
+};
+
+#define LIGHTING_THREADS           4
+
+struct LightingWorld_t             /* progress of lightingRelightWorld() */
+{
+	STRPTR   path;                 /* region directory */
+	int *    skip;                 /* X, Z coord of chunks loaded in the editor (will be sorted) */
+	int      skipCount;
+	int      regions;              /* region files found in <path> */
+	int      regionDone;
+	int      chunks;               /* chunks relit and saved */
+	int      failed;               /* chunks that could not be saved */
+	double   elapsed;              /* in ms */
+	uint8_t  cancel;               /* set by caller: stop after current region */
+	uint8_t  done;                 /* set by thread */
+};
+
+#ifdef LIGHTING_IMPL
+typedef struct LightingCol_t *     LightingCol;
+typedef struct LightingCell_t *    LightingCell;
+typedef struct LightingQueue_t *   LightingQueue;
+
+struct LightingCol_t               /* one column being relit */
+{
+	Chunk    chunk;
+	DATA8    backup;               /* old sky+block light of each sub-chunk (4096 bytes per layer) */
+	uint8_t  maxy;                 /* chunk->maxy before relight (new sub-chunks might be allocated) */
+};
+
+struct LightingCell_t
+{
+	Chunk    chunk;
+	int      pos;                  /* CHUNK_BLOCK_POS() with absolute Y */
+};
+
+struct LightingQueue_t             /* FIFO of cells that need to spread their light */
+{
+	LightingCell cells;
+	int      head, count, max;
+};
+
+struct LightingPrivate_t
+{
+	LightingCol columns;           /* columns to relight (all have CFLAG_RELIGHT set) */
+	int      count;
+	int      next;                 /* next column to process by worker threads */
+	DATAS16  nbor;                 /* Map->chunkOffsets */
+	Mutex    lock;                 /* protect <next> */
+	Semaphore done;                /* worker threads finished */
+	uint8_t  newLayer;             /* sub-chunks have been allocated */
+};
+#endif
+#endif
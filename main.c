@@ -225,6 +225,7 @@ static void prefsInit(void)
 	INIFile ini = ParseINI(PREFS_PATH);
 
 	globals.renderDist    = GetINIValueInt(ini, "RenderDist",    16);
+	globals.entityDist    = GetINIValueInt(ini, "EntityDist",    8);
 	globals.redstoneTick  = GetINIValueInt(ini, "RedstoneTick",  100);
 	globals.compassSize   = GetINIValueInt(ini, "CompassSize",   100) * 0.01f;
 	globals.fieldOfVision = GetINIValueInt(ini, "FieldOfVision", 80);
@@ -235,6 +236,8 @@ static void prefsInit(void)
 	globals.distanceFOG   = GetINIValueInt(ini, "UseFOG",        0);
 	globals.showPreview   = GetINIValueInt(ini, "UsePreview",    1);
 	globals.lockMouse     = GetINIValueInt(ini, "LockMouse",     0);
+	globals.undoMaxMem    = GetINIValueInt(ini, "UndoMaxMem",    256);
+	globals.autoSelectMax = GetINIValueInt(ini, "AutoSelectMax", 4 << 20);
 
 	mcedit.autoEdit       = GetINIValueInt(ini, "AutoEdit",      0);
 	mcedit.fullScreen     = GetINIValueInt(ini, "FullScreen",    0);
@@ -880,6 +883,11 @@ void mceditWorld(void)
 					//meshDebugBank(globals.level);
 					//FramePauseUnpause(globals.breakPoint);
 					break;
+				case SDLK_F8:
+					debugBenchmark(mod & SITK_FlagAlt   ? DEBUG_BENCH_COLLISION :
+					               mod & SITK_FlagCtrl  ? DEBUG_BENCH_ENTITYGRID :
+					               mod & SITK_FlagShift ? DEBUG_BENCH_TILETICK : DEBUG_BENCH_LIGHT, mcedit.player.pos);
+					break;
 				#endif
 				case SDLK_DELETE:
 					if ((globals.selPoints & 8) == 0)
@@ -1025,6 +1033,8 @@ void mceditWorld(void)
 			/* ignore the next mouse move (from GRAB_ON) */
 			state.ignore = 1;
 		}
+		/* new tick: events above might have modified the map */
+		mapResetBBoxCache();
 		if (mcedit.player.keyvec)
 		{
 			vec4 oldpos;
@@ -22,6 +22,8 @@
 #include "meshBanks.h"
 #include "tileticks.h"
 #include "undoredo.h"
+#include "lighting.h"
+#include "globals.h"
 #include "NBT2.h"
 
 /* order is S, E, N, W, T, B ({xyz}off last slot is to get back to starting pos) */
@@ -60,7 +62,11 @@ void mapUpdateDelAll(void)
 	ListNode * node;
 	while ((node = ListRemHead(&track.updates))) free(node);
 	free(track.coord);
+	free(track.queued);
+	free(track.relight);
+	free(track.updateHash);
 	memset(&track, 0, sizeof track);
+	redstoneNetClearAll();
 }
 
 /*
@@ -294,42 +300,57 @@ uint8_t mapGetSkyBlockLight(BlockIter iter)
 
 #define STEP     126   /* need to be multiple of 3 */
 
-#define mapUpdateInitTrack(track)    \
+#define TRACK_KEY(x, y, z)           ((((x) & 31) << 16) | ((uint8_t) (y) << 8) | (uint8_t) (z))
+
+/* reset ring buffer, clear <queued> bits of values that were not processed */
+static void mapUpdateInitTrack(void)
+{
+	if (track.unique)
+	{
+		int pos;
+		for (pos = track.pos; track.usage > 0; track.usage -= 3)
+		{
+			int8_t * buffer = track.coord + pos;
+			int      key    = TRACK_KEY(buffer[0], buffer[1], buffer[2]);
+			track.queued[key >> 3] &= ~mask8bit[key & 7];
+			pos += 3;
+			if (pos == track.max) pos = 0;
+		}
+	}
 	memset(&track.pos, 0, sizeof track - offsetof(struct MapUpdate_t, pos));
+}
 
 /* coordinates that will need further investigation for skylight/blocklight */
 static void trackAdd(int x, int y, int z)
 {
 	int8_t * buffer;
+	if (track.unique)
+	{
+		/* ring buffer can grow quite large on big light changes: scanning it would be O(n^2) */
+		int key = TRACK_KEY(x, y, z);
+		if (track.queued == NULL)
+		{
+			track.queued = calloc(TRACK_QUEUED_SIZE, 1);
+			if (! track.queued) return;
+		}
+		if (track.queued[key >> 3] & mask8bit[key & 7])
+			return;
+		track.queued[key >> 3] |= mask8bit[key & 7];
+	}
 	/* this is an expanding ring buffer */
 	if (track.usage == track.max)
 	{
-		/* not enough space left */
-		track.max += STEP;
-		buffer = realloc(track.coord, track.max);
+		/* not enough space left: double the size, wrapped part will fit entirely in the new space */
+		int grow = track.max < STEP ? STEP : track.max;
+		buffer = realloc(track.coord, track.max + grow);
 		if (! buffer) return;
 		track.coord = buffer;
 		if (track.last > 0)
-		{
-			int nb = track.last;
-			if (nb > STEP) nb = STEP;
-			memcpy(track.coord + track.usage, track.coord, nb);
-			if (nb < track.last) memmove(track.coord, track.coord + nb, track.last - nb);
-		}
-		track.last -= STEP;
-		if (track.last < 0)
-			track.last += track.max;
-	}
-	if (track.unique)
-	{
-		int i;
-		for (i = track.usage, buffer = track.coord + track.last; i > 0; i -= 3)
-		{
-			if (buffer == track.coord) buffer += track.max;
-			buffer -= 3;
-			if ((buffer[0]&31) == (x&31) && buffer[1] == y && buffer[2] == z)
-				return;
-		}
+			memcpy(track.coord + track.max, track.coord, track.last);
+		track.last += track.max;
+		track.max  += grow;
+		if (track.last == track.max)
+			track.last = 0;
 	}
 	buffer = track.coord + track.last;
 	buffer[0] = x;
@@ -343,35 +364,104 @@ static void trackAdd(int x, int y, int z)
 		track.maxUsage = track.usage;
 }
 
+/* remove first item of ring buffer */
+static void trackNext(void)
+{
+	if (track.unique)
+	{
+		int8_t * buffer = track.coord + track.pos;
+		int      key    = TRACK_KEY(buffer[0], buffer[1], buffer[2]);
+		track.queued[key >> 3] &= ~mask8bit[key & 7];
+	}
+	track.pos += 3;
+	track.usage -= 3;
+	if (track.pos == track.max) track.pos = 0;
+}
+
+#define TRACK_HASH(cd, offset)     ((((uint32_t) ((uintptr_t) (cd) >> 4) * 4099 + (offset)) * 0x9E3779B1u >> 8) & track.updateHashMask)
+
+/* get update at <cd>/<offset> that has not been applied yet */
+static BlockUpdate trackFindUpdate(ChunkData cd, int offset)
+{
+	UpdateHash hash;
+	int i;
+	if (track.updateHash == NULL)
+		return NULL;
+	for (i = TRACK_HASH(cd, offset); (hash = track.updateHash + i)->index > 0; i = (i + 1) & track.updateHashMask)
+	{
+		/* entries already flushed are kept until the end of mapUpdateFlush() */
+		if (hash->index > track.updateFlushed && hash->update->cd == cd && hash->update->offset == offset)
+			return hash->update;
+	}
+	return NULL;
+}
+
+static void trackHashUpdate(BlockUpdate update, int index)
+{
+	int i;
+	if (track.updateIndex * 2 >= track.updateHashMask)
+	{
+		/* keep load factor below 50% */
+		UpdateHash old = track.updateHash, hash, eof;
+		int max = track.updateHashMask + 1;
+		hash = calloc(max < 256 ? 256 : max * 2, sizeof *hash);
+		/* not fatal: update won't be checked for duplicates */
+		if (hash == NULL) return;
+		track.updateHash = hash;
+		track.updateHashMask = max < 256 ? 255 : max * 2 - 1;
+		for (hash = old, eof = old + max; old && hash < eof; hash ++)
+		{
+			if (hash->index <= track.updateFlushed) continue;
+			for (i = TRACK_HASH(hash->update->cd, hash->update->offset); track.updateHash[i].index > 0; i = (i + 1) & track.updateHashMask);
+			track.updateHash[i] = *hash;
+		}
+		free(old);
+	}
+	for (i = TRACK_HASH(update->cd, update->offset); track.updateHash[i].index > 0; i = (i + 1) & track.updateHashMask);
+	track.updateHash[i].update = update;
+	track.updateHash[i].index  = index + 1;
+}
+
 /* will prevent use of recursion (mapUpdate) */
 static void trackAddUpdate(BlockIter iter, int blockId, DATA8 tile)
 {
 	UpdateBuffer updates;
 
-	for (updates = HEAD(track.updates); updates && updates->count == 128; NEXT(updates));
-	if (updates == NULL)
+	/* avoid duplicates */
+	if (trackFindUpdate(iter->cd, iter->offset))
 	{
-		/* alloc them in chunk, block updates must not be relocated if there isn't enough space */
-		updates = malloc(sizeof *updates);
-		if (updates == NULL) return;
-		memset(updates, 0, offsetof(struct UpdateBuffer_t, buffer));
-		ListAddTail(&track.updates, &updates->node);
+		track.statDeduped ++;
+		return;
+	}
+
+	/* updates must be applied in the order they were added */
+	updates = track.updateTail;
+	if (updates == NULL || updates->count == 128)
+	{
+		updates = updates ? (UpdateBuffer) updates->node.ln_Next : HEAD(track.updates);
+		if (updates == NULL)
+		{
+			/* alloc them in chunk, block updates must not be relocated if there isn't enough space */
+			updates = malloc(sizeof *updates);
+			if (updates == NULL) return;
+			memset(updates, 0, offsetof(struct UpdateBuffer_t, buffer));
+			ListAddTail(&track.updates, &updates->node);
+		}
+		track.updateTail = updates;
 	}
 
 	/* redstone needs a 2 pass system */
 	BlockUpdate update = updates->buffer + updates->count;
-	BlockUpdate dup;
-
-	/* avoid duplicates */
-	for (dup = updates->buffer; dup < update; dup ++)
-		if (dup->cd == iter->cd && dup->offset == iter->offset) return;
 
 	updates->count ++;
 	update->cd = iter->cd;
 	update->offset = iter->offset;
 	update->blockId = blockId;
 	update->tile = tile;
+	trackHashUpdate(update, track.updateIndex);
+	track.updateIndex ++;
 	track.updateCount ++;
+	track.statQueued ++;
 
 	//fprintf(stderr, "adding update at %d,%d,%d\n", iter->ref->X + iter->x, iter->yabs, iter->ref->Z + iter->z);
 }
@@ -389,7 +479,7 @@ static void mapUpdateSkyLightBlock(BlockIter iterator)
 	int8_t max, level, newsky, sky;
 	int    i, height;
 
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = 1;
 
 	sky = mapGetSky(iterator);
@@ -533,9 +623,7 @@ static void mapUpdateSkyLightBlock(BlockIter iterator)
 			}
 		}
 		skip:
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
@@ -544,7 +632,7 @@ static void mapUpdateSkyLightUnblock(BlockIter iterator)
 {
 	struct BlockIter_t iter = *iterator;
 
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = 0;
 
 	int i = CHUNK_BLOCK_POS(iter.x, iter.z, 0);
@@ -611,9 +699,7 @@ static void mapUpdateSkyLightUnblock(BlockIter iterator)
 			}
 		}
 
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
@@ -643,7 +729,7 @@ static void mapUpdateRestoreSky(BlockIter iterator)
  */
 static void mapUpdateAddLight(BlockIter iterator, int intensity /* max: 15 */)
 {
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = 0;
 	if (mapGetLight(iterator) >= intensity)
 		return;
@@ -672,15 +758,13 @@ static void mapUpdateAddLight(BlockIter iterator, int intensity /* max: 15 */)
 				mapUpdateTable(&neighbor, level - dim, BLOCKLIGHT_OFFSET);
 			}
 		}
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
 static void mapUpdateRemLight(BlockIter iterator)
 {
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = 1;
 	trackAdd(0, 0, 0);
 
@@ -750,9 +834,7 @@ static void mapUpdateRemLight(BlockIter iterator)
 
 			trackAdd(XYZ[0] + relx[i], XYZ[1] + rely[i], XYZ[2] + relz[i]);
 		}
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
@@ -760,7 +842,7 @@ static void mapUpdateObstructLight(struct BlockIter_t iter)
 {
 	int8_t light;
 
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	trackAdd(0, 0, 0);
 	light = mapGetLight(&iter);
 	if (light <= 1) return;
@@ -812,9 +894,7 @@ static void mapUpdateObstructLight(struct BlockIter_t iter)
 				}
 			}
 		}
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
@@ -921,6 +1001,27 @@ static void mapUpdateAddRSUpdate(struct BlockIter_t iter, RSWire cnx)
 	}
 }
 
+/* wire pointed by <iterator> needs an update: use compiled graph if possible */
+static Bool mapUpdateWireNet(BlockIter iterator)
+{
+	RSNet net = redstoneNetGet(*iterator);
+	int   count, i, j;
+
+	if (net == NULL || (count = redstoneNetEvaluate(net)) < 0)
+		return False;
+
+	for (i = 0; i < count; i ++)
+	{
+		RSNetNode node = net->nodes + net->changed[i];
+		struct BlockIter_t iter;
+		mapInitIterOffset(&iter, node->cd, node->offset);
+		mapUpdateTable(&iter, node->signal, DATA_OFFSET);
+		for (j = 0; j < node->outCount; j ++)
+			mapUpdateAddRSUpdate(iter, net->outputs + node->out + j);
+	}
+	return True;
+}
+
 /*
  * redstone propagation is very similar to blockLight, but with a lot more rules
  * to check which block to connect to.
@@ -930,7 +1031,7 @@ static void mapUpdatePropagateSignal(BlockIter iterator)
 	struct RSWire_t connectTo[RSMAXUPDATE];
 	int count, i, signal;
 
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = False;
 	signal = redstoneSignalStrength(iterator, True);
 	count = redstoneConnectTo(*iterator, connectTo);
@@ -978,9 +1079,7 @@ static void mapUpdatePropagateSignal(BlockIter iterator)
 				trackAdd(XYZ[0] + cnx->dx, XYZ[1] + cnx->dy, XYZ[2] + cnx->dz);
 			}
 		}
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 	}
 }
 
@@ -991,7 +1090,7 @@ void mapUpdateDeleteSignal(BlockIter iterator, int blockId)
 	int i, count, signal, block;
 
 	/* block must not be deleted at this point */
-	mapUpdateInitTrack(track);
+	mapUpdateInitTrack();
 	track.unique = True;
 
 	if (blockId >= 0)
@@ -1019,9 +1118,7 @@ void mapUpdateDeleteSignal(BlockIter iterator, int blockId)
 
 		memcpy(XYZ, track.coord + track.pos, 3);
 		mapIter(&neighbor, XYZ[0], XYZ[1], XYZ[2]);
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+		trackNext();
 
 		level = redstoneSignalStrength(&neighbor, False);
 		count = redstoneConnectTo(neighbor, connectTo);
@@ -1315,6 +1412,9 @@ int mapUpdateIfPowered(Map map, BlockIter iterator, int oldId, int blockId, Bool
 	case RSWIRE:
 		if (init)
 			iterator->blockIds[iterator->offset] = blockId >> 4;
+		else if (mapUpdateWireNet(iterator))
+			/* whole wire run already updated */
+			return getBlockId(iterator);
 		return ID(RSWIRE, redstoneSignalStrength(iterator, True));
 	case RSOBSERVER:
 		/* already log a tile tick to unpower */
@@ -1375,63 +1475,162 @@ void mapUpdateCheckGravity(struct BlockIter_t iter, int side)
 	}
 }
 
-/* extended selection: select all similar blocks within a 32x32x32 area */
-void mapUpdateFloodFill(Map map, vec4 pos, uint8_t visited[4096], int8_t minMax[8])
+/*
+ * flood fill used by auto-select: scanline over spans along X. Visited blocks are tracked with one bitmap of
+ * 4096 bits per sub-chunk reached, so the area is only limited by <budget> (number of blocks).
+ */
+static DATA8 floodGetVisited(FloodFill flood, int key)
 {
-	struct BlockIter_t iter;
-	int8_t min[4] = {0, 0, 0};
-	int8_t max[4] = {0, 0, 0};
-	int    block;
-	mapUpdateInitTrack(track);
-	mapInitIter(map, &iter, pos, False);
-	trackAdd(0, 0, 0);
-	visited[0] |= mask8bit[0];
-	block = getBlockId(&iter);
+	FloodSection sec;
+	int i;
 
-	while (track.usage > 0)
+	if (flood->count * 2 >= flood->max)
 	{
-		int8_t XYZ[3], i;
+		/* grow hash table */
+		int max = flood->max ? flood->max * 2 : 256;
+		FloodSection list = calloc(max, sizeof *list);
+		if (list == NULL) return NULL;
+		for (i = 0, sec = flood->sections; i < flood->max; i ++, sec ++)
+		{
+			int slot;
+			if (sec->visited == NULL) continue;
+			for (slot = (sec->key * 0x9E3779B1u >> 8) & (max - 1); list[slot].visited; slot = (slot + 1) & (max - 1));
+			list[slot] = *sec;
+		}
+		free(flood->sections);
+		flood->sections = list;
+		flood->max = max;
+	}
+	for (i = (key * 0x9E3779B1u >> 8) & (flood->max - 1); (sec = flood->sections + i)->visited; i = (i + 1) & (flood->max - 1))
+		if (sec->key == key) return sec->visited;
 
-		memcpy(XYZ, track.coord + track.pos, 3);
-		track.pos += 3;
-		track.usage -= 3;
-		if (track.pos == track.max) track.pos = 0;
+	sec->key = key;
+	sec->visited = calloc(512, 1);
+	flood->count ++;
+	return sec->visited;
+}
+
+/* check if block at <x>, <y>, <z> is the one we are looking for and has not been visited yet */
+static Bool floodMatch(FloodFill flood, int x, int y, int z)
+{
+	if (y < 0 || y >= BUILD_HEIGHT)
+		return False;
+
+	/* sub-chunk: XZ is 12bits each, Y 8bits */
+	int key = ((x >> 4) & 0xfff) | (((z >> 4) & 0xfff) << 12) | ((y >> 4) << 24);
+	if (key != flood->lastKey)
+	{
+		/* need to change sub-chunk */
+		Chunk c = mapGetChunk(flood->map, (vec4) {x, y, z});
+		flood->lastKey = key;
+		flood->blocks = NULL;
+		if (c == NULL || (c->cflags & CFLAG_GOTDATA) == 0)
+			return False;
+		ChunkData cd = (y >> 4) < c->maxy ? c->layer[y >> 4] : NULL;
+		flood->blocks = cd ? cd->blockIds : chunkAir->blockIds;
+		flood->visited = floodGetVisited(flood, key);
+		if (flood->visited == NULL)
+			flood->blocks = NULL;
+	}
+	if (flood->blocks == NULL)
+		return False;
+
+	int offset = CHUNK_BLOCK_POS(x & 15, z & 15, y & 15);
+	if (flood->visited[offset >> 3] & mask8bit[offset & 7])
+		return False;
+
+	DATA8 blocks = flood->blocks;
+	int   data   = blocks[DATA_OFFSET + (offset >> 1)];
+	return ((blocks[offset] << 4) | (offset & 1 ? data >> 4 : data & 15)) == flood->blockId;
+}
 
-		/* no more than 32x32x32 */
-		for (i = 0; i < 3; i ++)
+/* <minMax> will contain the bounding box (absolute coord) of all the blocks connected to <pos> */
+int mapUpdateFloodFill(Map map, vec4 pos, int budget, int minMax[6])
+{
+	static int8_t nextRow[] = {0, 1, 0, -1, 1, 0, -1, 0};
+	struct FloodFill_t flood = {.map = map, .lastKey = -1};
+	struct BlockIter_t iter;
+	int x, y, z, x0, x1, i, n;
+
+	mapInitIter(map, &iter, pos, False);
+	flood.blockId = getBlockId(&iter);
+
+	x = pos[VX];
+	y = pos[VY];
+	z = pos[VZ];
+	for (i = 0; i < 3; i ++)
+		minMax[i] = minMax[i+3] = pos[i];
+
+	/* stack of XYZ coord: start of span to check */
+	flood.seeds = malloc(FLOOD_STACK * sizeof *flood.seeds);
+	flood.seedMax = FLOOD_STACK;
+	if (flood.seeds == NULL) return 0;
+	flood.seedCount = 3;
+	flood.seeds[0] = x;
+	flood.seeds[1] = y;
+	flood.seeds[2] = z;
+
+	while (flood.seedCount > 0 && flood.total < budget)
+	{
+		int * seed = flood.seeds + (flood.seedCount -= 3);
+		x = seed[0]; y = seed[1]; z = seed[2];
+		if (! floodMatch(&flood, x, y, z))
+			continue;
+
+		/* expand span along X */
+		for (x0 = x; floodMatch(&flood, x0 - 1, y, z); x0 --);
+		for (x1 = x; floodMatch(&flood, x1 + 1, y, z); x1 ++);
+		for (i = x0; i <= x1; i ++)
 		{
-			int8_t x = XYZ[i];
-			if (x < min[i] || x > max[i])
-			{
-				if (max[i] - min[i] + 1 >= 32) continue;
-				if (x < min[i]) min[i] = x;
-				else            max[i] = x;
-			}
+			/* span can be across 2 sub-chunks */
+			floodMatch(&flood, i, y, z);
+			n = CHUNK_BLOCK_POS(i & 15, z & 15, y & 15);
+			flood.visited[n >> 3] |= mask8bit[n & 7];
 		}
-
-		struct BlockIter_t neighbor = iter;
-		mapIter(&neighbor, XYZ[0], XYZ[1], XYZ[2]);
-		for (i = 0; i < 6; i ++)
+		flood.total += x1 - x0 + 1;
+		if (minMax[VX] > x0) minMax[VX] = x0;
+		if (minMax[VX+3] < x1) minMax[VX+3] = x1;
+		if (minMax[VY] > y) minMax[VY] = y; else
+		if (minMax[VY+3] < y) minMax[VY+3] = y;
+		if (minMax[VZ] > z) minMax[VZ] = z; else
+		if (minMax[VZ+3] < z) minMax[VZ+3] = z;
+
+		/* rows above, below, front and back: only need to add the start of each run */
+		for (n = 0; n < 8; n += 2)
 		{
-			mapIter(&neighbor, xoff[i], yoff[i], zoff[i]);
-			if (getBlockId(&neighbor) == block)
+			int ny = y + nextRow[n];
+			int nz = z + nextRow[n+1];
+			Bool inRun = False;
+			for (i = x0; i <= x1; i ++)
 			{
-				int8_t x = XYZ[0] + relx[i];
-				int8_t y = XYZ[1] + rely[i];
-				int8_t z = XYZ[2] + relz[i];
-				/* that's why it is limited to 32x32x32: <visited> can only hold 32Kbits */
-				int xzy = (x & 31) + (z & 31) * 32 + (y & 15) * 1024;
-				if ((visited[xzy>>3] & mask8bit[xzy&7]) == 0)
+				if (! floodMatch(&flood, i, ny, nz))
+				{
+					inRun = False;
+					continue;
+				}
+				if (inRun) continue;
+				inRun = True;
+				if (flood.seedCount == flood.seedMax)
 				{
-					visited[xzy>>3] |= mask8bit[xzy&7];
-					trackAdd(x, y, z);
+					int * seeds = realloc(flood.seeds, (flood.seedMax *= 2) * sizeof *seeds);
+					if (seeds == NULL) goto break_all;
+					flood.seeds = seeds;
 				}
+				seed = flood.seeds + flood.seedCount;
+				seed[0] = i;
+				seed[1] = ny;
+				seed[2] = nz;
+				flood.seedCount += 3;
 			}
 		}
 	}
+	break_all:
+	for (i = 0; i < flood.max; i ++)
+		free(flood.sections[i].visited);
+	free(flood.sections);
+	free(flood.seeds);
 
-	memcpy(minMax,   min, 4);
-	memcpy(minMax+4, max, 4);
+	return flood.total;
 }
 
 /*
@@ -1538,9 +1737,9 @@ static void mapUpdateCheckPiston(BlockUpdate update)
 	UpdateBuffer updates;
 	BlockUpdate recheck;
 	int nb;
-	for (updates = HEAD(track.updates), nb = track.nbCheck; updates; NEXT(updates))
+	for (updates = HEAD(track.updates), nb = track.nbCheck; updates && nb > 0; NEXT(updates))
 	{
-		for (recheck = updates->buffer; nb > 0; nb --, recheck ++)
+		for (recheck = updates->buffer; nb > 0 && recheck < EOT(updates->buffer); nb --, recheck ++)
 		{
 			if (recheck->tile == (DATA8) update->cd && recheck->blockId == update->offset)
 			{
@@ -1557,24 +1756,70 @@ static void mapUpdateAddCheck(BlockUpdate update)
 {
 	UpdateBuffer updates;
 	int nb;
-	for (updates = HEAD(track.updates), nb = track.nbCheck; updates && nb > 128; NEXT(updates), nb -= 128);
+	for (updates = HEAD(track.updates), nb = track.nbCheck; updates && nb >= 128; NEXT(updates), nb -= 128);
 	updates->buffer[nb] = update[0];
 	track.nbCheck ++;
 }
 
+/* updates triggered by the last flush, will be applied by the next one */
+Bool mapUpdatePending(void)
+{
+	return track.updateCount > 0;
+}
+
+/* total updates queued, discarded because already pending and applied so far (shown in debug info) */
+void mapUpdateStats(int stats[3])
+{
+	stats[0] = track.statQueued;
+	stats[1] = track.statDeduped;
+	stats[2] = track.statFlushed;
+}
+
+/* move updates that were not flushed at the beginning of buffers: they will be applied by next flush */
+static void trackDeferUpdates(int first)
+{
+	UpdateBuffer src, dst;
+	int i, j, count = track.updateIndex - first;
+
+	for (src = HEAD(track.updates), i = first; i >= 128; NEXT(src), i -= 128);
+	for (dst = HEAD(track.updates); dst; dst->count = 0, NEXT(dst));
+	if (track.updateHash)
+		memset(track.updateHash, 0, (track.updateHashMask + 1) * sizeof *track.updateHash);
+	track.updateIndex = track.updateFlushed = 0;
+	track.updateCount = count;
+	track.updateTail = NULL;
+
+	/* destination is always before source: can be copied in place */
+	for (dst = HEAD(track.updates), j = 0; count > 0; count --, i ++, j ++)
+	{
+		if (i == 128) NEXT(src), i = 0;
+		if (j == 128) NEXT(dst), j = 0;
+		BlockUpdate update = dst->buffer + j;
+		*update = src->buffer[i];
+		dst->count = j + 1;
+		track.updateTail = dst;
+		trackHashUpdate(update, track.updateIndex);
+		track.updateIndex ++;
+	}
+}
+
 /* async update: NBT tables need to be up to date before we can apply these changes */
 void mapUpdateFlush(Map map)
 {
 	UpdateBuffer updates;
+	/* updates triggered by this flush will be applied by the next one: blocks updating each other would hang otherwise */
+	int end = track.updateIndex;
 	int i;
-	for (updates = HEAD(track.updates); updates; NEXT(updates))
+	for (updates = HEAD(track.updates); updates && track.updateFlushed < end; NEXT(updates))
 	{
 		BlockUpdate update;
-		for (update = updates->buffer, i = 0; i < updates->count; i ++, update ++)
+		for (update = updates->buffer, i = 0; i < updates->count && track.updateFlushed < end; i ++, update ++)
 		{
 			int   offset = update->offset;
 			Chunk c = update->cd->chunk;
 			vec4  pos;
+			double start = globals.profiling ? debugProfStart() : 0;
+			track.updateFlushed ++;
 			pos[0] = c->X + (offset & 15); offset >>= 4;
 			pos[2] = c->Z + (offset & 15);
 			pos[1] = update->cd->Y + (offset >> 4);
@@ -1607,10 +1852,14 @@ void mapUpdateFlush(Map map)
 				}
 			}
 			else mapUpdate(map, pos, update->blockId, update->tile, UPDATE_GRAVITY | UPDATE_SILENT | UPDATE_DONTLOG | UPDATE_FORCE);
+
+			if (start > 0) debugProfEnd(PROF_BLOCKUPDATE, c, start);
 		}
-		updates->count = 0;
 	}
-	track.updateCount = track.nbCheck = 0;
+	/* buffers can be reused only now: mapUpdateAddCheck() stores data in already flushed slots */
+	track.statFlushed += track.updateFlushed;
+	trackDeferUpdates(track.updateFlushed);
+	track.nbCheck = 0;
 	track.curUpdate = NULL;
 }
 
@@ -1628,26 +1877,18 @@ void mapUpdatePush(Map map, vec4 pos, int blockId, DATA8 tile)
 	}
 
 	/* update must not overwrite each other */
-	UpdateBuffer updates;
-	for (updates = HEAD(track.updates); updates; NEXT(updates))
+	BlockUpdate update = trackFindUpdate(iter.cd, iter.offset);
+	if (update)
 	{
-		BlockUpdate update;
-		int i;
-		for (i = updates->count, update = updates->buffer; i > 0; i --, update ++)
+		/* air blocks have lower priority */
+		if (blockId > 0)
 		{
-			if (update->offset == iter.offset && update->cd == iter.cd)
-			{
-				/* air blocks have lower priority */
-				if (blockId > 0)
-				{
-					update->blockId = blockId;
-					update->tile = tile;
-				}
-				return;
-			}
+			update->blockId = blockId;
+			update->tile = tile;
 		}
+		track.statDeduped ++;
 	}
-	trackAddUpdate(&iter, blockId, tile);
+	else trackAddUpdate(&iter, blockId, tile);
 }
 
 /* check if a tall block can be placed at given location */
@@ -1689,11 +1930,423 @@ void mapUpdateEnd(Map map)
 	if (track.updateCount > 0)
 		mapUpdateFlush(map);
 
+	mapUpdateRelight(map);
+
 	/* update mesh */
 	mapUpdateMesh(map);
 	renderPointToBlock(-1, -1);
 }
 
+/* recompute light of columns modified with UPDATE_LAZYLIGHT, all at once */
+void mapUpdateRelight(Map map)
+{
+	if (track.relightCount > 0)
+	{
+		lightingRelight(track.relight, track.relightCount, map->chunkOffsets, LIGHTING_EXPAND, mapUpdateChunkData);
+		track.relightCount = 0;
+	}
+}
+
+/* recompute light of all columns intersecting <range> (from selectionGetRange()), or all columns with a mesh or modified if NULL */
+int mapUpdateRelightArea(Map map, int range[6])
+{
+	Chunk * list;
+	Chunk   c;
+	int     count, x, z;
+
+	if (range)
+	{
+		x = ((range[3] - 1) >> 4) - (range[0] >> 4) + 1;
+		z = ((range[5] - 1) >> 4) - (range[2] >> 4) + 1;
+		list = malloc(x * z * sizeof *list);
+		if (list == NULL) return 0;
+		for (z = range[2] & ~15, count = 0; z < range[5]; z += 16)
+		{
+			for (x = range[0] & ~15; x < range[3]; x += 16)
+			{
+				c = mapGetChunk(map, (vec4) {x, 0, z});
+				if (c && (c->cflags & CFLAG_GOTDATA))
+					list[count++] = c;
+			}
+		}
+	}
+	else
+	{
+		/* every loaded column, lazy ones included: they would write back their stale light when saved */
+		int max = map->mapArea * map->mapArea;
+		list = malloc(max * sizeof *list);
+		if (list == NULL) return 0;
+		for (c = map->chunks, count = 0; max > 0; max --, c ++)
+			if (c->cflags & CFLAG_GOTDATA) list[count++] = c;
+	}
+
+	count = lightingRelight(list, count, map->chunkOffsets, 0, mapUpdateChunkData);
+	free(list);
+	mapUpdateMesh(map);
+
+	return count;
+}
+
+/* column will be relit by mapUpdateRelight() */
+static void mapUpdateLazyLight(Chunk c)
+{
+	if ((c->cflags & CFLAG_RELIGHT) == 0)
+	{
+		if (track.relightCount == track.relightMax)
+		{
+			Chunk * list = realloc(track.relight, (track.relightMax + 64) * sizeof *list);
+			if (list == NULL) return;
+			track.relight = list;
+			track.relightMax += 64;
+		}
+		track.relight[track.relightCount ++] = c;
+		c->cflags |= CFLAG_RELIGHT;
+	}
+}
+
+/* entire content of sub-chunk has been replaced (undo of region): remesh it with its neighbors, relight column later */
+void mapUpdateSection(ChunkData cd)
+{
+	mapUpdateChunkData(cd, (1 << 26) - 1);
+	mapUpdateLazyLight(cd->chunk);
+}
+
+/*
+ * bulk fill: write blocks directly in sub-chunk tables, one span per sub-chunk.
+ */
+
+/* block can be written in tables without side effects on nearby blocks (<withTile>: tile entity will be added by caller) */
+static Bool mapUpdateIsInert(int blockId, Bool withTile)
+{
+	Block b = &blockIds[blockId >> 4];
+	if (b->rsupdate || b->tall || (b->tileEntity && ! withTile) || (blockId >> 4) == RSOBSERVER)
+		return False;
+	switch (b->special) {
+	case BLOCK_DOOR:
+	case BLOCK_DOOR_TOP:
+	case BLOCK_TALLFLOWER:
+	case BLOCK_RAILS:
+	case BLOCK_BED:
+		return False;
+	}
+	return b->orientHint != ORIENT_LEVER;
+}
+
+/* deleting a solid block next to a redstone emitter will need a signal update (see mapUpdateDeleteRedstone()) */
+static Bool mapUpdateNearEmitter(ChunkData cd, int offset)
+{
+	struct BlockIter_t iter;
+	int i;
+	mapInitIterOffset(&iter, cd, offset);
+	for (i = 0; i < 6; i ++)
+	{
+		mapIter(&iter, xoff[i], yoff[i], zoff[i]);
+		if (blockIds[iter.blockIds[iter.offset]].rsupdate & RSUPDATE_SEND)
+			return True;
+	}
+	return False;
+}
+
+/* set blockId and data of <count> consecutive blocks starting at <offset> */
+static void mapUpdateWriteSpan(DATA8 blocks, int offset, int count, int blockId)
+{
+	DATA8   data = blocks + DATA_OFFSET;
+	uint8_t meta = blockId & 15;
+
+	if (count <= 0) return;
+	memset(blocks + offset, blockId >> 4, count);
+	if (offset & 1)
+	{
+		data[offset >> 1] = (data[offset >> 1] & 0x0f) | (meta << 4);
+		offset ++; count --;
+	}
+	if (count & 1)
+	{
+		int last = offset + count - 1;
+		data[last >> 1] = (data[last >> 1] & 0xf0) | meta;
+		count --;
+	}
+	/* now it is aligned on both ends */
+	memset(data + (offset >> 1), meta * 0x11, count >> 1);
+}
+
+/*
+ * set <count> blocks starting at <pos> along +X axis to <blockId>, equivalent to calling mapUpdate() with
+ * UPDATE_SILENT|UPDATE_LAZYLIGHT for each, but without per block overhead. Blocks that have side effects
+ * (redstone, rails, tile entities, ...) will still go through mapUpdate(). Meant to be called within a
+ * mapUpdateInit()/mapUpdateEnd() block. Returns False if <blockId> cannot be set that way.
+ */
+Bool mapUpdateFillRow(Map map, vec4 pos, int count, int blockId)
+{
+	Block b = &blockIds[blockId >> 4];
+	int   x = pos[VX], y = pos[VY], z = pos[VZ];
+	int   layer = y >> 4, written = 0;
+
+	if (! mapUpdateIsInert(blockId, False))
+		return False;
+
+	if (y < 0 || layer >= CHUNK_LIMIT)
+		return True;
+
+	while (count > 0)
+	{
+		Chunk c = mapGetChunk(map, (vec4) {x, y, z});
+		int   start = x & 15;
+		int   span  = MIN(16 - start, count);
+
+		x += span;
+		count -= span;
+		if (c == NULL) continue;
+
+		ChunkData cd = layer < c->maxy ? c->layer[layer] : NULL;
+		if (cd == NULL)
+		{
+			/* filling with air: nothing to do */
+			if (blockId == 0) continue;
+			cd = chunkCreateEmpty(c, layer);
+			renderResetFrustum();
+		}
+
+		DATA8 blocks  = cd->blockIds;
+		DATA8 data    = blocks + DATA_OFFSET;
+		int   base    = CHUNK_BLOCK_POS(0, z & 15, y & 15);
+		int   nearby  = b->updateNearby;
+		int   changed = 0;
+		int   i, run;
+
+		for (i = run = start, span += start; i < span; i ++)
+		{
+			int   offset = base + i;
+			int   oldId  = (blocks[offset] << 4) | (offset & 1 ? data[offset >> 1] >> 4 : data[offset >> 1] & 15);
+			Block old    = &blockIds[oldId >> 4];
+
+			if (oldId == blockId) continue;
+
+			if (! mapUpdateIsInert(oldId, False) || chunkHasTileEntry(cd, offset) ||
+			    (old->type == SOLID && b->type != SOLID && mapUpdateNearEmitter(cd, offset)))
+			{
+				/* slow path: need to check what's around */
+				mapUpdateWriteSpan(blocks, base + run, i - run, blockId);
+				mapUpdate(map, (vec4) {c->X + i, y, z}, blockId, NULL, UPDATE_SILENT | UPDATE_LAZYLIGHT);
+				run = i + 1;
+				continue;
+			}
+
+			undoLog(LOG_BLOCK, oldId, NULL, cd, offset);
+			if (blockId == 0)
+				updateRemove(cd, offset);
+			nearby |= old->updateNearby;
+			changed ++;
+		}
+		if (changed == 0) continue;
+		mapUpdateWriteSpan(blocks, base + run, i - run, blockId);
+
+		/* only the ends of the span can be near another sub-chunk along X */
+		base = (z & 15) << 4;
+		mapUpdateChunkData(cd, nearby ?
+			chunkNearby[slotsXZ[base | start] | slotsY[y & 15]] |
+			chunkNearby[slotsXZ[base | (span - 1)] | slotsY[y & 15]] : 0);
+		mapUpdateLazyLight(c);
+		written += changed;
+	}
+
+	/* cached wire graphs might not be valid anymore */
+	if (written > 0)
+		redstoneNetClearAll();
+
+	return True;
+}
+
+/* same as mapUpdateFillRow(), but along +Y axis: one span per sub-chunk of the column */
+Bool mapUpdateFillColumn(Map map, vec4 pos, int count, int blockId)
+{
+	Block b = &blockIds[blockId >> 4];
+	int   x = pos[VX], y = pos[VY], z = pos[VZ];
+	int   written = 0;
+	Chunk c;
+
+	if (! mapUpdateIsInert(blockId, False))
+		return False;
+
+	if (y < 0) count += y, y = 0;
+	if (y + count > BUILD_HEIGHT) count = BUILD_HEIGHT - y;
+	if (count <= 0 || (c = mapGetChunk(map, pos)) == NULL)
+		return True;
+
+	while (count > 0)
+	{
+		int layer = y >> 4;
+		int start = y & 15;
+		int span  = MIN(16 - start, count);
+
+		y += span;
+		count -= span;
+
+		ChunkData cd = layer < c->maxy ? c->layer[layer] : NULL;
+		if (cd == NULL)
+		{
+			if (blockId == 0) continue;
+			cd = chunkCreateEmpty(c, layer);
+			renderResetFrustum();
+		}
+
+		DATA8 blocks  = cd->blockIds;
+		DATA8 data    = blocks + DATA_OFFSET;
+		int   base    = CHUNK_BLOCK_POS(x & 15, z & 15, 0);
+		int   nearby  = b->updateNearby;
+		int   changed = 0;
+		int   i;
+
+		for (i = start, span += start; i < span; i ++)
+		{
+			int   offset = base + (i << 8);
+			int   oldId  = (blocks[offset] << 4) | (offset & 1 ? data[offset >> 1] >> 4 : data[offset >> 1] & 15);
+			Block old    = &blockIds[oldId >> 4];
+
+			if (oldId == blockId) continue;
+
+			if (! mapUpdateIsInert(oldId, False) || chunkHasTileEntry(cd, offset) ||
+			    (old->type == SOLID && b->type != SOLID && mapUpdateNearEmitter(cd, offset)))
+			{
+				mapUpdate(map, (vec4) {x, (layer << 4) + i, z}, blockId, NULL, UPDATE_SILENT | UPDATE_LAZYLIGHT);
+				continue;
+			}
+
+			undoLog(LOG_BLOCK, oldId, NULL, cd, offset);
+			if (blockId == 0)
+				updateRemove(cd, offset);
+			nearby |= old->updateNearby;
+			changed ++;
+			blocks[offset] = blockId >> 4;
+			if (offset & 1) data[offset >> 1] = (data[offset >> 1] & 0x0f) | ((blockId & 15) << 4);
+			else            data[offset >> 1] = (data[offset >> 1] & 0xf0) | (blockId & 15);
+		}
+		if (changed == 0) continue;
+
+		/* only the ends of the span can be near another sub-chunk along Y */
+		base = slotsXZ[((z & 15) << 4) | (x & 15)];
+		mapUpdateChunkData(cd, nearby ? chunkNearby[base | slotsY[start]] | chunkNearby[base | slotsY[span - 1]] : 0);
+		mapUpdateLazyLight(c);
+		written += changed;
+	}
+
+	if (written > 0)
+		redstoneNetClearAll();
+
+	return True;
+}
+
+/* copy ids and data of <count> blocks from <src> at <soff> to <dst> at <doff> */
+static void mapUpdateCopySpan(DATA8 dst, int doff, DATA8 src, int soff, int count)
+{
+	if (count <= 0) return;
+	memcpy(dst + doff, src + soff, count);
+	for (dst += DATA_OFFSET, src += DATA_OFFSET; count > 0; count --, soff ++, doff ++)
+	{
+		uint8_t data = src[soff >> 1];
+		if (soff & 1) data >>= 4; else data &= 15;
+		if (doff & 1) dst[doff >> 1] = (dst[doff >> 1] & 0x0f) | (data << 4);
+		else          dst[doff >> 1] = (dst[doff >> 1] & 0xf0) | data;
+	}
+}
+
+/*
+ * paste <count> blocks along +X from brush sub-chunk <src> (starting at <srcOffset>) into map at <pos>: the
+ * span cannot cross a sub-chunk boundary, neither in brush nor in map. Like mapUpdateFillRow(), blocks without
+ * side effects are copied in runs directly in tables, and tile entities are copied in the hash table of the
+ * destination. Returns number of blocks copied that way.
+ */
+int mapUpdatePasteRow(Map map, vec4 pos, ChunkData src, int srcOffset, int count, int flags)
+{
+	int   x = pos[VX], y = pos[VY], z = pos[VZ];
+	int   layer = y >> 4;
+	Chunk c;
+
+	if (y < 0 || layer >= CHUNK_LIMIT || (c = mapGetChunk(map, pos)) == NULL)
+		return 0;
+
+	ChunkData cd      = layer < c->maxy ? c->layer[layer] : NULL;
+	DATA8     sblocks = src->blockIds;
+	DATA8     blocks  = cd ? cd->blockIds : NULL;
+	int       base    = CHUNK_BLOCK_POS(x & 15, z & 15, y & 15);
+	int       nearby  = 0;
+	int       changed = 0;
+	int       i, run;
+
+	for (i = run = 0; i < count; i ++)
+	{
+		int   soff    = srcOffset + i;
+		int   offset  = base + i;
+		int   blockId = (sblocks[soff] << 4) | (soff & 1 ? sblocks[DATA_OFFSET + (soff >> 1)] >> 4 : sblocks[DATA_OFFSET + (soff >> 1)] & 15);
+		Block b       = &blockIds[blockId >> 4];
+		int   oldId;
+		DATA8 tile;
+
+		if (blockId == 0 ? flags & PASTE_SKIPAIR : (flags & PASTE_SKIPWATER) && b->special == BLOCK_LIQUID)
+			goto skip;
+
+		if (blocks == NULL)
+		{
+			if (blockId == 0) goto skip;
+			cd = chunkCreateEmpty(c, layer);
+			blocks = cd->blockIds;
+			renderResetFrustum();
+		}
+		oldId = (blocks[offset] << 4) | (offset & 1 ? blocks[DATA_OFFSET + (offset >> 1)] >> 4 : blocks[DATA_OFFSET + (offset >> 1)] & 15);
+		if ((flags & PASTE_ONLYAIR) && oldId > 0)
+			goto skip;
+
+		tile = b->tileEntity ? chunkGetTileEntity(src, soff) : NULL;
+		if (tile == NULL && oldId == blockId && ! chunkHasTileEntry(cd, offset))
+			goto skip;
+
+		Block old = &blockIds[oldId >> 4];
+		if (! mapUpdateIsInert(blockId, True) || ! mapUpdateIsInert(oldId, False) || chunkHasTileEntry(cd, offset) ||
+		    (old->type == SOLID && b->type != SOLID && mapUpdateNearEmitter(cd, offset)))
+		{
+			/* slow path: need to check what's around */
+			mapUpdateCopySpan(blocks, base + run, sblocks, srcOffset + run, i - run);
+			run = i + 1;
+			mapUpdate(map, (vec4) {x + i, y, z}, blockId, tile ? NBT_Copy(tile) : NULL, UPDATE_SILENT | UPDATE_LAZYLIGHT);
+			continue;
+		}
+
+		undoLog(LOG_BLOCK, oldId, NULL, cd, offset);
+		if (blockId == 0)
+			updateRemove(cd, offset);
+		if (tile)
+		{
+			/* brush keeps its own copy (cloned multiple times) */
+			tile = NBT_Copy(tile);
+			chunkUpdateTilePosition(cd, offset, tile);
+			chunkAddTileEntity(cd, offset, tile);
+			chunkMarkForUpdate(c, CHUNK_NBT_TILEENTITIES);
+		}
+		nearby |= b->updateNearby | old->updateNearby;
+		changed ++;
+		continue;
+
+		skip:
+		/* masked: leave that block as is */
+		mapUpdateCopySpan(blocks, base + run, sblocks, srcOffset + run, i - run);
+		run = i + 1;
+	}
+	if (changed == 0) return 0;
+	mapUpdateCopySpan(blocks, base + run, sblocks, srcOffset + run, i - run);
+
+	/* only the ends of the span can be near another sub-chunk along X */
+	base = (z & 15) << 4;
+	mapUpdateChunkData(cd, nearby ?
+		chunkNearby[slotsXZ[base | (x & 15)] | slotsY[y & 15]] |
+		chunkNearby[slotsXZ[base | ((x + count - 1) & 15)] | slotsY[y & 15]] : 0);
+	mapUpdateLazyLight(c);
+
+	/* cached wire graphs might not be valid anymore */
+	redstoneNetClearAll();
+
+	return changed;
+}
+
 /*
  * main entry point for altering voxel tables and keep them consistent.
  */
@@ -1751,11 +2404,20 @@ Bool mapUpdate(Map map, vec4 pos, int blockId, DATA8 tile, int blockUpdate)
 		data = iter.blockIds + DATA_OFFSET + (iter.offset >> 1);
 	}
 
+	/* bbox of this block and its neighbors (connected blocks, doors) might change */
+	mapClearBBoxCache();
 	iter.blockIds[iter.offset] = blockId >> 4;
 	if (iter.offset & 1) *data = (*data & 0x0f) | ((blockId & 0xf) << 4);
 	else                 *data = (*data & 0xf0) | (blockId & 0xf);
 
-	if ((blockUpdate & UPDATE_KEEPLIGHT) == 0)
+	redstoneNetChanged(&iter, oldId, blockId);
+
+	if (blockUpdate & UPDATE_LAZYLIGHT)
+	{
+		/* bulk update: only keep track of what column will need to be relit */
+		mapUpdateLazyLight(iter.ref);
+	}
+	else if ((blockUpdate & UPDATE_KEEPLIGHT) == 0)
 	{
 		/* update skyLight */
 		uint8_t opac   = blockGetSkyOpacity(blockId>>4, 0);
@@ -1863,7 +2525,7 @@ Bool mapUpdate(Map map, vec4 pos, int blockId, DATA8 tile, int blockUpdate)
 	/* deleted block: remove everything there is in this location and add breaking particles if needed */
 	if (blockId == 0)
 	{
-		updateRemove(iter.cd, iter.offset, True);
+		updateRemove(iter.cd, iter.offset);
 		if ((blockUpdate & UPDATE_SILENT) == 0)
 			particlesExplode(map, 4, oldId, pos);
 	}
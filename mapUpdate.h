@@ -10,6 +10,8 @@
 #include "maps.h"
 
 typedef struct BlockUpdate_t *     BlockUpdate;
+typedef struct FloodFill_t *       FloodFill;
+typedef struct FloodSection_t *    FloodSection;
 
 Bool mapUpdate(Map, vec4 pos, int blockId, DATA8 tile, int blockUpdate);
 void mapUpdateBlock(Map, struct BlockIter_t, int blockId, int oldBlockId, DATA8 tile, Bool gravity);
@@ -33,10 +35,18 @@ Bool mapActivate(Map, vec4 pos);
 int  mapActivateBlock(BlockIter, vec4 pos, int blockId);
 void mapUpdateMesh(Map);
 void mapUpdateFlush(Map);
+Bool mapUpdatePending(void);
+void mapUpdateStats(int stats[3]);
 void mapUpdatePush(Map, vec4 pos, int blockId, DATA8 tile);
-void mapUpdateFloodFill(Map, vec4 pos, uint8_t visited[4096], int8_t minMax[8]);
+int  mapUpdateFloodFill(Map, vec4 pos, int budget, int minMax[6]);
 void mapUpdateInit(BlockIter);
 void mapUpdateEnd(Map);
+void mapUpdateRelight(Map);
+int  mapUpdateRelightArea(Map, int range[6]);
+Bool mapUpdateFillRow(Map, vec4 pos, int count, int blockId);
+Bool mapUpdateFillColumn(Map, vec4 pos, int count, int blockId);
+int  mapUpdatePasteRow(Map, vec4 pos, ChunkData src, int srcOffset, int count, int flags);
+void mapUpdateSection(ChunkData);
 
 enum /* extra flags for blockUpdate param from mapUpdate() */
 {
@@ -46,7 +56,15 @@ enum /* extra flags for blockUpdate param from mapUpdate() */
 	UPDATE_KEEPLIGHT = 32,         /* don't change block and sky light (blocks will need an update later though) */
 	UPDATE_DONTLOG   = 64,         /* don't store modification in undo log */
 	UPDATE_UNDOLINK  = 128,        /* more updates will follow, must be cancelled with this one */
-	UPDATE_FORCE     = 256         /* don't check if block is same as currently stored */
+	UPDATE_FORCE     = 256,        /* don't check if block is same as currently stored */
+	UPDATE_LAZYLIGHT = 512         /* light will be recomputed in bulk by mapUpdateRelight() */
+};
+
+enum /* <flags> for mapUpdatePasteRow() */
+{
+	PASTE_SKIPAIR   = 1,           /* air in brush does not overwrite map */
+	PASTE_SKIPWATER = 2,           /* same for liquid */
+	PASTE_ONLYAIR   = 4            /* only replace air blocks in map */
 };
 
 struct BlockUpdate_t
@@ -67,6 +85,7 @@ struct ChunkUpdate_t
 typedef struct BlockUpdate_t       BLOCKBUF;
 typedef struct ChunkUpdate_t *     ChunkUpdate;
 typedef struct UpdateBuffer_t *    UpdateBuffer;
+typedef struct UpdateHash_t *      UpdateHash;
 
 struct UpdateBuffer_t              /* group BlockUpdate_t in chunk of 128 */
 {
@@ -75,21 +94,64 @@ struct UpdateBuffer_t              /* group BlockUpdate_t in chunk of 128 */
 	BLOCKBUF buffer[128];
 };
 
+struct UpdateHash_t                /* index pending updates by cd/offset */
+{
+	BlockUpdate update;
+	int         index;             /* insertion order + 1 (0 = free slot) */
+};
+
 struct MapUpdate_t
 {
 	ChunkUpdate modif;             /* chunk list being modified in the current chain */
 	ListHead    updates;           /* async updates (UpdateBuffer) */
+	UpdateBuffer updateTail;       /* buffer where next update will be added */
+	UpdateHash  updateHash;        /* open addressing, linear probing */
+	int         updateHashMask;
 	int         updateCount;       /* total updates waiting to be applied */
+	int         updateIndex;       /* updates added since last flush */
+	int         updateFlushed;     /* updates already applied by current flush */
+	int         statQueued;        /* stats: total updates added */
+	int         statDeduped;       /* stats: updates discarded because already pending */
+	int         statFlushed;       /* stats: updates applied */
 	int         nbCheck;           /* re-check piston blocked */
 	int         modifCount;        /* chunks waiting for mesh update in modif[] */
 	int         modifMax;          /* max capacity of arrray modif[] */
+	Chunk *     relight;           /* columns modified with UPDATE_LAZYLIGHT */
+	int         relightCount;
+	int         relightMax;
 	BlockUpdate curUpdate;         /* used by piston update order */
 	BlockIter   iter;              /* mapUpdate() will use an external iterator (mostly used by selection) */
 	int8_t *    coord;             /* ring buffer */
-	int16_t     max;               /* params for ring buffer */
-	int16_t     pos, last, usage;
-	int16_t     maxUsage;          /* debug */
+	DATA8       queued;            /* bitfield of coord in ring buffer if <unique> is set (TRACK_QUEUED_SIZE) */
+	int         max;               /* params for ring buffer */
+	int         pos, last, usage;
+	int         maxUsage;          /* debug */
 	uint8_t     unique;            /* values will be unique in <coord> */
 };
 
+/* coord in ring buffer are relative: X is 5bits, Y and Z 8bits */
+#define TRACK_QUEUED_SIZE          ((32*256*256) >> 3)
+
+struct FloodSection_t              /* sub-chunk reached by mapUpdateFloodFill() */
+{
+	int         key;               /* sub-chunk coord */
+	DATA8       visited;           /* 4096 bits (NULL = free slot) */
+};
+
+struct FloodFill_t
+{
+	Map         map;
+	int         blockId;           /* block being looked for */
+	FloodSection sections;         /* hash table (open addressing, linear probing) */
+	int         count, max;
+	int *       seeds;             /* stack of XYZ coord */
+	int         seedCount, seedMax;
+	int         lastKey;           /* sub-chunk of last block checked */
+	DATA8       blocks;
+	DATA8       visited;
+	int         total;             /* blocks selected so far */
+};
+
+#define FLOOD_STACK                (3 * 1024)
+
 #endif
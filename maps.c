@@ -11,6 +11,9 @@
 #include <string.h>
 #include <malloc.h>
 #include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 #include "meshBanks.h"
 #include "render.h"
 #include "blocks.h"
@@ -18,6 +21,7 @@
 #include "particles.h"
 #include "entities.h"
 #include "waypoints.h"
+#include "selection.h"
 #include "globals.h"
 
 
@@ -56,6 +60,8 @@ ChunkData chunkAir;
 
 extern uint8_t openDoorDataToModel[];
 
+static struct BBoxCache_t bboxCache = {.stamp = 1};
+
 int mapFirstFree(DATA32 usage, int count)
 {
 	DATA32 eof = usage + count;
@@ -233,7 +239,7 @@ int getBlockId(BlockIter iter)
 }
 
 /* get bounding box from block pointed by iter */
-VTXBBox mapGetBBox(BlockIter iterator, int * count, int * cnxFlags)
+static VTXBBox mapComputeBBox(BlockIter iterator, int * count, int * cnxFlags)
 {
 	*count = 0;
 	if (iterator->blockIds == NULL)
@@ -310,6 +316,74 @@ VTXBBox mapGetBBox(BlockIter iterator, int * count, int * cnxFlags)
 	return NULL;
 }
 
+/*
+ * same as mapComputeBBox(), but neighboring entities will mostly check the same blocks: keep results until
+ * the map is modified or the next tick starts (see mapClearBBoxCache()). Main thread only (only <stamp> can be
+ * changed by other threads).
+ */
+VTXBBox mapGetBBox(BlockIter iterator, int * count, int * cnxFlags)
+{
+	if (iterator->blockIds == NULL || bboxCache.disabled)
+		return mapComputeBBox(iterator, count, cnxFlags);
+
+	ChunkData cd = iterator->cd;
+	uint32_t  key = ((uint32_t) ((size_t) cd >> 4) ^ iterator->offset * 0x9E3779B1u) >> 8;
+	struct BBoxCacheEntry_t * entry = bboxCache.entries + (key & (BBOX_CACHE_SIZE-1));
+
+	uint32_t  stamp = __atomic_load_n(&bboxCache.stamp, __ATOMIC_ACQUIRE);
+
+	if (entry->stamp == stamp && entry->cd == cd && entry->offset == iterator->offset)
+	{
+		bboxCache.hit ++;
+		*count = entry->count;
+		*cnxFlags = entry->cnxFlags;
+		return entry->box;
+	}
+	bboxCache.miss ++;
+	*cnxFlags = 0xffff;
+	VTXBBox box = mapComputeBBox(iterator, count, cnxFlags);
+
+	/* stairs bbox is generated in a static buffer: can't keep a reference to it */
+	if ((blockIds[iterator->blockIds[iterator->offset]].special & 31) != BLOCK_STAIRS)
+	{
+		entry->cd = cd;
+		entry->stamp = stamp;
+		entry->offset = iterator->offset;
+		entry->cnxFlags = *cnxFlags;
+		entry->count = *count;
+		entry->box = box;
+	}
+	return box;
+}
+
+/* called whenever blocks are modified: can be called from any thread (mapUpdate() is used by selection threads) */
+void mapClearBBoxCache(void)
+{
+	__atomic_add_fetch(&bboxCache.stamp, 1, __ATOMIC_RELEASE);
+}
+
+/* called at the start of a tick: main thread only */
+void mapResetBBoxCache(void)
+{
+	if (__atomic_add_fetch(&bboxCache.stamp, 1, __ATOMIC_RELEASE) >= 1u<<31)
+	{
+		/* way before wrap around: clear entries that could look valid again */
+		memset(bboxCache.entries, 0, sizeof bboxCache.entries);
+		__atomic_store_n(&bboxCache.stamp, 1, __ATOMIC_RELEASE);
+	}
+}
+
+#ifdef DEBUG
+void mapBBoxCacheStats(Bool enable, int stats[2])
+{
+	stats[0] = bboxCache.hit;
+	stats[1] = bboxCache.miss;
+	bboxCache.hit = bboxCache.miss = 0;
+	bboxCache.disabled = ! enable;
+	mapResetBBoxCache();
+}
+#endif
+
 
 
 /*
@@ -586,7 +660,7 @@ static void mapMarkLazyChunk(Map map)
 		{
 			if (chunk->entityList != ENTITY_END)
 				entityUnload(chunk);
-			chunk->cflags &= ~CFLAG_HASENTITY;
+			chunk->cflags &= ~(CFLAG_HASENTITY | CFLAG_LAZYENT);
 		}
 
 		/* also free lazy chunks that are not at their place */
@@ -604,6 +678,45 @@ static void mapMarkLazyChunk(Map map)
 	}
 }
 
+/* entities (and tile entities) are only decoded for chunks within entity distance of map center */
+Bool mapInEntityRange(Map map, Chunk c)
+{
+	int dist = globals.entityDist;
+	int max  = map->maxDist >> 1;
+
+	if (map->center == NULL) return True;
+	if (dist == 0 || dist > max) dist = max;
+
+	return abs(c->X - map->center->X) <= dist << 4 &&
+	       abs(c->Z - map->center->Z) <= dist << 4;
+}
+
+/* decode entities of chunks that came within entity distance, discard the ones of chunks that left (not MT safe!) */
+static void mapUpdateEntityRange(Map map)
+{
+	Chunk c;
+	int   i;
+	Bool  busy = selectionIsBusy();
+
+	for (i = map->mapArea * map->mapArea, c = map->chunks; i > 0; i --, c ++)
+	{
+		if ((c->cflags & CFLAG_GOTDATA) == 0) continue;
+
+		if (mapInEntityRange(map, c))
+		{
+			if (c->cflags & CFLAG_LAZYENT)
+				chunkDecodeEntities(c);
+			continue;
+		}
+		/* tile entities will be expanded again on first access: selection thread might be reading them */
+		if (! busy) chunkDropTileEntities(c);
+
+		if ((c->cflags & (CFLAG_HASENTITY | CFLAG_LAZYENT)) == CFLAG_HASENTITY && c->entityList != ENTITY_END &&
+		    entityUnloadIdle(c))
+			c->cflags |= CFLAG_LAZYENT;
+	}
+}
+
 /* chunks are stored in a 2D circular array (circular horizontally and vertically) */
 Bool mapMoveCenter(Map map, vec4 old, vec4 pos)
 {
@@ -629,6 +742,10 @@ Bool mapMoveCenter(Map map, vec4 old, vec4 pos)
 		int count = mapRedoGenList(map);
 		map->center = map->chunks + (map->mapX + map->mapZ * area);
 		mapMarkLazyChunk(map);
+		/* ChunkData freed can be reallocated with a different content */
+		mapResetBBoxCache();
+		/* meshing threads are stopped at this point */
+		mapUpdateEntityRange(map);
 		meshAddToProcess(map, count);
 		//mapShowChunks(map);
 
@@ -923,7 +1040,7 @@ Map mapInitFromPath(STRPTR path, int renderDist)
 		fprintf(stderr, "center = %d, %d\n", map->center->X, map->center->Z);
 		#endif
 
-		quadTreeInit(xyz[VX] - 1, xyz[VZ] - 1, map->maxDist * 16);
+		entityGridInit(map->maxDist);
 
 		return map;
 	}
@@ -1142,7 +1259,7 @@ void mapFreeLightingSlot(Map map, int lightId)
 {
 	LightingTex lightTex;
 
-	for (lightTex = HEAD(map->lightingTex); lightTex && (lightId & 127) > 0; NEXT(lightTex), lightId ++);
+	for (lightTex = HEAD(map->lightingTex); lightTex && (lightId & 127) > 0; NEXT(lightTex), lightId --);
 
 	if (lightTex)
 	{
@@ -1164,6 +1281,7 @@ void mapFreeLightingSlot(Map map, int lightId)
 #define UNVISITED           0x40
 #define VISIBLE             0x80
 #define UNCERTAIN           0x80
+#define FRUSTUM_GUARD       1.1f   /* widen X/Y planes by this factor: allow small rotations without rebuilding visible list */
 //#define FRUSTUM_DEBUG
 
 static ChunkData mapAllocFakeChunk(Map map)
@@ -1205,6 +1323,69 @@ static void mapFreeFakeChunk(ChunkData cd)
 	//fprintf(stderr, "free fake chunk at %d, %d, %d: %d\n", c->X, cd->Y, c->Z, cd->slot);
 }
 
+/*
+ * compute frustum sector of all the corners of a column (CHUNK_LIMIT+1 points), 4 at a time: for a given
+ * column, only Y varies, therefore clip coord is <base> + Y * <column 1 of MVP>. X and Y planes are
+ * pushed outward by FRUSTUM_GUARD, to be able to reuse the visible list for small rotations.
+ */
+static void mapGetColumnOutFlags(Chunk column)
+{
+	float * mvp  = globals.matMVP;
+	DATA8   dest = column->outflags;
+	float   base[4], step[4];
+	int     i;
+
+	for (i = 0; i < 4; i ++)
+	{
+		base[i] = mvp[A00+i] * column->X + mvp[A02+i] * column->Z + mvp[A03+i];
+		step[i] = mvp[A01+i] * 16;
+	}
+
+	#ifdef __SSE__
+	__m128 Y = _mm_set_ps(3, 2, 1, 0);
+	for (i = 0; i < CHUNK_LIMIT+1; i += 4, Y = _mm_add_ps(Y, _mm_set1_ps(4)))
+	{
+		__m128 x  = _mm_add_ps(_mm_set1_ps(base[0]), _mm_mul_ps(Y, _mm_set1_ps(step[0])));
+		__m128 y  = _mm_add_ps(_mm_set1_ps(base[1]), _mm_mul_ps(Y, _mm_set1_ps(step[1])));
+		__m128 z  = _mm_add_ps(_mm_set1_ps(base[2]), _mm_mul_ps(Y, _mm_set1_ps(step[2])));
+		__m128 w  = _mm_add_ps(_mm_set1_ps(base[3]), _mm_mul_ps(Y, _mm_set1_ps(step[3])));
+		__m128 wg = _mm_mul_ps(w, _mm_set1_ps(FRUSTUM_GUARD));
+		__m128 nwg = _mm_sub_ps(_mm_setzero_ps(), wg);
+		int left   = _mm_movemask_ps(_mm_cmple_ps(x, nwg));
+		int right  = _mm_movemask_ps(_mm_cmpge_ps(x, wg));
+		int bottom = _mm_movemask_ps(_mm_cmple_ps(y, nwg));
+		int top    = _mm_movemask_ps(_mm_cmpge_ps(y, wg));
+		int front  = _mm_movemask_ps(_mm_cmple_ps(z, _mm_sub_ps(_mm_setzero_ps(), w)));
+		int back   = _mm_movemask_ps(_mm_cmpge_ps(z, w));
+
+		int j;
+		for (j = 0; j < 4 && i + j < CHUNK_LIMIT+1; j ++)
+		{
+			dest[i+j] = (dest[i+j] & VISIBLE) |
+				((left >> j) & 1) | (((right >> j) & 1) << 1) | (((bottom >> j) & 1) << 2) |
+				(((top >> j) & 1) << 3) | (((front >> j) & 1) << 4) | (((back >> j) & 1) << 5);
+		}
+	}
+	#else
+	for (i = 0; i < CHUNK_LIMIT+1; i ++)
+	{
+		float   x = base[0] + step[0] * i;
+		float   y = base[1] + step[1] * i;
+		float   z = base[2] + step[2] * i;
+		float   w = base[3] + step[3] * i;
+		float   wg = w * FRUSTUM_GUARD;
+		uint8_t sector = 0;
+		if (x <= -wg) sector |= 1;  /* to the left of left plane */
+		if (x >=  wg) sector |= 2;  /* to the right of right plane */
+		if (y <= -wg) sector |= 4;  /* below the bottom plane */
+		if (y >=  wg) sector |= 8;  /* above top plane */
+		if (z <= -w)  sector |= 16; /* behind near plane */
+		if (z >=  w)  sector |= 32; /* after far plane */
+		dest[i] = (dest[i] & VISIBLE) | sector;
+	}
+	#endif
+}
+
 static int mapGetOutFlags(Map map, ChunkData cur, DATA8 outflags)
 {
 	uint8_t out, i, sector;
@@ -1221,22 +1402,11 @@ static int mapGetOutFlags(Map map, ChunkData cur, DATA8 outflags)
 			neighbor->chunkFrame = map->frame;
 		}
 		int Y = layer + (dir[i]>>4);
-		if ((sector = neighbor->outflags[Y]) & UNVISITED)
-		{
-			vec4 point = {neighbor->X, Y << 4, neighbor->Z, 1};
-
-			sector &= ~0x7f;
-			/* XXX global var for MVP, should be a function param */
-			matMultByVec(point, globals.matMVP, point);
-			if (point[0] <= -point[3]) sector |= 1;  /* to the left of left plane */
-			if (point[0] >=  point[3]) sector |= 2;  /* to the right of right plane */
-			if (point[1] <= -point[3]) sector |= 4;  /* below the bottom plane */
-			if (point[1] >=  point[3]) sector |= 8;  /* above top plane */
-			if (point[2] <= -point[3]) sector |= 16; /* behind near plane */
-			if (point[2] >=  point[3]) sector |= 32; /* after far plane */
-			sector = (neighbor->outflags[Y] = sector) & 63;
-		}
-		else sector &= 63;
+		if (neighbor->outflags[Y] & UNVISITED)
+			/* first time this column is reached in this frame: do all the corners in one pass */
+			mapGetColumnOutFlags(neighbor);
+
+		sector = neighbor->outflags[Y] & 63;
 		if (sector == 0)
 			/* point of the chunk is entirely included in frustum: add all connected chunks to the list */
 			neighbors |= frustum.neighbors[i];
@@ -1406,7 +1576,35 @@ static void mapCullCave(ChunkData cur, vec4 camera)
 	}
 }
 
-void mapViewFrustum(Map map, vec4 camera)
+/*
+ * check if visible list from previous frame can be kept: new frustum must be entirely contained within
+ * the widened (by FRUSTUM_GUARD) frustum used to build the list. Frustum is convex, therefore checking
+ * its 8 corners is enough (z is ignored: near plane is way smaller than a chunk).
+ */
+static Bool mapFrustumIsCached(Map map, vec4 camera)
+{
+	int i;
+
+	if (frustum.cacheFrame != map->frame ||
+	    frustum.cacheCell[VX] != CPOS(camera[VX]) ||
+	    frustum.cacheCell[VY] != CPOS(camera[VY]) ||
+	    frustum.cacheCell[VZ] != CPOS(camera[VZ]))
+		return False;
+
+	for (i = 0; i < 8; i ++)
+	{
+		vec4 corner = {i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1, 1};
+		matMultByVec(corner, globals.matInvMVP, corner);
+		matMultByVec(corner, frustum.cacheMVP, corner);
+		if (corner[VT] <= 0) return False;
+		float max = corner[VT] * FRUSTUM_GUARD;
+		if (fabsf(corner[VX]) > max || fabsf(corner[VY]) > max)
+			return False;
+	}
+	return True;
+}
+
+void mapViewFrustum(Map map, vec4 camera, Bool viewOnly)
 {
 	ChunkData * prev;
 	ChunkData   cur, last;
@@ -1414,6 +1612,15 @@ void mapViewFrustum(Map map, vec4 camera)
 	int         frame;
 	int         center[3];
 
+	if (viewOnly && mapFrustumIsCached(map, camera))
+	{
+		/* only view matrix has changed, and not by much: current list is still valid */
+		frustum.reused ++;
+		return;
+	}
+
+	frustum.cacheFrame = 0;
+	frustum.reused = 0;
 	chunk = mapGetChunk(map, camera);
 
 	center[VY] = CPOS(camera[1]);
@@ -1525,6 +1732,12 @@ void mapViewFrustum(Map map, vec4 camera)
 	memset(chunk->outflags, UNVISITED, sizeof chunk->outflags);
 	chunk->outflags[cur->Y>>4] |= VISIBLE;
 
+	memcpy(frustum.cacheMVP, globals.matMVP, sizeof frustum.cacheMVP);
+	frustum.cacheFrame = frame;
+	frustum.cacheCell[VX] = CPOS(camera[VX]);
+	frustum.cacheCell[VY] = CPOS(camera[VY]);
+	frustum.cacheCell[VZ] = CPOS(camera[VZ]);
+
 	for (last = cur; cur; cur = *prev)
 	{
 		uint8_t outflags[9];
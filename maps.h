@@ -63,6 +63,10 @@ struct Frustum_t                   /* frustum culling static tables (see doc/int
 	uint16_t  lazyCount;
 	int8_t *  spiral;
 	int8_t *  lazy;
+	mat4      cacheMVP;            /* MVP used to build current visible list (widened by FRUSTUM_GUARD) */
+	int       cacheCell[3];        /* chunk coord of camera when visible list was built */
+	int       cacheFrame;          /* map->frame of cached list (0 = invalid) */
+	int       reused;              /* stat for debug: consecutive frames that reused visible list */
 };
 
 struct MapExtraData_t              /* extra info returned from mapPointToObject() and mapGetBlockId() */
@@ -116,14 +120,20 @@ Bool    mapSaveLevelDat(Map);
 int     mapGetConnect(ChunkData cd, int offset, BlockState b);
 int     mapConnectChest(Map, MapExtraData sel, MapExtraData ret);
 Bool    mapUpdateNBT(MapExtraData sel, NBTFile nbt);
-void    mapViewFrustum(Map, vec4 camera);
+void    mapViewFrustum(Map, vec4 camera, Bool viewOnly);
 int     mapIsPositionInLiquid(Map, vec4 pos);
 int     mapFirstFree(uint32_t * usage, int count);
 Chunk   mapGetChunk(Map, vec4 pos);
 VTXBBox mapGetBBox(BlockIter iterator, int * count, int * cnxFlags);
+void    mapClearBBoxCache(void);
+void    mapResetBBoxCache(void);
+#ifdef DEBUG
+void    mapBBoxCacheStats(Bool enable, int stats[2]);
+#endif
 int     getBlockId(BlockIter iter);
 uint8_t mapGetSkyBlockLight(BlockIter iter);
 void    mapAddToSaveList(Map, Chunk chunk);
+Bool    mapInEntityRange(Map, Chunk chunk);
 int     mapAllocLightingTex(Map);
 void    mapFreeLightingSlot(Map, int lightId);
 void    printCoord(BlockIter);
@@ -150,4 +160,24 @@ struct ChunkFake_t
 	uint8_t   buffer[0]; /* more bytes will follow */
 };
 
+#define BBOX_CACHE_SIZE            1024
+
+struct BBoxCacheEntry_t            /* result of mapGetBBox() for one block */
+{
+	ChunkData cd;
+	uint32_t  stamp;               /* entry is valid if equal to BBoxCache_t.stamp */
+	uint16_t  offset;
+	uint16_t  cnxFlags;
+	VTXBBox   box;
+	int       count;
+};
+
+struct BBoxCache_t                 /* block collision boxes shared by all entities during one tick */
+{
+	struct BBoxCacheEntry_t entries[BBOX_CACHE_SIZE];
+	uint32_t  stamp;               /* incremented to invalidate all entries */
+	uint8_t   disabled;            /* debug */
+	int       hit, miss;
+};
+
 #endif
@@ -95,10 +95,7 @@ static void meshGenAsync(void * arg)
 			if (chunkLoad(load, map->path,
 					X + (dir & 8 ? -16 : dir & 2 ? 16 : 0),
 					Z + (dir & 4 ? -16 : dir & 1 ? 16 : 0)))
-			{
-				chunkExpandTileEntities(load);
 				load->cflags |= CFLAG_GOTDATA;
-			}
 			load->processing = 0;
 
 			if (threadStop) goto bail;
@@ -163,10 +160,7 @@ void meshInitThreads(Map map)
 	/* already load center chunk */
 	Chunk center = map->center;
 	if (chunkLoad(center, map->path, center->X, center->Z))
-	{
-		chunkExpandTileEntities(center);
 		center->cflags |= CFLAG_GOTDATA;
-	}
 //	NBT_Dump(&center->nbt, 0, 0, 0);
 
 	int nb;
@@ -950,10 +944,7 @@ void meshGenerateST(Map map)
 			{
 				if (chunkLoad(load, map->path, X + (dir & 8 ? -16 : dir & 2 ? 16 : 0),
 						Z + (dir & 4 ? -16 : dir & 1 ? 16 : 0)))
-				{
-					chunkExpandTileEntities(load);
 					load->cflags |= CFLAG_GOTDATA;
-				}
 			}
 		}
 		if ((list->cflags & CFLAG_GOTDATA) == 0)
@@ -994,6 +985,8 @@ void meshGenerateST(Map map)
 		if ((list->cflags & CFLAG_HASENTITY) == 0)
 		{
 			chunkExpandEntities(list);
+			if (mapInEntityRange(map, list))
+				chunkDecodeEntities(list);
 			updateParseNBT(list);
 		}
 
@@ -1122,6 +1115,8 @@ void meshGenerateMT(Map map)
 				if ((chunk->cflags & CFLAG_HASENTITY) == 0)
 				{
 					chunkExpandEntities(chunk);
+					if (mapInEntityRange(map, chunk))
+						chunkDecodeEntities(chunk);
 					updateParseNBT(chunk);
 				}
 			}
@@ -503,7 +503,7 @@ static Bool minecartCreate(vec4 pos, STRPTR tech)
 	/* orient minecart according to player orientation */
 	entity->rotation[0] = globals.yawPitch[0];
 	entity->VBObank = entityGetModelId(entity);
-	quadTreeInsertItem(entity);
+	entityGridInsert(entity);
 
 	/* entity texture bank (for shader) */
 	entity->pos[VT] = 2;
@@ -577,8 +577,7 @@ Bool minecartTryUsing(ItemID_t itemId, vec4 pos, int pointToBlock)
 	points[VZ+3] = lines[1] + 0.5f;
 	points[VY+3] = points[VY]+0.6f;
 
-	quadTreeIntersect(points, &i, ENFLAG_ANYENTITY);
-	if (i == 0)
+	if (entityGridQuery(points, ENFLAG_ANYENTITY, NULL, 0) == 0)
 	{
 		TEXT techName[32];
 		points[VX] = lines[0];
@@ -13,6 +13,7 @@
 #include <math.h>
 #include "blocks.h"
 #include "particles.h"
+#include "render.h"
 #include "glad.h"
 #include "globals.h"
 
@@ -26,10 +27,21 @@ static struct ENTBBox_t  particleBBox = {
 
 //#define NOEMITTERS
 
-Bool particlesInit(void)
+static void emitterInitPool(void)
 {
-	ParticleList list = calloc(sizeof *list, 1);
+	int i;
+	for (i = 0; i < EMITTERS_MAX; i ++)
+		emitters.buffer[i].next = i + 1;
+	emitters.buffer[i-1].next = -1;
+	emitters.freeSlot = 0;
+	emitters.count = 0;
+	emitters.full = 0;
+	memset(emitters.cacheLoc, 0, sizeof emitters.cacheLoc);
+	memset(emitters.startIds, 0xff, sizeof emitters.startIds);
+}
 
+Bool particlesInit(void)
+{
 	particles.shader = createGLSLProgram("particles.vsh", "particles.fsh", "particles.gsh");
 	if (! particles.shader)
 		/* error message already showed */
@@ -47,8 +59,6 @@ Bool particlesInit(void)
 	glEnableVertexAttribArray(1);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	ListAddTail(&particles.buffers, &list->node);
-
 	int x, z, y, i;
 	for (x = z = y = -1, i = 0; i < 27; i ++)
 	{
@@ -61,81 +71,80 @@ Bool particlesInit(void)
 				z = -1, y ++;
 		}
 	}
-	memset(emitters.startIds, 0xff, sizeof emitters.startIds);
+	emitterInitPool();
 	return True;
 }
 
 /* map about to be closed */
 void particleDelAll(void)
 {
-	ParticleList list = (ParticleList) ListRemHead(&particles.buffers);
-	list->count = 0;
-	memset(list->usage, 0, sizeof list->usage);
 	particles.count = 0;
+	emitterInitPool();
+}
 
-	ListNode * node;
-	while ((node = ListRemHead(&particles.buffers)))
-		free(node);
-
-	ListAddTail(&particles.buffers, &list->node);
+/* get a free slot at end of pool */
+static int particlesAlloc(void)
+{
+	int i = particles.count;
 
-	free(emitters.active);
-	free(emitters.buffer);
+	if (i == PARTICLES_MAX)
+		return -1;
 
-	memset(&emitters, 0, offsetof(struct EmitterPrivate_t, startIds));
-	memset(emitters.startIds, 0xff, sizeof emitters.startIds);
+	particles.count ++;
+	memset(particles.physics + i, 0, sizeof particles.physics[0]);
+	particles.UV[i]    = 0;
+	particles.time[i]  = 0;
+	particles.ttl[i]   = 0;
+	particles.color[i] = 0;
+	particles.size[i]  = 0;
+	particles.delay[i] = 0;
+	return i;
 }
 
-static Particle particlesAlloc(void)
+/* particle <i> expired: move last one in its slot (order does not matter) */
+static void particlesFree(int i)
 {
-	ParticleList list;
-
-	if (particles.count == PARTICLES_MAX)
-		return NULL;
-
-	for (list = HEAD(particles.buffers); list; NEXT(list))
+	int last = -- particles.count;
+	if (i < last)
 	{
-		int nth = mapFirstFree(list->usage, 4);
-		if (nth >= 0)
-		{
-			/* try at end of array */
-			particles.count ++;
-			list->count ++;
-			memset(list->buffer + nth, 0, sizeof list->buffer[0]);
-			return list->buffer + nth;
-		}
+		particles.physics[i] = particles.physics[last];
+		particles.UV[i]      = particles.UV[last];
+		particles.time[i]    = particles.time[last];
+		particles.ttl[i]     = particles.ttl[last];
+		particles.color[i]   = particles.color[last];
+		particles.size[i]    = particles.size[last];
+		particles.delay[i]   = particles.delay[last];
 	}
-	list = calloc(sizeof *list, 1);
-	ListAddTail(&particles.buffers, &list->node);
-	list->usage[0] = 1;
-	list->count = 1;
-	particles.count ++;
-	return list->buffer;
 }
 
 #ifndef NOEMITTERS
 static Emitter emitterAlloc(void)
 {
-	int count = emitters.count;
-	int max   = emitters.max;
-	if (count == max)
+	int slot = emitters.freeSlot;
+	if (slot < 0)
 	{
-		emitters.max = max += 32;
-		Emitter emit = realloc(emitters.buffer, max * sizeof *emit + (max >> 5) * 4);
-		if (emit)
-		{
-			emitters.buffer = emit;
-			/* move usage flags at end of buffer */
-			count >>= 5;
-			memmove(emitters.usage = (DATA32) (emit + max), emit + (count<<5), count * 4);
-			emitters.usage[count] = 0;
-			max = count + 1;
-		}
-		else return NULL;
+		#ifdef DEBUG
+		/* not fatal: emitters of farthest sub-chunks won't spawn anything */
+		if (! emitters.full)
+			fprintf(stderr, "emitter pool full (%d slots): ignoring new emitters\n", EMITTERS_MAX);
+		emitters.full = 1;
+		#endif
+		return NULL;
 	}
-	else max >>= 5;
+	Emitter emit = emitters.buffer + slot;
+	emitters.freeSlot = emit->next;
 	emitters.count ++;
-	return emitters.buffer + mapFirstFree(emitters.usage, max);
+	return emit;
+}
+
+static void emitterFree(int slot)
+{
+	emitters.buffer[slot].next = emitters.freeSlot;
+	emitters.freeSlot = slot;
+	emitters.count --;
+	#ifdef DEBUG
+	emitters.full = 0;
+	#endif
 }
 #endif
 
@@ -164,7 +173,6 @@ static void particlesGetBlockInfo(Map map, vec4 pos, DATA8 plight)
 
 void particlesExplode(Map map, int count, int blockId, vec4 pos)
 {
-	Particle p = NULL;
 	BlockState b = blockGetById(blockId);
 
 	/* invalid state id (none defined in blocksTable.js) */
@@ -175,6 +183,7 @@ void particlesExplode(Map map, int count, int blockId, vec4 pos)
 	float step = 1. / (count+1);
 	uint8_t light;
 
+	/* all bits will share that light value */
 	particlesGetBlockInfo(map, pos, &light);
 
 	for (y = 1; y <= count; y ++)
@@ -184,7 +193,7 @@ void particlesExplode(Map map, int count, int blockId, vec4 pos)
 		for (x = 1; x <= count; x ++)
 		{
 			float xp = pos[VX] + x * step;
-			for (z = 1; z <= count; z ++, p ++)
+			for (z = 1; z <= count; z ++)
 			{
 				float zp = pos[VZ] + z * step;
 				float pitch = RandRange(M_PI/6, M_PI_2);
@@ -197,40 +206,42 @@ void particlesExplode(Map map, int count, int blockId, vec4 pos)
 				 * the speed of particles have been calibrated with 40fps
 				 * but can be linearly scaled to match any other fps
 				 */
-				p = particlesAlloc();
-				if (p == NULL) return;
-				p->physics.dir[VX] = cosf(yaw) * cp * 0.1f;
-				p->physics.dir[VZ] = sinf(yaw) * cp * 0.1f;
-				p->physics.dir[VY] = sinf(pitch) * 0.1f;
+				int n = particlesAlloc();
+				if (n < 0) return;
+				PhysicsEntity p = particles.physics + n;
+				p->dir[VX] = cosf(yaw) * cp * 0.1f;
+				p->dir[VZ] = sinf(yaw) * cp * 0.1f;
+				p->dir[VY] = sinf(pitch) * 0.1f;
 
-				p->physics.loc[VX] = xp;
-				p->physics.loc[VY] = yp;
-				p->physics.loc[VZ] = zp;
+				p->loc[VX] = xp;
+				p->loc[VY] = yp;
+				p->loc[VZ] = zp;
 
-				physicsInitEntity(&p->physics, blockId);
+				physicsInitEntity(p, blockId);
 
-				p->physics.light = light;
-				p->physics.bbox = &particleBBox;
+				p->light = light;
+				p->bbox = &particleBBox;
 
 				int V = b->nzV;
 				int U = b->nzU;
 				if (V == 62 && U < 17) V = 63; /* biome dependent color */
 
 				U = (U * 16 + (int) (x * step * 16)) | ((V * 16 + (int) (y * step * 16)) << 9);
-				p->size = 2 + rand() % 8;
-				p->UV = PARTICLE_BITS | (p->size << 6) | (U << 10);
-				p->ttl = RandRange(1000, 1500);
-				p->time = globals.curTime + p->ttl;
+				particles.size[n] = 2 + rand() % 8;
+				particles.UV[n]   = PARTICLE_BITS | (particles.size[n] << 6) | (U << 10);
+				particles.ttl[n]  = RandRange(1000, 1500);
+				particles.time[n] = globals.curTime + particles.ttl[n];
 			}
 		}
 	}
 }
 
 /* init a SMOKE particle */
-static Particle particlesSmoke(Map map, int blockId, vec4 pos)
+static int particlesSmoke(int blockId, vec4 pos)
 {
-	Particle p = particlesAlloc();
-	if (p == NULL) return NULL;
+	int n = particlesAlloc();
+	if (n < 0) return -1;
+	PhysicsEntity p = particles.physics + n;
 	Block b = &blockIds[blockId >> 4];
 	int range = RandRange(b->particleTTL, b->particleTTL * 3);
 	int UV    = 31 * 16 + ((9*16) << 9);
@@ -238,104 +249,97 @@ static Particle particlesSmoke(Map map, int blockId, vec4 pos)
 
 	blockGetEmitterLocation(blockId, offset);
 
-	memset(p, 0, sizeof *p);
-	p->physics.loc[0] = pos[0] + offset[0];
-	p->physics.loc[1] = pos[1] + offset[1];
-	p->physics.loc[2] = pos[2] + offset[2];
-	p->time = globals.curTime + range;
+	p->loc[0] = pos[0] + offset[0];
+	p->loc[1] = pos[1] + offset[1];
+	p->loc[2] = pos[2] + offset[2];
+	particles.time[n] = globals.curTime + range;
 	/* will rise in the air */
-	p->physics.dir[VY] = 0.01;
-	p->physics.bbox = &particleBBox;
-	p->ttl = range;
+	p->dir[VY] = 0.01;
+	p->bbox = &particleBBox;
+	particles.ttl[n] = range;
 
-	p->size = 6 + rand() % 6;
-	p->UV = PARTICLE_SMOKE | (UV << 10) | (p->size << 6);
+	particles.size[n] = 6 + rand() % 6;
+	particles.UV[n] = PARTICLE_SMOKE | (UV << 10) | (particles.size[n] << 6);
 
 	if ((blockId >> 4) == RSWIRE)
 	{
 		int8_t color = (blockId & 15) - (rand() & 3);
 		if (color < 0) color = 0;
-		p->color = color + (56 << 4),
+		particles.color[n] = color + (56 << 4),
 		/* way slower */
-		p->physics.dir[VY] = 0.005;
+		p->dir[VY] = 0.005;
 	}
 	else if (b->category == REDSTONE)
 	{
-		p->color = 15 - (rand() & 3) + (56 << 4);
+		particles.color[n] = 15 - (rand() & 3) + (56 << 4);
 	}
-	else p->color = (rand() & 15) | (60 << 4); /* torch, fire */
-	return p;
+	else particles.color[n] = (rand() & 15) | (60 << 4); /* torch, fire */
+	return n;
 }
 
 /* init a DUST particle */
-static Particle particlesDust(Map map, int blockId, vec4 pos)
+static int particlesDust(int blockId, vec4 pos, uint8_t light)
 {
-	if ((rand() & 255) < 127) return NULL;
-	Particle p = particlesAlloc();
+	if ((rand() & 255) < 127) return -1;
+	int n = particlesAlloc();
+	if (n < 0) return -1;
+	PhysicsEntity p = particles.physics + n;
 	BlockState state = blockGetById(blockId);
 	Block b = &blockIds[blockId >> 4];
-	if (p == NULL) return NULL;
 	int range = RandRange(b->particleTTL, b->particleTTL * 2);
 	int UV    = state->nzU * 16 + 8 + ((state->nzV * 16 + 8) << 9);
 
-	memset(p, 0, sizeof *p);
-	p->physics.loc[0] = pos[0] + RandRange(0.1, 0.9);
-	p->physics.loc[1] = pos[1] - 0.01f;
-	p->physics.loc[2] = pos[2] + RandRange(0.1, 0.9);
-	p->physics.friction[VY] = 0.00125;
-	p->time = globals.curTime + range;
-	p->physics.dir[VY] = -RandRange(0.01, 0.04);
-	p->physics.bbox = &particleBBox;
-	p->ttl = range;
-	p->color = RandRange(64, 255); /* speed-up or slow down rotation */
-
-	particlesGetBlockInfo(map, p->physics.loc, &p->physics.light);
-
-	p->size = 6 + rand() % 3;
-	p->UV = PARTICLE_DUST | (UV << 10) | (p->size << 6);
-	return p;
+	p->loc[0] = pos[0] + RandRange(0.1, 0.9);
+	p->loc[1] = pos[1] - 0.01f;
+	p->loc[2] = pos[2] + RandRange(0.1, 0.9);
+	p->friction[VY] = 0.00125;
+	particles.time[n] = globals.curTime + range;
+	p->dir[VY] = -RandRange(0.01, 0.04);
+	p->bbox = &particleBBox;
+	particles.ttl[n] = range;
+	particles.color[n] = RandRange(64, 255); /* speed-up or slow down rotation */
+
+	p->light = light;
+
+	particles.size[n] = 6 + rand() % 3;
+	particles.UV[n] = PARTICLE_DUST | (UV << 10) | (particles.size[n] << 6);
+	return n;
 }
 
 /* init a DRIP particle */
-static Particle particlesDrip(Map map, int blockId, vec4 pos)
+static int particlesDrip(int blockId, vec4 pos, uint8_t light)
 {
-	if ((rand() & 255) < 127) return NULL;
-	Particle p = particlesAlloc();
+	if ((rand() & 255) < 127) return -1;
+	int n = particlesAlloc();
+	if (n < 0) return -1;
+	PhysicsEntity p = particles.physics + n;
 	BlockState state = blockGetById(blockId);
 	Block b = &blockIds[blockId >> 4];
-	if (p == NULL) return NULL;
 	int UV = state->nzU * 16 + 8 + ((state->nzV * 16 + 8) << 9);
 
-	memset(p, 0, sizeof *p);
-	p->physics.loc[0] = pos[0] + RandRange(0.1, 0.9);
-	p->physics.loc[1] = pos[1] - 1.05f;
-	p->physics.loc[2] = pos[2] + RandRange(0.1, 0.9);
-	p->time = globals.curTime + 5000;
-	p->physics.dir[VY] = -0.01;
-	p->physics.friction[VY] = 0.005;
-	p->physics.bbox = &particleBBox;
-	p->physics.rebound = b->density;
-	p->ttl = 5000;
-
-	particlesGetBlockInfo(map, p->physics.loc, &p->physics.light);
-	p->physics.loc[1] -= 0.1f;
-	if (b->emitLight > 0) p->physics.light |= b->emitLight;
-
-	p->size = 2 + rand() % 3;
-	p->UV = PARTICLE_DRIP | (UV << 10) | (p->size << 6);
-	return p;
+	p->loc[0] = pos[0] + RandRange(0.1, 0.9);
+	p->loc[1] = pos[1] - 1.15f;
+	p->loc[2] = pos[2] + RandRange(0.1, 0.9);
+	particles.time[n] = globals.curTime + 5000;
+	p->dir[VY] = -0.01;
+	p->friction[VY] = 0.005;
+	p->bbox = &particleBBox;
+	p->rebound = b->density;
+	particles.ttl[n] = 5000;
+
+	p->light = light;
+	if (b->emitLight > 0) p->light |= b->emitLight;
+
+	particles.size[n] = 2 + rand() % 3;
+	particles.UV[n] = PARTICLE_DRIP | (UV << 10) | (particles.size[n] << 6);
+	return n;
 }
 
 #ifndef NOEMITTERS
-static Emitter particlesAddEmitter(ChunkData cd, DATA16 data, int16_t ** next)
+static Emitter particlesAddEmitter(ChunkData cd, DATA16 data)
 {
-	Emitter old  = emitters.buffer;
 	Emitter emit = emitterAlloc();
 
-	/* relocate <*next> if it was pointing within emitters.buffer :-/ */
-	if (old != emitters.buffer && (DATAS16) old <= *next && *next < (DATAS16) (old + emitters.count-1))
-		*next = (int16_t *) ((DATA8) emitters.buffer + ((DATA8) *next - (DATA8) old));
-
 	if (emit)
 	{
 		emit->cd = cd;
@@ -355,11 +359,11 @@ static Emitter particlesAddEmitter(ChunkData cd, DATA16 data, int16_t ** next)
 /* chunk is about to be unloaded */
 static void particlesDelChain(int16_t last)
 {
-	if (last >= 0)
+	while (last >= 0)
 	{
-		int16_t next;
-		for (next = last; next >= 0; next = emitters.buffer[next].next)
-			emitters.usage[next >> 5] ^= 1 << (next & 31), emitters.count --;
+		int16_t next = emitters.buffer[last].next;
+		emitterFree(last);
+		last = next;
 	}
 }
 
@@ -425,13 +429,14 @@ static void particleMakeActive(Map map)
 		if (cd && cd->emitters)
 		for (emit = cd->emitters + 2, j = emit[-2]; j > 0; j --, emit += CHUNK_EMIT_SIZE)
 		{
-			Emitter e = particlesAddEmitter(cd, emit, &cur);
+			Emitter e = particlesAddEmitter(cd, emit);
+			if (e == NULL) break;
 			*cur = e - emitters.buffer;
 			cur = &e->next;
 		}
 	}
-//	emitterDebug();
-	emitters.dirtyList = 1;
+	/* all buckets will have to be checked on next frame */
+	memset(emitters.nextTime, 0, sizeof emitters.nextTime);
 }
 
 /* emitters list changed, update particle emitters object */
@@ -493,24 +498,21 @@ void particlesChunkUpdate(Map map, ChunkData cd)
 			else if (newOffset < oldOffset)
 			{
 				/* new emitter */
-				Emitter e = particlesAddEmitter(cd, newIds, &start);
+				Emitter e = particlesAddEmitter(cd, newIds);
+				if (e == NULL) continue;
 				e->next = oldEmit;
 				*start = e - emitters.buffer;
 				start = &e->next;
-				/* don't do it now, it is highly likely that more chunk updates are coming */
-				emitters.dirtyList = 1;
 				continue;
 			}
 			else if (newOffset > oldOffset)
 			{
 				/* deleted emitter */
 				old = emitters.buffer + oldEmit;
-				emitters.usage[oldEmit>>5] ^= 1 << (oldEmit & 31);
 				*start = old->next;
+				emitterFree(oldEmit);
 				newIds -= CHUNK_EMIT_SIZE;
 				i ++;
-				emitters.count --;
-				emitters.dirtyList = 1;
 			}
 			nextloop:
 			oldEmit = *start;
@@ -518,9 +520,10 @@ void particlesChunkUpdate(Map map, ChunkData cd)
 		if (*start >= 0)
 		{
 			particlesDelChain(*start);
-			emitters.dirtyList = 1;
 			*start = -1;
 		}
+		/* spawn time of this bucket needs to be checked again */
+		emitters.nextTime[index] = 0;
 	}
 }
 #else
@@ -528,13 +531,6 @@ void particlesChunkUpdate(Map map, ChunkData cd) { }
 void particleMakeActive(Map map) { }
 #endif
 
-static int emitterSort(const void * item1, const void * item2)
-{
-	Emitter emit1 = emitters.buffer + * (DATA16) item1;
-	Emitter emit2 = emitters.buffer + * (DATA16) item2;
-	return emit1->time - emit2->time;
-}
-
 Bool particleCanSpawn(struct BlockIter_t iter, int blockId, int particleType)
 {
 	if (blockId == ID(RSWIRE, 0))
@@ -566,32 +562,6 @@ Bool particleCanSpawn(struct BlockIter_t iter, int blockId, int particleType)
 	return True;
 }
 
-/* will make it easier to update the list later */
-static void particleSortEmitters(void)
-{
-	if (emitters.count > emitters.activeMax)
-	{
-		emitters.activeMax = (emitters.count+31) & ~31;
-		DATA16 buffer = realloc(emitters.active, emitters.activeMax * 2);
-		if (buffer == NULL) return;
-		emitters.active = buffer;
-	}
-	int i, j;
-	for (i = j = 0; i < 27; i ++)
-	{
-		int start = emitters.startIds[i];
-		while (start >= 0)
-		{
-			Emitter list = emitters.buffer + start;
-			emitters.active[j++] = start;
-			start = list->next;
-		}
-	}
-	qsort(emitters.active, j, 2, emitterSort);
-	emitters.dirtyList = 0;
-	//debugEmitters();
-}
-
 static void iterOffset(BlockIter iter, int offset)
 {
 	iter->offset += offset;
@@ -612,6 +582,7 @@ static void emitterSpawnParticles(Map map, Emitter emit)
 	int X = iter.ref->X;
 	int Z = iter.ref->Z;
 	int Y = iter.cd->Y;
+	int light = -1;
 
 	while (area > 0 && count > 0)
 	{
@@ -629,15 +600,22 @@ static void emitterSpawnParticles(Map map, Emitter emit)
 			{
 				if (particleCanSpawn(iter, blockId, emit->type))
 				{
-					Particle p;
 					vec4 pos = {X + iter.x, Y + iter.y, Z + iter.z};
+					int  n;
+					if (light < 0 && emit->type != PARTICLE_SMOKE)
+					{
+						/* light is sampled once per emitter: DUST and DRIP will spawn in the air block(s) below */
+						uint8_t value;
+						particlesGetBlockInfo(map, (vec4) {pos[VX] + 0.5f, pos[VY] - (emit->type == PARTICLE_DRIP ? 1.05f : 0.01f), pos[VZ] + 0.5f}, &value);
+						light = value;
+					}
 					switch (emit->type) {
-					case PARTICLE_SMOKE: p = particlesSmoke(map, blockId, pos); break;
-					case PARTICLE_DUST:  p = particlesDust(map, blockId, pos); break;
-					case PARTICLE_DRIP:  p = particlesDrip(map, blockId, pos); break;
+					case PARTICLE_SMOKE: n = particlesSmoke(blockId, pos); break;
+					case PARTICLE_DUST:  n = particlesDust(blockId, pos, light); break;
+					case PARTICLE_DRIP:  n = particlesDrip(blockId, pos, light); break;
 					default: continue;
 					}
-					if (p) p->delay = RandRange(0, 255);
+					if (n >= 0) particles.delay[n] = RandRange(0, 255);
 					count --;
 				}
 			}
@@ -648,41 +626,57 @@ static void emitterSpawnParticles(Map map, Emitter emit)
 }
 
 
+/* integrate movement of particles in <batch>, then check collision one by one */
+static void particlesMoveBatch(Map map, PhysicsBatch batch)
+{
+	int i;
+	physicsBatchIntegrate(batch);
+	for (i = 0; i < batch->count; i ++)
+	{
+		double start = globals.profiling ? debugProfStart() : 0;
+		physicsBatchCollide(map, batch, i);
+		if (start > 0) debugProfEnd(PROF_PHYSICS, mapGetChunk(map, batch->entity[i]->loc), start);
+	}
+	batch->count = 0;
+}
+
 /* move particles */
 int particlesAnimate(Map map)
 {
-	ParticleList list;
-	Particle     p;
-	float *      buf;
-	int          i, count;
-	uint32_t     curTimeMS = globals.curTime;
+	struct PhysicsBatch_t batch;
+	float *  buf;
+	int      i;
+	uint32_t curTimeMS = globals.curTime;
 
 	particleMakeActive(map);
-	if (emitters.dirtyList)
-		particleSortEmitters();
 
-	if (emitters.count)
-	for (count = emitters.count; ; )
+	/* only check buckets (ie: ChunkData) that have emitters ready */
+	if (emitters.count > 0)
+	for (i = 0; i < 27; i ++)
 	{
-		uint16_t cur  = emitters.active[0];
-		Emitter  emit = emitters.buffer + cur;
+		uint32_t nextTime = 0xffffffff;
+		int16_t  cur;
+
+		if (emitters.nextTime[i] > curTimeMS)
+			continue;
 
-		if (emit->time <= curTimeMS)
+		for (cur = emitters.startIds[i]; cur >= 0; )
 		{
-			emitterSpawnParticles(map, emit);
-			int next = emit->interval;
-			if (next == 0) next = 500;
-			emit->time = curTimeMS + RandRange(next>>1, next);
-
-			/* keep the list sorted (start from the end: MUCH cheaper) */
-			for (i = count-1; i > 0 && emitters.buffer[emitters.active[i]].time > emit->time; i --);
-			if (i > 0)
+			Emitter emit = emitters.buffer + cur;
+			if (emit->time <= curTimeMS)
 			{
-				memmove(emitters.active, emitters.active + 1, i * 2);
-				emitters.active[i] = cur;
+				double start = globals.profiling ? debugProfStart() : 0;
+				emitterSpawnParticles(map, emit);
+				if (start > 0) debugProfEnd(PROF_PARTICLE, emit->cd->chunk, start);
+				int next = emit->interval;
+				if (next == 0) next = 500;
+				emit->time = curTimeMS + RandRange(next>>1, next);
 			}
+			if (nextTime > emit->time)
+				nextTime = emit->time;
+			cur = emit->next;
 		}
-		else break;
+		emitters.nextTime[i] = nextTime;
 	}
 
 	if (particles.count == 0)
@@ -691,79 +685,79 @@ int particlesAnimate(Map map)
 		return 0;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, particles.vbo);
-	buf = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-
 	/* this scale factor will make particles move at a constant speed no matter at what fps the screen is refreshed */
 	float speed = (float) ((globals.curTime - particles.lastTime) / 25);
 	uint32_t diff = globals.curTime - particles.lastTime;
 
 //	fprintf(stderr, "speed = %f, diff = %d\n", speed, time - particles.lastTime);
 
-	for (list = HEAD(particles.buffers), count = 0; list; NEXT(list))
+	/* first: discard expired particles, move the other ones in batch */
+	for (i = 0, batch.count = 0; i < particles.count; )
 	{
-		uint8_t nth, type;
-		for (i = list->count, nth = 0, p = list->buffer; i > 0; p ++, nth ++)
+		if (particles.delay[i] > 0)
 		{
-			if (p->time == 0) continue; i --;
-			if (p->delay > 0)
-			{
-				if (p->delay > (diff >> 2))
-				{
-					p->delay -= (diff >> 2);
-					continue;
-				}
-				else p->delay = 0, p->time = (uint32_t) globals.curTime + p->ttl;
-			}
-			if (p->time < curTimeMS)
+			if (particles.delay[i] > (diff >> 2))
 			{
-				/* expired particle */
-				p->time = 0;
-				list->usage[nth>>5] ^= 1 << (nth&31);
-				particles.count --;
-				list->count --;
+				particles.delay[i] -= (diff >> 2);
+				i ++;
 				continue;
 			}
-			DATA32 info = (DATA32) buf + 3;
-			buf[0]  = p->physics.loc[VX];
-			buf[1]  = p->physics.loc[VY];
-			buf[2]  = p->physics.loc[VZ];
-			info[0] = p->UV;
-			type = p->UV&63;
-			switch (type) {
-			case PARTICLE_BITS:
-			case PARTICLE_DRIP:
-				info[1] = p->physics.light;
-				break;
-			case PARTICLE_SMOKE:
-				info[1] = p->color;
-				/* color will get darker over time */
-				p->UV &= 0x7ffff;
-				p->UV |= ((int) ((globals.curTime - (p->time - p->ttl)) / p->ttl * 8) * 8 + 9 * 16) << 19;
-				break;
-			case PARTICLE_DUST:
-				{
-					float ttl = (globals.curTime - (p->time - p->ttl)) / p->ttl;
-					int   rotation = ((int) (ttl * (1<<19)) * p->color >> 7) & ((1<<20)-1);
-					int   frame = ttl * 8;
-					if (frame > 7) frame = 7;
-					info[1] = p->physics.light | (rotation << 12) | (frame << 8);
-				}
-			}
-			buf += PARTICLES_VBO_SIZE/4;
-			count ++;
+			else particles.delay[i] = 0, particles.time[i] = (uint32_t) globals.curTime + particles.ttl[i];
+		}
+		if (particles.time[i] < curTimeMS)
+		{
+			/* expired particle: last one will be moved at <i> */
+			particlesFree(i);
+			continue;
+		}
+		physicsBatchAdd(&batch, particles.physics + i, speed);
+		if (batch.count == PHYSICS_BATCH)
+			particlesMoveBatch(map, &batch);
+		i ++;
+	}
+	if (batch.count > 0)
+		particlesMoveBatch(map, &batch);
+
+	/* then fill the VBO */
+	glBindBuffer(GL_ARRAY_BUFFER, particles.vbo);
+	buf = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
 
-			if (physicsMoveEntity(map, &p->physics, speed) && type != PARTICLE_SMOKE)
+	int count;
+	for (i = count = 0; i < particles.count; i ++)
+	{
+		if (particles.delay[i] > 0) continue;
+
+		PhysicsEntity p = particles.physics + i;
+		DATA32 info = (DATA32) buf + 3;
+		int    ttl  = particles.ttl[i];
+		int    born = particles.time[i] - particles.ttl[i];
+		buf[0]  = p->loc[VX];
+		buf[1]  = p->loc[VY];
+		buf[2]  = p->loc[VZ];
+		switch (particles.UV[i] & 63) {
+		case PARTICLE_BITS:
+		case PARTICLE_DRIP:
+			info[1] = p->light;
+			break;
+		case PARTICLE_SMOKE:
+			info[1] = particles.color[i];
+			/* color will get darker over time */
+			particles.UV[i] &= 0x7ffff;
+			particles.UV[i] |= ((int) ((globals.curTime - born) / ttl * 8) * 8 + 9 * 16) << 19;
+			break;
+		case PARTICLE_DUST:
 			{
-				/* update light values */
-				particlesGetBlockInfo(map, p->physics.loc, &p->physics.light);
-				info[1] = (info[1] & ~0xff) | p->physics.light;
+				float elapsed  = (globals.curTime - born) / ttl;
+				int   rotation = ((int) (elapsed * (1<<19)) * particles.color[i] >> 7) & ((1<<20)-1);
+				int   frame    = elapsed * 8;
+				if (frame > 7) frame = 7;
+				info[1] = p->light | (rotation << 12) | (frame << 8);
 			}
-
-			if (count == 1000) goto break_all;
 		}
+		info[0] = particles.UV[i];
+		buf += PARTICLES_VBO_SIZE/4;
+		count ++;
 	}
-	break_all:
 	glUnmapBuffer(GL_ARRAY_BUFFER);
 
 	particles.lastTime = globals.curTime;
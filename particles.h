@@ -26,22 +26,10 @@ Bool particleCanSpawn(struct BlockIter_t iter, int blockId, int particleType);
  * private stuff below
  */
 #ifdef PARTICLES_IMPL
-typedef struct Particle_t *       Particle;
-typedef struct Particle_t         Particle_t;
-typedef struct ParticleList_t *   ParticleList;
 typedef struct Emitter_t *        Emitter;
 typedef struct PhysicsEntity_t    PHYSENT_t;
 
-struct Particle_t
-{
-	PHYSENT_t physics;            /* collision detection */
-	uint32_t  UV;                 /* tex coord to use */
-	uint8_t   size;
-	uint8_t   delay;
-	uint16_t  ttl;                /* time to live (ms) */
-	uint16_t  color;              /* color modulation (offset in terrain.png) */
-	int       time;
-};
+#define EMITTERS_MAX              1024
 
 struct Emitter_t
 {
@@ -50,7 +38,7 @@ struct Emitter_t
 	uint8_t   type;               /* PARTICLE_* (declared in blocks.h) */
 	uint16_t  interval;           /* time in ms before creating a new particle */
 
-	int16_t   next;               /* linked list of emitters within a chunk (offset in emitters.buffer) */
+	int16_t   next;               /* linked list of emitters within a chunk, or free list (offset in emitters.buffer) */
 	uint16_t  count;              /* number of emitters in the area */
 
 	uint32_t  area;               /* used by DUST and DRIP: area where blocks might be (loc[] is at 0,0 of a XZ layer in the ChunkData) */
@@ -58,35 +46,31 @@ struct Emitter_t
 	uint32_t  time;
 };
 
-struct ParticleList_t
-{
-	ListNode   node;
-	Particle_t buffer[128];
-	uint32_t   usage[4];
-	uint8_t    count;
-};
-
-struct ParticlePrivate_t
+struct ParticlePrivate_t          /* fixed capacity pool, structure of arrays: live particles are packed in [0, count[ */
 {
-	ListHead buffers;             /* ParticleList */
-	int      count;
-	double   lastTime;
-	int      shader;              /* OpenGL stuff */
-	int      vao, vbo;
+	int       count;
+	double    lastTime;
+	int       shader;             /* OpenGL stuff */
+	int       vao, vbo;
+	PHYSENT_t physics[PARTICLES_MAX];  /* collision detection */
+	uint32_t  UV[PARTICLES_MAX];       /* tex coord to use */
+	int       time[PARTICLES_MAX];     /* time of death (ms) */
+	uint16_t  ttl[PARTICLES_MAX];      /* time to live (ms) */
+	uint16_t  color[PARTICLES_MAX];    /* color modulation (offset in terrain.png) */
+	uint8_t   size[PARTICLES_MAX];
+	uint8_t   delay[PARTICLES_MAX];
 };
 
 struct EmitterPrivate_t
 {
-	Emitter  buffer;              /* active emitters */
-	DATA32   usage;               /* usage bitfield (ceil(count/32) items) */
-	int      count;               /* items in <buffer> */
-	int      max;                 /* max capacity of <buffer> */
-	DATA16   active;              /* index in <buffer>, sorted by time to spawn next particle */
-	int      activeMax;           /* max capacity of <active> */
+	struct Emitter_t buffer[EMITTERS_MAX]; /* fixed capacity pool */
+	int      count;               /* items used in <buffer> */
+	int16_t  freeSlot;            /* first free item in <buffer> (chained through <next>) */
+	uint8_t  full;                /* DEBUG: pool exhaustion already reported */
 	int      cacheLoc[3];
-	int16_t  startIds[27];        /* emitters for one ChunkData ordered XZY */
+	int16_t  startIds[27];        /* emitters for one ChunkData (bucket) ordered XZY */
+	uint32_t nextTime[27];        /* earliest time an emitter of this bucket will spawn a particle (0 = need to check) */
 	uint8_t  offsets[27];         /* +/- 1 for X, Z, Y for locating chunk 0-26 */
-	uint8_t  dirtyList;           /* <active> needs to be rebuilt */
 };
 #endif
 #endif
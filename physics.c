@@ -189,7 +189,7 @@ int physicsCheckCollision(Map map, vec4 start, vec4 end, ENTBBox bbox, float aut
 	if (shortestDist > 0)
 	{
 		int count;
-		Entity * list = quadTreeIntersect(broad, &count, ENFLAG_FIXED | ENFLAG_HASBBOX);
+		Entity * list = entityGridIntersect(broad, &count, ENFLAG_FIXED | ENFLAG_HASBBOX);
 		if (count > 0)
 		{
 			for (i = 0; i < count; i ++)
@@ -339,11 +339,8 @@ Bool physicsCheckOnGround(Map map, vec4 start, ENTBBox bbox)
 		if (i > dz) break;
 		mapIter(&iter, -dx, 0, 1);
 	}
-	int count;
 	minMax[VY+3] = minMax[VY] + 0.1f;
-	quadTreeIntersect(minMax, &count, ENFLAG_HASBBOX | ENFLAG_FIXED);
-	if (count > 0) return True;
-	return False;
+	return entityGridQuery(minMax, ENFLAG_HASBBOX | ENFLAG_FIXED, NULL, 0) > 0;
 }
 
 /* physicsCheckCollision detected we are near a ladder, check if we can climb it */
@@ -522,25 +519,80 @@ void physicsShoveEntity(PhysicsEntity entity, float friction, int side)
 /* move particles according to their parameters */
 Bool physicsMoveEntity(Map map, PhysicsEntity entity, float speed)
 {
-	float inc, oldLoc[3], DY;
-	memcpy(oldLoc, entity->loc, sizeof oldLoc);
+	struct PhysicsBatch_t batch;
+	batch.count = 0;
+	physicsBatchAdd(&batch, entity, speed);
+	physicsBatchIntegrate(&batch);
+	return physicsBatchCollide(map, &batch, 0);
+}
+
+/* gather parameters of <entity> in SoA buffers: batch must not be full */
+void physicsBatchAdd(PhysicsBatch batch, PhysicsEntity entity, float speed)
+{
+	int i = batch->count ++, j;
+	for (j = 0; j < 3; j ++)
+	{
+		batch->start[j][i]    = entity->loc[j];
+		batch->dir[j][i]      = entity->dir[j];
+		batch->friction[j][i] = entity->friction[j];
+	}
+	batch->sign[0][i]  = entity->negXZ & 1 ? -1 : 1;
+	batch->sign[1][i]  = entity->negXZ & 2 ? -1 : 1;
+	batch->blocked[i]  = entity->physFlags & PHYSFLAG_VYBLOCKED ? 1 : 0;
+	batch->density[i]  = entity->density;
+	batch->speed[i]    = speed;
+	batch->entity[i]   = entity;
+}
 
-	inc = entity->dir[VX] * speed; entity->loc[VX] += entity->negXZ & 1 ? -inc : inc;
-	inc = entity->dir[VZ] * speed; entity->loc[VZ] += entity->negXZ & 2 ? -inc : inc;
-	entity->loc[VY] += DY = entity->dir[VY] * speed;
+/* integrate movement of all entities in batch: no branch, no map access, compiler is free to vectorize this */
+void physicsBatchIntegrate(PhysicsBatch batch)
+{
+	int i, count = batch->count;
+
+	for (i = 0; i < count; i ++)
+	{
+		float speed = batch->speed[i];
+		batch->loc[VX][i] = batch->start[VX][i] + batch->sign[0][i] * (batch->dir[VX][i] * speed);
+		batch->loc[VZ][i] = batch->start[VZ][i] + batch->sign[1][i] * (batch->dir[VZ][i] * speed);
+		batch->loc[VY][i] = batch->start[VY][i] + (batch->moveY[i] = batch->dir[VY][i] * speed);
+	}
 
 	/* that's why we don't want to deal with negative values in <dir> */
-	entity->dir[VX] -= entity->friction[VX] * speed; if (entity->dir[VX] < 0) entity->dir[VX] = 0;
-	entity->dir[VZ] -= entity->friction[VZ] * speed; if (entity->dir[VZ] < 0) entity->dir[VZ] = 0;
-	entity->dir[VY] -= entity->friction[VY] * speed;
+	for (i = 0; i < count; i ++)
+	{
+		float speed = batch->speed[i];
+		float dirX  = batch->dir[VX][i] - batch->friction[VX][i] * speed;
+		float dirZ  = batch->dir[VZ][i] - batch->friction[VZ][i] * speed;
+		batch->dir[VX][i]  = dirX < 0 ? 0 : dirX;
+		batch->dir[VZ][i]  = dirZ < 0 ? 0 : dirZ;
+		batch->dir[VY][i] -= batch->friction[VY][i] * speed;
+
+		/* increase friction if sliding on ground, gravity otherwise */
+		batch->friction[VX][i] += 0.0005f * speed * batch->blocked[i];
+		batch->friction[VZ][i] += 0.0005f * speed * batch->blocked[i];
+		batch->friction[VY][i] += 0.003f * speed * batch->density[i] * (1 - batch->blocked[i]);
+	}
 
-	if (entity->physFlags & PHYSFLAG_VYBLOCKED)
+	/* scatter back: collision will be checked per entity */
+	for (i = 0; i < count; i ++)
 	{
-		/* increase friction if sliding on ground */
-		entity->friction[VX] += 0.0005f * speed;
-		entity->friction[VZ] += 0.0005f * speed;
+		PhysicsEntity entity = batch->entity[i];
+		int j;
+		for (j = 0; j < 3; j ++)
+		{
+			entity->loc[j]      = batch->loc[j][i];
+			entity->dir[j]      = batch->dir[j][i];
+			entity->friction[j] = batch->friction[j][i];
+		}
 	}
-	else entity->friction[VY] += 0.003f * speed * entity->density;
+}
+
+/* check collision of entity <index> of batch after integration: returns True if it moved into another voxel */
+Bool physicsBatchCollide(Map map, PhysicsBatch batch, int index)
+{
+	PhysicsEntity entity = batch->entity[index];
+	float oldLoc[] = {batch->start[VX][index], batch->start[VY][index], batch->start[VZ][index]};
+	float DY = batch->moveY[index];
 
 	/* check collision */
 	int axis = physicsCheckCollision(map, oldLoc, entity->loc, entity->bbox, 0, NULL);
@@ -689,7 +741,7 @@ void physicsEntityMoved(Map map, APTR self, vec4 start, vec4 end)
 	/* add a tiny amount on VY to check if there are entities that sit on top this one */
 	broad[VY+3] += 0.0625f;
 
-	Entity * list = quadTreeIntersect(broad, &count, ENFLAG_FIXED | ENFLAG_EQUALZERO);
+	Entity * list = entityGridIntersect(broad, &count, ENFLAG_FIXED | ENFLAG_EQUALZERO);
 	if (count > 0)
 	{
 		/* make a copy of the list (return value is static) */
@@ -748,3 +800,97 @@ void physicsEntityMoved(Map map, APTR self, vec4 start, vec4 end)
 		}
 	}
 }
+
+#ifdef DEBUG
+/*
+ * benchmark for mapGetBBox() cache: lots of items falling on a floor of hoppers. The floor is temporarily
+ * written in the sub-chunk below <pos> (restored afterwards, no mesh/undo involved). Results on stderr.
+ */
+#define BENCH_ITEMS        2000
+#define BENCH_STEPS        100
+
+static uint32_t physicsBenchRand(uint32_t * seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+void physicsBenchmark(Map map, vec4 pos)
+{
+	static struct ENTBBox_t itemBBox = {.pt1 = {-0.125f, 0, -0.125f}, .pt2 = {0.125f, 0.25f, 0.125f}};
+	struct BlockIter_t iter;
+	float * items;
+	DATA8   backup;
+	int     x, z, i, step, pass;
+
+	/* floor is one sub-chunk layer of 16x16 hoppers */
+	int floorY = (int) pos[VY] - 1;
+	mapInitIter(map, &iter, (vec4) {(int) floorf(pos[VX]) & ~15, floorY, (int) floorf(pos[VZ]) & ~15}, False);
+	if (iter.blockIds == NULL || iter.cd == chunkAir || floorY < 0 || floorY + 12 >= BUILD_HEIGHT)
+	{
+		fprintf(stderr, "bench collision: need a non-empty sub-chunk below player\n");
+		return;
+	}
+	items  = malloc(BENCH_ITEMS * 4 * sizeof *items);
+	backup = malloc(DATA_OFFSET + 2048);
+	if (items && backup)
+	{
+		memcpy(backup, iter.blockIds, DATA_OFFSET + 2048);
+		for (z = 0; z < 16; z ++)
+		{
+			for (x = 0; x < 16; x ++)
+			{
+				i = CHUNK_BLOCK_POS(x, z, floorY & 15);
+				iter.blockIds[i] = RSHOPPER;
+				iter.blockIds[DATA_OFFSET + (i >> 1)] &= i & 1 ? 0x0f : 0xf0;
+			}
+		}
+		for (pass = 0; pass < 2; pass ++)
+		{
+			uint32_t seed = 1;
+			int      stats[2], onGround;
+			double   time;
+
+			/* same starting positions for both passes */
+			for (i = 0; i < BENCH_ITEMS; i ++)
+			{
+				float * item = items + i * 4;
+				item[VX] = iter.ref->X + 0.5f + (physicsBenchRand(&seed) % 1500) * 0.01f;
+				item[VZ] = iter.ref->Z + 0.5f + (physicsBenchRand(&seed) % 1500) * 0.01f;
+				item[VY] = floorY + 1 + (physicsBenchRand(&seed) % 1000) * 0.01f;
+				item[VT] = 1;
+			}
+			mapBBoxCacheStats(pass == 1, stats);
+
+			time = FrameGetTime();
+			for (step = onGround = 0; step < BENCH_STEPS; step ++)
+			{
+				/* one tick */
+				mapResetBBoxCache();
+				for (i = 0; i < BENCH_ITEMS; i ++)
+				{
+					float * item = items + i * 4;
+					if (physicsCheckOnGround(map, item, &itemBBox))
+					{
+						onGround ++;
+						continue;
+					}
+					vec4 end = {item[VX], item[VY] - 0.25f, item[VZ], 1};
+					physicsCheckCollision(map, item, end, &itemBBox, 0, NULL);
+					memcpy(item, end, 12);
+				}
+			}
+			time = FrameGetTime() - time;
+			mapBBoxCacheStats(True, stats);
+
+			fprintf(stderr, "bench collision (%s): %d items x %d ticks in %.1f ms, %d on ground checks, cache hit: %d, miss: %d\n",
+				pass ? "cached" : "uncached", BENCH_ITEMS, BENCH_STEPS, time, onGround, stats[0], stats[1]);
+		}
+		memcpy(iter.blockIds, backup, DATA_OFFSET + 2048);
+	}
+	free(backup);
+	free(items);
+}
+#endif
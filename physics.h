@@ -10,6 +10,7 @@
 #include "maps.h"
 
 typedef struct PhysicsEntity_t *         PhysicsEntity;
+typedef struct PhysicsBatch_t *          PhysicsBatch;
 
 typedef int (ValidBlockCb_t)(struct BlockIter_t iter, int dx, int dy, int dz);
 
@@ -18,10 +19,16 @@ void physicsEntityMoved(Map, APTR self, vec4 start, vec4 end);
 Bool physicsCheckOnGround(Map, vec4 start, ENTBBox bbox);
 void physicsInitEntity(PhysicsEntity entity, int block);
 Bool physicsMoveEntity(Map, PhysicsEntity, float speed);
+void physicsBatchAdd(PhysicsBatch, PhysicsEntity, float speed);
+void physicsBatchIntegrate(PhysicsBatch);
+Bool physicsBatchCollide(Map, PhysicsBatch, int index);
 int  physicsCheckIfCanClimb(Map, vec4 pos, ENTBBox bbox);
 void physicsCheckPressurePlate(Map, vec4 start, vec4 end, ENTBBox bbox);
 void physicsChangeEntityDir(PhysicsEntity, float friction);
 void physicsShoveEntity(PhysicsEntity, float friction, int side);
+#ifdef DEBUG
+void physicsBenchmark(Map, vec4 pos);
+#endif
 
 struct PhysicsEntity_t
 {
@@ -36,6 +43,22 @@ struct PhysicsEntity_t
 	ENTBBox bbox;              /* bounding box of entity */
 };
 
+#define PHYSICS_BATCH          64
+
+struct PhysicsBatch_t          /* move several entities at once: structure of arrays */
+{
+	int     count;
+	float   start[3][PHYSICS_BATCH];    /* location before integration */
+	float   loc[3][PHYSICS_BATCH];      /* location after integration */
+	float   dir[3][PHYSICS_BATCH];
+	float   friction[3][PHYSICS_BATCH];
+	float   sign[2][PHYSICS_BATCH];     /* -1 if dir[VX] or dir[VZ] is negative (PhysicsEntity_t.negXZ) */
+	float   blocked[PHYSICS_BATCH];     /* 1 if PHYSFLAG_VYBLOCKED is set */
+	float   density[PHYSICS_BATCH];
+	float   speed[PHYSICS_BATCH];
+	float   moveY[PHYSICS_BATCH];       /* vertical displacement of this step */
+	PhysicsEntity entity[PHYSICS_BATCH];
+};
 
 enum
 {
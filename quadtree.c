@@ -6,9 +6,13 @@
  * the purpose of this module is to be able to quickly enumerate entities that intersect a 3d AABB:
  * see doc/internals.html for a quick overview of how this module works.
  *
+ * note: entities are now partitioned using entityGrid.c, this module is only kept in debug builds as a reference
+ * for entityGridBenchmark().
+ *
  * written by T.Pierron, dec 2021.
  */
 
+#ifdef DEBUG
 #define ENTITY_IMPL
 #include <stdio.h>
 #include <stdlib.h>
@@ -252,7 +256,7 @@ static void quadTreePrune(QuadTree root, Entity item)
 void quadTreeDeleteItem(Entity item)
 {
 	/* not every entity are in quad tree (temporary ones aren't) */
-	if ((item->enflags & ENFLAG_INQUADTREE) == 0)
+	if ((item->enflags & ENFLAG_INGRID) == 0)
 		return;
 
 	QuadTree root  = qroot;
@@ -282,7 +286,7 @@ void quadTreeInsertItem(Entity item)
 	float szEntX = item->szx * scale;
 	float szEntZ = item->szz * scale;
 
-	item->enflags |= ENFLAG_INQUADTREE;
+	item->enflags |= ENFLAG_INGRID;
 	/* check if quadtree is big enough */
 	for (;;)
 	{
@@ -320,7 +324,7 @@ void quadTreeInsertItem(Entity item)
 /* relocate one item in the quad tree */
 void quadTreeChangePos(Entity item)
 {
-	if ((item->enflags & ENFLAG_INQUADTREE) == 0)
+	if ((item->enflags & ENFLAG_INGRID) == 0)
 		return;
 
 	QuadTree root = qroot;
@@ -420,7 +424,6 @@ Entity * quadTreeIntersect(float bbox[6], int * count, int filter)
 	return qselected.list;
 }
 
-#ifdef DEBUG
 /* render on screen quad tree with entity location */
 #define MARGIN    20
 #include "nanovg.h"
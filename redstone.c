@@ -457,6 +457,50 @@ static int redstoneGetComparatorSignal(struct BlockIter_t iter, RSWire cnx)
 	return 0;
 }
 
+/* signal a wire receives from anything but other wires (<connect> is what redstoneConnectTo() returned) */
+int redstoneWireInput(BlockIter iter, RSWire connect, int count)
+{
+	int i, max = 0;
+	Block b;
+	for (i = 0; i < count; i ++)
+	{
+		RSWire cnx = connect + i;
+		if (cnx->signal == RSUPDATE)
+			continue;
+		switch (cnx->blockId) {
+		case RSWIRE: break;
+		case RSBLOCK:
+		case RSTORCH_ON:
+		case RSREPEATER_ON: return MAXSIGNAL;
+		case RSCOMPARATOR: return redstoneGetComparatorSignal(*iter, cnx);
+		case RSOBSERVER: return cnx->data & 8 ? MAXSIGNAL : 0;
+		default:
+			b = &blockIds[cnx->blockId];
+			if (b->orientHint == ORIENT_LEVER)
+			{
+				if (cnx->data >= 8)
+					return MAXSIGNAL;
+			}
+			else if (b->special == BLOCK_PLATE)
+			{
+				if (cnx->data > 0)
+					return MAXSIGNAL;
+			}
+		}
+	}
+	/* check for nearby power source */
+	for (i = 0; i < 6; i ++)
+	{
+		uint8_t power = redstoneIsPowered(*iter, i, POW_STRONG);
+		if (power > 0)
+		{
+			power = power > 15 ? power >> 4 : MAXSIGNAL;
+			if (power > max) max = power;
+		}
+	}
+	return max;
+}
+
 /* get signal strength emitted by block pointed by <iter> */
 int redstoneSignalStrength(BlockIter iter, Bool dirty)
 {
@@ -468,51 +512,21 @@ int redstoneSignalStrength(BlockIter iter, Bool dirty)
 			struct RSWire_t connect[RSMAXUPDATE];
 			int count = redstoneConnectTo(*iter, connect);
 			int i, max = 0, min = blockId & 15;
-			Block b;
 			for (i = 0; i < count; i ++)
 			{
 				RSWire cnx = connect + i;
-				int    sig = 0;
-				if (cnx->signal == RSUPDATE)
+				int    sig;
+				if (cnx->signal == RSUPDATE || cnx->blockId != RSWIRE)
 					continue;
-				switch (cnx->blockId) {
-				case RSWIRE:
-					sig = cnx->data - 1;
-					if (sig < min) continue;
-					if (sig < 0) sig = 0;
-					break;
-				case RSBLOCK:
-				case RSTORCH_ON:
-				case RSREPEATER_ON: return MAXSIGNAL;
-				case RSCOMPARATOR: return redstoneGetComparatorSignal(*iter, cnx);
-				case RSOBSERVER: return cnx->data & 8 ? MAXSIGNAL : 0;
-				default:
-					b = &blockIds[cnx->blockId];
-					if (b->orientHint == ORIENT_LEVER)
-					{
-						if (cnx->data >= 8)
-							return MAXSIGNAL;
-					}
-					else if (b->special == BLOCK_PLATE)
-					{
-						if (cnx->data > 0)
-							return MAXSIGNAL;
-					}
-				}
+				sig = cnx->data - 1;
+				if (sig < min) continue;
+				if (sig < 0) sig = 0;
 				if (max < sig) max = sig;
 			}
 			if (max < MAXSIGNAL)
 			{
-				/* check for nearby power source */
-				for (i = 0; i < 6; i ++)
-				{
-					uint8_t power = redstoneIsPowered(*iter, i, POW_STRONG);
-					if (power > 0)
-					{
-						power = power > 15 ? power >> 4 : MAXSIGNAL;
-						if (power > max) max = power;
-					}
-				}
+				i = redstoneWireInput(iter, connect, count);
+				if (i > max) max = i;
 			}
 			return max;
 		}
@@ -633,3 +647,435 @@ int redstoneIsPowered(struct BlockIter_t iter, int side, int minPower)
 	}
 	return pow;
 }
+
+/*
+ * wire runs compiled into a graph: updating a long line of redstone wire with the generic
+ * propagation code requires to scan the world (redstoneConnectTo()) for every wire, every
+ * time signal changes. Connectivity between wires rarely change though.
+ */
+static struct
+{
+	struct RSNet_t nets[RSNET_CACHE];
+	int count;
+	int usage;                 /* LRU counter */
+}	rsnet;
+
+#define RSNET_HASH(cd, offset, mask)    ((((uint32_t) ((uintptr_t) (cd) >> 4) * 4099 + (offset)) * 0x9E3779B1u >> 16) & (mask))
+
+static void redstoneNetFree(RSNet net)
+{
+	free(net->nodes);
+	free(net->edges);
+	free(net->outputs);
+	free(net->hash);
+	free(net->changed);
+	memset(net, 0, sizeof *net);
+}
+
+static void redstoneNetDiscard(RSNet net)
+{
+	RSNet last = rsnet.nets + (-- rsnet.count);
+	redstoneNetFree(net);
+	if (net != last)
+		*net = *last, memset(last, 0, sizeof *last);
+}
+
+void redstoneNetClearAll(void)
+{
+	while (rsnet.count > 0)
+		redstoneNetFree(rsnet.nets + (-- rsnet.count));
+}
+
+/* chunk column at <X>, <Z> (block coord) is about to be freed: discard graphs that might point to its ChunkData */
+void redstoneNetClearChunk(int X, int Z)
+{
+	int i;
+	for (i = 0; i < rsnet.count; )
+	{
+		RSNet net = rsnet.nets + i;
+		/* overflowed graphs only keep their bbox */
+		if (! net->overflow && net->min[0] < X + 16 && net->max[0] >= X && net->min[2] < Z + 16 && net->max[2] >= Z)
+			redstoneNetDiscard(net);
+		else
+			i ++;
+	}
+}
+
+static int redstoneNetFind(RSNet net, ChunkData cd, int offset)
+{
+	int i;
+	for (i = RSNET_HASH(cd, offset, net->hashMask); net->hash[i]; i = (i + 1) & net->hashMask)
+	{
+		RSNetNode node = net->nodes + net->hash[i] - 1;
+		if (node->cd == cd && node->offset == offset)
+			return net->hash[i] - 1;
+	}
+	return -1;
+}
+
+/* add wire to graph: returns index in <nodes>, -1 if graph is too big, -2 if out of memory */
+static int redstoneNetAddNode(RSNet net, BlockIter iter)
+{
+	RSNetNode node;
+	int i;
+	if (net->count == net->nodeMax)
+	{
+		if (net->nodeMax == RSNET_MAXNODE)
+		{
+			net->overflow = 1;
+			return -1;
+		}
+		i = net->nodeMax ? net->nodeMax * 2 : 64;
+		node = realloc(net->nodes, i * sizeof *node);
+		if (node == NULL) return -2;
+		net->nodes = node;
+		net->nodeMax = i;
+		net->hashMask = i * 2 - 1;
+		free(net->hash);
+		net->hash = calloc(i * 2, sizeof *net->hash);
+		if (net->hash == NULL) return -2;
+		/* rehash */
+		for (node = net->nodes, i = 0; i < net->count; i ++, node ++)
+		{
+			int slot;
+			for (slot = RSNET_HASH(node->cd, node->offset, net->hashMask); net->hash[slot]; slot = (slot + 1) & net->hashMask);
+			net->hash[slot] = i + 1;
+		}
+	}
+	node = net->nodes + net->count;
+	memset(node, 0, sizeof *node);
+	node->cd = iter->cd;
+	node->offset = iter->offset;
+	node->XYZ[0] = iter->ref->X + iter->x;
+	node->XYZ[1] = iter->yabs;
+	node->XYZ[2] = iter->ref->Z + iter->z;
+	for (i = 0; i < 3; i ++)
+	{
+		/* a block 2 blocks away can still power that wire */
+		if (net->count == 0 || net->min[i] > node->XYZ[i] - 2) net->min[i] = node->XYZ[i] - 2;
+		if (net->count == 0 || net->max[i] < node->XYZ[i] + 2) net->max[i] = node->XYZ[i] + 2;
+	}
+	for (i = RSNET_HASH(iter->cd, iter->offset, net->hashMask); net->hash[i]; i = (i + 1) & net->hashMask);
+	net->hash[i] = ++ net->count;
+	return net->count - 1;
+}
+
+/* comparator signal level is stored in tile entity: can change without block update */
+static Bool redstoneNetVolatile(struct BlockIter_t iter)
+{
+	int i, j;
+	for (i = 0; i < 6; i ++)
+	{
+		mapIter(&iter, xoff[i], yoff[i], zoff[i]);
+		int id = iter.blockIds[iter.offset];
+		if (id == RSCOMPARATOR)
+			return True;
+		if (blockIds[id].type == SOLID)
+		{
+			struct BlockIter_t solid = iter;
+			for (j = 0; j < 6; j ++)
+			{
+				mapIter(&solid, xoff[j], yoff[j], zoff[j]);
+				if (solid.blockIds[solid.offset] == RSCOMPARATOR)
+					return True;
+			}
+		}
+	}
+	return False;
+}
+
+/* net is too big to be compiled: remember the regions it spans, wires there will use the old propagation code */
+static void redstoneNetOverflow(RSNet net)
+{
+	/* nodes past RSNET_MAXNODE are not known: mark entire regions, not just the bbox of what was explored */
+	net->min[0] &= ~511; net->max[0] |= 511;
+	net->min[2] &= ~511; net->max[2] |= 511;
+	net->min[1] = 0;     net->max[1] = BUILD_HEIGHT - 1;
+	free(net->nodes);   net->nodes = NULL;
+	free(net->hash);    net->hash = NULL;
+	free(net->edges);   net->edges = NULL;
+	free(net->outputs); net->outputs = NULL;
+	net->count = net->nodeMax = 0;
+}
+
+/* returns False if out of memory */
+static Bool redstoneNetBuild(RSNet net, BlockIter start)
+{
+	struct RSWire_t connect[RSMAXUPDATE];
+	DATA16 pos;
+	int    i, j;
+
+	if (redstoneNetAddNode(net, start) < 0)
+		return False;
+
+	/* first pass: find wires connected to each other, <edges> will contain what power each wire */
+	for (i = 0; i < net->count; i ++)
+	{
+		struct BlockIter_t iter;
+		RSNetNode node = net->nodes + i;
+		int count;
+
+		mapInitIterOffset(&iter, node->cd, node->offset);
+		count = redstoneConnectTo(iter, connect);
+		node->input = redstoneWireInput(&iter, connect, count);
+		node->dirty = redstoneNetVolatile(iter) ? 2 : 0;
+		node->edge  = net->edgeCount;
+		node->out   = net->outCount;
+
+		for (j = 0; j < count; j ++)
+		{
+			RSWire cnx = connect + j;
+			if (cnx->blockId == RSWIRE && cnx->signal != RSUPDATE)
+			{
+				struct BlockIter_t wire = iter;
+				int id;
+				mapIter(&wire, cnx->dx, cnx->dy, cnx->dz);
+				id = redstoneNetFind(net, wire.cd, wire.offset);
+				if (id < 0 && (id = redstoneNetAddNode(net, &wire)) < 0)
+				{
+					if (id < -1) return False;
+					/* too big: keep the region to quickly know it is not worth compiling */
+					redstoneNetOverflow(net);
+					return True;
+				}
+				if (net->edgeCount == net->edgeMax)
+				{
+					DATA16 edges = realloc(net->edges, (net->edgeMax + 256) * sizeof *edges);
+					if (edges == NULL) return False;
+					net->edges = edges;
+					net->edgeMax += 256;
+				}
+				net->edges[net->edgeCount ++] = id;
+			}
+			else /* will need a block update if wire level change */
+			{
+				if (net->outCount == net->outMax)
+				{
+					RSWire outputs = realloc(net->outputs, (net->outMax + 256) * sizeof *outputs);
+					if (outputs == NULL) return False;
+					net->outputs = outputs;
+					net->outMax += 256;
+				}
+				net->outputs[net->outCount ++] = *cnx;
+			}
+		}
+		node = net->nodes + i;
+		node->edgeCount = net->edgeCount - node->edge;
+		node->outCount  = net->outCount  - node->out;
+	}
+
+	/* second pass: reverse edges, we need to know what each wire power */
+	DATA16 powered = malloc(net->edgeCount * sizeof *powered + 1);
+	net->changed = malloc(net->count * 4 * sizeof *net->changed);
+	if (powered == NULL || net->changed == NULL)
+	{
+		free(powered);
+		return False;
+	}
+	net->queue = net->changed + net->count;
+	pos = net->queue;
+	memset(pos, 0, (net->count + 1) * sizeof *pos);
+	for (i = 0; i < net->edgeCount; i ++)
+		pos[net->edges[i] + 1] ++;
+	for (i = 1; i <= net->count; i ++)
+		pos[i] += pos[i-1];
+	for (i = 0; i < net->count; i ++)
+	{
+		RSNetNode node = net->nodes + i;
+		for (j = 0; j < node->edgeCount; j ++)
+			powered[pos[net->edges[node->edge + j]] ++] = i;
+	}
+	/* <pos> now points to the end of each range */
+	for (i = 0; i < net->count; i ++)
+	{
+		RSNetNode node = net->nodes + i;
+		node->edge = i > 0 ? pos[i-1] : 0;
+		node->edgeCount = pos[i] - node->edge;
+	}
+	free(net->edges);
+	net->edges = powered;
+	return True;
+}
+
+/* get graph of wires <iter> is part of: NULL if too big */
+RSNet redstoneNetGet(struct BlockIter_t iter)
+{
+	int XYZ[] = {iter.ref->X + iter.x, iter.yabs, iter.ref->Z + iter.z};
+	RSNet net, eol;
+
+	for (net = rsnet.nets, eol = net + rsnet.count; net < eol; net ++)
+	{
+		if (net->min[0] <= XYZ[0] && XYZ[0] <= net->max[0] &&
+		    net->min[1] <= XYZ[1] && XYZ[1] <= net->max[1] &&
+		    net->min[2] <= XYZ[2] && XYZ[2] <= net->max[2] &&
+		    (net->overflow || redstoneNetFind(net, iter.cd, iter.offset) >= 0))
+		{
+			net->lastUse = ++ rsnet.usage;
+			return net->overflow ? NULL : net;
+		}
+	}
+
+	/* not compiled yet */
+	if (rsnet.count == RSNET_CACHE)
+	{
+		RSNet lru;
+		for (net = lru = rsnet.nets; net < eol; net ++)
+			if (lru->lastUse > net->lastUse) lru = net;
+		redstoneNetFree(net = lru);
+	}
+	else net = rsnet.nets + rsnet.count ++;
+
+	net->lastUse = ++ rsnet.usage;
+	if (! redstoneNetBuild(net, &iter))
+	{
+		/* out of memory: use uncached propagation */
+		redstoneNetDiscard(net);
+		return NULL;
+	}
+	return net->overflow ? NULL : net;
+}
+
+/* compute signal level of all wires, returns number of wires that need to be changed (RSNet.changed) or -1 if graph is stale */
+int redstoneNetEvaluate(RSNet net)
+{
+	RSNetNode node;
+	DATA16    src, cur, next;
+	int       first[MAXSIGNAL+1];
+	int       i, j, count, level;
+
+	memset(first, 0, sizeof first);
+	for (node = net->nodes, i = net->count; i > 0; i --, node ++)
+	{
+		if (node->cd->blockIds[node->offset] != RSWIRE)
+		{
+			/* redstoneNetChanged() should have been called */
+			redstoneNetDiscard(net);
+			return -1;
+		}
+		if (node->dirty)
+		{
+			/* power source nearby has changed */
+			struct RSWire_t connect[RSMAXUPDATE];
+			struct BlockIter_t iter;
+			mapInitIterOffset(&iter, node->cd, node->offset);
+			node->input = redstoneWireInput(&iter, connect, redstoneConnectTo(iter, connect));
+			if (node->dirty == 1)
+				node->dirty = 0;
+		}
+		node->signal = node->input;
+		first[node->input] ++;
+	}
+
+	/* sort wires directly powered by decreasing level */
+	src  = net->queue;
+	cur  = src + net->count;
+	next = cur + net->count;
+	for (level = MAXSIGNAL, j = 0; level > 0; level --)
+		i = first[level], first[level] = j, j += i;
+	for (node = net->nodes, i = 0; i < net->count; i ++, node ++)
+		if (node->input > 0) src[first[node->input] ++] = i;
+
+	/* same as blockLight propagation, except each level is processed at once */
+	for (level = MAXSIGNAL, count = 0, j = 0; level > 1; level --)
+	{
+		int nextCount = 0;
+		for (; j < first[1] && net->nodes[src[j]].input == level; j ++)
+			if (net->nodes[src[j]].signal == level) cur[count ++] = src[j];
+
+		for (i = 0; i < count; i ++)
+		{
+			node = net->nodes + cur[i];
+			DATA16 edge = net->edges + node->edge;
+			int    k;
+			for (k = node->edgeCount; k > 0; k --, edge ++)
+			{
+				RSNetNode wire = net->nodes + edge[0];
+				if (wire->signal < level - 1)
+					wire->signal = level - 1, next[nextCount ++] = edge[0];
+			}
+		}
+		DATA16 swap = cur; cur = next; next = swap; count = nextCount;
+	}
+
+	/* what's different from the world */
+	for (node = net->nodes, i = count = 0; i < net->count; i ++, node ++)
+	{
+		uint8_t data = node->cd->blockIds[DATA_OFFSET + (node->offset >> 1)];
+		if (node->offset & 1) data >>= 4;
+		else data &= 15;
+		if (data != node->signal)
+			net->changed[count ++] = i;
+	}
+	net->lastUse = ++ rsnet.usage;
+	return count;
+}
+
+/* does changing <oldId> into <newId> keep connections between wires */
+static Bool redstoneNetToggle(int oldId, int newId)
+{
+	int id = oldId >> 4;
+	if (oldId == newId) return True;
+	switch (id) {
+	case RSWIRE:
+		return (newId >> 4) == RSWIRE;
+	case RSTORCH_OFF:
+	case RSTORCH_ON:
+		return ((newId >> 4) == RSTORCH_OFF || (newId >> 4) == RSTORCH_ON) && (oldId & 15) == (newId & 15);
+	case RSREPEATER_OFF:
+	case RSREPEATER_ON:
+		return ((newId >> 4) == RSREPEATER_OFF || (newId >> 4) == RSREPEATER_ON) && (oldId & 3) == (newId & 3);
+	case RSLAMP:
+	case RSLAMP+1:
+		return ((newId >> 4) == RSLAMP || (newId >> 4) == RSLAMP+1) && (oldId & 15) == (newId & 15);
+	case RSCOMPARATOR:
+		return (newId >> 4) == id && (oldId & 3) == (newId & 3);
+	case RSOBSERVER:
+		return (newId >> 4) == id && (oldId & 7) == (newId & 7);
+	}
+	if ((newId >> 4) != id)
+		return False;
+	Block b = &blockIds[id];
+	if (b->orientHint == ORIENT_LEVER)
+		return (oldId & 7) == (newId & 7);
+	return b->special == BLOCK_PLATE;
+}
+
+/* block pointed by <iter> has been modified: check if graphs nearby are still valid */
+void redstoneNetChanged(BlockIter iter, int oldId, int newId)
+{
+	if (rsnet.count == 0) return;
+
+	int  XYZ[] = {iter->ref->X + iter->x, iter->yabs, iter->ref->Z + iter->z};
+	Bool toggle = redstoneNetToggle(oldId, newId);
+	int  i;
+
+	for (i = 0; i < rsnet.count; )
+	{
+		RSNet net = rsnet.nets + i;
+		if (XYZ[0] < net->min[0] || XYZ[0] > net->max[0] ||
+		    XYZ[1] < net->min[1] || XYZ[1] > net->max[1] ||
+		    XYZ[2] < net->min[2] || XYZ[2] > net->max[2])
+		{
+			i ++;
+			continue;
+		}
+		if (! toggle)
+		{
+			/* connections might have changed: recompile later */
+			redstoneNetDiscard(net);
+			continue;
+		}
+		if ((newId >> 4) != RSWIRE && ! net->overflow)
+		{
+			/* only power sources: wire level does not depend on other wires here */
+			RSNetNode node;
+			int j;
+			for (node = net->nodes, j = net->count; j > 0; j --, node ++)
+			{
+				if (node->dirty == 0 && abs(node->XYZ[0] - XYZ[0]) + abs(node->XYZ[1] - XYZ[1]) + abs(node->XYZ[2] - XYZ[2]) <= 2)
+					node->dirty = 1;
+			}
+		}
+		i ++;
+	}
+}
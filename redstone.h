@@ -10,6 +10,8 @@
 #define TICK_PER_SECOND    10     /* needs to be a divisor of 1000 */
 
 typedef struct RSWire_t *     RSWire;
+typedef struct RSNet_t *      RSNet;
+typedef struct RSNetNode_t *  RSNetNode;
 
 int  redstoneConnectTo(struct BlockIter_t iter, RSWire connectTo);
 int  redstoneSignalStrength(BlockIter iter, Bool dirty);
@@ -17,6 +19,12 @@ Bool redstonePropagate(int blockId);
 int  redstoneIsPowered(struct BlockIter_t iter, int side, int minPower);
 void redstonePowerChange(struct BlockIter_t iter, RSWire connectTo, int count);
 Bool redstoneIsAttachedTo(int blockId, int side);
+int  redstoneWireInput(BlockIter iter, RSWire connect, int count);
+RSNet redstoneNetGet(struct BlockIter_t iter);
+int  redstoneNetEvaluate(RSNet);
+void redstoneNetChanged(BlockIter iter, int oldId, int newId);
+void redstoneNetClearAll(void);
+void redstoneNetClearChunk(int X, int Z);
 #ifdef MCMAPUPDATE_H
 int  redstonePushedByPiston(struct BlockIter_t iter, int blockId, RSWire list, BlockUpdate blockedBy);
 #endif
@@ -34,6 +42,42 @@ struct RSWire_t /* track where a wire can connect to */
 	uint16_t blockId;
 };
 
+/*
+ * wire runs compiled into a graph: signal level can be recomputed without scanning the world again,
+ * as long as no block changes around the wires (see redstoneNetChanged()).
+ */
+struct RSNetNode_t             /* one wire */
+{
+	ChunkData cd;
+	uint16_t  offset;
+	uint8_t   signal;          /* new level, after redstoneNetEvaluate() */
+	uint8_t   input;           /* level coming from power sources other than wires */
+	uint8_t   dirty;           /* 1: <input> needs to be recomputed, 2: always recompute (comparator nearby) */
+	int       XYZ[3];
+	uint16_t  edge, edgeCount; /* wires powered by this one (RSNet.edges) */
+	uint16_t  out, outCount;   /* other components to update if level changes (RSNet.outputs) */
+};
+
+struct RSNet_t                 /* connected wires */
+{
+	RSNetNode nodes;
+	DATA16    edges;           /* index in <nodes> */
+	RSWire    outputs;         /* relative to node, as returned by redstoneConnectTo() */
+	DATA16    hash;            /* cd/offset => index in <nodes> + 1 */
+	DATA16    changed;         /* nodes modified by redstoneNetEvaluate() */
+	DATA16    queue;           /* scratch for redstoneNetEvaluate() */
+	int       count, nodeMax;  /* <nodes> */
+	int       edgeCount, edgeMax;
+	int       outCount, outMax;
+	int       hashMask;
+	int       min[3], max[3];  /* bbox of blocks that can change the graph */
+	int       lastUse;
+	uint8_t   overflow;        /* too many wires: use old propagation code for all wires within <min>, <max> */
+};
+
+#define RSNET_CACHE   16  /* max graph kept in memory */
+#define RSNET_MAXNODE 4096
+
 #define RSSAMEBLOCK   255 /* possible value for <side> param of redstoneIsPowered() */
 #define MAXSIGNAL     15
 #define RSMAXUPDATE   12
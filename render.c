@@ -942,7 +942,7 @@ void renderSetViewMat(vec4 pos, vec4 lookat, float * yawPitch)
 	glBufferSubData(GL_UNIFORM_BUFFER, UBO_LOOKAT_OFFSET, sizeof old, old);
 
 	uint8_t oldDir = globals.direction;
-	render.setFrustum = 1;
+	render.setFrustum |= FRUSTUM_VIEWMAT;
 	render.yaw = yawPitch[0];
 	render.pitch = yawPitch[1];
 	render.yawFull = yawPitch[2]; /* needed by underwater overlay */
@@ -1458,14 +1458,14 @@ void renderWorld(void)
 	if (meshReady(globals.level))
 	{
 		meshGenerate(globals.level);
-		render.setFrustum = 1;
+		render.setFrustum |= FRUSTUM_REBUILD;
 	}
 
 	if (render.setFrustum)
 	{
 		/* do it as late as possible */
 		double start = FrameGetTime();
-		mapViewFrustum(globals.level, render.nearPlane);
+		mapViewFrustum(globals.level, render.nearPlane, render.setFrustum == FRUSTUM_VIEWMAT);
 		start = FrameGetTime() - start;
 		render.frustumTime = start;
 		render.underWater = mapIsPositionInLiquid(globals.level, render.camera);
@@ -1698,7 +1698,7 @@ void renderWorld(void)
 	{
 		debugCoord(vg, render.camera, render.debugTotalQuad);
 		entityRenderBBox();
-		//quadTreeDebug(globals.nvgCtx);
+		//entityGridDebug(globals.nvgCtx);
 	}
 
 	if (render.debug & RENDER_FRAME_ADVANCE)
@@ -1831,7 +1831,7 @@ void renderResetFrustum(void)
 		glBindBuffer(GL_UNIFORM_BUFFER, globals.uboShader);
 		glBufferSubData(GL_UNIFORM_BUFFER, UBO_SHADING_OFFSET+SHADING_FOGDIST*4, sizeof (float), shading + SHADING_FOGDIST);
 	}
-	render.setFrustum = 1;
+	render.setFrustum |= FRUSTUM_REBUILD;
 }
 
 /* SIT_Nuke is about to be called */
@@ -1870,7 +1870,7 @@ void renderSetFOV(float fov)
 	glBindBuffer(GL_UNIFORM_BUFFER, globals.uboShader);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof (mat4), render.matPerspective);
 
-	render.setFrustum = 1;
+	render.setFrustum |= FRUSTUM_REBUILD;
 }
 
 void renderSetFOG(int fogEnabled)
@@ -72,6 +72,29 @@ void debugZoomView(int x, int y, int dir);
 void debugBlock(int x, int y, int dump);
 void debugToggleInfo(int what);
 void debugLoadSaveState(STRPTR path, Bool load);
+void debugBenchmark(int type, vec4 pos);
+
+enum /* possible values for <type> of debugBenchmark() */
+{
+	DEBUG_BENCH_LIGHT,
+	DEBUG_BENCH_TILETICK,
+	DEBUG_BENCH_ENTITYGRID,
+	DEBUG_BENCH_COLLISION
+};
+
+/* simulation profiler: only call these if globals.profiling is set */
+double debugProfStart(void);
+void   debugProfEnd(int type, Chunk, double start);
+
+enum /* possible values for <type> of debugProfEnd() */
+{
+	PROF_TILETICK,
+	PROF_BLOCKUPDATE,
+	PROF_ENTITY,
+	PROF_PARTICLE,
+	PROF_PHYSICS,
+	PROF_MAX
+};
 
 enum /* possible flags for paramter <what> of debugToggleInfo() (side view) and renderShowBlockInfo() */
 {
@@ -163,7 +186,7 @@ struct RenderWorld_t
 	double     frustumTime;
 	uint8_t    debug;              /* 1 if debug info is displayed (chunk boundaries) */
 	uint8_t    debugInfo;          /* tooltip over block highligted (DEBUG_*) */
-	uint8_t    setFrustum;         /* recompute chunk visible list */
+	uint8_t    setFrustum;         /* recompute chunk visible list (FRUSTUM_*) */
 	uint8_t    previewItem;        /* >0 == preview item being displayed */
 	int        underWater;         /* >0 == player in underwater */
 	int        debugFont;          /* font id from nanovg (init by SITGL) */
@@ -187,6 +210,12 @@ struct RenderWorld_t
 	Message_t  freeze;             /* warn that RENDER_FRAME_ADVANCE is active */
 };
 
+enum                               /* possible values for render.setFrustum (bitfield) */
+{
+	FRUSTUM_REBUILD    = 1,        /* mesh/FOV/chunks changed: visible list must be rebuilt */
+	FRUSTUM_VIEWMAT    = 2         /* only view matrix changed: list can be reused if rotation is small */
+};
+
 enum                               /* possible values for render.previewItem */
 {
 	PREVIEW_NOTHING = 0,
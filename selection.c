@@ -13,6 +13,9 @@
 #include <math.h>
 #include <stdio.h>
 #include <malloc.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "selection.h"
 #include "mapUpdate.h"
 #include "blockUpdate.h"
@@ -21,6 +24,7 @@
 #include "entities.h"
 #include "meshBanks.h"
 #include "keybindings.h"
+#include "undoredo.h"
 #include "globals.h"
 #include "SIT.h"
 
@@ -73,8 +77,8 @@ void selectionInitStatic(int shader)
 	glBindVertexArray(0);
 }
 
-static const char * selectionKeys[] = {"CopyAir", "CopyWater", "CopyEntity"};
-static char selectionDefault[] = {1, 1, 0};
+static const char * selectionKeys[] = {"CopyAir", "CopyWater", "CopyEntity", "OnlyReplaceAir"};
+static char selectionDefault[] = {1, 1, 0, 0};
 
 /* load settings from disk */
 void selectionLoadState(INIFile ini)
@@ -491,7 +495,6 @@ void selectionRender(void)
 /*
  * clone selection tool: create a mini-map from the selected blocks
  */
-#define chunkDeleteIterTE(iter)   chunkDeleteTileEntity((iter).cd, (iter).offset, True, NULL)
 #define chunkAddIterTE(iter,tile) \
 { \
 	chunkAddTileEntity((iter).cd, (iter).offset, tile); \
@@ -579,61 +582,62 @@ static int selectionRepeat(SIT_Widget w, APTR cd, APTR ud)
 	return 1;
 }
 
-/* copy blocks from brush into map */
+/*
+ * copy blocks from brush into map: brush is split in spans that do not cross a sub-chunk boundary (both in brush
+ * and map), each span being copied in the tables with mapUpdatePasteRow(). Light and meshes are updated once,
+ * at the end.
+ */
 int selectionCopyBlocks(SIT_Widget w, APTR cd, APTR ud)
 {
-	struct BlockIter_t dst;
-	struct BlockIter_t src;
-	Map  brush = selection.brush;
-	Map  map   = globals.level;
+	Map  brush   = selection.brush;
+	Map  map     = globals.level;
+	int  chunksX = (brush->size[VX] + 15) >> 4;
+	int  size[]  = {brush->size[VX] - 2, brush->size[VY] - 2, brush->size[VZ] - 2};
+	int  count   = selection.cloneRepeat; /* max repeat is 128 */
+	int  flags   = 0;
+	int  range[6], i, x, y, z, n;
 	vec4 pos;
 
-	memcpy(pos, selection.clonePt, sizeof pos);
-	mapInitIter(map, &dst, selection.clonePt, True);
-	mapInitIterOffset(&src, brush->firstVisible, 256+16+1);
-	mapUpdateInit(&dst);
-	src.nbor = brush->chunkOffsets;
+	if (! selection.copyAir)   flags |= PASTE_SKIPAIR;
+	if (! selection.copyWater) flags |= PASTE_SKIPWATER;
+	if (selection.onlyAir)     flags |= PASTE_ONLYAIR;
 
-	uint8_t air = selection.copyAir;
-	uint8_t water = selection.copyWater;
-	uint8_t count = selection.cloneRepeat; /* max repeat is 128 */
+	/* area covered by all the copies: modified sub-chunks will be saved in undo log */
+	for (i = 0; i < 3; i ++)
+	{
+		n = selection.cloneOff[i] * (count - 1);
+		range[i]   = selection.clonePt[i] + MIN(n, 0);
+		range[i+3] = size[i] + abs(n);
+	}
+	undoLog(LOG_REGION_START, range);
+	mapUpdateInit(NULL);
 
-	while (dst.yabs < BUILD_HEIGHT)
+	for (memcpy(pos, selection.clonePt, sizeof pos); count > 0; count --)
 	{
-		int dx = brush->size[VX] - 2;
-		int dy = brush->size[VY] - 2;
-		int dz = brush->size[VZ] - 2;
-		while (dy > 0)
+		/* brush has a 1 block layer of air all around */
+		for (y = 1; y <= size[VY]; y ++)
 		{
-			int z, x;
-			for (z = 0; z < dz; z ++, mapIter(&src, -dx, 0, 1), mapIter(&dst, -dx, 0, 1))
+			for (z = 1; z <= size[VZ]; z ++)
 			{
-				for (x = 0; x < dx; x ++, mapIter(&src, 1, 0, 0), mapIter(&dst, 1, 0, 0))
+				for (x = 1; x <= size[VX]; x += n)
 				{
-					uint8_t data = src.blockIds[DATA_OFFSET + (src.offset >> 1)];
-					int blockId = (src.blockIds[src.offset] << 4) | (src.offset & 1 ? data >> 4 : data & 15);
-					if (dst.ref == NULL) continue; /* outside map :-/ */
-					if (air == 0 && blockId == 0) continue;
-					if (water == 0 && blockGetById(blockId)->special == BLOCK_LIQUID) continue;
-					DATA8 tile = chunkDeleteIterTE(src);
-					mapUpdate(map, NULL, blockId, tile, UPDATE_SILENT);
+					int X = pos[VX] + x - 1;
+					n = MIN(16 - (x & 15), 16 - (X & 15));
+					if (n > size[VX] + 1 - x) n = size[VX] + 1 - x;
+
+					mapUpdatePasteRow(map, (vec4) {X, pos[VY] + y - 1, pos[VZ] + z - 1},
+						brush->chunks[(x >> 4) + (z >> 4) * chunksX].layer[y >> 4], CHUNK_BLOCK_POS(x & 15, z & 15, y & 15), n, flags);
 				}
 			}
-			mapIter(&src, 0, 1, -dz);
-			mapIter(&dst, 0, 1, -dz);
-			dy --;
 		}
-		count --;
-		if (count == 0) break;
-
 		pos[VX] += selection.cloneOff[VX];
 		pos[VY] += selection.cloneOff[VY];
 		pos[VZ] += selection.cloneOff[VZ];
-
-		mapInitIter(map, &dst, pos, True);
-		mapInitIterOffset(&src, brush->firstVisible, 256+16+1);
 	}
+	undoLog(LOG_REGION_END, &i);
+	if (i) renderAddModif();
 
+	/* not part of region undo: logged individually */
 	if (selection.copyEntity)
 		entityCopyToMap(BRUSH_ENTITIES(brush), map);
 
@@ -818,8 +822,9 @@ void selectionEditBrush(Bool simplified)
 		"<button name=copyair title=", LANG("Copy <u>a</u>ir"),    "curValue=", &selection.copyAir,    "top=WIDGET,#LAST,1em     buttonType=", SITV_CheckBox, ">"
 		"<button name=copywat title=", LANG("Copy <u>w</u>ater"),  "curValue=", &selection.copyWater,  "top=WIDGET,copyair,0.5em buttonType=", SITV_CheckBox, ">"
 		"<button name=copyent title=", LANG("Copy <u>e</u>ntity"), "curValue=", &selection.copyEntity, "top=WIDGET,copywat,0.5em buttonType=", SITV_CheckBox, ">"
+		"<button name=onlyair title=", LANG("<u>O</u>nly replace air"), "curValue=", &selection.onlyAir, "top=WIDGET,copyent,0.5em buttonType=", SITV_CheckBox, ">"
 
-		"<button name=ko.act title=", LANG("Cancel"), "right=FORM top=WIDGET,copyent,1em>"
+		"<button name=ko.act title=", LANG("Cancel"), "right=FORM top=WIDGET,onlyair,1em>"
 		"<button name=ok.act title=", LANG("Clone"),  "right=WIDGET,ko,0.5em top=OPPOSITE,ko buttonType=", SITV_DefaultButton, ">"
 	);
 	SIT_SetAttributes(diag,
@@ -900,7 +905,20 @@ void selectionIterEntities(SIT_CallProc cb, APTR data)
 
 	selectionGetRange(pos, False);
 	for (i = 0; i < 6; bbox[i] = pos[i], i ++);
-	Entity * list = quadTreeIntersect(bbox, pos, ENFLAG_ANYENTITY);
+
+	/* chunks beyond entity distance only have their entities decoded on demand */
+	for (bbox[VZ] = pos[VZ] & ~15; bbox[VZ] <= pos[VZ+3]; bbox[VZ] += 16)
+	{
+		for (bbox[VX] = pos[VX] & ~15; bbox[VX] <= pos[VX+3]; bbox[VX] += 16)
+		{
+			Chunk chunk = mapGetChunk(globals.level, bbox);
+			if (chunk && (chunk->cflags & CFLAG_LAZYENT))
+				chunkDecodeEntities(chunk);
+		}
+	}
+	bbox[VX] = pos[VX];
+	bbox[VZ] = pos[VZ];
+	Entity * list = entityGridIntersect(bbox, pos, ENFLAG_ANYENTITY);
 
 	for (i = 0; i < pos[0]; i ++)
 	{
@@ -960,6 +978,93 @@ static int selectionEnumEntities(SIT_Widget unused, APTR cd, APTR ud)
 /*
  * copy selected blocks into a mini-map: this is the clone brush creation function.
  */
+static struct
+{
+	Map       src, dst;
+	int       pos[3];              /* selection start in <src> */
+	int       size[3];             /* selection size */
+	int       next;                /* next Y plane to copy */
+	Mutex     lock;
+	Semaphore done;
+}	selectionCopyJob;
+
+/* copy <count> nibbles from <src> (starting at nibble <soff>) to <dst> (at <doff>) */
+static void selectionCopyNibbles(DATA8 dst, int doff, DATA8 src, int soff, int count)
+{
+	if (count <= 0) return;
+	if ((soff & 1) == (doff & 1))
+	{
+		/* same alignment: bytes in the middle can be copied as is */
+		if (soff & 1)
+		{
+			dst[doff >> 1] = (dst[doff >> 1] & 0x0f) | (src[soff >> 1] & 0xf0);
+			soff ++; doff ++; count --;
+		}
+		if (count <= 0) return;
+		memcpy(dst + (doff >> 1), src + (soff >> 1), count >> 1);
+		if (count & 1)
+		{
+			soff += count - 1;
+			doff += count - 1;
+			dst[doff >> 1] = (dst[doff >> 1] & 0xf0) | (src[soff >> 1] & 0x0f);
+		}
+	}
+	else for (; count > 0; count --, soff ++, doff ++)
+	{
+		uint8_t data = src[soff >> 1];
+		if (soff & 1) data >>= 4; else data &= 15;
+		if (doff & 1) dst[doff >> 1] = (dst[doff >> 1] & 0x0f) | (data << 4);
+		else          dst[doff >> 1] = (dst[doff >> 1] & 0xf0) | data;
+	}
+}
+
+/* worker thread: copy XZ planes of blocks (only plane <y> writes into data nibbles of row <y>, no locking needed) */
+static void selectionCopyWorker(void * arg)
+{
+	int * pos  = selectionCopyJob.pos;
+	int * size = selectionCopyJob.size;
+	int   chunksX = (size[VX] + 2 + 15) >> 4;
+
+	for (;;)
+	{
+		int x, y, z, count;
+		MutexEnter(selectionCopyJob.lock);
+		y = selectionCopyJob.next ++;
+		MutexLeave(selectionCopyJob.lock);
+		if (y >= size[VY]) break;
+
+		/* brush has a 1 block layer of air all around */
+		int sy = pos[VY] + y, dy = y + 1;
+		if (sy < 0 || sy >= BUILD_HEIGHT) continue;
+
+		for (z = 0; z < size[VZ]; z ++)
+		{
+			int sz = pos[VZ] + z, dz = z + 1;
+			for (x = 0; x < size[VX]; x += count)
+			{
+				int sx = pos[VX] + x, dx = x + 1;
+				/* span must not cross a sub-chunk boundary, both in source and destination */
+				count = MIN(16 - (sx & 15), 16 - (dx & 15));
+				if (count > size[VX] - x) count = size[VX] - x;
+
+				Chunk c = mapGetChunk(selectionCopyJob.src, (vec4) {sx, sy, sz});
+				if (c == NULL || (sy >> 4) >= c->maxy || c->layer[sy >> 4] == NULL)
+					/* air: brush is already cleared */
+					continue;
+
+				DATA8 src = c->layer[sy >> 4]->blockIds;
+				DATA8 dst = selectionCopyJob.dst->chunks[(dx >> 4) + (dz >> 4) * chunksX].layer[dy >> 4]->blockIds;
+				int   soff = CHUNK_BLOCK_POS(sx & 15, sz & 15, sy & 15);
+				int   doff = CHUNK_BLOCK_POS(dx & 15, dz & 15, dy & 15);
+
+				memcpy(dst + doff, src + soff, count);
+				selectionCopyNibbles(dst + DATA_OFFSET, doff, src + DATA_OFFSET, soff, count);
+			}
+		}
+	}
+	SemAdd(selectionCopyJob.done, 1);
+}
+
 Map selectionClone(vec4 pos, int side, Bool genMesh)
 {
 	if (globals.selPoints != 3)
@@ -1001,33 +1106,48 @@ Map selectionClone(vec4 pos, int side, Bool genMesh)
 			fminf(selection.firstPt[VY], selection.secondPt[VY]),
 			fminf(selection.firstPt[VZ], selection.secondPt[VZ])
 		};
-		struct BlockIter_t src;
-		struct BlockIter_t dst;
 		Chunk chunk;
-		int   x, y, z;
-		mapInitIter(map, &src, srcPos, False);
-		mapInitIterOffset(&dst, brush->firstVisible, 256+16+1);
-		dst.nbor = brush->chunkOffsets;
+		int   x, y, z, threads;
 		sizes[VX] -= 2;
 		sizes[VY] -= 2;
 		sizes[VZ] -= 2;
-		chunk = src.ref;
-		/* note: we have to add a 1 block layer all around the brush to prevent face culling at the edge of chunk */
-		for (y = 1; y <= sizes[VY]; y ++, mapIter(&src, 0, 1, -sizes[VZ]), mapIter(&dst, 0, 1, -sizes[VZ]))
+
+		/* blocks are copied by worker threads, one XZ plane at a time */
+		selectionCopyJob.src = map;
+		selectionCopyJob.dst = brush;
+		selectionCopyJob.next = 0;
+		for (x = 0; x < 3; x ++)
+			selectionCopyJob.pos[x] = srcPos[x], selectionCopyJob.size[x] = sizes[x];
+		if (selectionCopyJob.lock == NULL)
+			selectionCopyJob.lock = MutexCreate(), selectionCopyJob.done = SemInit(0);
+		threads = MIN(sizes[VY], COPY_THREADS);
+		for (x = 0; x < threads; x ++)
+			ThreadCreate(selectionCopyWorker, &selectionCopyJob);
+
+		/* meanwhile: copy tile entities (note: we have to add a 1 block layer all around the brush to prevent face culling at the edge of chunk) */
+		int range[6];
+		selectionGetRange(range, False);
+		for (z = range[VZ] & ~15; z < range[VZ+3]; z += 16)
 		{
-			for (z = 1; z <= sizes[VZ]; z ++, mapIter(&src, -sizes[VX], 0, 1), mapIter(&dst, -sizes[VX], 0, 1))
+			for (x = range[VX] & ~15; x < range[VX+3]; x += 16)
 			{
-				for (x = 1; x <= sizes[VX]; x ++, mapIter(&src, 1, 0, 0), mapIter(&dst, 1, 0, 0))
+				int   offset = 0, XYZ[3];
+				DATA8 tile;
+				chunk = mapGetChunk(map, (vec4) {x, 0, z});
+				if (chunk == NULL) continue;
+				while ((tile = chunkIterTileEntity(chunk, XYZ, &offset)))
 				{
-					/* would be nice if we could use memcpy(), but DATA_OFFSET table is packed by 2 voxels per byte :-/ */
-					uint8_t data = src.blockIds[DATA_OFFSET + (src.offset >> 1)];
-					dst.blockIds[dst.offset] = src.blockIds[src.offset];
-					if (src.offset & 1) data >>= 4; else data &= 15;
-					dst.blockIds[DATA_OFFSET + (dst.offset>>1)] |= dst.offset & 1 ? data << 4 : data;
-
-					/* also need to copy tile entities */
-					DATA8 tile = chunkGetTileEntity(src.cd, src.offset);
-					if (tile) chunkAddIterTE(dst, tile = NBT_Copy(tile));
+					if (XYZ[VX] < range[VX] || XYZ[VX] >= range[VX+3] ||
+					    XYZ[VY] < range[VY] || XYZ[VY] >= range[VY+3] ||
+					    XYZ[VZ] < range[VZ] || XYZ[VZ] >= range[VZ+3]) continue;
+					int dx = XYZ[VX] - range[VX] + 1;
+					int dy = XYZ[VY] - range[VY] + 1;
+					int dz = XYZ[VZ] - range[VZ] + 1;
+					ChunkData cd = brush->chunks[(dx >> 4) + (dz >> 4) * ((sizes[VX] + 17) >> 4)].layer[dy >> 4];
+					int dst = CHUNK_BLOCK_POS(dx & 15, dz & 15, dy & 15);
+					tile = NBT_Copy(tile);
+					chunkAddTileEntity(cd, dst, tile);
+					chunkUpdateTilePosition(cd, dst, tile);
 				}
 			}
 		}
@@ -1038,6 +1158,9 @@ Map selectionClone(vec4 pos, int side, Bool genMesh)
 		BRUSH_SETENT(brush, entityCopy(stat.nbVertex, srcPos, stat.ids ? stat.ids : stat.buffer, stat.nbIds,
 			stat.models ? stat.models : stat.modelIds, stat.nbModels));
 
+		for (x = 0; x < threads; x ++)
+			SemWait(selectionCopyJob.done);
+
 		if (genMesh)
 		{
 			/* convert all chunks into meshes */
@@ -1211,101 +1334,198 @@ int selectionCancelClone(SIT_Widget w, APTR cd, APTR ud)
 		dataTbl[0] = (dataTbl[0] & 0xf0) | (data); \
 }
 
-/* rotate brush along Y axis by 90deg CW */
-static void selectionBrushRotate(void)
+/*
+ * brush transform: blocks are remapped one 16x16x16 sub-chunk of the destination at a time, by
+ * worker threads, using precomputed id:meta tables (see blockTransformTable()).
+ */
+static struct
 {
-	/* we can rotate the brush Y layer per Y layer */
-	Map brush = selection.brush;
-	int chunkX = (brush->size[VX] + 15) >> 4;
-	int chunkZ = (brush->size[VZ] + 15) >> 4;
-	int size = chunkX * chunkZ;
-	int dx, dy, dz, x, y, z;
-
-	DATA8 layer = size <= 6 ? alloca(size * 384) : malloc(size * 384);
-	memset(layer, 0, size * 384);
-
-	struct BlockIter_t iter;
-	Chunk c;
-	mapInitIterOffset(&iter, brush->firstVisible, 256+16+1);
-	iter.nbor = brush->chunkOffsets;
-
-	dx = brush->size[VX] - 2;
-	dy = brush->size[VY] - 2;
-	dz = brush->size[VZ] - 2;
-	/* relocate blocks + data */
-	for (y = 1; y <= dy; y ++, mapIter(&iter, 0, 1, -dz))
+	Map       src, dst;
+	DATA16    table;               /* id:meta => transformed id:meta */
+	int8_t    perm[3];             /* src coord [i] = sign[i] * dst coord [perm[i]] + shift[i] */
+	int8_t    sign[3];
+	int       shift[3];
+	int       next, count;         /* next sub-chunk of <dst> to fill */
+	Mutex     lock;
+	Semaphore done;
+}	selectionTransformJob;
+
+/* worker thread: each sub-chunk of destination is written by only one thread */
+static void selectionTransformWorker(void * arg)
+{
+	Map      src    = selectionTransformJob.src;
+	Map      dst    = selectionTransformJob.dst;
+	DATA16   table  = selectionTransformJob.table;
+	int8_t * perm   = selectionTransformJob.perm;
+	int8_t * sign   = selectionTransformJob.sign;
+	int *    shift  = selectionTransformJob.shift;
+	int      srcX   = (src->size[VX] + 15) >> 4;
+	int      layers = (dst->size[VY] + 15) >> 4;
+
+	for (;;)
 	{
-		for (z = 1; z <= dz; z ++, mapIter(&iter, -dx, 0, 1))
+		int tile, min[3], max[3], pos[3], i;
+		MutexEnter(selectionTransformJob.lock);
+		tile = selectionTransformJob.next ++;
+		MutexLeave(selectionTransformJob.lock);
+		if (tile >= selectionTransformJob.count) break;
+
+		ChunkData cd = dst->chunks[tile / layers].layer[tile % layers];
+		DATA8 blocks = cd->blockIds;
+		min[VX] = cd->chunk->X;
+		min[VY] = cd->Y;
+		min[VZ] = cd->chunk->Z;
+		/* 1 block layer of air around brush stays as is */
+		for (i = 0; i < 3; i ++)
 		{
-			for (x = 1; x <= dx; x ++, mapIter(&iter, 1, 0, 0))
+			max[i] = MIN(min[i] + 16, dst->size[i] - 1);
+			if (min[i] == 0) min[i] = 1;
+		}
+		for (pos[VY] = min[VY]; pos[VY] < max[VY]; pos[VY] ++)
+		{
+			for (pos[VZ] = min[VZ]; pos[VZ] < max[VZ]; pos[VZ] ++)
 			{
-				/* these 2 assignments will do the 90deg CW rotation */
-				int x2 = dz - z + 1;
-				int z2 = x;
-				int off = 0;
-				DATA8 tile = chunkDeleteIterTE(iter);
-				if (tile)
+				int offset = CHUNK_BLOCK_POS(min[VX] & 15, pos[VZ] & 15, pos[VY] & 15);
+				for (pos[VX] = min[VX]; pos[VX] < max[VX]; pos[VX] ++, offset ++)
 				{
-					struct BlockIter_t te = iter;
-					mapIter(&te, x2 - x, 0, z2 - z);
-					chunkAddIterTE(te, tile);
+					int   x    = sign[VX] * pos[perm[VX]] + shift[VX];
+					int   y    = sign[VY] * pos[perm[VY]] + shift[VY];
+					int   z    = sign[VZ] * pos[perm[VZ]] + shift[VZ];
+					DATA8 from = src->chunks[(x >> 4) + (z >> 4) * srcX].layer[y >> 4]->blockIds;
+					int   off  = CHUNK_BLOCK_POS(x & 15, z & 15, y & 15);
+					int   data = from[DATA_OFFSET + (off >> 1)];
+					int   id   = table[(from[off] << 4) | (off & 1 ? data >> 4 : data & 15)];
+
+					/* <dst> has been cleared: nibbles can be or'ed */
+					blocks[offset] = id >> 4;
+					blocks[DATA_OFFSET + (offset >> 1)] |= offset & 1 ? (id & 15) << 4 : id & 15;
 				}
-				if (x2 > 15) off += 384 * (x2 >> 4), x2 &= 15;
-				if (z2 > 15) off += 384 * chunkX * (z2 >> 4), z2 &= 15;
-				off += z2*16 + x2;
-				int blockId = blockRotateY90(getBlockId(&iter));
-				layer[off] = blockId >> 4; blockId &= 15;
-				layer[256 + (off >> 1)] |= off & 1 ? blockId << 4 : blockId;
 			}
 		}
-		/* copy temp layer into brush */
-		DATA8 blocks;
-		for (z = 0, blocks = layer, c = brush->chunks; z < chunkZ; z ++)
+	}
+	SemAdd(selectionTransformJob.done, 1);
+}
+
+/* remap all blocks of <src> into <dst> (a cleared brush of transformed size), tile entities are moved */
+static void selectionTransformBrush(Map src, Map dst, int transform, int8_t perm[3], int8_t sign[3], int shift[3])
+{
+	Chunk c;
+	int   i, count, threads;
+	int   dstX = (dst->size[VX] + 15) >> 4;
+
+	selectionTransformJob.src   = src;
+	selectionTransformJob.dst   = dst;
+	selectionTransformJob.table = blockTransformTable(transform);
+	selectionTransformJob.next  = 0;
+	selectionTransformJob.count = dstX * ((dst->size[VY] + 15) >> 4) * ((dst->size[VZ] + 15) >> 4);
+	for (i = 0; i < 3; i ++)
+	{
+		selectionTransformJob.perm[i]  = perm[i];
+		selectionTransformJob.sign[i]  = sign[i];
+		selectionTransformJob.shift[i] = shift[i];
+	}
+	if (selectionTransformJob.lock == NULL)
+		selectionTransformJob.lock = MutexCreate(), selectionTransformJob.done = SemInit(0);
+	threads = MIN(selectionTransformJob.count, COPY_THREADS);
+	for (i = 0; i < threads; i ++)
+		ThreadCreate(selectionTransformWorker, &selectionTransformJob);
+
+	/* meanwhile: relocate tile entities (inverse of the mapping used by workers) */
+	for (c = src->chunks, count = ((src->size[VX] + 15) >> 4) * ((src->size[VZ] + 15) >> 4); count > 0; count --, c ++)
+	{
+		DATA8 tile;
+		int   offset, XYZ[3], pos[3];
+
+		for (offset = 0; (tile = chunkIterTileEntity(c, XYZ, &offset)); )
 		{
-			for (x = 0; x < chunkX; x ++, blocks += 384, c ++)
-			{
-				DATA8 dest = c->layer[y>>4]->blockIds;
-				memcpy(dest + iter.y * 256, blocks, 256);
-				memcpy(dest + iter.y * 128 + DATA_OFFSET, blocks + 256, 128);
-				/* cleanup for next layer */
-				memset(blocks, 0, 384);
-			}
+			/* extract from <src>: entries following in hash chain might be moved in the slot we just freed */
+			tile = chunkDeleteTileEntity(c->layer[XYZ[VY] >> 4], CHUNK_BLOCK_POS(XYZ[VX] & 15, XYZ[VZ] & 15, XYZ[VY] & 15), True, NULL);
+			offset --;
+			for (i = 0; i < 3; i ++)
+				pos[perm[i]] = (XYZ[i] - shift[i]) * sign[i];
+
+			ChunkData cd = dst->chunks[(pos[VX] >> 4) + (pos[VZ] >> 4) * dstX].layer[pos[VY] >> 4];
+			int       dstOff = CHUNK_BLOCK_POS(pos[VX] & 15, pos[VZ] & 15, pos[VY] & 15);
+			chunkAddTileEntity(cd, dstOff, tile);
+			chunkUpdateTilePosition(cd, dstOff, tile);
 		}
 	}
-	if (BRUSH_ENTITIES(brush))
-		entityCopyTransform(BRUSH_ENTITIES(brush), TRANSFORM_ROTATE + VY, selection.clonePt, brush->size);
-	if (size > 6) free(layer);
-	brush->size[VX] = dz+2;
-	brush->size[VZ] = dx+2;
 
-	/* relocate chunk coord and regenerate mesh */
-	swap(chunkX, chunkZ);
-	float diff = (selection.cloneSize[VX] - selection.cloneSize[VZ]) * 0.5f;
-	selection.clonePt[VX] += roundf(diff);
-	selection.clonePt[VZ] += roundf(-diff);
-	/* chunk grid will be the same size */
+	for (i = 0; i < threads; i ++)
+		SemWait(selectionTransformJob.done);
+}
+
+/* move transformed blocks from <temp> back into <brush>: keep ChunkData (and their GPU banks), number of columns and layers are the same */
+static void selectionBrushReplace(Map brush, Map temp)
+{
+	Chunk src, dst;
+	int   count, y;
+
+	for (src = temp->chunks, dst = brush->chunks, count = ((temp->size[VX] + 15) >> 4) * ((temp->size[VZ] + 15) >> 4);
+	     count > 0; count --, src ++, dst ++)
+	{
+		for (y = 0; y < dst->maxy; y ++)
+			memcpy(dst->layer[y]->blockIds, src->layer[y]->blockIds, SKYLIGHT_OFFSET);
+		/* chunk grid might have been transposed */
+		dst->X = src->X;
+		dst->Z = src->Z;
+		dst->noChunks = src->noChunks;
+		/* tile entities have all been moved into <src> by now, but the hash table itself was kept */
+		if (dst->tileEntities) chunkFreeHash(dst->tileEntities, NULL, NULL);
+		dst->tileEntities = src->tileEntities;
+		src->tileEntities = NULL;
+	}
+	memcpy(brush->size, temp->size, 6);
+	selectionFreeBrush(temp);
+}
+
+/* regenerate mesh of brush */
+static void selectionBrushGenMesh(Map brush)
+{
+	Chunk c;
+	int   x, y, z;
+	int   chunkX = (brush->size[VX] + 15) >> 4;
+	int   chunkZ = (brush->size[VZ] + 15) >> 4;
 	for (z = 0, c = brush->chunks; z < chunkZ; z ++)
 	{
 		for (x = 0; x < chunkX; x ++, c ++)
 		{
-			uint8_t missing = 0;
-			if (x == 0) missing |= 1 << SIDE_WEST;
-			if (z == 0) missing |= 1 << SIDE_NORTH;
-			if (x == chunkX-1) missing |= 1 << SIDE_EAST;
-			if (z == chunkZ-1) missing |= 1 << SIDE_SOUTH;
-			c->noChunks = missing;
-			c->X = x * 16;
-			c->Z = z * 16;
-
-			for (dy = 0; dy < c->maxy; dy ++)
+			for (y = 0; y < c->maxy; y ++)
 			{
-				chunkUpdate(brush, c, chunkAir, dy, meshInitST);
+				chunkUpdate(brush, c, chunkAir, y, meshInitST);
 				/* transfer chunk to the GPU */
 				meshFinishST(brush);
 			}
 		}
 	}
 	meshAllocCmdBuffer(brush);
+}
+
+/* rotate brush along Y axis by 90deg CW */
+static void selectionBrushRotate(void)
+{
+	Map brush = selection.brush;
+	int dx = brush->size[VX] - 2;
+	int dy = brush->size[VY] - 2;
+	int dz = brush->size[VZ] - 2;
+
+	/* chunk grid will have the same number of columns, only transposed */
+	Map temp = selectionAllocBrush((uint16_t[3]) {dz+2, dy+2, dx+2});
+	if (! temp) return;
+
+	/* 90deg CW: x2 = dz - z + 1, z2 = x */
+	selectionTransformBrush(brush, temp, TRANSFORM_ROTATE + VY, (int8_t[3]) {VZ, VY, VX}, (int8_t[3]) {1, 1, -1}, (int[3]) {0, 0, dz+1});
+
+	if (BRUSH_ENTITIES(brush))
+		entityCopyTransform(BRUSH_ENTITIES(brush), TRANSFORM_ROTATE + VY, selection.clonePt, brush->size);
+
+	selectionBrushReplace(brush, temp);
+
+	float diff = (selection.cloneSize[VX] - selection.cloneSize[VZ]) * 0.5f;
+	selection.clonePt[VX] += roundf(diff);
+	selection.clonePt[VZ] += roundf(-diff);
+
+	selectionBrushGenMesh(brush);
 
 	/* swap sizes for X and Z axis */
 	vec   sz  = selection.cloneSize;
@@ -1322,53 +1542,20 @@ static void selectionBrushRotate(void)
 static void selectionBrushRoll(void)
 {
 	Map brush = selection.brush;
-	int dx, dy, dz, x, y, z;
-
-	struct BlockIter_t src;
-	struct BlockIter_t dst;
-	mapInitIterOffset(&src, brush->firstVisible, 256+16+1);
-	src.nbor = brush->chunkOffsets;
-
-	dx = brush->size[VX] - 2;
-	dy = brush->size[VY] - 2;
-	dz = brush->size[VZ] - 2;
-
-	if (dx > BUILD_HEIGHT) return;
+	int dx = brush->size[VX] - 2;
+	int dy = brush->size[VY] - 2;
+	int dz = brush->size[VZ] - 2;
 
 	/* way too many things to relocate when doing in place modifications: WAY TOO MANY */
 	Map roll;
 	if (globals.direction & 1)
+	{
+		/* rotate along X axis: z2 = dy - y + 1, y2 = z */
+		if (dz > BUILD_HEIGHT) return;
 		roll = selectionAllocBrush((uint16_t[3]) {dx+2, dz+2, dy+2});
-	else
-		roll = selectionAllocBrush((uint16_t[3]) {dy+2, dx+2, dz+2});
-	if (! roll) return;
-	mapInitIterOffset(&dst, roll->firstVisible, 256+16+1);
-	dst.nbor = roll->chunkOffsets;
+		if (! roll) return;
+		selectionTransformBrush(brush, roll, TRANSFORM_ROTATE + VX, (int8_t[3]) {VX, VZ, VY}, (int8_t[3]) {1, -1, 1}, (int[3]) {0, dy+1, 0});
 
-	/* relocate blocks + data */
-	if (globals.direction & 1)
-	{
-		int oz = 1, oy = 1;
-		/* rotate along X axis */
-		for (x = 1; x <= dx; x ++, mapIter(&src, 1, -dy, 0), mapIter(&dst, 1, 0, 0))
-		{
-			for (y = 1; y <= dy; y ++, mapIter(&src, 0, 1, -dz))
-			{
-				for (z = 1; z <= dz; z ++, mapIter(&src, 0, 0, 1))
-				{
-					int z2 = dy - y + 1;
-					int y2 = z;
-					int blockId = blockRotateX90(getBlockId(&src));
-					mapIter(&dst, 0, y2 - oy, z2 - oz);
-					oy = y2; oz = z2;
-					dst.blockIds[dst.offset] = blockId >> 4;
-					mapUpdateData(&dst, blockId & 15);
-
-					DATA8 tile = chunkDeleteIterTE(src);
-					if (tile) chunkAddIterTE(dst, tile);
-				}
-			}
-		}
 		/* center the new brush in the center of the old */
 		float diff = (selection.cloneSize[VZ] - selection.cloneSize[VY]) * 0.5f;
 		selection.clonePt[VZ] += roundf(diff);
@@ -1377,29 +1564,13 @@ static void selectionBrushRoll(void)
 		selection.cloneSize[VZ] = selection.cloneSize[VY];
 		selection.cloneSize[VY] = diff;
 	}
-	else /* rotate along Z axis */
+	else /* rotate along Z axis (camera viewing direction = axis of rotation): x2 = dy - y + 1, y2 = x */
 	{
-		int ox = 1, oy = 1;
-		/* rotate along X axis: camera viewing direction = axis of rotation */
-		for (z = 1; z <= dz; z ++, mapIter(&src, 0, -dy, 1), mapIter(&dst, 0, 0, 1))
-		{
-			for (y = 1; y <= dy; y ++, mapIter(&src, -dx, 1, 0))
-			{
-				for (x = 1; x <= dx; x ++, mapIter(&src, 1, 0, 0))
-				{
-					int x2 = dy - y + 1;
-					int y2 = x;
-					int blockId = blockRotateZ90(getBlockId(&src));
-					mapIter(&dst, x2 - ox, y2 - oy, 0);
-					oy = y2; ox = x2;
-					dst.blockIds[dst.offset] = blockId >> 4;
-					mapUpdateData(&dst, blockId & 15);
-
-					DATA8 tile = chunkDeleteIterTE(src);
-					if (tile) chunkAddIterTE(dst, tile);
-				}
-			}
-		}
+		if (dx > BUILD_HEIGHT) return;
+		roll = selectionAllocBrush((uint16_t[3]) {dy+2, dx+2, dz+2});
+		if (! roll) return;
+		selectionTransformBrush(brush, roll, TRANSFORM_ROTATE + VZ, (int8_t[3]) {VY, VX, VZ}, (int8_t[3]) {1, -1, 1}, (int[3]) {0, dy+1, 0});
+
 		float diff = (selection.cloneSize[VX] - selection.cloneSize[VY]) * 0.5f;
 		selection.clonePt[VX] += roundf(diff);
 		selection.clonePt[VY] += roundf(-diff);
@@ -1412,23 +1583,7 @@ static void selectionBrushRoll(void)
 	selectionFreeBrush(brush);
 	selection.brush = roll;
 
-	/* regen mesh */
-	Chunk chunk;
-	dz = (roll->size[VZ] + 15) >> 4;
-	dx = (roll->size[VX] + 15) >> 4;
-	for (z = 0, chunk = roll->chunks; z < dz; z ++)
-	{
-		for (x = 0; x < dx; x ++, chunk ++)
-		{
-			for (y = 0; y < chunk->maxy; y ++)
-			{
-				chunkUpdate(roll, chunk, chunkAir, y, meshInitST);
-				/* transfer chunk to the GPU */
-				meshFinishST(roll);
-			}
-		}
-	}
-	meshAllocCmdBuffer(roll);
+	selectionBrushGenMesh(roll);
 
 	selectionSetRect(SEL_POINT_CLONE);
 	selectionSetClonePt(NULL, -1);
@@ -1439,76 +1594,16 @@ static void selectionBrushRoll(void)
 static void selectionBrushFlip(void)
 {
 	Map brush = selection.brush;
-	int dx, dy, dz, x, y, z;
+	Map temp  = selectionAllocBrush(brush->size);
+	if (! temp) return;
 
-	dx = brush->size[VX] - 2;
-	dy = brush->size[VY] - 2;
-	dz = brush->size[VZ] - 2;
-
-	struct BlockIter_t iterHI;
-	struct BlockIter_t iterLO;
-	mapInitIterOffset(&iterLO, brush->firstVisible, 256+16+1);
-	iterLO.nbor = brush->chunkOffsets;
-	iterHI = iterLO;
-	mapIter(&iterHI, 0, dy - 1, 0);
-
-	/* relocate blocks + data */
-	for (y = 1; iterLO.yabs < iterHI.yabs; y ++, mapIter(&iterLO, 0, 1, -dz), mapIter(&iterHI, 0, -1, -dz))
-	{
-		for (z = 1; z <= dz; z ++, mapIter(&iterLO, -dx, 0, 1), mapIter(&iterHI, -dx, 0, 1))
-		{
-			for (x = 1; x <= dx; x ++, mapIter(&iterLO, 1, 0, 0), mapIter(&iterHI, 1, 0, 0))
-			{
-				/* exchange LO & HI blockId, flipping them in the process */
-				int idLO = blockMirrorY(&iterHI);
-				int idHI = blockMirrorY(&iterLO);
-
-				iterHI.blockIds[iterHI.offset] = idHI >> 4;
-				iterLO.blockIds[iterLO.offset] = idLO >> 4;
-				DATA8 tileLO = chunkDeleteIterTE(iterHI);
-				DATA8 tileHI = chunkDeleteIterTE(iterLO);
-				mapUpdateData(&iterLO, idLO & 15);
-				mapUpdateData(&iterHI, idHI & 15);
-				if (tileLO) chunkAddIterTE(iterLO, tileLO);
-				if (tileHI) chunkAddIterTE(iterHI, tileHI);
-			}
-		}
-	}
-	if (iterLO.yabs == iterHI.yabs)
-	{
-		/* odd high brush: need to flip one layer alone */
-		for (z = 1; z <= dz; z ++, mapIter(&iterLO, -dx, 0, 1))
-		{
-			for (x = 1; x <= dx; x ++, mapIter(&iterLO, 1, 0, 0))
-			{
-				/* tile entities won't be moved, no need to check for them */
-				int id = blockMirrorY(&iterLO);
-				iterLO.blockIds[iterLO.offset] = id >> 4;
-				mapUpdateData(&iterLO, id&15);
-			}
-		}
-	}
+	selectionTransformBrush(brush, temp, TRANSFORM_MIRROR + VY, (int8_t[3]) {VX, VY, VZ}, (int8_t[3]) {1, -1, 1}, (int[3]) {0, brush->size[VY] - 1, 0});
+	selectionBrushReplace(brush, temp);
 
 	if (BRUSH_ENTITIES(brush))
 		entityCopyTransform(BRUSH_ENTITIES(brush), TRANSFORM_MIRROR + VY, selection.clonePt, brush->size);
 
-	/* regenerate mesh of brush */
-	Chunk c;
-	dx = (brush->size[VX] + 15) >> 4;
-	dz = (brush->size[VZ] + 15) >> 4;
-	for (z = 0, c = brush->chunks; z < dz; z ++)
-	{
-		for (x = 0; x < dx; x ++, c ++)
-		{
-			for (y = 0, dy = c->maxy; y < dy; y ++)
-			{
-				chunkUpdate(brush, c, chunkAir, y, meshInitST);
-				/* transfer chunk to the GPU */
-				meshFinishST(brush);
-			}
-		}
-	}
-	meshAllocCmdBuffer(brush);
+	selectionBrushGenMesh(brush);
 }
 
 /* mirror brush on X or Z axis */
@@ -1517,88 +1612,46 @@ typedef int (*BlockTransform_t)(BlockIter);
 static void selectionBrushMirror(void)
 {
 	Map brush = selection.brush;
-	int dx, dy, dz, x, y, z, axisEW;
-	int iterX, iterZ;
+	Map temp  = selectionAllocBrush(brush->size);
+	if (! temp) return;
 
-	dx = brush->size[VX] - 2;
-	dy = brush->size[VY] - 2;
-	dz = brush->size[VZ] - 2;
 	/* mirror will be done perdendicular to camera viewing direction */
-	axisEW = (globals.direction & 1) == 0;
-
-	struct BlockIter_t iterMIN;
-	struct BlockIter_t iterMAX;
-	BlockTransform_t   trans;
-	int8_t             dirX, dirZ;
-	mapInitIterOffset(&iterMIN, brush->firstVisible, 256+16+1);
-	iterMIN.nbor = brush->chunkOffsets;
-	iterMAX = iterMIN;
-	iterZ   = dz;
-	iterX   = dx;
-	if (axisEW) mapIter(&iterMAX, dx - 1, 0, 0), trans = blockMirrorX, iterX >>= 1, dirX = -1, dirZ =  1;
-	else        mapIter(&iterMAX, 0, 0, dz - 1), trans = blockMirrorZ, iterZ >>= 1, dirX =  1, dirZ = -1;
-
-	/* relocate blocks + data */
-	for (y = 1; y <= dy; y ++, mapIter(&iterMIN, 0, 1, -iterZ), mapIter(&iterMAX, 0, 1, -iterZ * dirZ))
-	{
-		for (z = 1; z <= iterZ; z ++, mapIter(&iterMIN, -iterX, 0, 1), mapIter(&iterMAX, -iterX * dirX, 0, dirZ))
-		{
-			for (x = 1; x <= iterX; x ++, mapIter(&iterMIN, 1, 0, 0), mapIter(&iterMAX, dirX, 0, 0))
-			{
-				/* exchange LO & HI blockId, mirroring them in the process */
-				int idMIN = trans(&iterMAX);
-				int idMAX = trans(&iterMIN);
-
-				iterMAX.blockIds[iterMAX.offset] = idMAX >> 4;
-				iterMIN.blockIds[iterMIN.offset] = idMIN >> 4;
-				mapUpdateData(&iterMIN, idMIN & 15);
-				mapUpdateData(&iterMAX, idMAX & 15);
-				DATA8 tileMIN = chunkDeleteIterTE(iterMAX);
-				DATA8 tileMAX = chunkDeleteIterTE(iterMIN);
-				if (tileMIN) chunkAddIterTE(iterMIN, tileMIN);
-				if (tileMAX) chunkAddIterTE(iterMAX, tileMAX);
-			}
-			if (axisEW && iterMIN.x == iterMAX.x)
-			{
-				/* odd width: need to transform a single block */
-				int id = trans(&iterMIN);
-				iterMIN.blockIds[iterMIN.offset] = id >> 4;
-				mapUpdateData(&iterMIN, id & 15);
-			}
-		}
-		if (axisEW == 0 && iterMIN.z == iterMAX.z)
+	int axis = (globals.direction & 1) == 0 ? VX : VZ;
+	int layers = (brush->size[VY] + 15) >> 4;
+	int count;
+	BlockTransform_t trans = axis == VX ? blockMirrorX : blockMirrorZ;
+	Chunk c;
+
+	/* doors: hinge is in top half, orient in bottom half: can't be done with a table, do these in place first */
+	for (c = brush->chunks, count = ((brush->size[VX] + 15) >> 4) * ((brush->size[VZ] + 15) >> 4); count > 0; count --, c ++)
+	{
+		int y, offset;
+		for (y = 0; y < layers; y ++)
 		{
-			/* odd length */
-			for (x = 1; x <= iterX; x ++, mapIter(&iterMIN, 1, 0, 0))
+			DATA8 blocks = c->layer[y]->blockIds;
+			for (offset = 0; offset < 4096; offset ++)
 			{
-				int id = trans(&iterMIN);
-				iterMIN.blockIds[iterMIN.offset] = id >> 4;
-				mapUpdateData(&iterMIN, id & 15);
+				if (blockIds[blocks[offset]].orientHint != ORIENT_DOOR) continue;
+				struct BlockIter_t iter;
+				mapInitIterOffset(&iter, c->layer[y], offset);
+				iter.nbor = brush->chunkOffsets;
+				int id = trans(&iter);
+				mapUpdateData(&iter, id & 15);
 			}
-			mapIter(&iterMIN, -iterX, 0, 0);
 		}
 	}
 
+	int8_t sign[3]  = {1, 1, 1};
+	int    shift[3] = {0, 0, 0};
+	sign[axis]  = -1;
+	shift[axis] = brush->size[axis] - 1;
+	selectionTransformBrush(brush, temp, TRANSFORM_MIRROR + axis, (int8_t[3]) {VX, VY, VZ}, sign, shift);
+	selectionBrushReplace(brush, temp);
+
 	if (BRUSH_ENTITIES(brush))
-		entityCopyTransform(BRUSH_ENTITIES(brush), axisEW ? TRANSFORM_MIRROR + VX : TRANSFORM_MIRROR + VZ, selection.clonePt, brush->size);
+		entityCopyTransform(BRUSH_ENTITIES(brush), TRANSFORM_MIRROR + axis, selection.clonePt, brush->size);
 
-	/* regenerate mesh of brush */
-	Chunk c;
-	dx = (brush->size[VX] + 15) >> 4;
-	dz = (brush->size[VZ] + 15) >> 4;
-	for (z = 0, c = brush->chunks; z < dz; z ++)
-	{
-		for (x = 0; x < dx; x ++, c ++)
-		{
-			for (y = 0, dy = c->maxy; y < dy; y ++)
-			{
-				chunkUpdate(brush, c, chunkAir, y, meshInitST);
-				/* transfer chunk to the GPU */
-				meshFinishST(brush);
-			}
-		}
-	}
-	meshAllocCmdBuffer(brush);
+	selectionBrushGenMesh(brush);
 }
 
 /*
@@ -1606,15 +1659,13 @@ static void selectionBrushMirror(void)
  */
 void selectionAutoSelect(vec4 pos, float scale)
 {
-	DATA8  visited = calloc(1, 4096); /* bitfield for a 32x32x32 area */
-	int8_t minMax[8];
+	int minMax[6];
 
-	/* work is done in mapUpdate.c because of that ring buffer */
-	mapUpdateFloodFill(globals.level, pos, visited, minMax);
-	free(visited);
+	/* select bounding box of all connected blocks that are similar to the one at <pos> */
+	mapUpdateFloodFill(globals.level, pos, globals.autoSelectMax, minMax);
 
-	vec4 pt1 = {pos[VX] + minMax[VX],   pos[VY] + minMax[VY],   pos[VZ] + minMax[VZ]};
-	vec4 pt2 = {pos[VX] + minMax[VX+4], pos[VY] + minMax[VY+4], pos[VZ] + minMax[VZ+4]};
+	vec4 pt1 = {minMax[VX],   minMax[VY],   minMax[VZ]};
+	vec4 pt2 = {minMax[VX+3], minMax[VY+3], minMax[VZ+3]};
 	selectionSetPoint(scale, pt1, SEL_POINT_1);
 	selectionSetPoint(scale, pt2, SEL_POINT_2);
 }
@@ -1630,6 +1681,9 @@ void selectionSelect(vec4 pos, float scale)
 /*
  * selection manipulation : fill / replace / geometric brushes
  */
+
+/* below that volume, incremental light update of mapUpdate() is cheaper than relighting entire columns (done in mapUpdateEnd()) */
+#define BULK_LIGHT_MIN       4096
 static struct
 {
 	DATA32 progress;
@@ -1639,7 +1693,7 @@ static struct
 	int    replId;
 	int    similar;
 	char   cancel;
-	vec4   size;
+	char   running;  /* set by main thread, cleared by worker when done */
 }	selectionAsync;
 
 /* globals.direction only look at S,E,N,W: this one check for S,E,N,W,T,B */
@@ -1708,13 +1762,14 @@ void selectionProcessFill(void * unused)
 	struct BlockIter_t iter;
 	Map  map;
 	vec4 pos;
-	int  dx, dy, dz, z, x, blockId, yinc;
+	int  dx, dy, dz, z, x, blockId, yinc, update;
 	pos[VX] = MIN(selection.firstPt[VX], selection.secondPt[VX]);
 	pos[VY] = MIN(selection.firstPt[VY], selection.secondPt[VY]);
 	pos[VZ] = MIN(selection.firstPt[VZ], selection.secondPt[VZ]);
 	dx = selection.regionSize[VX];
 	dy = selection.regionSize[VY];
 	dz = selection.regionSize[VZ];
+	update = dx * dy * dz >= BULK_LIGHT_MIN ? UPDATE_SILENT | UPDATE_LAZYLIGHT : UPDATE_SILENT;
 
 	map = globals.level;
 	blockId = selectionAsync.blockId;
@@ -1766,6 +1821,20 @@ void selectionProcessFill(void * unused)
 		/* no need to check if the operation is cancelled: this type of operation should be very fast */
 		selectionAsync.progress[0] = dz*dx;
 	}
+	else if ((update & UPDATE_LAZYLIGHT) && mapUpdateFillRow(map, pos, 0, blockId))
+	{
+		/* bulk fill: write rows directly in sub-chunk tables, without going through mapUpdate() for each block */
+		if (yinc < 0) pos[VY] += dy - 1;
+		for (; dy > 0; dy --, pos[VY] += yinc, pos[VZ] -= dz)
+		{
+			for (z = dz; z > 0; z --, pos[VZ] ++)
+			{
+				mapUpdateFillRow(map, pos, dx, blockId);
+				if (selectionAsync.cancel) goto break_all;
+				selectionAsync.progress[0] += dx;
+			}
+		}
+	}
 	else while (dy > 0)
 	{
 		for (z = dz; z > 0; z --, mapIter(&iter, -dx, 0, 1))
@@ -1774,7 +1843,7 @@ void selectionProcessFill(void * unused)
 			{
 				/* DEBUG: slow down processing */
 				// ThreadPause(500);
-				mapUpdate(map, NULL, blockId, NULL, UPDATE_SILENT);
+				mapUpdate(map, NULL, blockId, NULL, update);
 			}
 
 			/* O(n^3) complexity functions better have a way to be cancelled */
@@ -1786,6 +1855,7 @@ void selectionProcessFill(void * unused)
 	}
 	/* note: mapUpdateEnd() will regen mesh, must no be called from here */
 	break_all:
+	__atomic_store_n(&selectionAsync.running, 0, __ATOMIC_RELEASE);
 	MutexLeave(selection.wait);
 }
 
@@ -1797,6 +1867,7 @@ int selectionFill(DATA32 progress, int blockId, int side, int direction)
 	selectionAsync.side     = side;
 	selectionAsync.facing   = direction;
 	selectionAsync.cancel   = 0;
+	selectionAsync.running  = 1;
 
 	/* have to be careful with thread: don't call any opengl or SITGL function in them */
 	ThreadCreate(selectionProcessFill, NULL);
@@ -1868,115 +1939,301 @@ static Bool keepDataValues(int srcId, int dstId)
 	return False;
 }
 
+/*
+ * scan sub-chunks of selection in parallel: look for a set of block states (replace) or count them (statistics)
+ */
+static struct SelScan_t scan;
+
+static void selectionScanInit(void)
+{
+	int * range = scan.range;
+	int   i;
+
+	selectionGetRange(range, False);
+	/* nothing to find above or below build limit */
+	if (range[VY] < 0) range[VY] = 0;
+	if (range[VY+3] > BUILD_HEIGHT) range[VY+3] = BUILD_HEIGHT;
+
+	for (i = 0; i < 3; i ++)
+		scan.size[i] = range[i] < range[i+3] ? ((range[i+3] - 1) >> 4) - (range[i] >> 4) + 1 : 0;
+
+	memset(scan.states, 0, sizeof scan.states);
+	scan.idCount = 0;
+
+	if (scan.lock == NULL)
+		scan.lock = MutexCreate(), scan.done = SemInit(0);
+}
+
+/* add a block state to look for */
+static void selectionScanAdd(int blockId)
+{
+	int i, id = blockId >> 4;
+
+	scan.states[blockId >> 5] |= 1 << (blockId & 31);
+	if (scan.idCount < 0) return;
+	for (i = 0; i < scan.idCount && scan.ids[i] != id; i ++);
+	if (i < scan.idCount) return;
+	if (i < SCAN_MAXIDS)
+		scan.ids[scan.idCount ++] = id;
+	else /* too many: will have to check every block */
+		scan.idCount = -1;
+}
+
+/* get sub-chunk <index> (XZY order) and which part of it is within selection (min X, Y, Z, max X, Y, Z exclusive) */
+static ChunkData selectionScanGet(int index, int box[6])
+{
+	int * range = scan.range;
+	int   XYZ[3], i;
+
+	XYZ[VX] = index % scan.size[VX]; index /= scan.size[VX];
+	XYZ[VZ] = index % scan.size[VZ];
+	XYZ[VY] = index / scan.size[VZ];
+
+	for (i = 0; i < 3; i ++)
+	{
+		XYZ[i] = (range[i] & ~15) + XYZ[i] * 16;
+		box[i]   = MAX(range[i], XYZ[i]) - XYZ[i];
+		box[i+3] = MIN(range[i+3], XYZ[i] + 16) - XYZ[i];
+	}
+
+	Chunk c = mapGetChunk(globals.level, (vec4) {XYZ[VX], XYZ[VY], XYZ[VZ]});
+	if (c == NULL) return NULL;
+
+	i = XYZ[VY] >> 4;
+	return i < c->maxy && c->layer[i] ? c->layer[i] : chunkAir;
+}
+
+/* which of the 16 blocks of row at <offset> match <scan.states>, limited to <xmask> */
+static int selectionScanRow(DATA8 blocks, int offset, int xmask)
+{
+	DATA8 ids  = blocks + offset;
+	DATA8 data = blocks + DATA_OFFSET + (offset >> 1);
+	int   cand = xmask, match, i;
+
+	#ifdef __SSE2__
+	if (scan.idCount > 0)
+	{
+		/* compare the whole row with each block id at once: only metadata of candidates has to be checked */
+		__m128i row = _mm_loadu_si128((__m128i *) ids);
+		for (i = cand = 0; i < scan.idCount; i ++)
+			cand |= _mm_movemask_epi8(_mm_cmpeq_epi8(row, _mm_set1_epi8(scan.ids[i])));
+		cand &= xmask;
+	}
+	#endif
+
+	for (match = 0; cand; cand &= cand - 1)
+	{
+		i = ZEROBITS(cand);
+		int state = (ids[i] << 4) | (i & 1 ? data[i >> 1] >> 4 : data[i >> 1] & 15);
+		if (scan.states[state >> 5] & (1 << (state & 31)))
+			match |= 1 << i;
+	}
+	return match;
+}
+
+/* worker thread: grab sub-chunks until there are none left */
+static void selectionScanWorker(void * arg)
+{
+	DATA32 histo = NULL;
+
+	if (scan.histo)
+	{
+		/* each thread has its own table */
+		MutexEnter(scan.lock);
+		histo = scan.histo + (scan.threads ++) * 4096;
+		MutexLeave(scan.lock);
+	}
+
+	for (;;)
+	{
+		ChunkData cd;
+		int next, box[6], x, y, z;
+		MutexEnter(scan.lock);
+		next = scan.next ++;
+		MutexLeave(scan.lock);
+		if (next >= scan.count) break;
+
+		cd = selectionScanGet(next, box);
+
+		if (histo)
+		{
+			if (cd == NULL) continue;
+			for (y = box[VY]; y < box[VY+3]; y ++)
+			{
+				for (z = box[VZ]; z < box[VZ+3]; z ++)
+				{
+					DATA8 ids  = cd->blockIds + (y << 8) + (z << 4);
+					DATA8 data = cd->blockIds + DATA_OFFSET + (y << 7) + (z << 3);
+					for (x = box[VX]; x < box[VX+3]; x ++)
+						histo[(ids[x] << 4) | (x & 1 ? data[x >> 1] >> 4 : data[x >> 1] & 15)] ++;
+				}
+			}
+		}
+		else /* match mask */
+		{
+			DATA16 mask = scan.masks + (next - scan.first) * 256;
+			memset(mask, 0, 256 * 2);
+			if (cd == NULL) continue;
+			x = ((1 << box[VX+3]) - 1) & ~((1 << box[VX]) - 1);
+			for (y = box[VY]; y < box[VY+3]; y ++)
+				for (z = box[VZ]; z < box[VZ+3]; z ++)
+					mask[(y << 4) | z] = selectionScanRow(cd->blockIds, (y << 8) | (z << 4), x);
+		}
+	}
+	/* calling thread also process sub-chunks, but don't need to signal anything */
+	if (arg) SemAdd(scan.done, 1);
+}
+
+/* process <count> sub-chunks starting at index <first> */
+static void selectionScanRun(int first, int count)
+{
+	int threads, i;
+
+	scan.first = scan.next = first;
+	scan.count = first + count;
+	scan.threads = 0;
+	threads = MIN(count, SCAN_THREADS) - 1;
+	for (i = 0; i < threads; i ++)
+		ThreadCreate(selectionScanWorker, &scan);
+	selectionScanWorker(NULL);
+	for (i = 0; i < threads; i ++)
+		SemWait(scan.done);
+}
+
+/* count of each block state (id:meta) within selection: array of 4096 entries, must be free()'ed */
+DATA32 selectionHistogram(void)
+{
+	DATA32 histo = calloc(4096 * SCAN_THREADS, sizeof *histo);
+	int    i, j;
+
+	if (histo == NULL) return NULL;
+	selectionScanInit();
+	scan.histo = histo;
+	selectionScanRun(0, scan.size[VX] * scan.size[VY] * scan.size[VZ]);
+	scan.histo = NULL;
+
+	/* merge per thread tables */
+	for (i = 1; i < SCAN_THREADS; i ++)
+		for (j = 0; j < 4096; j ++)
+			histo[j] += histo[i * 4096 + j];
+
+	return histo;
+}
+
 /* thread that will process block replace */
 static void selectionProcessReplace(void * unsued)
 {
 	struct BlockIter_t iter;
 	Map  map;
-	vec4 pos;
-	int  dx, dy, dz, z, x, blockId, replId;
+	int  dx, dz, x, y, z, cy, blockId, replId, update, keepData, layer;
 	int  variant[6];
-	pos[VX] = MIN(selection.firstPt[VX], selection.secondPt[VX]);
-	pos[VY] = MIN(selection.firstPt[VY], selection.secondPt[VY]);
-	pos[VZ] = MIN(selection.firstPt[VZ], selection.secondPt[VZ]);
-	dx = selection.regionSize[VX];
-	dy = selection.regionSize[VY];
-	dz = selection.regionSize[VZ];
+	int * range;
 
 	MutexEnter(selection.wait);
 
 	map = globals.level;
 	replId = selectionAsync.replId;
 	blockId = selectionAsync.blockId;
-	mapInitIter(map, &iter, pos, blockId > 0);
-	mapUpdateInit(&iter);
+	dx = selection.regionSize[VX];
+	dz = selection.regionSize[VZ];
+	update = dx * dz * selection.regionSize[VY] >= BULK_LIGHT_MIN ? UPDATE_SILENT | UPDATE_LAZYLIGHT : UPDATE_SILENT;
+	keepData = 0;
+
+	selectionScanInit();
+	range = scan.range;
+	/* rows above or below build limit: nothing to replace there */
+	selectionAsync.progress[0] += (selection.regionSize[VY] - MAX(range[VY+3] - range[VY], 0)) * dx * dz;
 
 	Block b = &blockIds[replId>>4];
 
+	/* build set of block states to replace */
 	if (selectionAsync.similar)
 	{
 		/* find block, stairs and slab variant of each block type */
 		if (keepDataValues(blockId, replId))
 		{
-			blockId >>= 4;
-			replId  >>= 4;
 			/* only replace blockIds, keep data values */
-			while (dy > 0)
-			{
-				for (z = dz; z > 0; z --, mapIter(&iter, -dx, 0, 1))
-				{
-					for (x = dx; x > 0; x --, mapIter(&iter, 1, 0, 0))
-					{
-						if (iter.blockIds && iter.blockIds[iter.offset] == blockId)
-						{
-							int data = getBlockId(&iter);
-							mapUpdate(map, NULL, ID(replId, data&15), NULL, UPDATE_SILENT);
-						}
-					}
-					/* emergency exit */
-					if (selectionAsync.cancel) goto break_all;
-					selectionAsync.progress[0] += dx;
-				}
-				mapIter(&iter, 0, 1, -dz);
-				dy --;
-			}
+			for (x = 0; x < 16; x ++)
+				selectionScanAdd((blockId & ~15) | x);
+			keepData = 1;
 		}
 		else /* replace by similar types */
 		{
 			selectionFindVariant(variant,   blockId);
 			selectionFindVariant(variant+3, replId);
-			variant[1] >>= 4;
-			while (dy > 0)
+			selectionScanAdd(blockId);
+			if (variant[1] > 0)
 			{
-				for (z = dz; z > 0; z --, mapIter(&iter, -dx, 0, 1))
-				{
-					for (x = dx; x > 0; x --, mapIter(&iter, 1, 0, 0))
-					{
-						int srcId = iter.blockIds ? getBlockId(&iter) : 0;
-
-						if (srcId == blockId)
-							/* replace full blocks */
-							mapUpdate(map, NULL, variant[3], NULL, UPDATE_SILENT);
-						else if ((srcId >> 4) == variant[1])
-							/* replace stairs */
-							mapUpdate(map, NULL, variant[4] | (srcId&15), NULL, UPDATE_SILENT);
-						else if ((srcId & ~8) == variant[2])
-							/* replace slabs */
-							mapUpdate(map, NULL, variant[5] | (srcId&8), NULL, UPDATE_SILENT);
-					}
-					/* emergency exit */
-					if (selectionAsync.cancel) goto break_all;
-					selectionAsync.progress[0] += dx;
-				}
-				mapIter(&iter, 0, 1, -dz);
-				dy --;
+				for (x = 0; x < 16; x ++)
+					selectionScanAdd((variant[1] & ~15) | x);
 			}
+			if (variant[2] > 0 && (variant[2] & 8) == 0)
+				selectionScanAdd(variant[2]), selectionScanAdd(variant[2] | 8);
+			keepData = 2;
 		}
 	}
 	else /* only replace <blockId> */
 	{
 		if ((b->special == BLOCK_HALF || b->special == BLOCK_STAIRS) && selectionAsync.side > 0)
 			replId |= 8;
+		selectionScanAdd(blockId);
+	}
+
+	/* scan one layer of sub-chunks at a time, then replace what was found in XZY order */
+	layer = scan.size[VX] * scan.size[VZ];
+	scan.masks = malloc(layer * 256 * 2);
+	mapUpdateInit(&iter);
+
+	if (scan.masks == NULL)
+		/* not enough memory: don't let the interface wait for us */
+		selectionAsync.progress[0] = dx * dz * selection.regionSize[VY];
+
+	for (cy = 0; scan.masks && cy < scan.size[VY]; cy ++)
+	{
+		int maxy = MIN(range[VY+3], (range[VY] & ~15) + cy * 16 + 16);
+		selectionScanRun(cy * layer, layer);
 
-		while (dy > 0)
+		for (y = MAX(range[VY], (range[VY] & ~15) + cy * 16); y < maxy; y ++)
 		{
-			for (z = dz; z > 0; z --, mapIter(&iter, -dx, 0, 1))
+			for (z = range[VZ]; z < range[VZ+3]; z ++)
 			{
-				for (x = dx; x > 0; x --, mapIter(&iter, 1, 0, 0))
+				for (x = range[VX]; x < range[VX+3]; x = (x | 15) + 1)
 				{
-					int srcId = iter.blockIds ? getBlockId(&iter) : 0;
+					int index = (x >> 4) - (range[VX] >> 4) + ((z >> 4) - (range[VZ] >> 4)) * scan.size[VX];
+					int bits  = scan.masks[(index << 8) | ((y & 15) << 4) | (z & 15)];
 
-					if (srcId == blockId)
-						mapUpdate(map, NULL, replId, NULL, UPDATE_SILENT);
+					for (; bits; bits &= bits - 1)
+					{
+						int srcId, dstId;
+						mapInitIter(map, &iter, (vec4) {(x & ~15) + ZEROBITS(bits), y, z}, False);
+						srcId = getBlockId(&iter);
+						switch (keepData) {
+						case 0:  dstId = replId; break;
+						case 1:  dstId = (replId & ~15) | (srcId & 15); break;
+						default:
+							if (srcId == blockId)
+								/* replace full blocks */
+								dstId = variant[3];
+							else if ((srcId >> 4) == (variant[1] >> 4))
+								/* replace stairs */
+								dstId = variant[4] | (srcId & 15);
+							else
+								/* replace slabs */
+								dstId = variant[5] | (srcId & 8);
+						}
+						mapUpdate(map, NULL, dstId, NULL, update);
+					}
 				}
+				/* emergency exit */
 				if (selectionAsync.cancel) goto break_all;
 				selectionAsync.progress[0] += dx;
 			}
-			mapIter(&iter, 0, 1, -dz);
-			dy --;
 		}
 	}
 	break_all:
+	free(scan.masks);
+	scan.masks = NULL;
+	__atomic_store_n(&selectionAsync.running, 0, __ATOMIC_RELEASE);
 	MutexLeave(selection.wait);
 }
 
@@ -1989,6 +2246,7 @@ int selectionReplace(DATA32 progress, int blockId, int replId, int side, Bool do
 	selectionAsync.replId   = replId;
 	selectionAsync.side     = side;
 	selectionAsync.cancel   = 0;
+	selectionAsync.running  = 1;
 
 	ThreadCreate(selectionProcessReplace, NULL);
 
@@ -2056,181 +2314,393 @@ int selectionCylinderAxis(vec4 size, int direction)
 	return axis;
 }
 
-static void selectionProcessShape(void * unused)
-{
-	vec4 pos = {
-		MIN(selection.firstPt[VX], selection.secondPt[VX]),
-		MIN(selection.firstPt[VY], selection.secondPt[VY]),
-		MIN(selection.firstPt[VZ], selection.secondPt[VZ])
-	};
+/*
+ * shapes are rasterized per column (XZ) by worker threads: for a given column, voxels within the shape are a
+ * single range along Y that can be computed from the equation of the shape. Exact test on each voxel is only
+ * used at both ends of that range (to get the same rounding as the voxel test).
+ */
+static struct SelShape_t raster;
 
-	/* size can be bigger than selection to create half-sphere or arches */
-	int selSize[] = {selectionAsync.size[0], selectionAsync.size[2], selectionAsync.size[1]};
-	if (selectionAsync.facing & 1)
-		swap(selSize[VX], selSize[VZ]);
+/* vector from center of shape to sample point of voxel <x>, <y>, <z> (relative to selection) */
+static void selectionShapeVoxel(vec4 vox, int x, int y, int z, float dy)
+{
+	vox[VX] = raster.pos[VX] + x + 0.5f - raster.center[VX];
+	vox[VY] = raster.pos[VY] + y + dy - raster.center[VY] - raster.yoffset;
+	vox[VZ] = raster.pos[VZ] + z + 0.5f - raster.center[VZ];
+}
 
-	vec4 center = {
-		pos[VX] + selSize[VX] * 0.5f,
-		pos[VY] + selSize[VY] * 0.5f,
-		pos[VZ] + selSize[VZ] * 0.5f,
-	};
+/* add a voxel if its center is within the object (this is also what was done in MCEdit v1) */
+static Bool selectionShapeInside(vec4 vox)
+{
+	float * sq = raster.sq;
+	float   eq;
+	switch (raster.shape) {
+	case SHAPE_SPHERE:
+		eq = vox[VX]*vox[VX]*sq[VX] + vox[VY]*vox[VY]*sq[VY] + vox[VZ]*vox[VZ]*sq[VZ];
+		break;
+	case SHAPE_CYLINDER:
+		eq = vox[raster.axis1]*vox[raster.axis1]*sq[raster.axis1] + vox[raster.axis2]*vox[raster.axis2]*sq[raster.axis2];
+		break;
+	default: /* SHAPE_DIAMOND */
+		eq = fabsf(vox[VX])*sq[VX] + fabsf(vox[VY])*sq[VY] + fabsf(vox[VZ])*sq[VZ] - EPSILON;
+	}
+	return eq < 1;
+}
 
-	int   x, y, z;
-	int   flags = selectionAsync.similar;
-	Block block = &blockIds[selectionAsync.blockId>>4];
-	char  shape = flags & 15;
-	int   blockId = selectionAdjustOrient(selectionAsync.blockId, block->orientHint, selSize[VX], selSize[VY], selSize[VZ]);
+/* exact test on one voxel, <inner>: check if voxel is hidden by outer layer instead (hollow shape) */
+static Bool selectionShapeTest(int x, int y, int z, Bool inner)
+{
+	vec4 vox;
+	selectionShapeVoxel(vox, x, y, z, 0.5f);
+	if (! selectionShapeInside(vox)) return False;
+	return ! inner || isInInnerShape(raster.shape, vox, raster.sq);
+}
 
-	struct BlockIter_t iter;
-	MutexEnter(selection.wait);
-	mapInitIter(globals.level, &iter, pos, selectionAsync.blockId > 0);
-	mapUpdateInit(&iter);
+/* Y range where voxel centers of column at <vx>, <vz> (relative to center) are within shape, rounding errors aside */
+static Bool selectionShapeEstimate(float vx, float vz, float dy, int span[2])
+{
+	float * sq = raster.sq;
+	float   vy = raster.pos[VY] + dy - raster.center[VY] - raster.yoffset;
+	float   h;
 
-	switch (shape) {
+	switch (raster.shape) {
 	case SHAPE_SPHERE:
+		h = 1 - vx*vx*sq[VX] - vz*vz*sq[VZ];
+		if (h <= 0) return False;
+		h = sqrtf(h / sq[VY]);
+		break;
 	case SHAPE_CYLINDER:
-		/* equation of a 3d ellipse is (x - center[VX]) / Rx + (y - center[VY]) / Ry + (z - center[VZ]) / Rz <= 1 */
-		pos[VX] = 1 / (selSize[VX] * selSize[VX] * 0.25f); /* == 1 / Rx.y.z (selSize == diameter) */
-		pos[VY] = 1 / (selSize[VY] * selSize[VY] * 0.25f);
-		pos[VZ] = 1 / (selSize[VZ] * selSize[VZ] * 0.25f);
+		if (raster.axis2 != VY)
+		{
+			/* disk is horizontal: column is either entirely within or outside */
+			if (vx*vx*sq[VX] + vz*vz*sq[VZ] >= 1) return False;
+			span[0] = 0;
+			span[1] = raster.size[VY] - 1;
+			return True;
+		}
+		h = raster.axis1 == VX ? vx : vz;
+		h = 1 - h*h*sq[raster.axis1];
+		if (h <= 0) return False;
+		h = sqrtf(h / sq[VY]);
 		break;
-	case SHAPE_DIAMOND:
-		/* equation of a 3d diamond: |x - center[VX]| / Rx + |y - center[VY]| / Ry + |z - center[VZ]| / Rz <= 1 */
-		pos[VX] = 2. / selSize[VX];
-		pos[VY] = 2. / selSize[VY];
-		pos[VZ] = 2. / selSize[VZ];
-	}
-
-	selSize[VX] = fabsf(selection.firstPt[VX] - selection.secondPt[VX]) + 1;
-	selSize[VY] = fabsf(selection.firstPt[VY] - selection.secondPt[VY]) + 1;
-	selSize[VZ] = fabsf(selection.firstPt[VZ] - selection.secondPt[VZ]) + 1;
-	float   yoffset = selSize[VY] - selectionAsync.size[2];
-	uint8_t outer = flags & SHAPE_OUTER;
-	uint8_t hollow = flags & SHAPE_HOLLOW;
-	uint8_t axis1 = 0;
-	uint8_t axis2 = 0;
-	uint8_t axisS = 0;
-	uint8_t slab  = block->orientHint == ORIENT_SLAB;
-	if (shape == SHAPE_CYLINDER)
+	default:
+		h = 1 + EPSILON - fabsf(vx)*sq[VX] - fabsf(vz)*sq[VZ];
+		if (h <= 0) return False;
+		h /= sq[VY];
+	}
+	/* -h < vy + y < h */
+	span[0] = MAX(floorf(-h - vy) + 1, 0);
+	span[1] = MIN(ceilf(h - vy) - 1, raster.size[VY] - 1);
+	return span[0] <= span[1];
+}
+
+/* adjust estimated <span> of column <x>, <z> with exact voxel test: voxels that pass the test form a single range */
+static Bool selectionShapeAdjust(int x, int z, int span[2], Bool found, Bool inner)
+{
+	int max = raster.size[VY] - 1;
+	int lo  = span[0];
+	int hi  = span[1];
+
+	if (! found)
 	{
-		/* get the 2 axis where the disk of the cylinder will be located */
-		uint8_t axis[] = {0, 2};
-		if (selectionAsync.facing & 1) axis[0] = 2, axis[1] = 0;
-		if (flags & SHAPE_AXIS_H) axis1 = axis[0], axis2 = axis[1]; else
-		if (flags & SHAPE_AXIS_L) axis1 = axis[0], axis2 = 1;
-		else                      axis1 = axis[1], axis2 = 1;
-		pos[VT] = axis1 | (axis2 << 2);
+		/* estimate is empty: only voxel closest to center can be within shape */
+		lo = floorf(raster.center[VY] + raster.yoffset - raster.pos[VY]);
+		if (lo < 0)   lo = 0;
+		if (lo > max) lo = max;
+		if (! selectionShapeTest(x, lo, z, inner)) return False;
+		hi = lo;
 	}
-	if (slab) hollow = 0;
-	if (selectionAsync.facing & 1) axisS = 2;
-	flags &= 15;
+	else
+	{
+		while (lo <= hi && ! selectionShapeTest(x, lo, z, inner)) lo ++;
+		if (lo > hi) return False;
+		while (! selectionShapeTest(x, hi, z, inner)) hi --;
+	}
+	while (lo > 0   && selectionShapeTest(x, lo - 1, z, inner)) lo --;
+	while (hi < max && selectionShapeTest(x, hi + 1, z, inner)) hi ++;
+	span[0] = lo;
+	span[1] = hi;
+	return True;
+}
 
-	for (y = 0; y < selSize[VY]; y ++, mapIter(&iter, 0, 1, -selSize[VZ]))
+/* number of voxels that will be processed in column <span> */
+static int selectionShapeCount(int16_t * span)
+{
+	if (raster.outer && ! raster.slab)
+		return raster.size[VY] - (span[1] - span[0] + 1);
+	return span[1] - span[0] + 1;
+}
+
+/* rasterize column <x>, <z>: <span> will contain Y range within shape and Y range of hollow part */
+static void selectionShapeColumn(int x, int z, int16_t * span)
+{
+	int   range[2], inner[2], other[2];
+	vec4  vox;
+	Bool  found;
+	float dx;
+
+	selectionShapeVoxel(vox, x, 0, z, 0.5f);
+	/* empty range */
+	span[0] = span[2] = raster.size[VY];
+	span[1] = span[3] = raster.size[VY] - 1;
+
+	if (raster.slab)
 	{
-		for (z = 0; z < selSize[VZ]; z ++, mapIter(&iter, -selSize[VX], 0, 1))
+		/* slab halves are sampled off center: get a conservative range, each voxel will be checked by writer */
+		if (raster.outer)
 		{
-			for (x = 0; x < selSize[VX]; x ++, mapIter(&iter, 1, 0, 0))
-			{
-				/*
-				 * XXX yeah, this is a gcc extension :-/ alternatives are:
-				 * - functions with way too many parameters
-				 * - macro hell
-				 * good luck to anyone trying to port this for another compiler
-				 */
-				int isInShape(vec4 vox) /* this function can access all local vars declared up to this point */
-				{
-					/*
-					 * add a voxel if its center is within the object (this is also what was done in MCEdit v1)
-					 * this might not rasterize the object as perfectly as it should, but the result is kind
-					 * of esthetically pleasing, which is all what matter.
-					 */
-					switch (shape) {
-					case SHAPE_SPHERE:
-						vox[VT] = vox[VX]*vox[VX]*pos[VX] + vox[VY]*vox[VY]*pos[VY] + vox[VZ]*vox[VZ]*pos[VZ];
-						break;
-					case SHAPE_CYLINDER:
-						vox[VT] = vox[axis1]*vox[axis1]*pos[axis1] + vox[axis2]*vox[axis2]*pos[axis2];
-						break;
-					case SHAPE_DIAMOND:
-						vox[VT] = fabsf(vox[VX])*pos[VX] + fabsf(vox[VY])*pos[VY] + fabsf(vox[VZ])*pos[VZ] - EPSILON;
-					}
-					if (outer)
-					{
-						/* don't care about hollow */
-						if (vox[VT] < 1) return 0;
-					}
-					else
-					{
-						if (vox[VT] >= 1) return 0;
-						if (hollow && isInInnerShape(shape, vox, pos)) return 2;
-					}
-					return 1;
-				}
+			span[0] = 0;
+			return;
+		}
+		range[0] = raster.size[VY];
+		range[1] = -1;
+		for (dx = -0.2f; dx < 0.3f; dx += 0.4f)
+		{
+			float vx = raster.axisS == VX ? vox[VX] + dx : vox[VX];
+			float vz = raster.axisS == VZ ? vox[VZ] + dx : vox[VZ];
+			if (selectionShapeEstimate(vx, vz, 0.25f, inner)) range[0] = MIN(range[0], inner[0]), range[1] = MAX(range[1], inner[1]);
+			if (selectionShapeEstimate(vx, vz, 0.75f, inner)) range[0] = MIN(range[0], inner[0]), range[1] = MAX(range[1], inner[1]);
+		}
+		if (range[0] <= range[1])
+		{
+			span[0] = MAX(range[0] - 2, 0);
+			span[1] = MIN(range[1] + 2, raster.size[VY] - 1);
+		}
+		return;
+	}
 
-				if (slab)
-				{
-					vec4 vox = {
-						iter.ref->X + iter.x + 0.5f - center[VX],
-						iter.yabs + 0.25f - center[VY] - yoffset,
-						iter.ref->Z + iter.z + 0.5f - center[VZ]
-					};
-					uint8_t quadrant;
-					/* hmmm: using 0.25 and 0.75 as center for axisS looks slightly off: uses 0.3 and 0.7 instead :-/ */
-					vox[axisS] -= 0.2f; quadrant  = isInShape(vox);
-					vox[axisS] += 0.4f; quadrant |= isInShape(vox) << 1;
-					vox[VY] += 0.5f;
-					vox[axisS] -= 0.4f; quadrant |= isInShape(vox) << 2;
-					vox[axisS] += 0.4f; quadrant |= isInShape(vox) << 3;
-					int id = blockId;
-					switch (quadrant) {
-					default: continue;
-					case 3:  case 3+4: case 3+8: break;
-					case 12: case 12+1: case 12+2: id |= 8; break; /* top slab */
-					case 15: id -= 16; break; /* double slab */
-					}
-					mapUpdate(globals.level, NULL, id, NULL, UPDATE_SILENT);
-				}
-				else
+	found = selectionShapeEstimate(vox[VX], vox[VZ], 0.5f, range);
+	if (! selectionShapeAdjust(x, z, range, found, False))
+		return;
+
+	span[0] = range[0];
+	span[1] = range[1];
+
+	if (raster.hollow && ! raster.outer)
+	{
+		/* hollow part: voxels whose farther neighbors (from center) are all within shape */
+		inner[0] = range[0] + 1;
+		inner[1] = range[1] - 1;
+		if (vox[VX] != 0 && selectionShapeEstimate(vox[VX] + (vox[VX] < 0 ? -1 : 1), vox[VZ], 0.5f, other))
+			inner[0] = MAX(inner[0], other[0]), inner[1] = MIN(inner[1], other[1]);
+		if (vox[VZ] != 0 && selectionShapeEstimate(vox[VX], vox[VZ] + (vox[VZ] < 0 ? -1 : 1), 0.5f, other))
+			inner[0] = MAX(inner[0], other[0]), inner[1] = MIN(inner[1], other[1]);
+		if (selectionShapeAdjust(x, z, inner, inner[0] <= inner[1], True))
+		{
+			span[2] = MAX(inner[0], range[0]);
+			span[3] = MIN(inner[1], range[1]);
+		}
+	}
+}
+
+/* worker thread: rasterize rows of columns until there are none left */
+static void selectionShapeWorker(void * arg)
+{
+	for (;;)
+	{
+		int16_t * span;
+		int x, z, total;
+		MutexEnter(raster.lock);
+		z = raster.next ++;
+		MutexLeave(raster.lock);
+		if (z >= raster.size[VZ]) break;
+
+		span = raster.spans + z * raster.size[VX] * 4;
+		for (x = total = 0; x < raster.size[VX]; x ++, span += 4)
+		{
+			selectionShapeColumn(x, z, span);
+			total += selectionShapeCount(span);
+		}
+		MutexEnter(raster.lock);
+		raster.total += total;
+		MutexLeave(raster.lock);
+	}
+	if (arg) SemAdd(raster.done, 1);
+}
+
+/* slab: place a bottom, top or double slab depending on which halves are within shape (-1 if none) */
+static int selectionShapeSlab(int x, int y, int z)
+{
+	uint8_t axisS = raster.axisS;
+	uint8_t quadrant;
+	vec4    vox;
+
+	selectionShapeVoxel(vox, x, y, z, 0.25f);
+	/* hmmm: using 0.25 and 0.75 as center for axisS looks slightly off: uses 0.3 and 0.7 instead :-/ */
+	vox[axisS] -= 0.2f; quadrant  = selectionShapeInside(vox) ^ raster.outer;
+	vox[axisS] += 0.4f; quadrant |= (selectionShapeInside(vox) ^ raster.outer) << 1;
+	vox[VY] += 0.5f;
+	vox[axisS] -= 0.4f; quadrant |= (selectionShapeInside(vox) ^ raster.outer) << 2;
+	vox[axisS] += 0.4f; quadrant |= (selectionShapeInside(vox) ^ raster.outer) << 3;
+	switch (quadrant) {
+	case 3:  case 3+4: case 3+8: return raster.blockId;
+	case 12: case 12+1: case 12+2: return raster.blockId | 8; /* top slab */
+	case 15: return raster.blockId - 16; /* double slab */
+	}
+	return -1;
+}
+
+/* set <count> blocks of column <x>, <z> (relative to selection) starting at <y> */
+static void selectionShapeWrite(int x, int y, int z, int count, int blockId, int update)
+{
+	vec4 pos = {raster.pos[VX] + x, raster.pos[VY] + y, raster.pos[VZ] + z};
+
+	if (count <= 0) return;
+	if ((update & UPDATE_LAZYLIGHT) && mapUpdateFillColumn(globals.level, pos, count, blockId))
+		return;
+
+	for (; count > 0; count --, pos[VY] ++)
+	{
+		/* DEBUG: slow processing down */
+		// ThreadPause(500);
+		mapUpdate(globals.level, pos, blockId, NULL, update);
+	}
+}
+
+/* thread that write spans of columns rasterized by selectionFillWithShape() */
+static void selectionProcessShape(void * unused)
+{
+	struct BlockIter_t iter;
+	int16_t * span;
+	int x, y, z, update;
+
+	update = raster.size[VX] * raster.size[VY] * raster.size[VZ] >= BULK_LIGHT_MIN ? UPDATE_SILENT | UPDATE_LAZYLIGHT : UPDATE_SILENT;
+
+	MutexEnter(selection.wait);
+	mapInitIter(globals.level, &iter, (vec4) {raster.pos[VX], raster.pos[VY], raster.pos[VZ]}, raster.blockId > 0);
+	mapUpdateInit(&iter);
+
+	for (z = 0, span = raster.spans; z < raster.size[VZ]; z ++)
+	{
+		int total = 0;
+		for (x = 0; x < raster.size[VX]; x ++, span += 4)
+		{
+			if (raster.slab)
+			{
+				/* need to check each voxel within range */
+				int start = span[0], id = -1;
+				for (y = span[0]; y <= span[1] + 1; y ++)
 				{
-					vec4 vox = {
-						iter.ref->X + iter.x + 0.5f - center[VX],
-						iter.yabs + 0.5f - center[VY] - yoffset,
-						iter.ref->Z + iter.z + 0.5f - center[VZ]
-					};
-					switch (isInShape(vox)) {
-					case 1: mapUpdate(globals.level, NULL, blockId, NULL, UPDATE_SILENT); break;
-					case 2: mapUpdate(globals.level, NULL, 0, NULL, UPDATE_SILENT);
-					}
+					int slab = y <= span[1] ? selectionShapeSlab(x, y, z) : -1;
+					if (slab == id) continue;
+					if (id >= 0) selectionShapeWrite(x, start, z, y - start, id, update);
+					start = y;
+					id = slab;
 				}
-
-				/* DEBUG: slow processing down */
-				// ThreadPause(500);
 			}
-
-			if (selectionAsync.cancel) goto break_all;
-			selectionAsync.progress[0] += selSize[VX];
+			else if (raster.outer)
+			{
+				selectionShapeWrite(x, 0, z, span[0], raster.blockId, update);
+				selectionShapeWrite(x, span[1] + 1, z, raster.size[VY] - span[1] - 1, raster.blockId, update);
+			}
+			else
+			{
+				/* hollow part is filled with air */
+				selectionShapeWrite(x, span[0], z, MIN(span[2], span[1] + 1) - span[0], raster.blockId, update);
+				selectionShapeWrite(x, span[2], z, span[3] - span[2] + 1, 0, update);
+				selectionShapeWrite(x, MAX(span[3] + 1, span[0]), z, span[1] - MAX(span[3] + 1, span[0]) + 1, raster.blockId, update);
+			}
+			total += selectionShapeCount(span);
 		}
+
+		if (selectionAsync.cancel) goto break_all;
+		selectionAsync.progress[0] += total;
 	}
 	break_all:
+	free(raster.spans);
+	raster.spans = NULL;
+	__atomic_store_n(&selectionAsync.running, 0, __ATOMIC_RELEASE);
 	MutexLeave(selection.wait);
 }
 
-/* start the thread that will do the job */
+/* rasterize shape, then start the thread that will write it into the map */
 int selectionFillWithShape(DATA32 progress, int blockId, int flags, vec4 size, int direction)
 {
 	selectionAsync.progress = progress;
-	selectionAsync.blockId  = blockId;
-	selectionAsync.similar  = flags;
 	selectionAsync.facing   = direction;
 	selectionAsync.cancel   = 0;
 
-	memcpy(selectionAsync.size, size, 12);
+	/* size can be bigger than selection to create half-sphere or arches */
+	int selSize[] = {size[0], size[2], size[1]};
+	int i, threads;
+	if (direction & 1)
+		swap(selSize[VX], selSize[VZ]);
+
+	for (i = 0; i < 3; i ++)
+	{
+		raster.pos[i]    = MIN(selection.firstPt[i], selection.secondPt[i]);
+		raster.size[i]   = fabsf(selection.firstPt[i] - selection.secondPt[i]) + 1;
+		raster.center[i] = raster.pos[i] + selSize[i] * 0.5f;
+	}
+
+	Block block = &blockIds[blockId >> 4];
+	raster.shape   = flags & 15;
+	raster.outer   = (flags & SHAPE_OUTER) > 0;
+	raster.hollow  = (flags & SHAPE_HOLLOW) > 0;
+	raster.slab    = block->orientHint == ORIENT_SLAB;
+	raster.blockId = selectionAdjustOrient(blockId, block->orientHint, selSize[VX], selSize[VY], selSize[VZ]);
+	raster.yoffset = raster.size[VY] - size[2];
+	raster.axisS   = direction & 1 ? VZ : VX;
+	raster.axis1   = raster.axis2 = 0;
+	if (raster.slab) raster.hollow = 0;
+
+	switch (raster.shape) {
+	case SHAPE_SPHERE:
+	case SHAPE_CYLINDER:
+		/* equation of a 3d ellipse is (x - center[VX]) / Rx + (y - center[VY]) / Ry + (z - center[VZ]) / Rz <= 1 */
+		for (i = 0; i < 3; i ++)
+			raster.sq[i] = 1 / (selSize[i] * selSize[i] * 0.25f); /* == 1 / Rx.y.z (selSize == diameter) */
+		break;
+	case SHAPE_DIAMOND:
+		/* equation of a 3d diamond: |x - center[VX]| / Rx + |y - center[VY]| / Ry + |z - center[VZ]| / Rz <= 1 */
+		for (i = 0; i < 3; i ++)
+			raster.sq[i] = 2. / selSize[i];
+	}
+	if (raster.shape == SHAPE_CYLINDER)
+	{
+		/* get the 2 axis where the disk of the cylinder will be located */
+		uint8_t axis[] = {0, 2};
+		if (direction & 1) axis[0] = 2, axis[1] = 0;
+		if (flags & SHAPE_AXIS_H) raster.axis1 = axis[0], raster.axis2 = axis[1]; else
+		if (flags & SHAPE_AXIS_L) raster.axis1 = axis[0], raster.axis2 = 1;
+		else                      raster.axis1 = axis[1], raster.axis2 = 1;
+		raster.sq[VT] = raster.axis1 | (raster.axis2 << 2);
+	}
+
+	raster.spans = malloc(raster.size[VX] * raster.size[VZ] * 4 * sizeof *raster.spans);
+	if (raster.spans == NULL)
+		return 0;
+
+	/* columns are rasterized in parallel, one row along X at a time */
+	raster.total = raster.next = 0;
+	if (raster.lock == NULL)
+		raster.lock = MutexCreate(), raster.done = SemInit(0);
+	threads = MIN(raster.size[VZ], SHAPE_THREADS) - 1;
+	for (i = 0; i < threads; i ++)
+		ThreadCreate(selectionShapeWorker, &raster);
+	selectionShapeWorker(NULL);
+	for (i = 0; i < threads; i ++)
+		SemWait(raster.done);
+
+	if (raster.total == 0)
+	{
+		/* nothing to do: progress is already complete */
+		free(raster.spans);
+		raster.spans = NULL;
+		return 0;
+	}
 
+	/* have to be careful with thread: don't call any opengl or SITGL function in them */
+	selectionAsync.running = 1;
 	ThreadCreate(selectionProcessShape, NULL);
 
-	return (int) selection.regionSize[VX] *
-	       (int) selection.regionSize[VY] *
-	       (int) selection.regionSize[VZ];
+	return raster.total;
+}
+
+/* fill/replace/shape thread is still reading/writing the map */
+Bool selectionIsBusy(void)
+{
+	return __atomic_load_n(&selectionAsync.running, __ATOMIC_ACQUIRE);
 }
 
 /* need to wait for thread to exit first */
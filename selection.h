@@ -20,6 +20,7 @@ void selectionSetSize(void);
 void selectionRender(void);
 void selectionCancel(void);
 void selectionCancelOperation(void);
+Bool selectionIsBusy(void);
 vec  selectionGetPoints(void);
 int  selectionHasPoints(void);
 Map  selectionAllocBrush(uint16_t sizes[3]);
@@ -39,6 +40,7 @@ int  selectionCancelClone(SIT_Widget w, APTR cd, APTR ud);
 int  selectionCopyBlocks(SIT_Widget w, APTR cd, APTR ud);
 void selectionFreeBrush(Map brush);
 void selectionGetRange(int points[6], Bool relative);
+DATA32 selectionHistogram(void);
 
 enum /* flags for <shape> parameter of function selectionFillWithShape() */
 {
@@ -100,6 +102,7 @@ struct Selection_t
 	int      copyAir;
 	int      copyWater;
 	int      copyEntity;
+	int      onlyAir;          /* paste brush only over air blocks */
 	uint8_t  loadSettings[4];  /* check if settings have changed on exit */
 	STRPTR   ext[4];           /* directionnal dependant icon for roll button */
 	APTR     nudgeDiag;        /* SIT_DIALOG */
@@ -125,6 +128,47 @@ struct SelEntities_t           /* gather some stat about selected entities */
 
 typedef struct SelEntities_t * SelEntities;
 
+#define SCAN_THREADS           4
+#define COPY_THREADS           4
+#define SCAN_MAXIDS            4
+
+struct SelScan_t               /* scan sub-chunks of selection in parallel (replace/statistics) */
+{
+	uint32_t states[4096/32];  /* bitfield of block states (id:meta) to look for */
+	uint8_t  ids[SCAN_MAXIDS]; /* block ids in <states>, to compare a row of 16 blocks at once */
+	int      idCount;          /* -1 if too many ids */
+	int      range[6];         /* selection: min X, Y, Z, max X, Y, Z (exclusive) */
+	int      size[3];          /* sub-chunks intersecting selection along X, Y, Z */
+	int      first;            /* index of first sub-chunk of current pass (XZY order) */
+	int      next, count;      /* next sub-chunk to process / end of pass */
+	int      threads;          /* threads that have grabbed a <histo> table */
+	DATA16   masks;            /* matching blocks: 256 rows of 16 bits per sub-chunk of current pass */
+	DATA32   histo;            /* 4096 counters per thread */
+	Mutex    lock;             /* protect <next> and <threads> */
+	Semaphore done;            /* worker threads finished */
+};
+
+#define SHAPE_THREADS          4
+
+struct SelShape_t              /* geometric brush rasterized per column in parallel */
+{
+	vec4     center;           /* center of shape (absolute coord) */
+	vec4     sq;               /* 1/R (sphere, cylinder) or 1/R (diamond) per axis, VT: axis of cylinder disk */
+	float    yoffset;          /* shape can be taller than selection (half-sphere, arches) */
+	int      pos[3];           /* selection start (absolute) */
+	int      size[3];          /* selection size */
+	int      blockId;
+	uint8_t  shape, outer;     /* SHAPE_* */
+	uint8_t  hollow, slab;
+	uint8_t  axis1, axis2;     /* cylinder: axis of disk */
+	uint8_t  axisS;            /* slab: axis where slab halves are sampled */
+	int16_t * spans;           /* 4 per column (XZ order): Y range within shape and Y range of hollow part (relative) */
+	int      total;            /* blocks to process (progress) */
+	int      next;             /* next Z row to rasterize */
+	Mutex    lock;             /* protect <next> and <total> */
+	Semaphore done;            /* worker threads finished */
+};
+
 #define MAX_REPEAT             128
 #define MAX_SELECTION          1024 /* blocks */
 #define MAX_VERTEX             (8*2+(36+24)*2)
@@ -1,5 +1,6 @@
 /*
- * tileticks.c: delayed block update. kept in a hash table along with a sorted list (by tick) to scan all items.
+ * tileticks.c: delayed block update. kept in a hash table (by location) along with a hierarchical
+ *              timing wheel (by tick) to process them in order.
  *
  * Written by T.Pierron, mar 2021.
  */
@@ -15,244 +16,205 @@
 #include "blocks.h"
 #include "tileticks.h"
 #include "redstone.h"
+#include "render.h"
 #include "globals.h"
 
 
 static struct UpdatePrivate_t updates;
 
 
-static TileTick updateInsert(ChunkData cd, int offset, int tick);
 void mapUpdateChangeRedstone(Map map, BlockIter iterator, int side, RSWire dir);
 
-#define TOHASH(cd, offset)      (((uint64_t) (int)cd) | ((uint64_t)offset << 32))
-#define EOL_MARKER              0xffff
+#define TOHASH(cd, offset)      (((uint32_t) ((uintptr_t) (cd) >> 4) * 4099 + (offset)) * 0x9E3779B1u >> (32 - updates.hashBits))
 
-static Bool updateAlloc(int max)
+/* handles are indices in updates.list[]: they remain valid if table is enlarged */
+static Bool updateAlloc(void)
 {
-	max = roundToUpperPrime(max < 32 ? 32 : max);
-
-	updates.list   = calloc(max, sizeof (struct TileTick_t) + sizeof *updates.sorted);
-	updates.max    = max;
-	updates.count  = 0;
-	updates.sorted = (DATA16) (updates.list + max);
-
-	return updates.list != NULL;
+	int        max  = updates.max ? updates.max * 2 : 1024;
+	TileTick   list = realloc(updates.list, max * sizeof *list);
+	uint32_t * hash;
+	int        i;
+
+	if (list == NULL) return False;
+	updates.list = list;
+	hash = realloc(updates.hash, max * sizeof *hash);
+	if (hash == NULL) return False;
+	updates.hash = hash;
+	updates.max  = max;
+	if (updates.used == 0) updates.used = 1;
+	for (updates.hashBits = 0; (1 << updates.hashBits) < max; updates.hashBits ++);
+
+	/* rehash everything: hash size has changed */
+	memset(hash, 0, max * sizeof *hash);
+	for (i = 1; i < updates.used; i ++)
+	{
+		TileTick entry = list + i;
+		if (entry->cd == NULL) continue;
+		uint32_t index = TOHASH(entry->cd, entry->offset);
+		entry->chain = hash[index];
+		hash[index] = i;
+	}
+	return True;
 }
 
 /* map will be closed shortly */
 void updateClearAll(void)
 {
 	free(updates.list);
+	free(updates.hash);
 	memset(&updates, 0, sizeof updates);
 }
 
-static void updateExpand(void)
+/* <a> must be processed after <b> (both are in the same slot of first level) */
+static inline Bool updateAfter(TileTick a, TileTick b)
 {
-	TileTick old = updates.list;
-	int      max = updates.max;
+	if (a->tick != b->tick) return (int) (a->tick - b->tick) > 0;
+	if (a->priority != b->priority) return a->priority > b->priority;
+	return (int) (a->seq - b->seq) > 0;
+}
 
-	/* redo from scratch */
-	if (updateAlloc(max+1))
+/* insert entry in the timing wheel, according to its tick */
+static void updateLink(uint32_t id)
+{
+	TileTick entry = updates.list + id;
+	unsigned tick  = entry->tick;
+	int      delta = tick - updates.now;
+	int      slot;
+	uint32_t prev, next;
+
+	if (delta < 0) /* late: process as soon as possible */
+		slot = updates.now & 255;
+	else
 	{
-		/* shouldn't happen very often: performance is not really a concern */
-		TileTick entry, eof;
-		for (entry = old, eof = entry + max; entry < eof; entry ++)
-		{
-			if (entry->tick > 0)
-			{
-				TileTick tick = updateInsert(entry->cd, entry->offset, entry->tick);
-				tick->cb = entry->cb;
-			}
-		}
-		free(old);
+		if (delta >= WHEEL_RANGE)
+			delta = WHEEL_RANGE - 1, tick = updates.now + delta;
+		if (delta < (1 << 8))  slot = tick & 255; else
+		if (delta < (1 << 14)) slot = 256 + ((tick >> 8) & 63); else
+		if (delta < (1 << 20)) slot = 256 + 64 + ((tick >> 14) & 63);
+		else                   slot = 256 + 128 + ((tick >> 20) & 63);
 	}
-}
 
-static TileTick updateInsert(ChunkData cd, int offset, int tick)
-{
-	if ((updates.count * 36 >> 5) >= updates.max)
+	prev = updates.tail[slot];
+	next = 0;
+	if (slot < 256)
 	{
-		/* 90% full: expand */
-		updateExpand();
+		/* only order of first level matters: usually 0 iteration */
+		while (prev && updateAfter(updates.list + prev, entry))
+			next = prev, prev = updates.list[prev].prev;
+		updates.near ++;
 	}
+	entry->slot = slot;
+	entry->prev = prev;
+	entry->next = next;
+	if (prev) updates.list[prev].next = id; else updates.head[slot] = id;
+	if (next) updates.list[next].prev = id; else updates.tail[slot] = id;
+}
+
+static void updateUnlink(uint32_t id)
+{
+	TileTick entry = updates.list + id;
+	int      slot  = entry->slot;
 
-	TileTick entry, last;
-	int      index = TOHASH(cd, offset) % updates.max;
+	if (entry->prev) updates.list[entry->prev].next = entry->next; else updates.head[slot] = entry->next;
+	if (entry->next) updates.list[entry->next].prev = entry->prev; else updates.tail[slot] = entry->prev;
+	if (slot < 256) updates.near --;
+}
 
-	/* similar to TileEntities hash table */
-	for (entry = updates.list + index, last = NULL; entry->tick; entry = updates.list + entry->next)
+static uint32_t updateFind(ChunkData cd, int offset)
+{
+	if (updates.max == 0)
+		return 0;
+
+	uint32_t id;
+	for (id = updates.hash[TOHASH(cd, offset)]; id; id = updates.list[id].chain)
 	{
-		last = entry;
-		/* check if already inserted */
+		TileTick entry = updates.list + id;
 		if (entry->cd == cd && entry->offset == offset)
-			return entry;
-		if (entry->next == EOL_MARKER)
-		{
-			TileTick eof = updates.list + updates.max;
-			last = entry;
-			do {
-				entry ++;
-				if (entry == eof) entry = updates.list;
-			} while (entry->tick);
 			break;
-		}
 	}
+	return id;
+}
+
+/* remove entry from hash table and timing wheel */
+static void updateRelease(uint32_t id)
+{
+	TileTick   entry = updates.list + id;
+	uint32_t * prev;
+
+	for (prev = updates.hash + TOHASH(entry->cd, entry->offset); *prev != id; prev = &updates.list[*prev].chain);
+	*prev = entry->chain;
+	updateUnlink(id);
+	entry->cd = NULL;
+	entry->next = updates.freeList;
+	updates.freeList = id;
+	updates.count --;
+}
+
+static TileTick updateInsert(ChunkData cd, int offset, unsigned tick, int priority)
+{
+	uint32_t id = updateFind(cd, offset);
+	if (id > 0)
+		/* already scheduled */
+		return updates.list + id;
 
-	if (last)
+	if (updates.freeList)
 	{
-		entry->prev = last - updates.list;
-		last->next = entry - updates.list;
+		id = updates.freeList;
+		updates.freeList = updates.list[id].next;
 	}
-	else entry->prev = EOL_MARKER;
-	entry->next   = EOL_MARKER;
-	entry->cd     = cd;
-	entry->offset = offset;
-	entry->tick   = tick;
-
-	/* sort insert into sorted[] array */
-	int start, end;
-	for (start = 0, end = updates.count; start < end; )
+	else
 	{
-		/* dichotomic search */
-		index = (start + end) >> 1;
-		TileTick middle = updates.list + updates.sorted[index];
-		if (middle->tick == tick) { start = index; break; }
-		if (middle->tick <  tick) start = index + 1;
-		else end = index;
+		if (updates.used == updates.max && ! updateAlloc())
+			return NULL;
+		id = updates.used ++;
 	}
 
-	if (start < updates.count)
-	{
-		DATA16 move = updates.sorted + start;
-		memmove(move + 1, move, (updates.count - start) * sizeof *move);
-	}
-	updates.sorted[start] = entry - updates.list;
+	TileTick entry = updates.list + id;
+	uint32_t index = TOHASH(cd, offset);
+
+	memset(entry, 0, sizeof *entry);
+	entry->cd       = cd;
+	entry->offset   = offset;
+	entry->tick     = tick;
+	entry->priority = priority;
+	entry->seq      = updates.seq ++;
+	entry->chain    = updates.hash[index];
+	updates.hash[index] = id;
+
+	if (updates.count == 0)
+		/* wheel was idle */
+		updates.now = (unsigned) globals.curTime;
 	updates.count ++;
+	updateLink(id);
 
 	return entry;
 }
 
-Bool updateRemove(ChunkData cd, int offset, Bool clearSorted)
+Bool updateRemove(ChunkData cd, int offset)
 {
-	if (! updates.list)
+	uint32_t id = updateFind(cd, offset);
+	if (id == 0)
 		return False;
-	TileTick base = updates.list;
-	TileTick entry = updates.list + TOHASH(cd, offset) % updates.max;
-
-	if (entry->tick == 0) return False;
-	while (entry->cd != cd || entry->offset != offset)
-	{
-		if (entry->next == EOL_MARKER) return False;
-		entry = base + entry->next;
-	}
-
-	/* entry is in the table */
-	updates.count --;
-	entry->tick = 0;
-	if (entry->prev != EOL_MARKER)
-		base[entry->prev].next = entry->next;
-	if (entry->next != EOL_MARKER)
-		base[entry->next].prev = entry->prev;
-
-	int index = entry - base;
-	while (entry->next != EOL_MARKER)
-	{
-		TileTick next = base + entry->next;
-
-		/* check if this entry depended on the slot that was freed */
-		if (index == TOHASH(next->cd, next->offset) % updates.max)
-		{
-			/* yes, need relocation */
-			index = entry->next;
-			*entry = *next;
-			next->tick = 0;
-			if (entry->prev != EOL_MARKER)
-				base[entry->prev].next = entry - base;
-			if (entry->next != EOL_MARKER)
-				base[entry->next].prev = entry - base;
-
-			/* index of <next> has changed, need to update <sorted> array too */
-			DATA16 p;
-			int    i;
-			for (i = updates.max, p = updates.sorted; i > 0; i --, p ++)
-				if (*p == index) { *p = entry - base; break; }
-		}
-		entry = next;
-	}
-
-	if (clearSorted)
-	{
-		DATA16 p;
-		int    i;
-		for (i = updates.max, p = updates.sorted, index = entry - updates.list; i > 0; i --, p ++)
-		{
-			if (*p != index) continue;
-			if (i > 1) memmove(p, p + 1, i * 2 - 2);
-			break;
-		}
-	}
+	updateRelease(id);
 	return True;
 }
 
 /* check if a tile tick is scheduled for this location */
 Bool updateScheduled(ChunkData cd, int offset)
 {
-	if (updates.max == 0)
-		return False;
-
-	TileTick entry;
-	int      index = TOHASH(cd, offset) % updates.max;
-
-	for (entry = updates.list + index; entry->tick; entry = updates.list + entry->next)
-	{
-		/* check if already inserted */
-		if (entry->cd == cd && entry->offset == offset)
-			return True;
-		if (entry->next == EOL_MARKER)
-			break;
-	}
-	return False;
-}
-
-#if 0
-#include <malloc.h>
-static void updateDebugSorted(void)
-{
-	int i, ok;
-	DATA8 exists = alloca(updates.max);
-	memset(exists, 0, updates.max);
-//	fprintf(stderr, " [%d: ", updates.count);
-	for (i = 0, ok = 1; i < updates.count; i ++)
-	{
-		//if (i > 0) fprintf(stderr, ", ");
-		int id = updates.sorted[i];
-		if (exists[id]) ok = 0;
-		exists[id] = 1;
-		TileTick tick = updates.list + id;
-		if (! updateScheduled(tick->cd, tick->offset))
-			puts("no good: not in hash");
-		// fprintf(stderr, "%d:%p", id, updates.list[id].cb);
-	}
-	if (! ok)
-		puts("no good: same entry twice");
-	for (i = ok = 0; i < updates.max; i ++)
-		if (updates.list[i].tick > 0) ok ++;
-	if (ok != updates.count)
-		puts("no good: entry not cleared");
-//	fprintf(stderr, "]: %s\n", ok ? "OK" : "DUP");
+	return updateFind(cd, offset) > 0;
 }
-#endif
 
 void updateAdd(BlockIter iter, int blockId, int nbTick)
 {
-	TileTick update = updateInsert(iter->cd, iter->offset, globals.curTime + nbTick * globals.redstoneTick);
-	update->blockId = blockId;
+	TileTick update = updateInsert(iter->cd, iter->offset, globals.curTime + nbTick * globals.redstoneTick, 0);
+	if (update) update->blockId = blockId;
 }
 
 void updateAddTickCallback(BlockIter iter, int nbTick, UpdateCb_t cb)
 {
-	TileTick update = updateInsert(iter->cd, iter->offset, globals.curTime + nbTick * globals.redstoneTick);
-	update->cb = cb;
+	TileTick update = updateInsert(iter->cd, iter->offset, globals.curTime + nbTick * globals.redstoneTick, 0);
+	if (update) update->cb = cb;
 }
 
 void updateAddRSUpdate(struct BlockIter_t iter, int side, int nbTick)
@@ -260,8 +222,8 @@ void updateAddRSUpdate(struct BlockIter_t iter, int side, int nbTick)
 	if (side != RSSAMEBLOCK)
 		mapIter(&iter, relx[side], rely[side], relz[side]);
 
-	TileTick update = updateInsert(iter.cd, iter.offset, globals.curTime + nbTick * globals.redstoneTick);
-	update->blockId = BLOCK_UPDATE;
+	TileTick update = updateInsert(iter.cd, iter.offset, globals.curTime + nbTick * globals.redstoneTick, 0);
+	if (update) update->blockId = BLOCK_UPDATE;
 }
 
 /* process tile tick coming from NBT: they do not have enough information to be processed as is */
@@ -321,10 +283,9 @@ void updateParseNBT(Chunk c)
 		if (flags == 63 && (x & ~15) == c->X && (z & ~15) == c->Z && layer < c->maxy && (tick.cd = c->layer[layer]) &&
 		    tick.cd->blockIds[pos] == (tick.blockId >> 4))
 		{
-			TileTick update = updateInsert(tick.cd, pos, globals.curTime + tick.tick * globals.redstoneTick);
+			TileTick update = updateInsert(tick.cd, pos, globals.curTime + (int) tick.tick * globals.redstoneTick, tick.priority);
 			/* blockId stored in tile tick is not going to help */
-			update->cb = updateTileTick;
-			count ++;
+			if (update) update->cb = updateTileTick, count ++;
 		}
 	}
 	c->cflags |= CFLAG_HAS_TT;
@@ -337,29 +298,27 @@ void updateParseNBT(Chunk c)
 /* called before saving a chunk to disk */
 int updateCount(Chunk chunk)
 {
-	int count, i, max;
-	for (count = 0, i = 0, max = updates.count; i < max; i ++)
-	{
-		TileTick tile = &updates.list[updates.sorted[i]];
-		if (tile->cd->chunk == chunk) count ++;
-	}
+	TileTick entry;
+	int      count, i;
+	for (count = 0, i = updates.used - 1, entry = updates.list + 1; i > 0; i --, entry ++)
+		if (entry->cd && entry->cd->chunk == chunk) count ++;
 	return count;
 }
 
 /* serialize a TileTick into an NBT record to be saved on disk */
-Bool updateGetNBT(Chunk chunk, NBTFile nbt, DATA16 index)
+Bool updateGetNBT(Chunk chunk, NBTFile nbt, int * index)
 {
 	static uint8_t buffer[256];
 
 	int i, max;
 
-	for (i = index[0], max = updates.count; i < max; i ++)
+	for (i = MAX(index[0], 1), max = updates.used; i < max; i ++)
 	{
-		TileTick tile = &updates.list[updates.sorted[i]];
-		if (tile->cd->chunk != chunk) continue;
+		TileTick tile = updates.list + i;
+		if (tile->cd == NULL || tile->cd->chunk != chunk) continue;
 		TEXT techName[64];
 		int  off = tile->offset;
-		int  ticks = (tile->tick - (unsigned) globals.curTime) / globals.redstoneTick;
+		int  ticks = (int) (tile->tick - (unsigned) globals.curTime) / globals.redstoneTick;
 		/* we can use a static buffer because saving chunks is not multi-threaded */
 		nbt->mem = buffer;
 		nbt->max = sizeof buffer;
@@ -368,7 +327,7 @@ Bool updateGetNBT(Chunk chunk, NBTFile nbt, DATA16 index)
 		*index = i + 1;
 		NBT_Add(nbt,
 			TAG_String, "i", techName,
-			TAG_Int,    "p", i,
+			TAG_Int,    "p", tile->priority,
 			TAG_Int,    "t", ticks,
 			TAG_Int,    "x", chunk->X + (off & 15),
 			TAG_Int,    "z", chunk->Z + ((off >> 4) & 15),
@@ -380,47 +339,95 @@ Bool updateGetNBT(Chunk chunk, NBTFile nbt, DATA16 index)
 	return False;
 }
 
-/* usually redstone devices (repeater, torch) update surrounding blocks after a delay */
-void updateTick(void)
+/* move entries of upper levels into lower ones: called every 256ms */
+static void updateCascade(void)
 {
-	struct BlockIter_t iter;
-	int i = 0, time = globals.curTime;
-	mapUpdateInit(&iter);
-	/* more tile ticks can be added while scanning this list */
-	while (updates.count > 0)
+	int level;
+	for (level = 0; level < WHEEL_LEVELS-1; level ++)
+	{
+		int      index = (updates.now >> (8 + level * 6)) & 63;
+		int      slot  = 256 + level * 64 + index;
+		uint32_t id    = updates.head[slot];
+
+		updates.head[slot] = updates.tail[slot] = 0;
+		while (id)
+		{
+			uint32_t next = updates.list[id].next;
+			updateLink(id);
+			id = next;
+		}
+		/* next level only needs to be cascaded when this one wraps around */
+		if (index > 0) break;
+	}
+}
+
+/* process all entries up to <time> (included), return number of entries processed */
+static int updateAdvance(unsigned time, BlockIter iter)
+{
+	int count = 0;
+
+	while ((int) (time - updates.now) >= 0)
 	{
-		int        id    = updates.sorted[0];
-		TileTick   list  = updates.list + id;
-		Chunk      chunk = list->cd->chunk;
-		UpdateCb_t cb    = list->cb;
-		if (list->tick > time) break;
-		//if (list->tick == 0)
-		//	puts("no good: cleared entry");
-		mapInitIterOffset(&iter, list->cd, list->offset);
-
-		//fprintf(stderr, "applying block update %d at %d, %d, %d for %d:%d", id,
-		//	(int) pos[0], (int) pos[1], (int) pos[2], list->blockId >> 4, list->blockId & 15);
-		i ++;
-		id = list->blockId;
-		updateRemove(list->cd, list->offset, False);
-		//	puts("no good: not cleared");
-		memmove(updates.sorted, updates.sorted + 1, updates.count * sizeof *updates.sorted);
-		if ((chunk->cflags & CFLAG_REBUILDTT) == 0)
-			chunkMarkForUpdate(chunk, CHUNK_NBT_TILETICKS);
-		//updateDebugSorted();
-
-		/* this can modify updates.sorted */
-		if (cb)
+		int slot = updates.now & 255;
+		if (updates.count == 0)
 		{
-			cb(globals.level, &iter);
+			updates.now = time + 1;
+			break;
+		}
+		if (slot == 0)
+		{
+			updateCascade();
+		}
+		else if (updates.near == 0)
+		{
+			/* nothing in first level: skip to next cascade */
+			unsigned next = (updates.now | 255) + 1;
+			updates.now = (int) (next - time) > 0 ? time + 1 : next;
+			continue;
 		}
-		else if (id == BLOCK_UPDATE)
+
+		/* more tile ticks can be added to this slot while processing it (<now> can also be reset if wheel is emptied) */
+		uint32_t id;
+		while ((id = updates.head[updates.now & 255]))
 		{
-			mapUpdateChangeRedstone(globals.level, &iter, RSSAMEBLOCK, NULL);
+			TileTick   list  = updates.list + id;
+			Chunk      chunk = list->cd->chunk;
+			UpdateCb_t cb    = list->cb;
+			int        block = list->blockId;
+
+			mapInitIterOffset(iter, list->cd, list->offset);
+			updateRelease(id);
+			count ++;
+
+			double start = globals.profiling ? debugProfStart() : 0;
+
+			if ((chunk->cflags & CFLAG_REBUILDTT) == 0)
+				chunkMarkForUpdate(chunk, CHUNK_NBT_TILETICKS);
+
+			if (cb)
+			{
+				cb(globals.level, iter);
+			}
+			else if (block == BLOCK_UPDATE)
+			{
+				mapUpdateChangeRedstone(globals.level, iter, RSSAMEBLOCK, NULL);
+			}
+			else mapUpdate(globals.level, NULL, block, NULL, UPDATE_DONTLOG | UPDATE_SILENT);
+
+			if (start > 0) debugProfEnd(PROF_TILETICK, chunk, start);
 		}
-		else mapUpdate(globals.level, NULL, id, NULL, UPDATE_DONTLOG | UPDATE_SILENT);
+		updates.now ++;
 	}
-	if (i > 0)
+	return count;
+}
+
+/* usually redstone devices (repeater, torch) update surrounding blocks after a delay */
+void updateTick(void)
+{
+	struct BlockIter_t iter;
+	mapUpdateInit(&iter);
+	/* also apply block updates deferred by previous mapUpdateFlush() */
+	if (updateAdvance(globals.curTime, &iter) > 0 || mapUpdatePending())
 	{
 		/* update meshes */
 		mapUpdateEnd(globals.level);
@@ -483,3 +490,116 @@ void updateFinished(DATA8 tile, vec4 dest)
 		}
 	}
 }
+
+#ifdef DEBUG
+/*
+ * scheduler stress test (debug build only): tile ticks of the map are kept aside while running it.
+ */
+#define BENCH_CHUNKS     64
+#define BENCH_TOTAL      (BENCH_CHUNKS * 4096)
+
+static struct
+{
+	ChunkData cds;
+	DATA32    ticks;
+	int8_t *  priority;
+	unsigned  lastTick;
+	int       lastPriority;
+	int       fired, errors, requeued;
+	uint32_t  seed;
+}	bench;
+
+static void updateBenchFire(Map map, BlockIter iter);
+
+static int updateBenchRand(void)
+{
+	bench.seed = bench.seed * 1103515245 + 12345;
+	return (bench.seed >> 8) & 0xffffff;
+}
+
+static void updateBenchInsert(ChunkData cd, int offset, unsigned tick)
+{
+	int      index = (cd - bench.cds) * 4096 + offset;
+	int      prio  = updateBenchRand() % 3 - 1;
+	TileTick entry = updateInsert(cd, offset, tick, prio);
+	if (entry)
+	{
+		entry->cb = updateBenchFire;
+		bench.ticks[index] = tick;
+		bench.priority[index] = prio;
+	}
+}
+
+/* check that ticks are processed in order, and reschedule some of them (like a redstone clock would) */
+static void updateBenchFire(Map map, BlockIter iter)
+{
+	int      index = (iter->cd - bench.cds) * 4096 + iter->offset;
+	unsigned tick  = bench.ticks[index];
+	int      prio  = bench.priority[index];
+
+	if ((int) (tick - bench.lastTick) < 0 || (tick == bench.lastTick && prio < bench.lastPriority))
+		bench.errors ++;
+	bench.lastTick = tick;
+	bench.lastPriority = prio;
+	bench.fired ++;
+
+	if ((updateBenchRand() & 7) == 0 && bench.requeued < BENCH_TOTAL / 2)
+	{
+		updateBenchInsert(iter->cd, iter->offset, updates.now + 100 + updateBenchRand() % 2000);
+		bench.requeued ++;
+	}
+}
+
+void updateBenchmark(void)
+{
+	struct UpdatePrivate_t saved = updates;
+	struct BlockIter_t     iter;
+	struct Chunk_t         chunk;
+	unsigned start, end;
+	double   time;
+	int      i, count, maxPending;
+
+	memset(&bench, 0, sizeof bench);
+	memset(&chunk, 0, sizeof chunk);
+	memset(&updates, 0, sizeof updates);
+	/* prevent chunkMarkForUpdate() on fake chunk */
+	chunk.cflags = CFLAG_REBUILDTT;
+	bench.cds = calloc(BENCH_CHUNKS, sizeof *bench.cds);
+	bench.ticks = malloc(BENCH_TOTAL * 5);
+	bench.priority = (int8_t *) (bench.ticks + BENCH_TOTAL);
+	bench.seed = 1;
+	if (bench.cds == NULL || bench.ticks == NULL)
+		goto bail;
+	for (i = 0; i < BENCH_CHUNKS; i ++)
+		bench.cds[i].chunk = &chunk;
+
+	start = globals.curTime;
+	time = FrameGetTime();
+	for (i = 0; i < BENCH_TOTAL; i ++)
+		/* spread over a minute */
+		updateBenchInsert(bench.cds + (i >> 12), i & 4095, start + updateBenchRand() % 60000);
+	time = FrameGetTime() - time;
+	maxPending = updates.count;
+	fprintf(stderr, "bench tile ticks: %d inserts in %.1f ms (%.0f/s)\n", BENCH_TOTAL, time, BENCH_TOTAL * 1000 / time);
+
+	time = FrameGetTime();
+	for (i = count = 0; i < BENCH_TOTAL; i += 4)
+		count += updateRemove(bench.cds + (i >> 12), i & 4095);
+	time = FrameGetTime() - time;
+	fprintf(stderr, "bench tile ticks: %d cancels in %.1f ms (%.0f/s)\n", count, time, count * 1000 / time);
+
+	/* simulate 50ms frames, until everything has been processed */
+	time = FrameGetTime();
+	for (end = start; updates.count > 0 && end - start < 600000; end += 50)
+		updateAdvance(end, &iter);
+	time = FrameGetTime() - time;
+	fprintf(stderr, "bench tile ticks: %d fired (%d requeued, %d max pending) in %.1f ms (%.0f/s), %d out of order\n",
+		bench.fired, bench.requeued, maxPending, time, bench.fired * 1000 / time, bench.errors);
+
+	bail:
+	free(bench.cds);
+	free(bench.ticks);
+	updateClearAll();
+	updates = saved;
+}
+#endif
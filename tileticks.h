@@ -19,32 +19,52 @@ void updateAddTickCallback(BlockIter iter, int nbTick, UpdateCb_t cb);
 void updateAddRSUpdate(struct BlockIter_t iter, int side, int nbTick);
 void updateClearAll(void);
 int  updateCount(Chunk);
-Bool updateRemove(ChunkData cd, int offset, Bool clearSorted);
-Bool updateGetNBT(Chunk, NBTFile nbt, DATA16 index);
+Bool updateRemove(ChunkData cd, int offset);
+Bool updateGetNBT(Chunk, NBTFile nbt, int * index);
 Bool updateScheduled(ChunkData cd, int offset);
+#ifdef DEBUG
+void updateBenchmark(void);
+#endif
 
 #ifdef TILE_TICK_IMPL
 typedef struct TileTick_t *    TileTick;
 typedef struct TileTick_t      TileTick_t;
 #define BLOCK_UPDATE           0x1000000
 
+/*
+ * hierarchical timing wheel: first level has one slot per millisec (256ms), next levels have 64
+ * slots each covering the entire range of the previous level (up to 2^26ms, ~18 hours).
+ */
+#define WHEEL_LEVELS           4
+#define WHEEL_SLOTS            (256 + 64 * (WHEEL_LEVELS-1))
+#define WHEEL_RANGE            (1 << 26)
+
 struct TileTick_t
 {
-	uint16_t   prev;
-	uint16_t   next;
-	ChunkData  cd;
+	uint32_t   prev, next;     /* slot of timing wheel (handle, 0 = none), <next> is also used for free list */
+	uint32_t   chain;          /* hash collision */
 	uint16_t   offset;
-	int16_t    priority;
+	int16_t    priority;       /* same tick: lower value is processed first */
+	uint16_t   slot;           /* index in UpdatePrivate_t.head[] */
+	ChunkData  cd;             /* NULL if entry is free */
 	ItemID_t   blockId;
-	unsigned   tick;
+	unsigned   tick;           /* globals.curTime when update must be processed */
+	unsigned   seq;            /* same tick and priority: insertion order */
 	UpdateCb_t cb;
 };
 
 struct UpdatePrivate_t
 {
-	TileTick list;
-	DATA16   sorted;
-	int      count, max;
+	TileTick   list;           /* handle 0 is not used */
+	uint32_t * hash;           /* (cd, offset) => handle */
+	uint32_t   head[WHEEL_SLOTS];
+	uint32_t   tail[WHEEL_SLOTS];
+	uint32_t   freeList;
+	int        count, max, used;
+	int        near;           /* entries in first level of wheel */
+	int        hashBits;
+	unsigned   now;            /* next millisec to process */
+	unsigned   seq;
 };
 #endif
 #endif
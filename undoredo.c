@@ -16,16 +16,220 @@
 #include "entities.h"
 #include "undoredo.h"
 #include "render.h"
+#include "redstone.h"
+#include "tileticks.h"
+#include "sign.h"
 #include "globals.h"
+#include "zlib.h"
 
 static struct UndoPrivate_t journal;
 
+static void undoFreeBuf(UndoLogBuf log)
+{
+	if (log->buffer)
+	{
+		free(log->buffer);
+		journal.memUsage -= UNDO_LOG_SIZE;
+	}
+	journal.spillUsed -= log->slotSize;
+	journal.logSize -= log->usage;
+	free(log);
+}
+
 /* map is being deleted */
 void undoDelAll(void)
 {
 	ListNode * node;
-	while ((node = ListRemHead(&journal.undoLog))) free(node);
-	while ((node = ListRemHead(&journal.redoLog))) free(node);
+	while ((node = ListRemHead(&journal.undoLog))) undoFreeBuf((UndoLogBuf) node);
+	while ((node = ListRemHead(&journal.redoLog))) undoFreeBuf((UndoLogBuf) node);
+	if (journal.spillFile)
+	{
+		fclose(journal.spillFile);
+		DeleteDOS(journal.spillPath);
+		journal.spillFile = NULL;
+	}
+	journal.spillSize = journal.spillUsed = 0;
+	journal.logSize = 0;
+	journal.noSpill = 0;
+}
+
+/*
+ * spill file: when the journal uses more than globals.undoMaxMem, the content of the oldest buffers is
+ * compressed and moved into a temp file. List nodes are kept: buffers are read back when undo reaches them.
+ */
+static Bool undoOpenSpill(void)
+{
+	STRPTR path = journal.spillPath;
+	STRPTR temp = getenv("TEMP");
+
+	/* next to level.dat first: tmpfile() would use the root of the drive on Windows */
+	CopyString(path, globals.level->path, MAX_PATHLEN);
+	AddPart(path, "../undo.tmp", MAX_PATHLEN);
+	journal.spillFile = fopen_enc(path, "w+b");
+
+	if (journal.spillFile == NULL)
+	{
+		/* world folder might be read-only */
+		if (temp == NULL) temp = getenv("TMPDIR");
+		if (temp == NULL) return False;
+		CopyString(path, temp, MAX_PATHLEN);
+		AddPart(path, "mcedit_undo.tmp", MAX_PATHLEN);
+		journal.spillFile = fopen_enc(path, "w+b");
+	}
+	journal.spillSize = journal.spillUsed = 0;
+	return journal.spillFile != NULL;
+}
+
+static int undoSortByOffset(const void * item1, const void * item2)
+{
+	UndoLogBuf log1 = * (UndoLogBuf *) item1;
+	UndoLogBuf log2 = * (UndoLogBuf *) item2;
+	return log1->fileOffset < log2->fileOffset ? -1 : 1;
+}
+
+/* more than half of the spill file is not used anymore: move slots still in use at the beginning */
+static void undoCompactSpill(void)
+{
+	ListHead *   lists[] = {&journal.undoLog, &journal.redoLog};
+	UndoLogBuf * slots;
+	UndoLogBuf   log;
+	long         pos;
+	int          i, count;
+
+	for (i = count = 0; i < 2; i ++)
+		for (log = HEAD(*lists[i]); log; NEXT(log))
+			if (log->slotSize > 0) count ++;
+
+	slots = malloc(count * sizeof *slots);
+	if (slots == NULL) return;
+
+	for (i = count = 0; i < 2; i ++)
+		for (log = HEAD(*lists[i]); log; NEXT(log))
+			if (log->slotSize > 0) slots[count++] = log;
+
+	/* slots can only move toward the beginning of the file: won't overwrite the ones not moved yet */
+	qsort(slots, count, sizeof *slots, undoSortByOffset);
+
+	for (i = 0, pos = 0; i < count; i ++)
+	{
+		uint8_t packed[UNDO_LOG_SIZE + 64];
+		log = slots[i];
+		if (log->spill == 0)
+		{
+			/* copy is out of date: slot can be discarded */
+			journal.spillUsed -= log->slotSize;
+			log->slotSize = 0;
+			continue;
+		}
+		if (log->fileOffset > pos)
+		{
+			fseek(journal.spillFile, log->fileOffset, SEEK_SET);
+			if (fread(packed, log->spill, 1, journal.spillFile) != 1)
+				break;
+			fseek(journal.spillFile, pos, SEEK_SET);
+			if (fwrite(packed, log->spill, 1, journal.spillFile) != 1)
+				break;
+			log->fileOffset = pos;
+		}
+		journal.spillUsed += log->spill - log->slotSize;
+		log->slotSize = log->spill;
+		pos += log->spill;
+	}
+	/* if an I/O error occured, slots after <i> have not been moved */
+	if (i == count)
+		journal.spillSize = pos;
+	free(slots);
+}
+
+static void undoSpillBuf(UndoLogBuf log)
+{
+	if (log->spill == 0)
+	{
+		uint8_t packed[UNDO_LOG_SIZE + 64];
+		uLongf  size = sizeof packed;
+		long    offset;
+		Bool    append;
+
+		if (journal.spillFile == NULL && ! undoOpenSpill())
+		{
+			journal.noSpill = 1;
+			return;
+		}
+		if (compress2(packed, &size, log->buffer, log->usage, Z_BEST_SPEED) != Z_OK)
+			return;
+
+		/* buffer was spilled before, but modified since: reuse its slot if possible */
+		append = log->slotSize < (int) size;
+		if (append)
+		{
+			if (journal.spillUsed == 0)
+				/* nothing in the file is used anymore */
+				journal.spillSize = 0;
+			else if (journal.spillSize > (1 << 20) && journal.spillSize > journal.spillUsed * 2)
+				undoCompactSpill();
+			offset = journal.spillSize;
+		}
+		else offset = log->fileOffset;
+
+		fseek(journal.spillFile, offset, SEEK_SET);
+		if (fwrite(packed, size, 1, journal.spillFile) != 1)
+			return;
+		if (append)
+		{
+			/* previous slot (if any) is lost until next compaction */
+			journal.spillUsed += size - log->slotSize;
+			journal.spillSize += size;
+			log->slotSize = size;
+		}
+		log->fileOffset = offset;
+		log->spill = size;
+	}
+	/* else: unmodified since it was read back from spill file */
+	free(log->buffer);
+	log->buffer = NULL;
+	journal.memUsage -= UNDO_LOG_SIZE;
+}
+
+/* get content of buffer, read it back from spill file if needed (NULL if out of memory) */
+static DATA8 undoLoadBuf(UndoLogBuf log)
+{
+	if (log->buffer == NULL)
+	{
+		uint8_t packed[UNDO_LOG_SIZE + 64];
+		uLongf  size = UNDO_LOG_SIZE;
+
+		log->buffer = malloc(UNDO_LOG_SIZE);
+		if (log->buffer == NULL)
+			return NULL;
+		journal.memUsage += UNDO_LOG_SIZE;
+		fseek(journal.spillFile, log->fileOffset, SEEK_SET);
+		if (fread(packed, log->spill, 1, journal.spillFile) != 1 ||
+		    uncompress(log->buffer, &size, packed, log->spill) != Z_OK)
+			/* should not happen */
+			memset(log->buffer, 0, UNDO_LOG_SIZE);
+	}
+	return log->buffer;
+}
+
+/* keep memory used by the journal below globals.undoMaxMem */
+static void undoCheckMem(void)
+{
+	ListHead * lists[] = {&journal.undoLog, &journal.redoLog};
+	int        max = MIN(globals.undoMaxMem, 2047) << 20;
+	int        i;
+
+	if (max <= 0 || journal.memUsage <= max || journal.noSpill)
+		return;
+
+	/* leave some room to not have to do this for every new buffer */
+	max -= max >> 2;
+	for (i = 0; i < 2; i ++)
+	{
+		/* oldest first, last buffer is still being written */
+		UndoLogBuf log, tail = TAIL(*lists[i]);
+		for (log = HEAD(*lists[i]); log != tail && journal.memUsage > max; NEXT(log))
+			if (log->buffer) undoSpillBuf(log);
+	}
 }
 
 /* store a chunk of memory in the undo log */
@@ -34,20 +238,31 @@ static void undoAddMem(ListHead * head, APTR buffer, int size)
 	UndoLogBuf log = TAIL(*head);
 
 	do {
-		if (log == NULL)
+		if (log == NULL || log->usage == UNDO_LOG_SIZE)
 		{
-			log = malloc(sizeof *log + UNDO_LOG_SIZE - 4);
+			log = malloc(sizeof *log);
+			if (log == NULL) return;
+			log->buffer = malloc(UNDO_LOG_SIZE);
+			if (log->buffer == NULL) { free(log); return; }
 			log->usage = 0;
-			ListAddHead(head, &log->node);
+			log->spill = 0;
+			log->slotSize = 0;
+			journal.memUsage += UNDO_LOG_SIZE;
+			ListAddTail(head, &log->node);
+			undoCheckMem();
 		}
-		int remain = UNDO_LOG_SIZE - log->usage;
+		int   remain = UNDO_LOG_SIZE - log->usage;
+		DATA8 mem = undoLoadBuf(log);
+		if (mem == NULL) return;
 		if (remain > size)
 			remain = size;
-		memcpy(log->buffer + log->usage, buffer, remain);
+		memcpy(mem + log->usage, buffer, remain);
+		/* copy in spill file (if any) is now out of date */
+		log->spill = 0;
 		size -= remain;
 		buffer += remain;
 		log->usage += remain;
-		NEXT(log);
+		journal.logSize += remain;
 	}
 	while (size > 0);
 }
@@ -55,10 +270,18 @@ static void undoAddMem(ListHead * head, APTR buffer, int size)
 static void undoFreeLog(ListHead * head)
 {
 	UndoLogBuf log, next;
-	for (log = HEAD(*head); log; next = (UndoLogBuf) log->node.ln_Next, free(log), log = next);
+	for (log = HEAD(*head); log; next = (UndoLogBuf) log->node.ln_Next, undoFreeBuf(log), log = next);
 	memset(head, 0, sizeof *head);
 }
 
+/* for debug info: memory used, spill file size and total size of journal (all in bytes) */
+void undoMemUsage(int stats[3])
+{
+	stats[0] = journal.memUsage;
+	stats[1] = journal.spillSize;
+	stats[2] = journal.logSize;
+}
+
 /* retrieve some memory from the log */
 static void undoGetMem(APTR mem, int max, UndoLogBuf log, int offset)
 {
@@ -76,7 +299,9 @@ static void undoGetMem(APTR mem, int max, UndoLogBuf log, int offset)
 		eom -= avail;
 		offset -= avail;
 		max -= avail;
-		memcpy(eom, log->buffer + offset, avail);
+		DATA8 buf = undoLoadBuf(log);
+		if (buf) memcpy(eom, buf + offset, avail);
+		else     memset(eom, 0, avail);
 		if (offset == 0)
 		{
 			PREV(log);
@@ -86,13 +311,82 @@ static void undoGetMem(APTR mem, int max, UndoLogBuf log, int offset)
 	}
 }
 
-static inline void undoFlushRepeat(ListHead * head)
+/*
+ * region operations (fill, replace, delete): instead of logging blocks one by one, the content of each sub-chunk
+ * is saved the first time it is modified (LOG_SECTION). Undo will copy them back, then relight and remesh once.
+ */
+static Bool undoAddSectionKey(Chunk c, int layer)
 {
-	*journal.regionRepeatLoc = UNDO_BLOCK_REPEAT;
-	undoAddMem(head, &journal.regionRepeat, sizeof journal.regionRepeat);
-	journal.regionBytes += sizeof journal.regionRepeat;
-	journal.regionRepeat = 0;
-	journal.regionRepeatId = -1;
+	uint64_t key = (1ULL << 63) | ((uint64_t) ((c->X >> 4) & 0xffffff) << 28) | (((c->Z >> 4) & 0xffffff) << 4) | layer;
+	int      i, mask;
+
+	if (journal.sectionCount * 2 >= journal.sectionMax)
+	{
+		/* grow hash table */
+		int        max  = journal.sectionMax ? journal.sectionMax * 2 : 256;
+		uint64_t * keys = calloc(max, sizeof *keys);
+		for (i = 0; i < journal.sectionMax; i ++)
+		{
+			uint64_t old = journal.sectionKeys[i];
+			int      slot;
+			if (old == 0) continue;
+			for (slot = ((old * 0x9E3779B97F4A7C15ULL) >> 40) & (max - 1); keys[slot]; slot = (slot + 1) & (max - 1));
+			keys[slot] = old;
+		}
+		free(journal.sectionKeys);
+		journal.sectionKeys = keys;
+		journal.sectionMax = max;
+	}
+	mask = journal.sectionMax - 1;
+	for (i = ((key * 0x9E3779B97F4A7C15ULL) >> 40) & mask; journal.sectionKeys[i]; i = (i + 1) & mask)
+		if (journal.sectionKeys[i] == key) return False;
+	journal.sectionKeys[i] = key;
+	journal.sectionCount ++;
+	return True;
+}
+
+/* store block ids, data and tile entities of a sub-chunk; <offset> (if >= 0) has already been changed from <blockId> */
+static void undoSaveSection(ListHead * head, Chunk c, int layer, int offset, int blockId)
+{
+	struct UndoSection_t mem;
+	ChunkData cd = layer < c->maxy ? c->layer[layer] : NULL;
+	DATA8     tile;
+	int       bytes, XYZ[3], off;
+
+	bytes = 0;
+	if (cd && (cd->cdFlags & CDFLAG_CHUNKAIR) == 0)
+	{
+		uint8_t blocks[SKYLIGHT_OFFSET];
+		memcpy(blocks, cd->blockIds, SKYLIGHT_OFFSET);
+		if (offset >= 0)
+		{
+			DATA8 data = blocks + DATA_OFFSET + (offset >> 1);
+			blocks[offset] = blockId >> 4;
+			if (offset & 1) *data = (*data & 0x0f) | (blockId << 4);
+			else            *data = (*data & 0xf0) | (blockId & 15);
+		}
+		undoAddMem(head, blocks, SKYLIGHT_OFFSET);
+		bytes = SKYLIGHT_OFFSET;
+
+		/* tile entities are still in the chunk at this point */
+		for (off = 0; (tile = chunkIterTileEntity(c, XYZ, &off)); )
+		{
+			if ((XYZ[VY] >> 4) != layer) continue;
+			uint32_t info[] = {CHUNK_BLOCK_POS(XYZ[VX] & 15, XYZ[VZ] & 15, XYZ[VY] & 15), NBT_Size(tile) + 4};
+			undoAddMem(head, info, sizeof info);
+			undoAddMem(head, tile, info[1]);
+			bytes += sizeof info + info[1];
+		}
+	}
+	/* else sub-chunk was empty: only store the header */
+
+	mem.loc[VX] = c->X;
+	mem.loc[VY] = layer << 4;
+	mem.loc[VZ] = c->Z;
+	/* all the sub-chunks of a region are undone at once */
+	mem.typeSize = ((bytes + sizeof mem) << 8) | LOG_SECTION | (journal.regionSections > 0 ? UNDO_LINK : 0);
+	undoAddMem(head, &mem, sizeof mem);
+	journal.regionSections ++;
 }
 
 /* register an operation in the log */
@@ -153,71 +447,10 @@ void undoLog(int type, ...)
 			if (tile) mem.itemId |= HAS_TILEENTITY;
 			undoAddMem(head, &mem, sizeof mem);
 		}
-		else /* the difference with previous branch, is that we won't have to store location */
+		else if (undoAddSectionKey(cd->chunk, cd->Y >> 4))
 		{
-			offset = (point[VX] - journal.regionLoc[VX]) +
-			        ((point[VY] - journal.regionLoc[VY]) * journal.regionSize[VZ] +
-			          point[VZ] - journal.regionLoc[VZ]) * journal.regionSize[VX];
-			if (offset != journal.regionOffset)
-			{
-				/* non-contiguous modification: need to add a skip count */
-				int skip = journal.regionOffset < 0 ? offset : offset - journal.regionOffset;
-				if (journal.regionRepeat > 1)
-					undoFlushRepeat(head);
-				else
-					journal.regionRepeatId = -1;
-				/* note: selection can be processed top to bottom, moving to another Y layer will generate a negative offset */
-				if (-32768 <= skip && skip <= 32767)
-				{
-					uint16_t store[2] = {UNDO_BLOCK_SKIP, skip};
-					undoAddMem(head, store, sizeof store);
-					journal.regionBytes += sizeof store;
-				}
-				else /* hmm, very sparse modifications */
-				{
-					uint16_t store[3] = {UNDO_BLOCK_SKIP32, skip, skip >> 16};
-					undoAddMem(head, store, sizeof store);
-					journal.regionBytes += sizeof store;
-				}
-			}
-			journal.regionOffset = offset+1;
-			if (tile)
-			{
-				if (journal.regionRepeat > 1)
-					undoFlushRepeat(head);
-				/* store tile entity before block id */
-				int size = NBT_Size(tile) + 4;
-				uint16_t info[] = {UNDO_BLOCK_TILEENT, size};
-				journal.regionBytes += 4 + size;
-				/* need a 4 bytes header though */
-				undoAddMem(head, info, sizeof info);
-				undoAddMem(head, tile, size);
-			}
-			else if (journal.regionRepeatId == blockId)
-			{
-				/* compress selection using run-length encoding */
-				if (journal.regionRepeat == 0xffff)
-					undoFlushRepeat(head);
-				journal.regionRepeat ++;
-				if (journal.regionRepeat == 1)
-				{
-					/* this method will save bytes only with 3 or more consecutive blocks of the same type */
-					undoAddMem(head, &blockId, sizeof blockId);
-					journal.regionBytes += 2;
-					UndoLogBuf log = TAIL(journal.undoLog);
-					journal.regionRepeatLoc = (DATA16) (log->buffer + log->usage - 2);
-				}
-				break;
-			}
-			else
-			{
-				if (journal.regionRepeat > 1)
-					undoFlushRepeat(head);
-				journal.regionRepeatId = blockId;
-				journal.regionRepeat = 0;
-			}
-			undoAddMem(head, &blockId, sizeof blockId);
-			journal.regionBytes += 2;
+			/* first block modified in this sub-chunk: save all of it */
+			undoSaveSection(head, cd->chunk, cd->Y >> 4, CHUNK_BLOCK_POS(point[VX] & 15, point[VZ] & 15, point[VY] & 15), blockId);
 		}
 	}	break;
 	case LOG_ENTITY_DEL:
@@ -245,12 +478,9 @@ void undoLog(int type, ...)
 	case LOG_REGION_START: /* won't store anything in the log (yet) */
 		if (journal.inSelection == 0)
 		{
-			/* need to write blocks changed first */
-			journal.regionRepeatId = -1;
-			journal.regionRepeat = 0;
+			/* sub-chunks modified will be saved first */
 			journal.inSelection = 1;
-			journal.regionOffset = 0;
-			journal.regionBytes = 0;
+			journal.regionSections = 0;
 			memcpy(journal.regionLoc, va_arg(args, int *), 2 * sizeof journal.regionLoc);
 		}
 		break;
@@ -258,19 +488,20 @@ void undoLog(int type, ...)
 		if (journal.inSelection == 1)
 		{
 			int * modif = va_arg(args, int *);
-			if (journal.regionRepeat > 1)
-				undoFlushRepeat(head);
-			if (journal.regionBytes > 0)
+			if (journal.regionSections > 0)
 			{
 				struct UndoSelection_t mem;
 				memcpy(mem.start, journal.regionLoc, 2 * sizeof mem.start);
-				mem.typeSize = LOG_REGION_START | ((journal.regionBytes + sizeof mem) << 8);
+				mem.typeSize = LOG_REGION_START | UNDO_LINK | (sizeof mem << 8);
 				undoAddMem(head, &mem, sizeof mem);
 				*modif = 1;
 			}
 			else *modif = 0;
 			/* else operation on selection did not modify anything */
 			journal.inSelection = 0;
+			free(journal.sectionKeys);
+			journal.sectionKeys = NULL;
+			journal.sectionCount = journal.sectionMax = 0;
 		}
 	}
 }
@@ -311,8 +542,16 @@ void undoDebugLog(STRPTR name, ListHead * head)
 			{
 				struct UndoSelection_t mem;
 				undoGetMem(&mem, sizeof mem, log, offset);
-				fprintf(stderr, "%c region: start at %d, %d, %d, size = %d, %d, %d, data = %d bytes\n", chr,
-					mem.start[VX], mem.start[VY], mem.start[VZ], mem.size[VX], mem.size[VY], mem.size[VZ], (typeSize >> 8) - sizeof mem);
+				fprintf(stderr, "%c region: start at %d, %d, %d, size = %d, %d, %d\n", chr,
+					mem.start[VX], mem.start[VY], mem.start[VZ], mem.size[VX], mem.size[VY], mem.size[VZ]);
+			}
+			break;
+		case LOG_SECTION:
+			{
+				struct UndoSection_t mem;
+				undoGetMem(&mem, sizeof mem, log, offset);
+				fprintf(stderr, "%c sub-chunk %d, %d, layer %d: %d bytes\n", chr, mem.loc[VX], mem.loc[VZ], mem.loc[VY] >> 4,
+					(typeSize >> 8) - sizeof mem);
 			}
 			break;
 		case LOG_ENTITY_DEL:
@@ -352,95 +591,82 @@ void undoDebug(void)
 }
 #endif
 
-static void inline undoNextBlock(int XYZ[3], int * start)
+/* copy back a sub-chunk saved by undoSaveSection(), current content goes into <other> log */
+static void undoRestoreSection(ListHead * other, UndoLogBuf log, int offset, int size)
 {
-	XYZ[VX] ++;
-	if (XYZ[VX] == start[VX+3])
+	struct UndoSection_t mem;
+	Chunk     c;
+	ChunkData cd;
+	DATA8     tile;
+	int       layer, XYZ[3], off;
+	uint8_t   old[SKYLIGHT_OFFSET];
+
+	undoGetMem(&mem, sizeof mem, log, offset);
+	c = mapGetChunk(globals.level, (vec4) {mem.loc[VX], mem.loc[VY], mem.loc[VZ]});
+	if (c == NULL || (c->cflags & CFLAG_GOTDATA) == 0)
+		return;
+
+	layer = mem.loc[VY] >> 4;
+	size -= sizeof mem;
+	undoSaveSection(other, c, layer, -1, 0);
+
+	cd = layer < c->maxy ? c->layer[layer] : NULL;
+	if (cd == NULL)
 	{
-		XYZ[VX] = 0;
-		XYZ[VZ] ++;
-		if (XYZ[VZ] == start[VZ+3])
-		{
-			XYZ[VZ] = 0;
-			XYZ[VY] ++;
-		}
+		/* was empty before and after */
+		if (size == 0) return;
+		cd = chunkCreateEmpty(c, layer);
+		renderResetFrustum();
 	}
-}
 
-/* cancel modifications done from selection */
-static void undoSelection(int * start, UndoLogBuf log, int offset, int bytes)
-{
-	uint16_t regionRepeat = 0;
-	DATA8    tile = NULL;
-	int      XYZ[3] = {0, 0, 0};
-
-	for (offset -= bytes; offset < 0; PREV(log), offset += log->usage);
+	/* remove current tile entities */
+	for (off = 0; (tile = chunkIterTileEntity(c, XYZ, &off)); )
+	{
+		if ((XYZ[VY] >> 4) != layer) continue;
+		int pos = CHUNK_BLOCK_POS(XYZ[VX] & 15, XYZ[VZ] & 15, XYZ[VY] & 15);
+		if (blockIds[cd->blockIds[pos]].special == BLOCK_SIGN)
+			signDel(tile);
+		chunkDeleteTileEntity(cd, pos, False, NULL);
+		chunkMarkForUpdate(c, CHUNK_NBT_TILEENTITIES);
+		/* entries further in the hash chain might have been moved in this slot */
+		off --;
+	}
 
-	mapUpdateInit(NULL);
-	while (bytes > 0)
+	memcpy(old, cd->blockIds, SKYLIGHT_OFFSET);
+	if (size == 0)
+	{
+		memset(cd->blockIds, 0, SKYLIGHT_OFFSET);
+	}
+	else
 	{
-		void undoRead(APTR mem, int size)
+		DATA8 tiles, eof;
+		undoGetMem(cd->blockIds, SKYLIGHT_OFFSET, log, offset - sizeof mem - (size - SKYLIGHT_OFFSET));
+		size -= SKYLIGHT_OFFSET;
+		if (size > 0)
 		{
-			while (size > 0)
+			tiles = malloc(size);
+			undoGetMem(tiles, size, log, offset - sizeof mem);
+			for (eof = tiles + size, tile = tiles; tile < eof; )
 			{
-				int remain = log->usage - offset;
-				if (remain > size) remain = size;
-				memcpy(mem, log->buffer + offset, remain);
-				size -= remain;
-				bytes -= remain;
-				mem += remain;
-				offset += remain;
-				if (offset == log->usage) NEXT(log), offset = 0;
+				uint32_t info[2];
+				memcpy(info, tile, sizeof info);
+				DATA8 nbt = malloc(info[1]);
+				memcpy(nbt, tile + sizeof info, info[1]);
+				chunkAddTileEntity(cd, info[0], nbt);
+				tile += sizeof info + info[1];
 			}
+			free(tiles);
+			chunkMarkForUpdate(c, CHUNK_NBT_TILEENTITIES);
 		}
+	}
 
-		uint16_t blockId;
-		int count;
-		undoRead(&blockId, 2);
-		switch (blockId) {
-		case UNDO_BLOCK_REPEAT:
-			undoRead(&blockId, 2);
-			for (count = blockId, blockId = regionRepeat; count > 0; count --)
-			{
-				mapUpdate(globals.level, (vec4) {start[VX] + XYZ[VX], start[VY] + XYZ[VY], start[VZ] + XYZ[VZ]}, blockId, NULL, UPDATE_SILENT | UPDATE_DONTLOG);
-				undoNextBlock(XYZ, start);
-			}
-			break;
-		case UNDO_BLOCK_SKIP:
-			undoRead(&blockId, 2);
-			count = (int16_t) blockId;
-			goto case_BLOCK_SKIP;
-		case UNDO_BLOCK_SKIP32:
-			undoRead(&blockId, 2); count = blockId;
-			undoRead(&blockId, 2); count |= blockId << 16;
-		case_BLOCK_SKIP:
-			{
-				int   pos = XYZ[VX] + (XYZ[VZ] + XYZ[VY] * start[VZ+3]) * start[VX+3] + count;
-				div_t res = div(pos, start[VX+3]);
-				XYZ[VX] = res.rem;
-				res = div(res.quot, start[VZ+3]);
-				XYZ[VZ] = res.rem;
-				XYZ[VY] = res.quot;
-			}
-			break;
-		case UNDO_BLOCK_TILEENT:
-			{
-				if (tile) free(tile); /* shouldn't happen */
-				uint16_t size;
-				undoRead(&size, sizeof size);
-				tile = malloc(size);
-				undoRead(tile, size);
-			}
-			break;
-		default:
-			mapUpdate(globals.level, (vec4) {start[VX] + XYZ[VX], start[VY] + XYZ[VY], start[VZ] + XYZ[VZ]}, blockId, tile, UPDATE_SILENT | UPDATE_DONTLOG);
-			undoNextBlock(XYZ, start);
-			regionRepeat = blockId;
-			tile = NULL;
-		}
+	/* pending tile ticks would write back their own blockId on the restored blocks (like mapUpdate() does) */
+	for (off = 0; off < 4096; off ++)
+	{
+		if (old[off] != cd->blockIds[off] || ((old[DATA_OFFSET + (off >> 1)] ^ cd->blockIds[DATA_OFFSET + (off >> 1)]) >> ((off & 1) << 2) & 15))
+			updateRemove(cd, off);
 	}
-	if (tile) free(tile); /* shouldn't happen */
-	mapUpdateEnd(globals.level);
+	mapUpdateSection(cd);
 }
 
 /* cancel last operation stored in the log */
@@ -452,6 +678,7 @@ void undoOperation(int redo)
 	int offset = log->usage;
 	uint32_t typeSize;
 	uint8_t  meshUpdated = 0;
+	uint8_t  region = 0;
 	undoGetMem(&typeSize, sizeof typeSize, log, offset);
 
 	journal.inUndo = 1 + redo;
@@ -491,11 +718,22 @@ void undoOperation(int redo)
 			break;
 		case LOG_REGION_START:
 			{
+				/* followed by the sub-chunks it modified */
 				struct UndoSelection_t mem;
 				undoGetMem(&mem, sizeof mem, log, offset);
-				undoSelection(mem.start, log, offset - sizeof mem, (typeSize >> 8) - sizeof mem);
-				renderCancelModif();
+				memcpy(journal.regionLoc, mem.start, 2 * sizeof mem.start);
+			}
+			journal.regionSections = 0;
+			region = 1;
+			if (meshUpdated == 0)
+			{
+				mapUpdateInit(NULL);
+				meshUpdated = 1;
 			}
+			renderCancelModif();
+			break;
+		case LOG_SECTION:
+			undoRestoreSection(redo ? &journal.undoLog : &journal.redoLog, log, offset, typeSize >> 8);
 			break;
 		case LOG_ENTITY_DEL:
 		case LOG_ENTITY_CHANGED:
@@ -539,15 +777,16 @@ void undoOperation(int redo)
 			do {
 				offset -= typeSize;
 				ListRemTail(head);
-				free(log);
+				undoFreeBuf(log);
 				log = TAIL(*head);
 				if (log == NULL) return;
 				typeSize = log->usage;
 			}
 			while (log->usage < offset);
 			log->usage -= offset;
+			journal.logSize -= offset;
 		}
-		else log->usage = offset;
+		else journal.logSize -= log->usage - offset, log->usage = offset;
 
 		/* check if the next operation needs to cancelled as well */
 		if (link && log && log->usage > 0)
@@ -556,6 +795,16 @@ void undoOperation(int redo)
 		}
 		else break;
 	}
+	if (region && journal.regionSections > 0)
+	{
+		/* what was just undone can be redone (and vice versa) */
+		struct UndoSelection_t mem;
+		memcpy(mem.start, journal.regionLoc, 2 * sizeof mem.start);
+		mem.typeSize = LOG_REGION_START | UNDO_LINK | (sizeof mem << 8);
+		undoAddMem(redo ? &journal.undoLog : &journal.redoLog, &mem, sizeof mem);
+		/* cached wire graphs might not be valid anymore */
+		redstoneNetClearAll();
+	}
 	if (meshUpdated)
 		mapUpdateEnd(globals.level);
 	journal.inUndo = 0;
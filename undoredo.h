@@ -16,12 +16,14 @@ enum
 	LOG_ENTITY_DEL,
 	LOG_REGION_START,              /* one block in the region */
 	LOG_REGION_END,                /* trailer of the region changed */
+	LOG_SECTION,                   /* content of a sub-chunk before a region operation (internal) */
 };
 
 void undoLog(int type, ...);
 void undoOperation(int redo);
 void undoDebug(void);
 void undoDelAll(void);
+void undoMemUsage(int stats[3]);
 
 #define UNDO_LINK                  0x80
 
@@ -47,6 +49,12 @@ struct UndoBlock_t                 /* LOG_BLOCK */
 	uint32_t typeSize;
 };
 
+struct UndoSection_t               /* LOG_SECTION: preceded by block ids + data table and tile entities (unless empty) */
+{
+	int32_t  loc[3];               /* chunk X, sub-chunk Y, chunk Z */
+	uint32_t typeSize;
+};
+
 struct UndoEntity_t                /* LOG_ENTITY */
 {
 	float    loc[3];
@@ -58,30 +66,31 @@ struct UndoLogBuf_t                /* memory storage for undo/redo */
 {
 	ListNode node;                 /* linked list of blocks */
 	int      usage;                /* how many bytes in this block */
-	uint8_t  buffer[4];            /* array of UNDO_LOG_SIZE (but gdb doesn't like big array) */
+	int      spill;                /* size of compressed copy in spill file (0 if none or out of date) */
+	int      slotSize;             /* bytes reserved in spill file at <fileOffset> (can be reused if out of date) */
+	long     fileOffset;           /* location of that copy */
+	DATA8    buffer;               /* array of UNDO_LOG_SIZE, NULL if only in spill file */
 };
 
 struct UndoPrivate_t               /* global private */
 {
 	uint8_t  inUndo;
 	uint8_t  inSelection;
-	int      regionRepeatId;       /* repeat this block id */
-	DATA16   regionRepeatLoc;      /* need to modify this location to UNDO_BLOCK_REPEAT if repeat */
-	uint16_t regionRepeat;         /* repeat this many times */
-	int      regionOffset;         /* offset within regionLoc and regionSize of last block added (XZY) */
 	int      regionLoc[3];         /* starting point of region */
 	int      regionSize[3];        /* size in blocks of the region */
-	int      regionBytes;          /* size in bytes of all the modifications done by region */
+	int      regionSections;       /* sub-chunks saved for current region */
+	uint64_t * sectionKeys;        /* hash table of sub-chunks already saved (chunk X, Z, layer) */
+	int      sectionCount;
+	int      sectionMax;
 	ListHead undoLog;              /* list of memory blocks to undo (UndoLogBuf) */
 	ListHead redoLog;              /* UndoLogBuf */
-};
-
-enum                               /* special blockId stored in undo buffer stream (instead of actual blockId) */
-{
-	UNDO_BLOCK_TILEENT = 0xffff,   /* next uint16 is size, then <size> bytes of tile entity data */
-	UNDO_BLOCK_SKIP    = 0xfffe,   /* next uint16 is amount to add to regionOffset (if other than 1) */
-	UNDO_BLOCK_SKIP32  = 0xfffd,   /* next 2 uint16 is amount to skip */
-	UNDO_BLOCK_REPEAT  = 0xfffc    /* next uint16 is count of blocks to repeat at offset <regionOffset+1> to <regionOffset+count> */
+	int      memUsage;             /* bytes of UndoLogBuf->buffer currently allocated */
+	int      logSize;              /* sum of UndoLogBuf->usage of both lists */
+	long     spillSize;            /* end of data in spillFile */
+	long     spillUsed;            /* bytes of spillFile still reserved by a buffer (UndoLogBuf->slotSize) */
+	FILE *   spillFile;            /* old buffers are moved here (zlib compressed) when memUsage > globals.undoMaxMem */
+	TEXT     spillPath[MAX_PATHLEN];
+	uint8_t  noSpill;              /* could not create spill file */
 };
 
 #endif
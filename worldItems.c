@@ -447,7 +447,7 @@ void worldItemDup(Map map, vec info, int entityId)
 	dup->enflags   = entity->enflags;
 	dup->blockId   = entity->blockId;
 	dup->tile      = NBT_Copy(entity->tile);
-	quadTreeInsertItem(dup);
+	entityGridInsert(dup);
 
 	NBTFile_t nbt = {.mem = dup->tile};
 	NBTIter_t iter;
@@ -635,7 +635,7 @@ Bool worldItemCreatePainting(Map map, int paintingId, vec4 pos)
 
 	entity = entityAlloc(&slot);
 	memcpy(entity->pos, posAndRot, sizeof posAndRot);
-	quadTreeInsertItem(entity);
+	entityGridInsert(entity);
 	worldItemCreateGeneric(&nbt, entity, "painting");
 	NBT_Add(&nbt,
 		TAG_String, "Motive", buffer,
@@ -696,9 +696,7 @@ static int worldItemCreateItemFrame(Map map, vec4 pos, int side)
 	posAndRot[VX] -= size[VX];   posAndRot[VX+3] += size[VX];
 	posAndRot[VY] -= size[VY];   posAndRot[VY+3] += size[VY];
 	posAndRot[VZ] -= size[VZ];   posAndRot[VZ+3] += size[VZ];
-	int count = 0;
-	quadTreeIntersect(posAndRot, &count, ENFLAG_ANYENTITY);
-	if (count > 0)
+	if (entityGridQuery(posAndRot, ENFLAG_ANYENTITY, NULL, 0) > 0)
 	{
 		/* does not fit: cancel creation */
 		fprintf(stderr, "can't fit item frame in %g, %g, %g\n", (double) posAndRot[VX], (double) posAndRot[VY], (double) posAndRot[VZ]);
@@ -720,7 +718,7 @@ static int worldItemCreateItemFrame(Map map, vec4 pos, int side)
 	entityGetLight(c, entity->pos, entity->light, True);
 	entityAddToCommandList(entity);
 	entityMarkListAsModified(map, c);
-	quadTreeInsertItem(entity);
+	entityGridInsert(entity);
 	undoLog(LOG_ENTITY_ADDED, slot);
 	renderAddModif();
 	return slot + 1;
@@ -935,7 +933,7 @@ void worldItemAdd(Map map)
 
 			preview->next = chunk->entityList;
 			preview->name = NBT_Payload(&nbt, NBT_FindNode(&nbt, 0, "id"));
-			quadTreeInsertItem(preview);
+			entityGridInsert(preview);
 			chunk->entityList = worldItem.slot;
 			undoLog(LOG_ENTITY_ADDED, worldItem.slot);
 